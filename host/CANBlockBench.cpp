@@ -0,0 +1,281 @@
+//
+/// CANBlock event dispatch microbenchmarks
+///
+/// Drives synthetic accessory event streams through the module's receive path
+///   - Dispatch : eventhandler() alone, per InEventID and opcode
+///   - Process  : CBUS.process() -> learned event lookup -> eventhandler()
+///   - Cycle    : a full Line Clear / Train on Track / Normal block cycle
+///   - BusFlood : 100% utilised 125 kbit/s CBUS, mostly foreign traffic
+///
+/// Besides ns/event each benchmark reports events/s and host cycles/event.
+//
+
+#include "SimHarness.h"
+
+#include "cbusdefs.h"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <memory>
+
+namespace
+{
+   constexpr uint16_t REMOTE_NN = 0x0300; ///< Node number of the (simulated) remote box
+   constexpr uint16_t SHORT_EN = 100;     ///< Device number base of short events
+
+   /// Single CANBlock node with an event taught for every InEventID
+   /// Long events are taught from the remote box node number, short events by device number
+   struct Bench
+   {
+      explicit Bench(bool shortEvents) : shortEvents(shortEvents), sim(1)
+      {
+         sim.measureLoops = false;
+         sim.boot();
+
+         for (uint8_t id = 0; id < MAX_EVENT_ID; id++)
+         {
+            sim.teach(0, nn(), en(id), id);
+         }
+
+         // Unlimited TX queue, the benchmarks drain it themselves
+         sim.node(0).txCapacity = SIZE_MAX;
+         sim::setCurrent(&sim.node(0));
+      }
+
+      ~Bench()
+      {
+         sim::setCurrent(nullptr);
+      }
+
+      uint16_t nn() const
+      {
+         return shortEvents ? 0 : REMOTE_NN;
+      }
+
+      uint16_t en(uint8_t id) const
+      {
+         return shortEvents ? SHORT_EN + id : id;
+      }
+
+      uint8_t index(uint8_t id)
+      {
+         return sim.ops(0).config->findExistingEvent(nn(), en(id));
+      }
+
+      bool shortEvents;
+      SimHarness sim;
+   };
+
+   std::unique_ptr<Bench> bench;
+
+   bool isShort(uint8_t opc)
+   {
+      return (opc == OPC_ASON) || (opc == OPC_ASOF);
+   }
+
+   /// Node with events taught to match the opcode, only one simulation can exist at a time
+   Bench &fixture(uint8_t opc = OPC_ACON)
+   {
+      if (!bench || (bench->shortEvents != isShort(opc)))
+      {
+         bench.reset();
+         bench = std::make_unique<Bench>(isShort(opc));
+      }
+
+      return *bench;
+   }
+
+   CANFrame accessoryFrame(uint8_t opc, uint16_t nn, uint16_t en)
+   {
+      CANFrame frame{};
+      frame.id = (DEFAULT_PRIORITY << 7) | 0x20;
+      frame.len = 5;
+      frame.data[0] = opc;
+      frame.data[1] = nn >> 8;
+      frame.data[2] = nn & 0xFF;
+      frame.data[3] = en >> 8;
+      frame.data[4] = en & 0xFF;
+      return frame;
+   }
+
+   using Clock = std::chrono::steady_clock;
+
+   /// events/s and host cycles/event, start is taken just before the benchmark loop
+   void setCounters(benchmark::State &state, Clock::time_point start, double eventsPerIteration = 1.0)
+   {
+      const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      const double events = static_cast<double>(state.iterations()) * eventsPerIteration;
+      const double cps = benchmark::CPUInfo::Get().cycles_per_second;
+
+      state.counters["events/s"] = benchmark::Counter(events, benchmark::Counter::kIsRate);
+      state.counters["cycles/event"] = benchmark::Counter((seconds * cps) / events);
+   }
+
+   void drainTx(Bench &b)
+   {
+      b.sim.node(0).tx.clear();
+   }
+
+   /// eventhandler() for one InEventID (range 0) and opcode (range 1)
+   void BM_Dispatch(benchmark::State &state)
+   {
+      const uint8_t id = static_cast<uint8_t>(state.range(0));
+      const uint8_t opc = static_cast<uint8_t>(state.range(1));
+      Bench &b = fixture(opc);
+      const CANFrame frame = accessoryFrame(opc, b.nn(), b.en(id));
+      const uint8_t index = b.index(id);
+
+      const Clock::time_point start = Clock::now();
+
+      for (auto _ : state)
+      {
+         b.sim.ops(0).eventhandler(index, frame);
+         benchmark::ClobberMemory();
+      }
+
+      drainTx(b);
+      setCounters(state, start);
+   }
+
+   /// CBUS.process() of one received frame, including the learned event lookup
+   void BM_Process(benchmark::State &state)
+   {
+      const uint8_t id = static_cast<uint8_t>(state.range(0));
+      const uint8_t opc = static_cast<uint8_t>(state.range(1));
+      Bench &b = fixture(opc);
+      const CANFrame frame = accessoryFrame(opc, b.nn(), b.en(id));
+      sim::Node &node = b.sim.node(0);
+      CBUSACAN2040 &cbus = *b.sim.ops(0).cbus;
+
+      const Clock::time_point start = Clock::now();
+
+      for (auto _ : state)
+      {
+         node.rx.push_back(frame);
+         cbus.process(1);
+      }
+
+      drainTx(b);
+      setCounters(state, start);
+   }
+
+   /// Foreign frame (no learned event matches) through CBUS.process()
+   void BM_ProcessForeign(benchmark::State &state)
+   {
+      Bench &b = fixture();
+      const CANFrame frame = accessoryFrame(OPC_ACON, 0x1234, 0x0042);
+      sim::Node &node = b.sim.node(0);
+      CBUSACAN2040 &cbus = *b.sim.ops(0).cbus;
+
+      const Clock::time_point start = Clock::now();
+
+      for (auto _ : state)
+      {
+         node.rx.push_back(frame);
+         cbus.process(1);
+      }
+
+      setCounters(state, start);
+   }
+
+   /// Full remote block cycle - each request transitions the state machine and sends the ACK pair
+   void BM_Cycle(benchmark::State &state)
+   {
+      Bench &b = fixture();
+      const InEventID sequence[]{InEventID::lineClear, InEventID::trainOnTrack, InEventID::blockCleared};
+      CANFrame frames[3];
+      uint8_t indices[3];
+
+      for (int i = 0; i < 3; i++)
+      {
+         const uint8_t id = static_cast<uint8_t>(sequence[i]);
+         frames[i] = accessoryFrame(OPC_ACON, REMOTE_NN, id);
+         indices[i] = b.index(id);
+      }
+
+      const Clock::time_point start = Clock::now();
+
+      for (auto _ : state)
+      {
+         for (int i = 0; i < 3; i++)
+         {
+            b.sim.ops(0).eventhandler(indices[i], frames[i]);
+         }
+
+         drainTx(b);
+      }
+
+      setCounters(state, start, 3.0);
+   }
+
+   /// One frame time of a 100% utilised bus through loop(); range(0) is the learned share in %
+   void BM_BusFlood(benchmark::State &state)
+   {
+      bench.reset();
+
+      SimHarness sim(1);
+      sim.measureLoops = false;
+      sim.boot();
+
+      for (uint8_t id = 0; id < MAX_EVENT_ID; id++)
+      {
+         sim.teach(0, REMOTE_NN, id, id);
+      }
+
+      sim.node(0).txCapacity = SIZE_MAX;
+
+      const uint32_t learnedShare = static_cast<uint32_t>(state.range(0));
+      uint32_t seed = 1;
+      uint32_t received = sim.node(0).rxFrames;
+
+      const Clock::time_point start = Clock::now();
+
+      for (auto _ : state)
+      {
+         seed = seed * 1664525u + 1013904223u;
+         const uint32_t r = seed >> 8;
+         const bool learned = (r % 100) < learnedShare;
+         const uint16_t nn = learned ? REMOTE_NN : static_cast<uint16_t>(0x1000 + (r & 0xFFF));
+         const uint16_t en = learned ? static_cast<uint16_t>((r >> 12) % MAX_EVENT_ID) : static_cast<uint16_t>((r >> 12) & 0xFF);
+
+         // Back to back frames - the next one is queued as soon as the bus frees
+         sim.bus().inject(accessoryFrame((r & 0x80000) ? OPC_ACON : OPC_ACOF, nn, en));
+
+         // The node's replies and state queries go on the bus too, a frame is never cleared while on it
+         while (sim.bus().injectPending() || !sim.node(0).tx.empty())
+         {
+            sim.step();
+         }
+      }
+
+      received = sim.node(0).rxFrames - received;
+      const double busSeconds = static_cast<double>(sim.bus().busyTime()) / 1e6;
+
+      setCounters(state, start);
+      state.counters["bus_frames/s"] = benchmark::Counter(sim.bus().frames() / busSeconds);
+      state.counters["rx_overflows"] = sim.node(0).rxOverflows;
+      state.counters["rx_frames"] = received;
+   }
+
+   void dispatchArgs(benchmark::internal::Benchmark *b)
+   {
+      b->ArgNames({"InEventID", "opcode"});
+
+      for (int id = 0; id < MAX_EVENT_ID; id++)
+      {
+         for (int opc : {OPC_ACON, OPC_ACOF, OPC_ASON, OPC_ASOF})
+         {
+            b->Args({id, opc});
+         }
+      }
+   }
+}
+
+BENCHMARK(BM_Dispatch)->Apply(dispatchArgs);
+BENCHMARK(BM_Process)->Apply(dispatchArgs);
+BENCHMARK(BM_ProcessForeign);
+BENCHMARK(BM_Cycle);
+BENCHMARK(BM_BusFlood)->ArgName("learned%")->Arg(0)->Arg(5)->Arg(100);
+
+BENCHMARK_MAIN();
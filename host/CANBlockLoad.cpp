@@ -0,0 +1,438 @@
+//
+/// CANBlock load regression test
+///
+/// Runs a line of four block posts on the simulated bus, each box in rear
+/// operating its block through Line Clear, Train on Track and Normal at random
+/// intervals, while a traffic generator loads the bus with foreign events,
+/// repeats of the block events and malformed frames, or replays a capture.
+/// Reports
+///   - learned events dropped before the module's eventhandler(), and events
+///     it was handed that no valid frame on the bus carried
+///   - state divergence between the two ends of each block
+///   - block operations that did not complete, and their switch to state latency
+///   - bus load and the throughput of the module code
+///
+/// Exits with 1 if any event was dropped or spurious, a block diverged or an
+/// operation failed, so it can be run as the standard load regression test.
+///
+/// Usage: CANBlockLoad [options]
+///   --seconds N      virtual time to run (10)
+///   --foreign N      foreign modules sending ACON / ACOF (32)
+///   --load P         bus load of the foreign modules, percent (60, 0 with --replay)
+///   --echo N         extra copies of every block event (2)
+///   --malformed P    percent of the foreign frames sent malformed (5)
+///   --replay FILE    replay a GridConnect capture, over again to the end of the run
+///   --speed X        replay at X times the captured timing, 0 as fast as the bus takes it (1)
+///   --capture FILE   write every frame on the bus as a GridConnect capture
+///   --single         service CAN on core 0, not core 1
+///   --seed N         seed of the generated traffic and operation intervals
+//
+
+#include "SimHarness.h"
+#include "SimReport.h"
+#include "SimTraffic.h"
+
+#include "cbusdefs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+   using sim::lcg;
+   using sim::MS;
+   using sim::SEC;
+
+   constexpr size_t NUM_POSTS = 4;     ///< Block posts in the line, each the box in advance of the one before
+
+   /// Learned events each node's eventhandler() was handed, counted on the way in
+   uint32_t handled[SIM_MAX_NODES];
+
+   template <size_t N>
+   void countingHandler(uint8_t index, const CANFrame &msg)
+   {
+      handled[N]++;
+      simNodes[N].eventhandler(index, msg);
+   }
+
+   const CBUSDispatch::EventHandler countingHandlers[SIM_MAX_NODES] = {countingHandler<0>, countingHandler<1>,
+                                                                       countingHandler<2>, countingHandler<3>};
+
+   /// Operations of the box in rear of one block
+   struct Block
+   {
+      size_t local;          ///< Node of the box in rear, the box in advance is the next node
+      uint8_t op;            ///< Next operation, Line Clear, Train on Track, Normal
+      bool pressed;          ///< Switch held, waiting for the state
+      uint8_t pin;           ///< Switch held
+      BlockState target;     ///< State the operation leads to
+      uint64_t pressedAt;    ///< Time the switch was pressed (us)
+      uint64_t next;         ///< Time of the next operation (us)
+      uint32_t operations;   ///< Operations completed
+      uint32_t failures;     ///< Operations that did not complete
+      uint32_t divergences;  ///< Times the two ends were found out of step
+      uint64_t maxLatencyUs; ///< Longest switch to state time (us)
+      uint64_t totalLatencyUs;
+   };
+
+   struct Options
+   {
+      double seconds{10.0};
+      TrafficMix mix{32, 0.6, 2, 0.05};
+      bool loadSet{false};
+      const char *replay{nullptr};
+      double speed{1.0};
+      const char *capture{nullptr};
+      bool dualCore{true};
+      uint32_t seed{12345};
+   };
+
+   bool parseOptions(int argc, char **argv, Options &options)
+   {
+      for (int i = 1; i < argc; i++)
+      {
+         const char *arg = argv[i];
+         const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+         if (strcmp(arg, "--single") == 0)
+         {
+            options.dualCore = false;
+            continue;
+         }
+
+         if (!value)
+         {
+            return false;
+         }
+
+         i++;
+
+         if (strcmp(arg, "--seconds") == 0)
+         {
+            options.seconds = atof(value);
+         }
+         else if (strcmp(arg, "--foreign") == 0)
+         {
+            options.mix.foreignNodes = static_cast<uint16_t>(atoi(value));
+         }
+         else if (strcmp(arg, "--load") == 0)
+         {
+            options.mix.foreignLoad = atof(value) / 100.0;
+            options.loadSet = true;
+         }
+         else if (strcmp(arg, "--echo") == 0)
+         {
+            options.mix.echoes = static_cast<uint8_t>(atoi(value));
+         }
+         else if (strcmp(arg, "--malformed") == 0)
+         {
+            options.mix.malformedShare = atof(value) / 100.0;
+         }
+         else if (strcmp(arg, "--replay") == 0)
+         {
+            options.replay = value;
+         }
+         else if (strcmp(arg, "--speed") == 0)
+         {
+            options.speed = atof(value);
+         }
+         else if (strcmp(arg, "--capture") == 0)
+         {
+            options.capture = value;
+         }
+         else if (strcmp(arg, "--seed") == 0)
+         {
+            options.seed = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+         }
+         else
+         {
+            return false;
+         }
+      }
+
+      // A replay is the foreign traffic unless a load is asked for as well
+      if (options.replay && !options.loadSet)
+      {
+         options.mix.foreignLoad = 0.0;
+      }
+
+      return true;
+   }
+
+   /// A frame that reaches a node's eventhandler(), if the node learned it, events and answers about events
+   bool learnedBy(const SimNodeOps &node, const CANFrame &frame)
+   {
+      const uint8_t opCode = frame.data[0];
+
+      if (frame.rtr || frame.ext || (frame.len < 5) ||
+          ((opCode != OPC_ACON) && (opCode != OPC_ACOF) && (opCode != OPC_ASON) && (opCode != OPC_ASOF) &&
+           (opCode != OPC_ARON) && (opCode != OPC_AROF) && (opCode != OPC_ARSON) && (opCode != OPC_ARSOF)))
+      {
+         return false;
+      }
+
+      const bool shortEvent = (opCode == OPC_ASON) || (opCode == OPC_ASOF) || (opCode == OPC_ARSON) ||
+                              (opCode == OPC_ARSOF);
+      const uint16_t nn = shortEvent ? 0 : ((frame.data[1] << 8) | frame.data[2]);
+      const uint16_t en = (frame.data[3] << 8) | frame.data[4];
+
+      return node.cbus->getEventIndex().find(nn, en) != EventIndex::NO_EVENT;
+   }
+
+   /// Compare the two ends of a block before its next operation, and bring them back to Normal if they differ
+   bool inStep(SimHarness &sim, Block &block)
+   {
+      BlockState &rear = sim.ops(block.local).localBoxState[0];
+      BlockState &advance = sim.ops(block.local + 1).remoteBoxState[0];
+
+      if (rear == advance)
+      {
+         return true;
+      }
+
+      block.divergences++;
+      rear = BlockState::Normal;
+      advance = BlockState::Normal;
+      block.op = 0;
+      return false;
+   }
+
+   void operate(SimHarness &sim, Block &block, uint32_t &seed)
+   {
+      const SimNodeOps &local = sim.ops(block.local);
+      const uint64_t now = sim::now();
+
+      if (block.pressed)
+      {
+         const bool done = local.localBoxState[0] == block.target;
+
+         if (!done && (now < block.pressedAt + RequestTracker::GIVE_UP_US + 100 * MS))
+         {
+            return;
+         }
+
+         sim.release(block.local, block.pin);
+         block.pressed = false;
+         block.next = now + 50 * MS + (lcg(seed) % (200 * MS));
+
+         if (done)
+         {
+            block.operations++;
+            block.maxLatencyUs = std::max(block.maxLatencyUs, now - block.pressedAt);
+            block.totalLatencyUs += now - block.pressedAt;
+            block.op = (block.op + 1) % 3;
+         }
+         else
+         {
+            // Start again from Normal at both ends
+            block.failures++;
+            local.localBoxState[0] = BlockState::Normal;
+            sim.ops(block.local + 1).remoteBoxState[0] = BlockState::Normal;
+            block.op = 0;
+         }
+
+         return;
+      }
+
+      if (now < block.next)
+      {
+         return;
+      }
+
+      inStep(sim, block);
+
+      const SectionPins &pins = local.pins[0];
+      const uint8_t opPins[3]{pins.lineClear, pins.trainOnTrack, pins.normal};
+      const BlockState targets[3]{BlockState::LineClear, BlockState::TrainOnTrack, BlockState::Normal};
+
+      block.pin = opPins[block.op];
+      block.target = targets[block.op];
+      block.pressedAt = now;
+      block.pressed = true;
+      sim.press(block.local, block.pin);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   Options options;
+
+   if (!parseOptions(argc, argv, options))
+   {
+      fprintf(stderr, "usage: CANBlockLoad [--seconds N] [--foreign N] [--load P] [--echo N] [--malformed P]\n"
+                      "                    [--replay FILE] [--speed X] [--capture FILE] [--single] [--seed N]\n");
+      return 2;
+   }
+
+   if (!simNodes[0].variant->paired())
+   {
+      printf("Built with a CANMIO needle as the box in advance, the line of block posts needs CANBlock pairs\n");
+      return 0;
+   }
+
+   SimHarness sim(NUM_POSTS);
+   sim.dualCore = options.dualCore;
+   sim.boot();
+
+   for (size_t i = 0; i + 1 < NUM_POSTS; i++)
+   {
+      sim.pair(i, i + 1);
+   }
+
+   // Count the learned events each node should have been handed, from the frames on the bus
+   uint32_t expected[NUM_POSTS]{};
+
+   sim.bus().observer = [&](uint64_t, const sim::Node *sender, const sim::TxEntry &entry)
+   {
+      for (size_t i = 0; i < NUM_POSTS; i++)
+      {
+         expected[i] += (sender != &sim.node(i)) && learnedBy(sim.ops(i), entry.frame);
+      }
+   };
+
+   for (size_t i = 0; i < NUM_POSTS; i++)
+   {
+      handled[i] = 0;
+      sim.ops(i).cbus->setEventHandlerCB(countingHandlers[i]);
+   }
+
+   SimTraffic traffic(sim, options.seed);
+   traffic.mix(options.mix);
+
+   if (options.replay)
+   {
+      if (!traffic.load(options.replay))
+      {
+         fprintf(stderr, "CANBlockLoad: no frames read from %s\n", options.replay);
+         return 2;
+      }
+
+      traffic.replay(options.speed);
+   }
+
+   if (options.capture && !traffic.capture(options.capture))
+   {
+      fprintf(stderr, "CANBlockLoad: cannot write %s\n", options.capture);
+      return 2;
+   }
+
+   Block blocks[NUM_POSTS - 1]{};
+   uint32_t seed = options.seed;
+
+   for (size_t i = 0; i < NUM_POSTS - 1; i++)
+   {
+      blocks[i].local = i;
+      blocks[i].next = sim::now() + (lcg(seed) % (100 * MS));
+   }
+
+   sim.onStep = [&]()
+   {
+      traffic.step();
+
+      for (Block &block : blocks)
+      {
+         operate(sim, block, seed);
+      }
+   };
+
+   const uint64_t start = sim::now();
+   const uint64_t busyBefore = sim.bus().busyTime();
+   const uint32_t framesBefore = sim.bus().frames();
+   sim.loopStats.clear();
+
+   sim.runFor(static_cast<uint64_t>(options.seconds * SEC));
+
+   // Stop the traffic, let the operations in hand finish and the queues drain
+   sim.onStep = [&]()
+   {
+      for (Block &block : blocks)
+      {
+         if (block.pressed)
+         {
+            operate(sim, block, seed);
+         }
+      }
+   };
+   sim.runUntil([&]()
+                { return std::none_of(std::begin(blocks), std::end(blocks), [](const Block &b)
+                                      { return b.pressed; }); },
+                RequestTracker::GIVE_UP_US + 200 * MS);
+   sim.runFor(200 * MS);
+   sim.onStep = nullptr;
+
+   const uint64_t elapsed = sim::now() - start;
+   const uint32_t frames = sim.bus().frames() - framesBefore;
+   const double hostSec = sim.loopStats.totalNs / (1e9 * NUM_POSTS); // per node time
+
+   printf("CANBlock load test, %zu block posts, %.1f s (virtual time), CAN on core %u\n", NUM_POSTS,
+          elapsed / 1e6, options.dualCore ? 1 : 0);
+   printf("  traffic: foreign %u from %u modules, block event copies %u, malformed %u", traffic.getForeign(),
+          options.mix.foreignNodes, traffic.getEchoes(), traffic.getMalformed());
+
+   if (options.replay)
+   {
+      printf(", replayed %u of a %zu frame capture at %gx (%u block events skipped)", traffic.getReplayed(),
+             traffic.getCaptureSize(), options.speed, traffic.getSkipped());
+   }
+
+   printf("\n  bus load %.1f %%, %u frames, %.0f frames/s\n",
+          100.0 * (sim.bus().busyTime() - busyBefore) / elapsed, frames, frames * 1e6 / elapsed);
+
+   uint32_t dropped = 0, spurious = 0, overflows = 0;
+   uint32_t rxFrames = 0, events = 0;
+
+   printf("  node  learned events  handled  dropped  spurious  RX overflows  ring full  filtered\n");
+
+   for (size_t i = 0; i < NUM_POSTS; i++)
+   {
+      const sim::Node &node = sim.node(i);
+      const CBUSDispatch &cbus = *sim.ops(i).cbus;
+      const uint32_t lost = (expected[i] > handled[i]) ? expected[i] - handled[i] : 0;
+      const uint32_t extra = (handled[i] > expected[i]) ? handled[i] - expected[i] : 0;
+
+      printf("  %4zu  %14u  %7u  %7u  %8u  %12u  %9u  %8u\n", i, expected[i], handled[i], lost, extra,
+             node.rxOverflows, cbus.getRxRingFull(), cbus.getRxFiltered());
+
+      dropped += lost;
+      spurious += extra;
+      overflows += node.rxOverflows;
+      rxFrames += cbus.getRxFrames();
+      events += handled[i];
+   }
+
+   uint32_t operations = 0, failures = 0, divergences = 0;
+
+   printf("  block  operations  failed  diverged  switch -> state avg      max\n");
+
+   for (size_t i = 0; i < NUM_POSTS - 1; i++)
+   {
+      Block &block = blocks[i];
+
+      // The two ends must agree once the line is quiet
+      inStep(sim, block);
+
+      printf("  %zu->%zu  %10u  %6u  %8u  %10.3f ms  %7.3f ms\n", block.local, block.local + 1, block.operations,
+             block.failures, block.divergences,
+             block.operations ? (block.totalLatencyUs / 1000.0) / block.operations : 0.0,
+             block.maxLatencyUs / 1000.0);
+
+      operations += block.operations;
+      failures += block.failures;
+      divergences += block.divergences;
+   }
+
+   if (hostSec > 0.0)
+   {
+      printf("  module throughput %.0f frames/s, %.0f events/s of host loop() time\n", rxFrames / hostSec,
+             events / hostSec);
+   }
+
+   const bool pass = !dropped && !spurious && !divergences && !failures && operations;
+
+   printf("%s: %u events dropped, %u spurious, %u RX overflows, %u divergences, %u failed of %u operations\n",
+          pass ? "PASS" : "FAIL", dropped, spurious, overflows, divergences, failures, operations + failures);
+
+   return pass ? 0 : 1;
+}
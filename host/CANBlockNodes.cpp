@@ -0,0 +1,97 @@
+//
+/// CANBlock host simulator - one copy of the module per simulated node
+//
+
+// Everything CANBlock.cpp includes must be seen here first, so the includes
+// inside the namespaces below are empty and library types stay global
+#include "CBUSACAN2040.h"
+#include "CBUSSwitch.h"
+#include "CBUSLED.h"
+#include "CBUSConfig.h"
+#include "CBUSParams.h"
+#include "cbusdefs.h"
+#include "CBUSUtil.h"
+#include "CANBlock.h"
+#include "ModuleVariant.h"
+#include "CBUSDispatch.h"
+#include "BlockStateMachine.h"
+#include "IndicatorOutput.h"
+#include "LoopScheduler.h"
+#include "Telemetry.h"
+#include "ConfigJournal.h"
+#include "StateResync.h"
+#include "InputCapture.h"
+#include "PortExpander.h"
+#include "SwitchInput.h"
+#include "BellOutput.h"
+#include "TonePlayer.h"
+#include "GridConnectBridge.h"
+#include "UsbSerial.h"
+
+#include <cstdio>
+#include <pico/stdlib.h>
+#include <pico/binary_info.h>
+#include <pico/multicore.h>
+#include <hardware/sync.h>
+#include <hardware/structs/xip_ctrl.h>
+
+#include "SimNode.h"
+
+namespace canblock0
+{
+#include "CANBlock.cpp"
+}
+
+namespace canblock1
+{
+#include "CANBlock.cpp"
+}
+
+namespace canblock2
+{
+#include "CANBlock.cpp"
+}
+
+namespace canblock3
+{
+#include "CANBlock.cpp"
+}
+
+/// Power on values of the module globals
+#define SIM_POWER_ON(ns)                                  \
+   []()                                                   \
+   {                                                      \
+      for (uint8_t s = 0; s < ns::NUM_SECTIONS; s++)      \
+      {                                                   \
+         ns::remoteBoxState[s] = BlockState::Normal;      \
+         ns::localBoxState[s] = BlockState::Normal;       \
+         ns::lineClearReleased[s] = true;                 \
+      }                                                   \
+   }
+
+/// RAM of the module's own objects and state, the library's configuration excluded
+#define SIM_STATE_BYTES(ns)                                                                           \
+   (sizeof(ns::CBUS) + sizeof(ns::indicators) + sizeof(ns::scheduler) + sizeof(ns::telemetry) +         \
+    sizeof(ns::settings) + sizeof(ns::requests) + sizeof(ns::resync) + sizeof(ns::trace) +              \
+    sizeof(ns::switches) + sizeof(ns::capture) + sizeof(ns::expander) + sizeof(ns::tones) +             \
+    sizeof(ns::bell) + sizeof(ns::usb) + sizeof(ns::gateway) + sizeof(ns::core0Trace) +                 \
+    sizeof(ns::core1Trace) + sizeof(ns::remoteBoxState) + sizeof(ns::localBoxState) +                   \
+    sizeof(ns::lineClearReleased))
+
+#define SIM_NODE(ns)                                                                     \
+   SimNodeOps                                                                            \
+   {                                                                                     \
+      #ns, &ns::VARIANT, SIM_STATE_BYTES(ns), ns::setup, ns::loop, ns::eventhandler,     \
+          ns::processRemoteStateMachine,                                                 \
+          SIM_POWER_ON(ns), ns::NUM_SECTIONS, ns::localBoxState, ns::remoteBoxState,     \
+          ns::lineClearReleased, ns::sectionPins, &ns::module_config, &ns::CBUS,         \
+          &ns::scheduler, &ns::telemetry, &ns::settings, &ns::requests, &ns::resync,     \
+          &ns::trace, &ns::expander, &ns::bell, &ns::gateway                             \
+   }
+
+const SimNodeOps simNodes[SIM_MAX_NODES] = {
+    SIM_NODE(canblock0),
+    SIM_NODE(canblock1),
+    SIM_NODE(canblock2),
+    SIM_NODE(canblock3),
+};
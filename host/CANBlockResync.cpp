@@ -0,0 +1,430 @@
+//
+/// CANBlock resync after reset test
+///
+/// Runs a line of three block posts on the simulated bus, each box in rear
+/// operating its block at random, and resets a post at a random moment, or the
+/// posts at both ends of a block together.  The module settings are written a
+/// while after a block changes state, so a post reset soon after restores a
+/// state the box at the other end has moved on from.  The bus loses frames at
+/// random and holds others back, delivering them late and out of order.
+///
+/// After each reset the block operations stop until the line is consistent:
+/// both ends of every block agree, no request is waiting for its ACK and no
+/// state query is waiting for its answers.  Reports
+///   - time and bus frames from the reset to a consistent line
+///   - resets that restored a state out of step with the box at the other end
+///   - state queries asked again and given up
+///   - resets after which the line did not become consistent
+///
+/// Exits with 1 if the line did not become consistent after any reset, so it
+/// can be run as the standard resync regression test.
+///
+/// Usage: CANBlockResync [options]
+///   --resets N       posts reset (200)
+///   --both P         percent of the resets of both ends of a block together (20)
+///   --loss P         percent of the frames lost (2)
+///   --reorder P      percent of the frames held back and delivered late (2)
+///   --delay MS       longest time a frame is held back (5)
+///   --single         service CAN on core 0, not core 1
+///   --seed N         seed of the resets, operations and bus faults
+//
+
+#include "SimHarness.h"
+#include "SimReport.h"
+
+#include "cbusdefs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace
+{
+   using sim::Latency;
+   using sim::lcg;
+   using sim::MS;
+   using sim::SEC;
+
+   constexpr size_t NUM_POSTS = 3;               ///< Block posts in the line, each the box in advance of the one before
+   constexpr uint64_t CONSISTENT_US = 5 * SEC;   ///< Time the line has to become consistent after a reset (us)
+
+   /// Operations of the box in rear of one block
+   struct Block
+   {
+      size_t local;       ///< Node of the box in rear, the box in advance is the next node
+      bool pressed;       ///< Switch held, waiting for the state
+      uint8_t pin;        ///< Switch held
+      BlockState target;  ///< State the operation leads to
+      uint64_t pressedAt; ///< Time the switch was pressed (us)
+      uint64_t next;      ///< Time of the next operation (us)
+      uint32_t operations; ///< Operations completed
+   };
+
+   /// A frame held back by the bus, and the time it is delivered
+   struct Held
+   {
+      uint64_t at;
+      CANFrame frame;
+   };
+
+   struct Options
+   {
+      uint32_t resets{200};
+      uint32_t both{20};
+      uint32_t loss{200};    ///< Hundredths of a percent
+      uint32_t reorder{200}; ///< Hundredths of a percent
+      uint64_t delayUs{5 * MS};
+      bool dualCore{true};
+      uint32_t seed{24680};
+   };
+
+   bool parseOptions(int argc, char **argv, Options &options)
+   {
+      for (int i = 1; i < argc; i++)
+      {
+         const char *arg = argv[i];
+         const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+         if (strcmp(arg, "--single") == 0)
+         {
+            options.dualCore = false;
+            continue;
+         }
+
+         if (!value)
+         {
+            return false;
+         }
+
+         i++;
+
+         if (strcmp(arg, "--resets") == 0)
+         {
+            options.resets = static_cast<uint32_t>(atoi(value));
+         }
+         else if (strcmp(arg, "--both") == 0)
+         {
+            options.both = static_cast<uint32_t>(atoi(value));
+         }
+         else if (strcmp(arg, "--loss") == 0)
+         {
+            options.loss = static_cast<uint32_t>(atof(value) * 100);
+         }
+         else if (strcmp(arg, "--reorder") == 0)
+         {
+            options.reorder = static_cast<uint32_t>(atof(value) * 100);
+         }
+         else if (strcmp(arg, "--delay") == 0)
+         {
+            options.delayUs = static_cast<uint64_t>(atof(value) * MS);
+         }
+         else if (strcmp(arg, "--seed") == 0)
+         {
+            options.seed = static_cast<uint32_t>(strtoul(value, nullptr, 0));
+         }
+         else
+         {
+            return false;
+         }
+      }
+
+      return options.delayUs > 0;
+   }
+
+   /// Blocks whose two ends do not agree
+   uint32_t outOfStep(SimHarness &sim)
+   {
+      uint32_t blocks = 0;
+
+      for (size_t i = 0; i + 1 < NUM_POSTS; i++)
+      {
+         blocks += sim.ops(i).localBoxState[0] != sim.ops(i + 1).remoteBoxState[0];
+      }
+
+      return blocks;
+   }
+
+   /// Both ends of every block agree, and no request or state query waits for the box at the other end
+   bool consistent(SimHarness &sim)
+   {
+      for (size_t i = 0; i < NUM_POSTS; i++)
+      {
+         const SimNodeOps &node = sim.ops(i);
+
+         if (node.requests->getOutstanding() || (node.resync->getInStepUs() == StateResync::NOT_YET))
+         {
+            return false;
+         }
+      }
+
+      return outOfStep(sim) == 0;
+   }
+
+   /// The next operation of a block follows the state of the box in rear: Line Clear, Train on Track, Normal
+   void operate(SimHarness &sim, Block &block, uint32_t &seed)
+   {
+      const SimNodeOps &local = sim.ops(block.local);
+      const uint64_t now = sim::now();
+
+      if (block.pressed)
+      {
+         const bool done = local.localBoxState[0] == block.target;
+
+         if (!done && (now < block.pressedAt + RequestTracker::GIVE_UP_US + 100 * MS))
+         {
+            return;
+         }
+
+         sim.release(block.local, block.pin);
+         block.pressed = false;
+         block.operations += done;
+         block.next = now + 20 * MS + (lcg(seed) % (200 * MS));
+         return;
+      }
+
+      if (now < block.next)
+      {
+         return;
+      }
+
+      const SectionPins &pins = local.pins[0];
+
+      switch (local.localBoxState[0])
+      {
+      case BlockState::Normal:
+         block.pin = pins.lineClear;
+         block.target = BlockState::LineClear;
+         break;
+      case BlockState::LineClear:
+         block.pin = pins.trainOnTrack;
+         block.target = BlockState::TrainOnTrack;
+         break;
+      default:
+         block.pin = pins.normal;
+         block.target = BlockState::Normal;
+         break;
+      }
+
+      block.pressedAt = now;
+      block.pressed = true;
+      sim.press(block.local, block.pin);
+   }
+
+   /// Release the switches held, the signallers stop while the line recovers
+   void stop(SimHarness &sim, Block *blocks, uint32_t &seed)
+   {
+      for (size_t i = 0; i + 1 < NUM_POSTS; i++)
+      {
+         Block &block = blocks[i];
+
+         if (block.pressed)
+         {
+            sim.release(block.local, block.pin);
+            block.pressed = false;
+         }
+
+         block.next = sim::now() + (lcg(seed) % (100 * MS));
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   Options options;
+
+   if (!parseOptions(argc, argv, options))
+   {
+      fprintf(stderr, "usage: CANBlockResync [--resets N] [--both P] [--loss P] [--reorder P] [--delay MS] [--single]\n"
+                      "                      [--seed N]\n");
+      return 2;
+   }
+
+   if (!simNodes[0].variant->paired())
+   {
+      printf("Built with a CANMIO needle as the box in advance, the line of block posts needs CANBlock pairs\n");
+      return 0;
+   }
+
+   SimHarness sim(NUM_POSTS);
+   sim.dualCore = options.dualCore;
+   sim.boot();
+
+   for (size_t i = 0; i + 1 < NUM_POSTS; i++)
+   {
+      sim.pair(i, i + 1);
+   }
+
+   // Frames lost, and frames held back then delivered by the harness, late and after the frames sent since
+   uint32_t seed = options.seed;
+   uint32_t lost = 0, reordered = 0, queries = 0, answers = 0;
+   std::deque<Held> held;
+
+   sim.bus().lose = [&](const sim::Node *sender, const CANFrame &frame)
+   {
+      // Frames held back are not lost again
+      if (!sender)
+      {
+         return false;
+      }
+
+      queries += frame.data[0] == OPC_AREQ;
+      answers += (frame.data[0] == OPC_ARON) || (frame.data[0] == OPC_AROF);
+
+      const uint32_t r = lcg(seed) % 10000;
+
+      if (r < options.loss)
+      {
+         lost++;
+         return true;
+      }
+
+      if (r < options.loss + options.reorder)
+      {
+         const uint64_t at = sim::now() + 1 + (lcg(seed) % options.delayUs);
+         held.insert(std::upper_bound(held.begin(), held.end(), at, [](uint64_t t, const Held &h)
+                                      { return t < h.at; }),
+                     Held{at, frame});
+         reordered++;
+         return true;
+      }
+
+      return false;
+   };
+
+   Block blocks[NUM_POSTS - 1]{};
+
+   for (size_t i = 0; i + 1 < NUM_POSTS; i++)
+   {
+      blocks[i].local = i;
+   }
+
+   bool operating = true;
+
+   sim.onStep = [&]()
+   {
+      while (!held.empty() && (held.front().at <= sim::now()))
+      {
+         sim.bus().inject(held.front().frame);
+         held.pop_front();
+      }
+
+      for (Block &block : blocks)
+      {
+         if (operating)
+         {
+            operate(sim, block, seed);
+         }
+      }
+   };
+
+   sim.runUntil([&]()
+                { return consistent(sim); },
+                CONSISTENT_US);
+
+   Latency toConsistent{"reset -> consistent", {}};
+   Latency staleToConsistent{"out of step -> consistent", {}};
+   std::vector<uint32_t> frames;
+   uint32_t resetsOfBoth = 0, stale = 0, failed = 0, retries = 0, timeouts = 0;
+   const uint32_t framesBefore = sim.bus().frames();
+   const uint64_t start = sim::now();
+
+   for (uint32_t r = 0; r < options.resets; r++)
+   {
+      // Operate for a while, so resets fall before and after the settings are written
+      operating = true;
+      sim.runFor(50 * MS + (lcg(seed) % (1500 * MS)));
+      operating = false;
+      stop(sim, blocks, seed);
+
+      const size_t post = lcg(seed) % NUM_POSTS;
+      const bool both = (lcg(seed) % 100) < options.both;
+      const size_t other = (post + 1 < NUM_POSTS) ? post + 1 : post - 1;
+
+      sim.reset(post);
+
+      if (both)
+      {
+         sim.reset(other);
+         resetsOfBoth++;
+      }
+
+      const uint32_t boot = outOfStep(sim);
+      const uint64_t resetAt = sim::now();
+      const uint32_t resetFrames = sim.bus().frames();
+
+      stale += boot != 0;
+
+      if (!sim.runUntil([&]()
+                        { return consistent(sim); },
+                        CONSISTENT_US))
+      {
+         failed++;
+         printf("  reset %u of post %zu%s: not consistent after %.0f ms, blocks out of step %u\n", r, post,
+                both ? " and its neighbour" : "", CONSISTENT_US / 1000.0, outOfStep(sim));
+
+         // Start again from Normal at both ends
+         for (size_t i = 0; i + 1 < NUM_POSTS; i++)
+         {
+            sim.ops(i).localBoxState[0] = BlockState::Normal;
+            sim.ops(i + 1).remoteBoxState[0] = BlockState::Normal;
+         }
+
+         continue;
+      }
+
+      toConsistent.samples.push_back(sim::now() - resetAt);
+      frames.push_back(sim.bus().frames() - resetFrames);
+
+      if (boot)
+      {
+         staleToConsistent.samples.push_back(sim::now() - resetAt);
+      }
+
+      // The counters start again at each reset, so take them before the next
+      retries += sim.ops(post).resync->getRetries() + (both ? sim.ops(other).resync->getRetries() : 0);
+      timeouts += sim.ops(post).resync->getTimeouts() + (both ? sim.ops(other).resync->getTimeouts() : 0);
+   }
+
+   sim.onStep = nullptr;
+   sim.bus().lose = nullptr;
+
+   const uint64_t elapsed = sim::now() - start;
+   uint32_t operations = 0;
+
+   for (const Block &block : blocks)
+   {
+      operations += block.operations;
+   }
+
+   printf("CANBlock resync test, %zu block posts, %.1f s (virtual time), CAN on core %u\n", NUM_POSTS, elapsed / 1e6,
+          options.dualCore ? 1 : 0);
+   printf("  bus: %u frames, lost %u (%.2f %%), held back up to %.1f ms %u (%.2f %%)\n",
+          sim.bus().frames() - framesBefore, lost, options.loss / 100.0, options.delayUs / 1000.0, reordered,
+          options.reorder / 100.0);
+   printf("  block operations %u, resets %u (%u of both ends of a block), out of step at boot %u\n", operations,
+          options.resets, resetsOfBoth, stale);
+   printf("  state queries %u, answers %u, asked again %u, given up %u, not consistent %u\n", queries, answers,
+          retries, timeouts, failed);
+   toConsistent.report();
+   staleToConsistent.report();
+
+   if (!frames.empty())
+   {
+      uint32_t total = 0;
+
+      for (uint32_t f : frames)
+      {
+         total += f;
+      }
+
+      printf("  bus frames to consistent     min %u  avg %.1f  max %u\n", *std::min_element(frames.begin(), frames.end()),
+             static_cast<double>(total) / frames.size(), *std::max_element(frames.begin(), frames.end()));
+   }
+
+   printf("\n");
+
+   return failed ? 1 : 0;
+}
@@ -0,0 +1,1350 @@
+//
+/// CANBlock host simulator
+///
+/// Runs paired CANBlock nodes on a simulated 125 kbit/s CBUS and reports
+///   - request to ACK latency for each block transition (virtual time)
+///   - frames per second the module code handles (host time)
+///   - host cost of one pass of loop(), idle and under bus load
+///   - core 0 wakes of the event driven loop and switch edge to wake latency
+///   - request to ACK latency with core 0 stalls under full bus load,
+///     single core against dual core, and TX queue stalls absorbed by bursts
+///   - a backlog of learned events left by a core 0 stall, worked off as the
+///     stall ends rather than one poll at each wake
+///   - the module's performance counters, read back over CBUS with RDGN
+///   - settings journal flash writes over power cycles and a batch of NV changes
+///   - every block section of a multi-section module switched together, with
+///     sections after the first on I2C port expanders if they are built in
+///   - time from power on to the first frame accepted, and block states restored
+///     at boot.  setup() takes no virtual time, so the costs of loading the
+///     library configuration and the settings journal and of starting stdio
+///     are only measured on a module, read as DGN services 4 and 5
+///   - block cycles on a bus that loses frames, recovered by request retries
+///   - short switch presses made while core 0 is stalled, caught by input capture
+///   - bell codes beaten out on the bell push at full bus load, the strokes
+///     sounded by the remote box and its request latency while they sound
+///   - a PC on the local box's USB port, as GridConnect over a pseudo-terminal:
+///     a full bus passed to it, its frames passed to a half full bus, and the
+///     module answering the PC's own query
+///
+/// Usage: CANBlockSim [cycles] [trace file], the trace of the local box on the
+/// lossy bus is written to the trace file for CANBlockTrace to decode.
+//
+
+#include "SimHarness.h"
+#include "SimReport.h"
+#include "SimTraffic.h"
+#include "SwitchInput.h"
+
+#include "cbusdefs.h"
+
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+   using sim::Latency;
+   using sim::lcg;
+   using sim::MS;
+   using sim::SEC;
+
+   /// Foreign accessory event from one of many other modules on the layout
+   CANFrame foreignEvent(uint32_t &seed)
+   {
+      CANFrame frame{};
+      const uint32_t r = lcg(seed);
+      frame.id = (DEFAULT_PRIORITY << 7) | (0x40 + (r & 0x3F));
+      frame.len = 5;
+      frame.data[0] = (r & 0x100) ? OPC_ACON : OPC_ACOF;
+      frame.data[1] = 0x10 + ((r >> 9) & 0x3F);
+      frame.data[2] = (r >> 15) & 0xFF;
+      frame.data[3] = 0;
+      frame.data[4] = (r >> 23) & 0xFF;
+      return frame;
+   }
+
+   /// Cab speed command from a command station, traffic no accessory module acts on
+   CANFrame cabSpeed(uint32_t &seed)
+   {
+      CANFrame frame{};
+      const uint32_t r = lcg(seed);
+      frame.id = (DEFAULT_PRIORITY << 7) | 0x7E;
+      frame.len = 3;
+      frame.data[0] = OPC_DSPD;
+      frame.data[1] = r & 0x1F;
+      frame.data[2] = (r >> 5) & 0xFF;
+      return frame;
+   }
+
+   /// Operate a commutator switch and time the request until the local box sees the ACK
+   bool transition(SimHarness &sim, uint8_t pin, BlockState target, uint64_t &requestQueued, Latency &latency, Latency &endToEnd)
+   {
+      const SimNodeOps &local = sim.ops(0);
+      const uint64_t pressed = sim::now();
+      requestQueued = 0;
+
+      sim.press(0, pin);
+
+      const bool ok = sim.runUntil([&]()
+                                   { return *local.localBoxState == target; },
+                                   SEC);
+      sim.release(0, pin);
+
+      if (ok && requestQueued)
+      {
+         latency.samples.push_back(sim::now() - requestQueued);
+         endToEnd.samples.push_back(sim::now() - pressed);
+      }
+
+      // let the switch settle before the next operation
+      sim.runFor(50 * MS);
+
+      return ok;
+   }
+
+   bool latencyScenario(int cycles)
+   {
+      SimHarness sim(2);
+      sim.boot();
+      sim.pair(0, 1);
+
+      // Record when the local box queued the request of each transition
+      uint64_t requestQueued = 0;
+      sim.bus().observer = [&](uint64_t, const sim::Node *sender, const sim::TxEntry &entry)
+      {
+         if (sender && (sender->id == 0) && (entry.frame.data[0] == OPC_ACON))
+         {
+            requestQueued = entry.queuedAt;
+         }
+      };
+
+      const SimNodeOps &local = sim.ops(0);
+
+      Latency lcAck{"Line Clear request -> ACK", {}};
+      Latency totAck{"Train on Track request -> ACK", {}};
+      Latency nrmAck{"Block Cleared request -> ACK", {}};
+      Latency lcSw{"Line Clear switch -> ACK", {}};
+      Latency totSw{"Train on Track switch -> ACK", {}};
+      Latency nrmSw{"Normal switch -> ACK", {}};
+
+      sim.runFor(100 * MS);
+      sim.loopStats.clear();
+
+      int failures = 0;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         failures += !transition(sim, local.pins[0].lineClear, BlockState::LineClear, requestQueued, lcAck, lcSw);
+         failures += !transition(sim, local.pins[0].trainOnTrack, BlockState::TrainOnTrack, requestQueued, totAck, totSw);
+         failures += !transition(sim, local.pins[0].normal, BlockState::Normal, requestQueued, nrmAck, nrmSw);
+      }
+
+      printf("Request -> ACK latency, %d block cycles (virtual time)\n", cycles);
+      lcAck.report();
+      totAck.report();
+      nrmAck.report();
+      lcSw.report();
+      totSw.report();
+      nrmSw.report();
+      printf("  failed transitions %d, bus frames %u\n", failures, sim.bus().frames());
+
+      const LoopScheduler &scheduler = *local.scheduler;
+      printf("  local core 0 wakes %u over %.1f s, switch edges %u, edge -> loop() avg %u us  max %u us\n\n",
+             scheduler.getWakes(), sim::now() / 1e6, scheduler.getEdges(), scheduler.getEdgeLatencyAvgUs(),
+             scheduler.getEdgeLatencyMaxUs());
+
+      return failures == 0;
+   }
+
+   bool loadScenario(const char *title, double utilisation, uint64_t duration, bool cabs = false)
+   {
+      SimHarness sim(2);
+      sim.boot();
+      sim.pair(0, 1);
+      sim.runFor(100 * MS);
+
+      sim.loopStats.clear();
+      const uint32_t rxBefore = sim.node(1).rxFrames;
+      const uint32_t readsBefore = sim.ops(1).config->readCount;
+      const uint32_t wakesBefore = sim.ops(1).scheduler->getWakes();
+      const uint32_t filteredBefore = sim.ops(1).cbus->getRxFiltered();
+      const uint64_t busyBefore = sim.bus().busyTime();
+      const uint64_t start = sim::now();
+      uint32_t seed = 12345;
+
+      // Keep the foreign transmitter queue topped up to the requested utilisation
+      const uint32_t bits = cabs ? (sim::frameBits(foreignEvent(seed)) + sim::frameBits(cabSpeed(seed))) / 2
+                                 : sim::frameBits(foreignEvent(seed));
+      const uint64_t frameUs = (bits * SEC) / sim::CAN_BITRATE;
+      const uint64_t intervalUs = static_cast<uint64_t>(frameUs / utilisation);
+      uint64_t nextFrame = sim::now();
+      uint32_t injected = 0;
+
+      while (sim::now() < (start + duration))
+      {
+         while ((utilisation > 0.0) && (nextFrame <= sim::now()))
+         {
+            // With cabs, every other frame is a speed command
+            sim.bus().inject((cabs && (injected++ & 1)) ? cabSpeed(seed) : foreignEvent(seed));
+            nextFrame += intervalUs;
+         }
+
+         sim.step();
+      }
+
+      const uint32_t frames = sim.node(1).rxFrames - rxBefore;
+      const double hostSec = sim.loopStats.totalNs / 2e9; // two nodes, per node time
+      const double busLoad = 100.0 * (sim.bus().busyTime() - busyBefore) / (sim::now() - start);
+
+      printf("%s\n", title);
+      printf("  bus load %5.1f %%, frames received %u, RX overflows %u, config reads %u\n", busLoad, frames,
+             sim.node(1).rxOverflows, sim.ops(1).config->readCount - readsBefore);
+      printf("  core 0 wakes %.0f /s, frames dropped by the acceptance filter %u\n",
+             (sim.ops(1).scheduler->getWakes() - wakesBefore) * 1e6 / (sim::now() - start),
+             sim.ops(1).cbus->getRxFiltered() - filteredBefore);
+      printf("  loop() host cost  min %llu ns  avg %.1f ns  max %llu ns  (%llu calls)\n",
+             static_cast<unsigned long long>(sim.loopStats.minNs), sim.loopStats.avgNs(),
+             static_cast<unsigned long long>(sim.loopStats.maxNs), static_cast<unsigned long long>(sim.loopStats.count));
+
+      if (frames)
+      {
+         printf("  module throughput %.0f frames/s of host loop() time\n", frames / hostSec);
+      }
+
+      printf("\n");
+
+      // With CAN on core 0 and nothing stalling it, every frame is taken off the controller in time
+      return sim.node(1).rxOverflows == 0;
+   }
+
+   /// A backlog of learned events left in the receive buffers by a core 0 stall, e.g. a flash erase,
+   /// more than one poll of CBUS.process() takes, timed from the stall to the state set by the last one
+   bool backlogScenario(bool dualCore)
+   {
+      constexpr uint16_t LOCK_NN = 0x0400;      ///< Node number of the lever frame sending the commutator lock
+      constexpr uint16_t LOCK_EN = 1;           ///< Its event number
+      constexpr uint64_t STALL_TIME = 40 * MS;  ///< Core 0 stall the backlog builds up in
+      constexpr uint64_t MARGIN = 2 * MS;       ///< Longest the backlog may take once the stall ends, a few passes
+      const int backlogs[] = {CBUSDispatch::MAX_EVENTS_PER_POLL / 2, CBUSDispatch::MAX_EVENTS_PER_POLL + 4,
+                              CBUSDispatch::MAX_EVENTS_PER_POLL * 5 / 2};
+
+      SimHarness sim(1);
+      sim.dualCore = dualCore;
+      sim.boot();
+      sim.teach(0, LOCK_NN, LOCK_EN, sectionEventBase(0) + static_cast<uint8_t>(InEventID::commutatorLock));
+      sim.runFor(100 * MS);
+
+      const SimNodeOps &module = sim.ops(0);
+      const auto lock = [&](uint8_t opCode)
+      {
+         CANFrame frame{};
+         frame.id = (DEFAULT_PRIORITY << 7) | 0x40;
+         frame.len = 5;
+         frame.data[0] = opCode;
+         frame.data[1] = LOCK_NN >> 8;
+         frame.data[2] = LOCK_NN & 0xFF;
+         frame.data[3] = LOCK_EN >> 8;
+         frame.data[4] = LOCK_EN & 0xFF;
+         sim.bus().inject(frame);
+      };
+
+      printf("%d to %d learned events queued during a %llu ms core 0 stall, %s\n", backlogs[0], backlogs[2],
+             static_cast<unsigned long long>(STALL_TIME / MS), dualCore ? "CAN on core 1" : "single core");
+
+      bool ok = true;
+
+      for (int frames : backlogs)
+      {
+         // Locked, then a run of locks ending in the release, all on the bus while core 0 is stalled
+         lock(OPC_ACON);
+         sim.runFor(50 * MS);
+
+         const uint64_t stalled = sim::now();
+         sim.stallCore0(0, STALL_TIME);
+
+         for (int i = 1; i < frames; i++)
+         {
+            lock(OPC_ACON);
+         }
+
+         lock(OPC_ACOF);
+
+         const bool released = sim.runUntil([&]()
+                                            { return module.lineClearReleased[0]; },
+                                            SEC);
+         const uint64_t us = sim::now() - stalled;
+         ok = ok && released && (us <= (STALL_TIME + MARGIN));
+
+         printf("  %2d events  stall -> last event handled %7.3f ms%s\n", frames, us / 1000.0,
+                released ? "" : ", never handled");
+         sim.runFor(100 * MS);
+      }
+
+      printf("  RX overflows %u\n\n", sim.node(0).rxOverflows);
+
+      return ok && !sim.node(0).rxOverflows;
+   }
+
+   /// Core 0 stalls under a full bus, e.g. while flash is written or a slow debug print runs
+   bool coreSplitScenario(const char *title, bool dualCore, int cycles)
+   {
+      constexpr uint64_t STALL_TIME = 30 * MS;  ///< Length of each stall
+      constexpr uint64_t STALL_GAP = 200 * MS;  ///< Longest time between stalls of a node
+
+      SimHarness sim(2);
+      sim.dualCore = dualCore;
+      sim.boot();
+      sim.pair(0, 1);
+
+      uint64_t requestQueued = 0;
+      sim.bus().observer = [&](uint64_t, const sim::Node *sender, const sim::TxEntry &entry)
+      {
+         if (sender && (sender->id == 0) && (entry.frame.data[0] == OPC_ACON))
+         {
+            requestQueued = entry.queuedAt;
+         }
+      };
+
+      // Full foreign traffic, with each node stalling at random
+      uint32_t seed = 12345;
+      uint32_t stallSeed = 54321;
+      const uint64_t intervalUs = (sim::frameBits(foreignEvent(seed)) * SEC) / sim::CAN_BITRATE;
+      uint64_t nextFrame = sim::now();
+      uint64_t nextStall[2]{sim::now(), sim::now() + STALL_GAP / 2};
+
+      sim.onStep = [&]()
+      {
+         while (nextFrame <= sim::now())
+         {
+            sim.bus().inject(foreignEvent(seed));
+            nextFrame += intervalUs;
+         }
+
+         for (size_t i = 0; i < 2; i++)
+         {
+            if (nextStall[i] <= sim::now())
+            {
+               sim.stallCore0(i, STALL_TIME);
+               nextStall[i] += STALL_TIME + (lcg(stallSeed) % STALL_GAP);
+            }
+         }
+      };
+
+      const SimNodeOps &local = sim.ops(0);
+
+      Latency lcAck{"Line Clear request -> ACK", {}};
+      Latency totAck{"Train on Track request -> ACK", {}};
+      Latency nrmAck{"Block Cleared request -> ACK", {}};
+      Latency lcSw{"Line Clear switch -> ACK", {}};
+      Latency totSw{"Train on Track switch -> ACK", {}};
+      Latency nrmSw{"Normal switch -> ACK", {}};
+
+      sim.runFor(100 * MS);
+
+      int failures = 0;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         const bool ok = transition(sim, local.pins[0].lineClear, BlockState::LineClear, requestQueued, lcAck, lcSw) &&
+                         transition(sim, local.pins[0].trainOnTrack, BlockState::TrainOnTrack, requestQueued, totAck, totSw) &&
+                         transition(sim, local.pins[0].normal, BlockState::Normal, requestQueued, nrmAck, nrmSw);
+
+         // A lost request or ACK leaves the boxes out of step, start the next cycle from Normal
+         if (!ok)
+         {
+            failures++;
+            sim.reset(0);
+            sim.reset(1);
+            sim.runFor(100 * MS);
+         }
+      }
+
+      printf("%s\n", title);
+      lcAck.report();
+      totAck.report();
+      nrmAck.report();
+      lcSw.report();
+      totSw.report();
+      nrmSw.report();
+      printf("  failed cycles %d of %d, RX overflows %u / %u, TX stalls avoided %u / %u", failures, cycles,
+             sim.node(0).rxOverflows, sim.node(1).rxOverflows, sim.ops(0).cbus->getTxStallsAvoided(),
+             sim.ops(1).cbus->getTxStallsAvoided());
+
+      printf(", filtered %u / %u%s\n\n", sim.ops(0).cbus->getRxFiltered(), sim.ops(1).cbus->getRxFiltered(),
+             dualCore ? " on core 1" : "");
+
+      return failures == 0;
+   }
+
+   /// Block cycles under foreign traffic, then read the local box's counters over the bus as a tool would
+   bool diagnosticsScenario(int cycles)
+   {
+      SimHarness sim(2);
+      sim.dualCore = true;
+      sim.boot();
+      sim.pair(0, 1);
+
+      uint32_t seed = 12345;
+      const uint64_t intervalUs = 2 * (sim::frameBits(foreignEvent(seed)) * SEC) / sim::CAN_BITRATE;
+      uint64_t nextFrame = sim::now();
+
+      sim.onStep = [&]()
+      {
+         while (nextFrame <= sim::now())
+         {
+            sim.bus().inject(foreignEvent(seed));
+            nextFrame += intervalUs;
+         }
+      };
+
+      const SimNodeOps &local = sim.ops(0);
+      uint64_t requestQueued = 0;
+      Latency unused{"", {}};
+      int failures = 0;
+
+      sim.runFor(100 * MS);
+
+      for (int i = 0; i < cycles; i++)
+      {
+         failures += !transition(sim, local.pins[0].lineClear, BlockState::LineClear, requestQueued, unused, unused);
+         failures += !transition(sim, local.pins[0].trainOnTrack, BlockState::TrainOnTrack, requestQueued, unused, unused);
+         failures += !transition(sim, local.pins[0].normal, BlockState::Normal, requestQueued, unused, unused);
+      }
+
+      sim.onStep = nullptr;
+
+      // Collect the DGN replies of the local box
+      std::map<std::pair<uint8_t, uint8_t>, uint16_t> values;
+      sim.bus().observer = [&](uint64_t, const sim::Node *sender, const sim::TxEntry &entry)
+      {
+         const CANFrame &frame = entry.frame;
+
+         if (sender && (sender->id == 0) && (frame.len == 7) && (frame.data[0] == OPC_DGN))
+         {
+            values[{frame.data[3], frame.data[4]}] = (frame.data[5] << 8) | frame.data[6];
+         }
+      };
+
+      // RDGN for every service and code
+      const uint16_t nn = SimHarness::nodeNumber(0);
+      CANFrame request{};
+      request.id = (DEFAULT_PRIORITY << 7) | 0x7D;
+      request.len = 5;
+      request.data[0] = OPC_RDGN;
+      request.data[1] = nn >> 8;
+      request.data[2] = nn & 0xFF;
+      sim.bus().inject(request);
+      sim.runFor(200 * MS);
+
+      auto value = [&](uint8_t service, uint8_t code)
+      {
+         const auto it = values.find({service, code});
+         return (it == values.end()) ? -1 : static_cast<int>(it->second);
+      };
+
+      printf("Performance counters read over CBUS, %d block cycles at 50%% bus load, CAN on core 1\n", cycles);
+      printf("  %zu DGN replies\n", values.size());
+      printf("  CAN   rx %d  tx %d  filtered %d  rx buffer max %d  rx ring max %d  rx ring full %d  tx ring full %d  "
+             "tx stalls avoided %d\n",
+             value(Telemetry::SERVICE_CAN, 1), value(Telemetry::SERVICE_CAN, 2), value(Telemetry::SERVICE_CAN, 3),
+             value(Telemetry::SERVICE_CAN, 4), value(Telemetry::SERVICE_CAN, 5), value(Telemetry::SERVICE_CAN, 6),
+             value(Telemetry::SERVICE_CAN, 7), value(Telemetry::SERVICE_CAN, 8));
+      printf("  loop  passes %d  min %d us  avg %d us  max %d us (virtual time)\n", value(Telemetry::SERVICE_LOOP, 1),
+             value(Telemetry::SERVICE_LOOP, 2), value(Telemetry::SERVICE_LOOP, 3), value(Telemetry::SERVICE_LOOP, 4));
+
+      const struct
+      {
+         const char *name;
+         OutEventID id;
+      } requests[] = {{"Line Clear", OutEventID::lineClear},
+                      {"Train on Track", OutEventID::trainOnTrack},
+                      {"Block Cleared", OutEventID::blockCleared}};
+
+      for (const auto &r : requests)
+      {
+         const uint8_t base = static_cast<uint8_t>(r.id) * 16;
+
+         // Every request of the cycles is counted, as read back over the bus
+         failures += (value(Telemetry::SERVICE_ROUND_TRIP, base + 1) != cycles);
+
+         printf("  %-15s round trips %d  min %d ms  max %d ms  buckets", r.name, value(Telemetry::SERVICE_ROUND_TRIP, base + 1),
+                value(Telemetry::SERVICE_ROUND_TRIP, base + 2), value(Telemetry::SERVICE_ROUND_TRIP, base + 3));
+
+         for (uint8_t b = 0; b < Telemetry::NUM_BUCKETS; b++)
+         {
+            printf(" %d", value(Telemetry::SERVICE_ROUND_TRIP, base + 4 + b));
+         }
+
+         printf("\n");
+      }
+
+      printf("\n");
+
+      return failures == 0;
+   }
+
+   /// Node variable request from a configuration tool
+   CANFrame nodeVariableRequest(uint8_t opCode, uint16_t nn, uint8_t index, uint8_t value = 0)
+   {
+      CANFrame frame{};
+      frame.id = (DEFAULT_PRIORITY << 7) | 0x7D;
+      frame.len = (opCode == OPC_NVSET) ? 5 : 4;
+      frame.data[0] = opCode;
+      frame.data[1] = nn >> 8;
+      frame.data[2] = nn & 0xFF;
+      frame.data[3] = index;
+      frame.data[4] = value;
+      return frame;
+   }
+
+   bool configScenario(int cycles)
+   {
+      SimHarness sim(1);
+      sim.boot();
+      sim.runFor(100 * MS);
+
+      const SimNodeOps &module = sim.ops(0);
+      const sim::Node &node = sim.node(0);
+      const uint16_t nn = SimHarness::nodeNumber(0);
+
+      // Power cycles, as a layout switched on every day
+      const uint32_t libraryWrites = module.config->writeCount;
+      const uint32_t erases = node.flashErases;
+      const uint32_t programs = node.flashPrograms;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         sim.reset(0);
+         sim.runFor(100 * MS);
+      }
+
+      printf("Module settings journal, %d power cycles then every NV set by a configuration tool\n", cycles);
+      printf("  boot  library configuration writes %u, flash sectors erased %u, pages programmed %u\n",
+             module.config->writeCount - libraryWrites, node.flashErases - erases, node.flashPrograms - programs);
+
+      // A configuration tool sets each NV in turn, waiting for each WRACK
+      uint32_t acks = 0;
+      int nvans = -1;
+      sim.bus().observer = [&](uint64_t, const sim::Node *sender, const sim::TxEntry &entry)
+      {
+         acks += sender && (entry.frame.data[0] == OPC_WRACK);
+
+         if (sender && (entry.frame.data[0] == OPC_NVANS))
+         {
+            nvans = entry.frame.data[4];
+         }
+      };
+
+      const uint32_t records = module.settings->getRecords();
+      const uint32_t setErases = node.flashErases;
+      const uint32_t setPrograms = node.flashPrograms;
+
+      for (uint8_t nv = 1; nv <= 10; nv++)
+      {
+         sim.bus().inject(nodeVariableRequest(OPC_NVSET, nn, nv, nv * 10));
+         sim.runFor(10 * MS);
+      }
+
+      sim.runFor(SEC);
+
+      printf("  NVSET 10 NVs, WRACK %u, journal records %u, flash sectors erased %u, pages programmed %u\n", acks,
+             module.settings->getRecords() - records, node.flashErases - setErases, node.flashPrograms - setPrograms);
+
+      // The settings survive a power cycle
+      sim.reset(0);
+      sim.runFor(100 * MS);
+      sim.bus().inject(nodeVariableRequest(OPC_NVRD, nn, 5));
+      sim.runFor(100 * MS);
+
+      // Loading takes no virtual time, DGN service 4 code 2 times it on a module
+      printf("  after power cycle NV5 reads %d (set to 50), %u records loaded\n\n", nvans,
+             module.settings->getRestored());
+
+      return (acks == 10) && (nvans == 50);
+   }
+
+   /// Operate the same switch of every section at once, true when every local box reaches the target state
+   /// Level of a module output, on the GPIO or a port expander
+   bool outputLevel(SimHarness &sim, size_t index, uint8_t pin)
+   {
+      if (pin >= EXPANDER_PIN_BASE)
+      {
+         const uint8_t bit = pin - EXPANDER_PIN_BASE;
+         return sim.node(index).expanderOutput(bit / EXPANDER_PINS, bit % EXPANDER_PINS);
+      }
+
+      return sim.node(index).output(pin);
+   }
+
+   /// Operate a switch on every section together, true once every section reaches the state and lights its indicator
+   bool sectionsTransition(SimHarness &sim, uint8_t SectionPins::*pin, BlockState target, uint8_t SectionPins::*indicator)
+   {
+      const SimNodeOps &local = sim.ops(0);
+
+      for (uint8_t s = 0; s < local.numSections; s++)
+      {
+         sim.press(0, local.pins[s].*pin);
+      }
+
+      const bool ok = sim.runUntil([&]()
+                                   {
+                                      for (uint8_t s = 0; s < local.numSections; s++)
+                                      {
+                                         if (local.localBoxState[s] != target)
+                                         {
+                                            return false;
+                                         }
+                                      }
+                                      return true; },
+                                   SEC);
+
+      for (uint8_t s = 0; s < local.numSections; s++)
+      {
+         sim.release(0, local.pins[s].*pin);
+      }
+
+      sim.runFor(50 * MS);
+
+      for (uint8_t s = 0; s < local.numSections; s++)
+      {
+         if (!outputLevel(sim, 0, local.pins[s].*indicator))
+         {
+            return false;
+         }
+      }
+
+      return ok;
+   }
+
+   /// Query node request, every module accepts it
+   CANFrame queryNodes()
+   {
+      CANFrame frame{};
+      frame.id = (DEFAULT_PRIORITY << 7) | 0x7E;
+      frame.len = 1;
+      frame.data[0] = OPC_QNN;
+      return frame;
+   }
+
+   bool bootScenario(int cycles)
+   {
+      SimHarness sim(2);
+      sim.dualCore = true;
+      sim.boot();
+      sim.pair(0, 1);
+      sim.runFor(100 * MS);
+
+      const SimNodeOps &local = sim.ops(0);
+      const SimNodeOps &remote = sim.ops(1);
+      const sim::Node &node = sim.node(0);
+
+      // Line Clear given, then long enough for the journal to write the new states
+      sim.press(0, local.pins[0].lineClear);
+      sim.runUntil([&]()
+                   { return local.localBoxState[0] == BlockState::LineClear; },
+                   SEC);
+      sim.release(0, local.pins[0].lineClear);
+      sim.runFor(SEC);
+
+      // A query from a configuration tool every millisecond, to time the first frame the module accepts
+      uint64_t nextQuery = 0;
+      sim.onStep = [&]()
+      {
+         if (sim::now() >= nextQuery)
+         {
+            sim.bus().inject(queryNodes());
+            nextQuery = sim::now() + MS;
+         }
+      };
+
+      Latency firstAccept{"Power on -> first frame", {}};
+      int restored = 0;
+      int shown = 0;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         const uint64_t powerOn = sim::now();
+         sim.reset(0);
+
+         // State and indicators are back before the first pass of loop()
+         restored += (local.localBoxState[0] == BlockState::LineClear);
+         shown += node.output(local.pins[0].lineClearLocal) && !node.output(local.pins[0].normalLocal);
+
+         sim.runUntil([&]()
+                      { return local.cbus->getFirstAcceptUs() != CBUSDispatch::NOT_YET; },
+                      SEC);
+
+         firstAccept.samples.push_back(local.cbus->getFirstAcceptUs() - static_cast<uint32_t>(powerOn));
+         sim.runFor(100 * MS);
+      }
+
+      sim.onStep = nullptr;
+
+      // Both boxes carry on from where they were, so the block can be given up as normal
+      sim.press(0, local.pins[0].trainOnTrack);
+      const bool resumed = sim.runUntil([&]()
+                                        { return (local.localBoxState[0] == BlockState::TrainOnTrack) &&
+                                                 (remote.remoteBoxState[0] == BlockState::TrainOnTrack); },
+                                        SEC);
+      sim.release(0, local.pins[0].trainOnTrack);
+
+      uint16_t sections = 0;
+      local.telemetry->read(Telemetry::SERVICE_BOOT, 4, sections);
+
+      printf("Fast boot, %d power cycles of a local box at Line Clear with a query every ms (virtual time)\n", cycles);
+      firstAccept.report();
+      printf("  bus ready and setup() done not shown, setup() takes no virtual time, read DGN service 5 on a module\n");
+      printf("  Line Clear restored %d/%d, indicators shown before loop() %d/%d, sections restored %u, "
+             "Train on Track after last boot %s\n\n",
+             restored, cycles, shown, cycles, sections, resumed ? "ACKed" : "FAILED");
+
+      return (restored == cycles) && (shown == cycles) && resumed;
+   }
+
+   bool lossyScenario(int cycles, uint32_t lossPercent, const char *traceFile)
+   {
+      SimHarness sim(2);
+      sim.boot();
+      sim.pair(0, 1);
+      sim.runFor(100 * MS);
+
+      // Lose frames at random, whoever sent them
+      uint32_t seed = 12345;
+      sim.bus().lose = [&](const sim::Node *, const CANFrame &)
+      {
+         return (lcg(seed) % 100) < lossPercent;
+      };
+
+      const SimNodeOps &local = sim.ops(0);
+      Latency lcSw{"Line Clear switch -> state", {}};
+      Latency totSw{"Train on Track switch -> state", {}};
+      Latency nrmSw{"Normal switch -> state", {}};
+      int failures = 0;
+
+      // Give each operation time to be given up, so a failure cannot run into the next cycle
+      const auto operate = [&](uint8_t pin, BlockState target, Latency &latency)
+      {
+         const uint64_t pressed = sim::now();
+         sim.press(0, pin);
+         const bool ok = sim.runUntil([&]()
+                                      { return local.localBoxState[0] == target; },
+                                      RequestTracker::GIVE_UP_US + 100 * MS);
+         sim.release(0, pin);
+
+         if (ok)
+         {
+            latency.samples.push_back(sim::now() - pressed);
+         }
+
+         failures += !ok;
+         sim.runFor(200 * MS);
+         return ok;
+      };
+
+      for (int i = 0; i < cycles; i++)
+      {
+         // Start each cycle from Normal, even after a failure
+         if (local.localBoxState[0] != BlockState::Normal)
+         {
+            local.localBoxState[0] = BlockState::Normal;
+            sim.ops(1).remoteBoxState[0] = BlockState::Normal;
+         }
+
+         operate(local.pins[0].lineClear, BlockState::LineClear, lcSw) &&
+             operate(local.pins[0].trainOnTrack, BlockState::TrainOnTrack, totSw) &&
+             operate(local.pins[0].normal, BlockState::Normal, nrmSw);
+      }
+
+      sim.bus().lose = nullptr;
+
+      uint16_t retries = 0, timeouts = 0, duplicates = 0;
+      local.telemetry->read(Telemetry::SERVICE_REQUESTS, 1, retries);
+      local.telemetry->read(Telemetry::SERVICE_REQUESTS, 2, timeouts);
+      local.telemetry->read(Telemetry::SERVICE_REQUESTS, 3, duplicates);
+
+      printf("%u%% of frames lost, %d block cycles, retry after %u ms doubling, given up after %.2f s (virtual time)\n",
+             lossPercent, cycles, RequestTracker::TIMEOUT_US / 1000, RequestTracker::GIVE_UP_US / 1e6);
+      lcSw.report();
+      totSw.report();
+      nrmSw.report();
+      printf("  failed operations %d, frames lost %u of %u, retries %u, given up %u, duplicate replies dropped %u\n",
+             failures, sim.bus().lost(), sim.bus().frames(), retries, timeouts, duplicates);
+
+      FILE *out = traceFile ? fopen(traceFile, "w") : nullptr;
+
+      if (out)
+      {
+         local.trace->dump(out);
+         fclose(out);
+         printf("  trace of the last %u records written to %s\n", FrameTrace::RECORDS, traceFile);
+      }
+
+      printf("\n");
+
+      return failures == 0;
+   }
+
+   /// Presses shorter than a core 0 stall, only seen if the PIO samples the switches
+   bool captureScenario(int cycles)
+   {
+      // Held for the debounce time and the sample interval, so SAMPLES samples land inside it at any phase
+      constexpr uint64_t PRESS_TIME = CANBLOCK_DEBOUNCE_MS * MS * SwitchInput::SAMPLES / (SwitchInput::SAMPLES - 1) + MS;
+      constexpr uint64_t STALL_TIME = PRESS_TIME + 10 * MS; ///< Core 0 stall around each press
+
+      SimHarness sim(2);
+      sim.boot();
+      sim.pair(0, 1);
+      sim.runFor(100 * MS);
+
+      const SimNodeOps &local = sim.ops(0);
+      Latency lcSw{"Line Clear switch -> state", {}};
+      int seen = 0;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         local.localBoxState[0] = BlockState::Normal;
+         sim.ops(1).remoteBoxState[0] = BlockState::Normal;
+
+         // The switch is pressed and released again inside the stall
+         sim.stallCore0(0, STALL_TIME);
+         sim.runFor(5 * MS);
+
+         const uint64_t pressed = sim::now();
+         sim.press(0, local.pins[0].lineClear);
+         sim.runFor(PRESS_TIME);
+         sim.release(0, local.pins[0].lineClear);
+
+         if (sim.runUntil([&]()
+                          { return local.localBoxState[0] == BlockState::LineClear; },
+                          SEC))
+         {
+            lcSw.samples.push_back(sim::now() - pressed);
+            seen++;
+         }
+
+         sim.runFor(100 * MS);
+      }
+
+      printf("%llu ms presses inside %llu ms core 0 stalls, %d presses, switch inputs %s\n",
+             static_cast<unsigned long long>(PRESS_TIME / MS), static_cast<unsigned long long>(STALL_TIME / MS), cycles,
+             CANBLOCK_INPUT_CAPTURE ? "captured by PIO" : "polled by loop()");
+      lcSw.report();
+      printf("  presses seen %d of %d\n\n", seen, cycles);
+
+      // Polled by loop(), presses inside a stall are missed, which is what this shows
+      return !CANBLOCK_INPUT_CAPTURE || (seen == cycles);
+   }
+
+   /// Bell code 1-pause-2 beaten out on the local bell push, a Line Clear request answered while it sounds
+   bool bellScenario(int cycles)
+   {
+      constexpr uint64_t PUSH_TIME = CANBLOCK_DEBOUNCE_MS * MS * 3; ///< Bell push held down
+      constexpr uint64_t BEAT_TIME = 200 * MS;  ///< Push to push within a group, faster than the bell strikes
+      constexpr uint64_t PAUSE_TIME = 1 * SEC;  ///< Push to push between the groups
+
+      SimHarness sim(2);
+      const SimNodeOps &local = sim.ops(0);
+      const SimNodeOps &remote = sim.ops(1);
+
+      sim.boot();
+      sim.pair(0, 1);
+      sim.runFor(100 * MS);
+
+      if (!remote.bell->isFitted())
+      {
+         printf("Bell not fitted, its pins are taken by block section 1\n\n");
+         return true;
+      }
+
+      // Foreign traffic fills the bus while the code is beaten out
+      SimTraffic traffic(sim);
+      TrafficMix mix;
+      mix.foreignLoad = 1.0;
+      traffic.mix(mix);
+      // The local box reaching Line Clear is timed to the step
+      uint64_t lineClearAt = 0;
+      sim.onStep = [&]()
+      {
+         traffic.step();
+
+         if (!lineClearAt && (local.localBoxState[0] == BlockState::LineClear))
+         {
+            lineClearAt = sim::now();
+         }
+      };
+
+      sim::Node &box = sim.node(1);
+      const uint8_t push = local.pins[0].bellPush;
+      Latency lcSw{"Line Clear switch -> state", {}};
+      Latency beat{"stroke to stroke in group", {}};
+      Latency pause{"stroke to stroke, pause", {}};
+      int heard = 0, failures = 0;
+      sim.loopStats.clear();
+
+      const auto beatOut = [&](uint64_t after)
+      {
+         sim.press(0, push);
+         sim.runFor(PUSH_TIME);
+         sim.release(0, push);
+         sim.runFor(after - PUSH_TIME);
+      };
+
+      for (int i = 0; i < cycles; i++)
+      {
+         local.localBoxState[0] = BlockState::Normal;
+         remote.remoteBoxState[0] = BlockState::Normal;
+         box.bellStrokes.clear();
+         lineClearAt = 0;
+
+         beatOut(PAUSE_TIME);
+
+         // Line Clear is asked for as the second group starts sounding
+         const uint64_t pressed = sim::now();
+         sim.press(0, local.pins[0].lineClear);
+         beatOut(BEAT_TIME);
+         sim.release(0, local.pins[0].lineClear);
+         beatOut(PAUSE_TIME);
+
+         if (lineClearAt)
+         {
+            lcSw.samples.push_back(lineClearAt - pressed);
+         }
+
+         failures += !lineClearAt;
+
+         const std::vector<uint64_t> &strokes = box.bellStrokes;
+
+         if (strokes.size() == 3)
+         {
+            heard++;
+            pause.samples.push_back(strokes[1] - strokes[0]);
+            beat.samples.push_back(strokes[2] - strokes[1]);
+         }
+      }
+
+      sim.onStep = nullptr;
+
+      printf("Bell code 1-pause-2 on the bell push, %d codes at 100%% bus load, %llu ms pushes %llu ms apart\n", cycles,
+             static_cast<unsigned long long>(PUSH_TIME / MS), static_cast<unsigned long long>(BEAT_TIME / MS));
+      pause.report();
+      beat.report();
+      lcSw.report();
+      printf("  codes heard %d of %d, strokes queued %u, dropped %u, Line Clear failed %d\n", heard, cycles,
+             remote.bell->getStrokes(), remote.bell->getDropped(), failures);
+      printf("  loop() host cost  min %llu ns  avg %.1f ns  max %llu ns  (%llu calls)\n\n",
+             static_cast<unsigned long long>(sim.loopStats.minNs), sim.loopStats.avgNs(),
+             static_cast<unsigned long long>(sim.loopStats.maxNs), static_cast<unsigned long long>(sim.loopStats.count));
+
+      return (heard == cycles) && (failures == 0);
+   }
+
+   /// PC end of a node's USB port, a GridConnect program such as JMRI
+   class GridConnectPC
+   {
+   public:
+      /// Open the port, as the PC setting DTR
+      explicit GridConnectPC(sim::Node &node) : m_node(node)
+      {
+         m_fd = node.usbPath.empty() ? -1 : open(node.usbPath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+         node.usbHost = (m_fd >= 0);
+      }
+
+      ~GridConnectPC()
+      {
+         m_node.usbHost = false;
+
+         if (m_fd >= 0)
+         {
+            close(m_fd);
+         }
+      }
+
+      bool isOpen() const { return m_fd >= 0; }
+
+      /// Queue a frame to send, written as the port takes it by flush()
+      void send(const CANFrame &frame)
+      {
+         char text[GridConnectBridge::MAX_FRAME_TEXT];
+         m_out.append(text, GridConnectBridge::encode(frame, text));
+      }
+
+      /// Text queued and not yet taken by the port
+      size_t pending() const { return m_out.size(); }
+
+      /// Write queued text, read what the module sent and pass each frame to a handler
+      template <typename Handler>
+      void service(Handler &&onFrame)
+      {
+         if (!m_out.empty())
+         {
+            const ssize_t n = write(m_fd, m_out.data(), m_out.size());
+            m_out.erase(0, (n > 0) ? n : 0);
+         }
+
+         char buffer[4096];
+         ssize_t n;
+
+         while ((n = read(m_fd, buffer, sizeof(buffer))) > 0)
+         {
+            m_in.append(buffer, n);
+         }
+
+         size_t start;
+
+         while ((start = m_in.find(':')) != std::string::npos)
+         {
+            const size_t end = m_in.find(';', start);
+
+            if (end == std::string::npos)
+            {
+               break;
+            }
+
+            CANFrame frame;
+            const std::string text = m_in.substr(start, end - start + 1);
+
+            if (GridConnectBridge::decode(text.data(), text.size(), frame))
+            {
+               onFrame(text, frame);
+            }
+            else
+            {
+               m_bad++;
+            }
+
+            m_in.erase(0, end + 1);
+         }
+      }
+
+      /// Lines from the module that were not well formed frames
+      uint32_t getBad() const { return m_bad; }
+
+   private:
+      sim::Node &m_node;
+      int m_fd{-1};
+      std::string m_out;
+      std::string m_in;
+      uint32_t m_bad{0};
+   };
+
+   /// A PC on the USB port of the local box: a full bus passed to it, its frames passed to the bus, its query answered
+   bool gatewayScenario(int cycles)
+   {
+      constexpr uint16_t PC_NN = 0x0F00;        ///< Node number of the events the PC sends
+      constexpr uint64_t PHASE_TIME = 2 * SEC;  ///< Length of each traffic phase
+      constexpr double PC_LOAD = 0.45;          ///< Share of the bus the PC fills while foreign modules fill half
+
+      SimHarness sim(2);
+      sim.dualCore = true;
+      sim.boot();
+      sim.pair(0, 1);
+      sim.runFor(100 * MS);
+
+      sim::Node &box = sim.node(0);
+      const SimNodeOps &local = sim.ops(0);
+      GridConnectPC pc(box);
+
+      if (!pc.isOpen())
+      {
+         printf("GridConnect gateway not built, configure with -DCANBLOCK_GRIDCONNECT=ON\n\n");
+         return true;
+      }
+
+      const auto fromPc = [&](const CANFrame &frame)
+      {
+         return !frame.ext && !frame.rtr && (frame.len == 5) && (((frame.data[1] << 8) | frame.data[2]) == PC_NN);
+      };
+
+      // Frames from the other modules the PC should see, by text, with the times they completed.  The
+      // module's own frames are passed to the PC as they are queued to send, so are only counted off
+      const uint8_t canId = local.config->getCANID();
+      std::map<std::string, std::deque<uint64_t>> expected;
+      std::map<std::string, int32_t> own;
+      uint32_t onBus = 0, atPc = 0, unexpected = 0, pcOnBus = 0, pcOutOfOrder = 0;
+      uint16_t pcNextEn = 0;
+      uint16_t pcSentEn = 0;
+
+      sim.bus().observer = [&](uint64_t time, const sim::Node *sender, const sim::TxEntry &entry)
+      {
+         const CANFrame &frame = entry.frame;
+         char text[40];
+         SimTraffic::format(frame, text, sizeof(text));
+
+         if (sender != &box)
+         {
+            expected[text].push_back(time);
+         }
+         else if (fromPc(frame))
+         {
+            const uint16_t en = (frame.data[3] << 8) | frame.data[4];
+            pcOutOfOrder += (en != pcNextEn);
+            pcNextEn = en + 1;
+            pcOnBus++;
+            return;
+         }
+         else
+         {
+            own[text]++;
+         }
+
+         onBus++;
+      };
+
+      SimTraffic traffic(sim);
+      Latency toPc{"bus -> PC", {}};
+      std::set<uint16_t> answered;
+
+      const auto onFrame = [&](const std::string &text, const CANFrame &frame)
+      {
+         atPc++;
+
+         if ((frame.len >= 3) && (frame.data[0] == OPC_PNN))
+         {
+            answered.insert((frame.data[1] << 8) | frame.data[2]);
+         }
+
+         if (!frame.ext && ((frame.id & 0x7F) == canId))
+         {
+            own[text]--;
+            return;
+         }
+
+         std::deque<uint64_t> &times = expected[text];
+
+         if (times.empty())
+         {
+            unexpected++;
+            return;
+         }
+
+         toPc.samples.push_back(sim::now() - times.front());
+         times.pop_front();
+      };
+
+      CANFrame pcFrame{};
+      pcFrame.len = 5;
+      const uint64_t pcInterval = static_cast<uint64_t>(sim::frameBits(pcFrame) * 1e6 / sim::CAN_BITRATE / PC_LOAD);
+      uint64_t pcNext = 0;
+      bool flood = false;
+
+      sim.onStep = [&]()
+      {
+         traffic.step();
+
+         while (flood && (pcNext <= sim::now()))
+         {
+            CANFrame frame{};
+            frame.id = (DEFAULT_PRIORITY << 7) | 0x7D;
+            frame.len = 5;
+            frame.data[0] = OPC_ACON;
+            frame.data[1] = PC_NN >> 8;
+            frame.data[2] = PC_NN & 0xFF;
+            frame.data[3] = pcSentEn >> 8;
+            frame.data[4] = pcSentEn & 0xFF;
+            pc.send(frame);
+            pcSentEn++;
+            pcNext += pcInterval;
+         }
+
+         pc.service(onFrame);
+      };
+
+      // Frames on the bus the PC has not seen, and the module's own frames it saw that never reached the bus
+      const auto missing = [&]()
+      {
+         uint32_t lost = 0;
+
+         for (const auto &[text, times] : expected)
+         {
+            lost += times.size();
+         }
+
+         for (const auto &[text, balance] : own)
+         {
+            lost += std::max(balance, 0);
+            unexpected += std::max(-balance, 0);
+         }
+
+         return lost;
+      };
+
+      // Full bus to the PC, with the local box beating the bell
+      TrafficMix mix;
+      mix.foreignLoad = 1.0;
+      mix.malformedShare = 0.05;
+      traffic.mix(mix);
+
+      uint64_t busyStart = sim.bus().busyTime();
+      uint64_t start = sim::now();
+
+      for (int i = 0; i < cycles; i++)
+      {
+         sim.press(0, local.pins[0].bellPush);
+         sim.runFor(PHASE_TIME / cycles / 2);
+         sim.release(0, local.pins[0].bellPush);
+         sim.runFor(PHASE_TIME / cycles / 2);
+      }
+
+      mix.foreignLoad = 0.0;
+      traffic.mix(mix);
+      sim.runFor(100 * MS);
+
+      printf("GridConnect gateway on the local box's USB port, a pseudo-terminal, CAN on core 1\n");
+      uint32_t lost = missing();
+      bool ok = !lost && !unexpected;
+      printf("  full bus to the PC, %.1f s at %.0f%% bus load: %u frames on the bus, %u at the PC, %u missing, %u unexpected\n",
+             (sim::now() - start) / 1e6, 100.0 * (sim.bus().busyTime() - busyStart) / (sim::now() - start), onBus,
+             atPc, lost, unexpected);
+      toPc.report();
+
+      // The PC fills the bus foreign modules leave, less a margin for the module's own frames
+      expected.clear();
+      own.clear();
+      toPc.samples.clear();
+      onBus = 0;
+      atPc = 0;
+      unexpected = 0;
+
+      mix.foreignLoad = 0.5;
+      traffic.mix(mix);
+      flood = true;
+      pcNext = sim::now();
+      busyStart = sim.bus().busyTime();
+      start = sim::now();
+      sim.runFor(PHASE_TIME);
+
+      flood = false;
+      const uint32_t pcSent = pcSentEn;
+      mix.foreignLoad = 0.0;
+      traffic.mix(mix);
+      sim.runFor(200 * MS);
+
+      printf("  PC filling a half full bus, %.1f s at %.0f%% bus load: PC frames %.0f/s on the bus, %u of %u, %u out of order\n",
+             PHASE_TIME / 1e6, 100.0 * (sim.bus().busyTime() - busyStart) / (sim::now() - start),
+             pcOnBus * 1e6 / PHASE_TIME, pcOnBus, pcSent, pcOutOfOrder);
+      lost = missing();
+      ok = ok && !lost && !unexpected && (pcOnBus == pcSent) && !pcOutOfOrder;
+      printf("  meanwhile %u frames on the bus, %u at the PC, %u missing, %u unexpected\n", onBus, atPc, lost,
+             unexpected);
+      toPc.report();
+
+      // The PC asks every module for its node number, this module answers through its own port
+      CANFrame query{};
+      query.id = (DEFAULT_PRIORITY << 7) | 0x7D;
+      query.len = 1;
+      query.data[0] = OPC_QNN;
+      pc.send(query);
+      sim.runFor(100 * MS);
+
+      sim.onStep = nullptr;
+
+      const GridConnectBridge &gateway = *local.gateway;
+      printf("  QNN from the PC answered by the local box %s, the remote box %s\n",
+             answered.count(SimHarness::nodeNumber(0)) ? "yes" : "no", answered.count(SimHarness::nodeNumber(1)) ? "yes" : "no");
+      printf("  gateway frames to the PC %u, dropped %u, batches %u (%.1f frames each), from the PC %u, bad lines %u / %u\n\n",
+             gateway.getToHost(), gateway.getToHostDropped(), gateway.getBatches(),
+             gateway.getBatches() ? static_cast<double>(gateway.getToHost()) / gateway.getBatches() : 0.0,
+             gateway.getFromHost(), gateway.getBadLines(), pc.getBad());
+
+      // The malformed frames on the bus are passed on as they are, so the PC reads no bad lines.  On a
+      // busy bus frames share their batch, rather than each going to the PC on its own
+      return ok && answered.count(SimHarness::nodeNumber(0)) && answered.count(SimHarness::nodeNumber(1)) &&
+             !gateway.getToHostDropped() && !pc.getBad() && (gateway.getToHost() > gateway.getBatches());
+   }
+
+   bool sectionsScenario(int cycles)
+   {
+      SimHarness sim(2);
+      const SimNodeOps &local = sim.ops(0);
+
+      if (local.numSections < 2)
+      {
+         printf("Multi-section module not built, configure with -DCANBLOCK_NUM_SECTIONS=2\n\n");
+         return true;
+      }
+
+      sim.boot();
+
+      for (uint8_t s = 0; s < local.numSections; s++)
+      {
+         sim.pair(0, 1, s);
+      }
+
+      sim.runFor(100 * MS);
+      sim.loopStats.clear();
+
+      int failures = 0;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         failures += !sectionsTransition(sim, &SectionPins::lineClear, BlockState::LineClear,
+                                         &SectionPins::lineClearLocal);
+         failures += !sectionsTransition(sim, &SectionPins::trainOnTrack, BlockState::TrainOnTrack,
+                                         &SectionPins::trainOnTrackLocal);
+         failures += !sectionsTransition(sim, &SectionPins::normal, BlockState::Normal, &SectionPins::normalLocal);
+      }
+
+      printf("%u block sections on one module, %d block cycles with every section switched together\n",
+             local.numSections, cycles);
+      printf("  failed transitions %d, bus frames %u\n", failures, sim.bus().frames());
+
+      if (local.expander->getDevices())
+      {
+         printf("  %u port expanders, scans %u, latch writes %u, abandoned scans %u\n", local.expander->getDevices(),
+                local.expander->getScans(), local.expander->getWrites(), local.expander->getErrors());
+      }
+
+      printf("  loop() host cost  min %llu ns  avg %.1f ns  max %llu ns  (%llu calls)\n\n",
+             static_cast<unsigned long long>(sim.loopStats.minNs), sim.loopStats.avgNs(),
+             static_cast<unsigned long long>(sim.loopStats.maxNs), static_cast<unsigned long long>(sim.loopStats.count));
+
+      return failures == 0;
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const int cycles = (argc > 1) ? atoi(argv[1]) : 20;
+
+   printf("CANBlock host simulator, %u bit/s CBUS\n\n", sim::CAN_BITRATE);
+
+   if (!simNodes[0].variant->paired())
+   {
+      printf("Built with a CANMIO needle as the box in advance, the scenarios pair CANBlock with CANBlock,\n"
+             "see CANBlockVariant_needle\n");
+      return 0;
+   }
+
+   // Every scenario is run, whatever came before, and each one failed is counted
+   int failed = 0;
+   failed += !latencyScenario(cycles);
+   failed += !loadScenario("Idle bus, 1 s", 0.0, SEC);
+   failed += !loadScenario("Foreign accessory traffic at 50% bus load, 1 s", 0.5, SEC);
+   failed += !loadScenario("Foreign accessory traffic at 100% bus load, 1 s", 1.0, SEC);
+   failed += !loadScenario("Foreign accessory and cab traffic at 100% bus load, 1 s", 1.0, SEC, true);
+   failed += !coreSplitScenario("30 ms core 0 stalls at 100% bus load, single core", false, cycles);
+   failed += !coreSplitScenario("30 ms core 0 stalls at 100% bus load, CAN on core 1", true, cycles);
+   failed += !backlogScenario(false);
+   failed += !backlogScenario(true);
+   failed += !diagnosticsScenario(cycles);
+   failed += !configScenario(cycles);
+   failed += !bootScenario(cycles);
+   failed += !lossyScenario(cycles * 5, 10, (argc > 2) ? argv[2] : nullptr);
+   failed += !captureScenario(cycles);
+   failed += !sectionsScenario(cycles);
+   failed += !bellScenario(cycles);
+   failed += !gatewayScenario(cycles);
+
+   printf("%s: %d scenarios failed\n", failed ? "FAIL" : "PASS", failed);
+
+   return failed ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+//
+/// CANBlock trace decoder
+///
+/// Reads a trace dump, as written by the module when sent 'T' on its USB
+/// console, and prints
+///   - a timeline of both cores' records in time order, with block events
+///     named by their InEventID / OutEventID and state machine steps by state
+///   - each request to the box in advance with the reply that answered it,
+///     its round trip and the retries it took
+///   - a summary of the round trips of each request
+///
+/// Usage: CANBlockTrace [dump file], reads stdin without a file.  Lines outside
+/// the trace (other console output) are skipped.
+//
+
+#include "CANBlock.h"
+#include "BlockStateMachine.h"
+#include "FrameTrace.h"
+#include "RequestTracker.h"
+
+#include "cbusdefs.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+   const char *const outEventNames[] = {"lineClearBlocked", "lineClearAck", "trainOnTrackAck", "blockClearedAck",
+                                        "attentionBell", "resetLineClear", "lineClear", "trainOnTrack", "blockCleared"};
+
+   const char *const inEventNames[] = {"commutatorLock", "lineClear", "trainOnTrack", "blockCleared", "attentionBell",
+                                       "resetLineClear", "lineClearAck", "trainOnTrackAck", "blockClearedAck",
+                                       "lineClearBlocked"};
+
+   /// InEventID a box receives for each OutEventID the other box sends, the events pair up by name
+   const InEventID receivedAs[] = {InEventID::lineClearBlocked, InEventID::lineClearAck, InEventID::trainOnTrackAck,
+                                   InEventID::blockClearedAck, InEventID::attentionBell, InEventID::resetLineClear,
+                                   InEventID::lineClear, InEventID::trainOnTrack, InEventID::blockCleared};
+
+   const char *const stateNames[] = {"Normal", "LineClear", "TrainOnTrack", "LCBlocked"};
+
+   const char *const localInputNames[] = {"LineClearSwitch", "TrainOnTrackSwitch", "NormalSwitch", "LineClearAck",
+                                          "TrainOnTrackAck", "BlockClearedAck", "LineClearNack"};
+
+   const char *const remoteInputNames[] = {"LineClearRequest", "TrainOnTrackRequest", "BlockClearedRequest",
+                                           "ResetRequest", "CommutatorLocked", "CommutatorReleased"};
+
+   constexpr size_t NUM_OUT_EVENTS = static_cast<size_t>(OutEventID::blockCleared) + 1;
+
+   static_assert(sizeof(outEventNames) / sizeof(outEventNames[0]) == NUM_OUT_EVENTS, "OutEventID names out of step");
+   static_assert(sizeof(receivedAs) / sizeof(receivedAs[0]) == NUM_OUT_EVENTS, "OutEventID pairs out of step");
+   static_assert(sizeof(inEventNames) / sizeof(inEventNames[0]) == MAX_EVENT_ID, "InEventID names out of step");
+   static_assert(sizeof(stateNames) / sizeof(stateNames[0]) == NUM_BLOCK_STATES, "BlockState names out of step");
+   static_assert(sizeof(localInputNames) / sizeof(localInputNames[0]) == NUM_LOCAL_INPUTS, "LocalInput names out of step");
+   static_assert(sizeof(remoteInputNames) / sizeof(remoteInputNames[0]) == NUM_REMOTE_INPUTS, "RemoteInput names out of step");
+
+   template <size_t N>
+   const char *name(const char *const (&names)[N], size_t value)
+   {
+      return (value < N) ? names[value] : "?";
+   }
+
+   /// A record and the core that made it
+   struct Entry
+   {
+      TraceRecord record;
+      unsigned core;
+   };
+
+   /// Block event carried by a frame
+   struct BlockEvent
+   {
+      bool on;
+      uint16_t nn;
+      uint8_t section;
+      uint8_t id; ///< OutEventID of the box that sent it
+   };
+
+   bool decodeEvent(const TraceRecord &record, BlockEvent &event)
+   {
+      const uint8_t opCode = record.data[0];
+
+      if (((record.kind & 0x0F) < 5) ||
+          ((opCode != OPC_ACON) && (opCode != OPC_ACOF) && (opCode != OPC_ASON) && (opCode != OPC_ASOF)))
+      {
+         return false;
+      }
+
+      const uint16_t en = (record.data[3] << 8) | record.data[4];
+
+      event.on = (opCode == OPC_ACON) || (opCode == OPC_ASON);
+      event.nn = (record.data[1] << 8) | record.data[2];
+      event.section = eventSection(static_cast<uint8_t>(en));
+      event.id = sectionEventID(static_cast<uint8_t>(en));
+      return (en < 256) && (event.id < NUM_OUT_EVENTS);
+   }
+
+   /// Request that a reply (as the OutEventID of the box in advance) answers
+   bool answers(uint8_t reply, OutEventID request)
+   {
+      switch (static_cast<OutEventID>(reply))
+      {
+      case OutEventID::lineClearAck:
+      case OutEventID::lineClearBlocked:
+         return request == OutEventID::lineClear;
+      case OutEventID::trainOnTrackAck:
+         return request == OutEventID::trainOnTrack;
+      case OutEventID::blockClearedAck:
+         return (request == OutEventID::blockCleared) || (request == OutEventID::resetLineClear);
+      default:
+         return false;
+      }
+   }
+
+   bool isRequest(uint8_t id)
+   {
+      return RequestTracker::isRequest(static_cast<OutEventID>(id));
+   }
+
+   /// Request waiting for its reply
+   struct Open
+   {
+      bool waiting;
+      OutEventID request;
+      uint32_t sentAt;
+      unsigned retries;
+   };
+
+   /// Round trips of one request
+   struct Summary
+   {
+      unsigned count;
+      unsigned retries;
+      unsigned unanswered;
+      uint32_t minUs;
+      uint32_t maxUs;
+      uint64_t totalUs;
+   };
+
+   /// Read the records of every core in the dump
+   std::vector<Entry> readDump(FILE *in)
+   {
+      std::vector<Entry> entries;
+      char line[128];
+      unsigned core = 0;
+      bool inTrace = false;
+
+      while (fgets(line, sizeof(line), in))
+      {
+         unsigned count;
+
+         if (sscanf(line, "trace core %u records %u", &core, &count) == 2)
+         {
+            inTrace = true;
+            continue;
+         }
+
+         if (!inTrace)
+         {
+            continue;
+         }
+
+         if (strncmp(line, "end", 3) == 0)
+         {
+            inTrace = false;
+            continue;
+         }
+
+         Entry entry{};
+         uint8_t *bytes = reinterpret_cast<uint8_t *>(&entry.record);
+         size_t b = 0;
+
+         for (; b < sizeof(TraceRecord); b++)
+         {
+            unsigned value;
+
+            if (sscanf(line + 2 * b, "%2x", &value) != 1)
+            {
+               break;
+            }
+
+            bytes[b] = static_cast<uint8_t>(value);
+         }
+
+         if ((b == sizeof(TraceRecord)) && ((entry.record.kind >> 4) != static_cast<uint8_t>(TraceKind::Empty)))
+         {
+            entry.core = core;
+            entries.push_back(entry);
+         }
+      }
+
+      // Order by time from the oldest record of either core, each core's records are already in
+      // order and the trace spans far less than the timer wrap
+      uint32_t start = entries.empty() ? 0 : entries.front().record.time;
+
+      for (const Entry &entry : entries)
+      {
+         start = (static_cast<int32_t>(entry.record.time - start) < 0) ? entry.record.time : start;
+      }
+
+      std::stable_sort(entries.begin(), entries.end(), [start](const Entry &a, const Entry &b)
+                       { return (a.record.time - start) < (b.record.time - start); });
+
+      return entries;
+   }
+
+   void printFrame(const Entry &entry, bool tx)
+   {
+      const TraceRecord &record = entry.record;
+      const uint8_t length = record.kind & 0x0F;
+      BlockEvent event;
+
+      printf("%-6s CAN ID %3u  ", tx ? "TX" : "RX", record.tag);
+
+      if (decodeEvent(record, event))
+      {
+         const char *eventName = tx ? outEventNames[event.id]
+                                    : inEventNames[static_cast<uint8_t>(receivedAs[event.id])];
+         printf("%s NN %u s%u %s %s\n", event.on ? "ON " : "OFF", event.nn, event.section, tx ? "out" : "in ",
+                eventName);
+         return;
+      }
+
+      printf("opcode 0x%02x", record.data[0]);
+
+      for (uint8_t i = 1; (i < length) && (i < sizeof(record.data)); i++)
+      {
+         printf(" %02x", record.data[i]);
+      }
+
+      printf("\n");
+   }
+
+   void printStep(const TraceRecord &record, bool local)
+   {
+      printf("%-6s s%u %s -> %s on %s\n", local ? "LOCAL" : "REMOTE", record.tag, name(stateNames, record.data[0]),
+             name(stateNames, record.data[1]),
+             local ? name(localInputNames, record.data[2]) : name(remoteInputNames, record.data[2]));
+   }
+}
+
+int main(int argc, char **argv)
+{
+   FILE *in = (argc > 1) ? fopen(argv[1], "r") : stdin;
+
+   if (!in)
+   {
+      fprintf(stderr, "CANBlockTrace: cannot open %s\n", argv[1]);
+      return 1;
+   }
+
+   const std::vector<Entry> entries = readDump(in);
+
+   if (in != stdin)
+   {
+      fclose(in);
+   }
+
+   if (entries.empty())
+   {
+      fprintf(stderr, "CANBlockTrace: no trace records found\n");
+      return 1;
+   }
+
+   Open open[MAX_SECTIONS]{};
+   Summary summary[NUM_OUT_EVENTS]{};
+   const uint32_t start = entries.front().record.time; // oldest once sorted
+
+   printf("    time ms core\n");
+
+   for (const Entry &entry : entries)
+   {
+      const TraceRecord &record = entry.record;
+      const TraceKind kind = static_cast<TraceKind>(record.kind >> 4);
+
+      printf("%11.3f  %u   ", (record.time - start) / 1000.0, entry.core);
+
+      switch (kind)
+      {
+      case TraceKind::RX:
+      case TraceKind::TX:
+         printFrame(entry, kind == TraceKind::TX);
+         break;
+      case TraceKind::Local:
+      case TraceKind::Remote:
+         printStep(record, kind == TraceKind::Local);
+         break;
+      case TraceKind::Switch:
+         printf("SWITCH GPIO %u %s\n", record.tag, (record.data[0] & 0x04) ? "fall" : "rise");
+         break;
+      default:
+         printf("unknown record kind %u\n", record.kind >> 4);
+         break;
+      }
+
+      // Match requests we sent with the replies of the box in advance
+      BlockEvent event;
+
+      if (((kind != TraceKind::RX) && (kind != TraceKind::TX)) || !decodeEvent(record, event) || !event.on ||
+          (event.section >= MAX_SECTIONS))
+      {
+         continue;
+      }
+
+      Open &pending = open[event.section];
+
+      if ((kind == TraceKind::TX) && isRequest(event.id))
+      {
+         const OutEventID request = static_cast<OutEventID>(event.id);
+
+         if (pending.waiting && (pending.request == request))
+         {
+            pending.retries++;
+            continue;
+         }
+
+         if (pending.waiting)
+         {
+            summary[static_cast<size_t>(pending.request)].unanswered++;
+         }
+
+         pending = {true, request, record.time, 0};
+      }
+      else if ((kind == TraceKind::RX) && pending.waiting && answers(event.id, pending.request))
+      {
+         const uint32_t us = record.time - pending.sentAt;
+         Summary &s = summary[static_cast<size_t>(pending.request)];
+
+         printf("%21s^ s%u %s answered after %.3f ms", "", event.section,
+                outEventNames[static_cast<size_t>(pending.request)], us / 1000.0);
+         printf(pending.retries ? ", retries %u\n" : "\n", pending.retries);
+
+         s.minUs = (!s.count || (us < s.minUs)) ? us : s.minUs;
+         s.maxUs = (us > s.maxUs) ? us : s.maxUs;
+         s.totalUs += us;
+         s.count++;
+         s.retries += pending.retries;
+         pending.waiting = false;
+      }
+   }
+
+   printf("\nRequest round trips\n");
+
+   for (size_t id = 0; id < NUM_OUT_EVENTS; id++)
+   {
+      const Summary &s = summary[id];
+
+      if (!isRequest(static_cast<uint8_t>(id)))
+      {
+         continue;
+      }
+
+      printf("  %-16s n=%-4u", outEventNames[id], s.count);
+
+      if (s.count)
+      {
+         printf(" min %7.3f ms  avg %7.3f ms  max %7.3f ms", s.minUs / 1000.0, (s.totalUs / 1000.0) / s.count,
+                s.maxUs / 1000.0);
+      }
+
+      printf("  retries %u  unanswered %u\n", s.retries, s.unanswered);
+   }
+
+   return 0;
+}
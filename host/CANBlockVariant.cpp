@@ -0,0 +1,334 @@
+//
+/// CANBlock host simulator - report of one module variant
+///
+/// Built once for each named variant (CANBLOCK_VARIANTS in CMakeLists.txt),
+/// each build reporting the variant it was compiled as
+///   - its block sections, port expanders, pairing, event table and NVs
+///   - RAM taken by the module's own objects and state, at host sizes
+///   - host cost of dispatching each event the variant can be taught
+///   - block cycles on every section, with another CANBlock or a CANMIO
+///     needle as the box in advance, and the switch to state latency
+///
+/// Usage: CANBlockVariant_<variant> [cycles]
+//
+
+#include "SimHarness.h"
+#include "SimReport.h"
+
+#include "cbusdefs.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace
+{
+   using sim::Latency;
+   using sim::MS;
+   using sim::SEC;
+
+   constexpr uint16_t REMOTE_NN = 0x0300;        ///< Node number events are taught from for the dispatch timing
+   constexpr uint32_t DISPATCH_RUNS = 100000;    ///< Passes over the taught events timed
+   constexpr uint8_t CANMIO_CANID = 0x40;        ///< CAN ID of the CANMIO
+   constexpr uint16_t CANMIO_NN = 0x0200;        ///< Node number of the CANMIO
+   constexpr uint16_t FEEDBACK_DN = 200;         ///< Device number of the CANMIO's first short feedback event
+   constexpr uint64_t NEEDLE_TRAVEL_US = 400 * MS; ///< Time the needle servo takes to reach a position
+
+   const char *pairingName(Pairing pairing)
+   {
+      return (pairing == Pairing::CANMIO) ? "a CANMIO needle" : "a CANBlock";
+   }
+
+   /// InEventID of a section's event variable
+   uint8_t eventVariable(uint8_t section, InEventID id)
+   {
+      return sectionEventBase(section) + static_cast<uint8_t>(id);
+   }
+
+   /// Boot the nodes with no events taught, the configuration store outlives a harness
+   void bootUntaught(SimHarness &sim)
+   {
+      sim.boot();
+
+      for (size_t i = 0; i < sim.size(); i++)
+      {
+         sim.with(i, [&]()
+                  {
+                     sim.ops(i).config->clearEventsEEPROM();
+                     sim.ops(i).cbus->rebuildEventIndex(); });
+      }
+   }
+
+   ///
+   /// CANMIO stand-in, the box in advance of every section of node 0
+   ///
+   /// A MULTI output for each section moves the needle to the position each request
+   /// asks for, and once there sends the short event taught for that position,
+   /// taught to the module as the reply.
+   ///
+   class NeedleStandIn
+   {
+   public:
+      explicit NeedleStandIn(SimHarness &sim) : m_sim(sim)
+      {
+         const SimNodeOps &local = sim.ops(0);
+
+         for (uint8_t s = 0; s < local.numSections; s++)
+         {
+            sim.teach(0, 0, feedback(s, 0), eventVariable(s, InEventID::lineClearAck));
+            sim.teach(0, 0, feedback(s, 1), eventVariable(s, InEventID::trainOnTrackAck));
+            sim.teach(0, 0, feedback(s, 2), eventVariable(s, InEventID::blockClearedAck));
+         }
+
+         sim.bus().observer = [this](uint64_t time, const sim::Node *sender, const sim::TxEntry &entry)
+         {
+            request(time, sender, entry.frame);
+         };
+      }
+
+      ~NeedleStandIn()
+      {
+         m_sim.bus().observer = nullptr;
+      }
+
+      /// Send the feedback of positions reached by now, call from SimHarness::onStep
+      void step()
+      {
+         while (!m_moves.empty() && (m_moves.front().at <= sim::now()))
+         {
+            m_sim.bus().inject(m_moves.front().frame);
+            m_moves.pop_front();
+         }
+      }
+
+   private:
+      /// A needle on its way to a position
+      struct Move
+      {
+         uint64_t at;
+         CANFrame frame;
+      };
+
+      /// Device number of the short event a section's needle sends at a position
+      static uint16_t feedback(uint8_t section, uint8_t position)
+      {
+         return FEEDBACK_DN + section * CANMIO_FEEDBACK_EVENTS + position;
+      }
+
+      void request(uint64_t time, const sim::Node *sender, const CANFrame &frame)
+      {
+         if ((sender != &m_sim.node(0)) || (frame.len < 5) || (frame.data[0] != OPC_ACON))
+         {
+            return;
+         }
+
+         const uint8_t en = frame.data[4];
+         const uint8_t id = sectionEventID(en);
+         uint8_t position;
+
+         // AT1 Line Clear, AT2 Train on Track, AT3 Normal, also taught the Line Clear reset
+         if (id == static_cast<uint8_t>(OutEventID::lineClear))
+         {
+            position = 0;
+         }
+         else if (id == static_cast<uint8_t>(OutEventID::trainOnTrack))
+         {
+            position = 1;
+         }
+         else if ((id == static_cast<uint8_t>(OutEventID::blockCleared)) ||
+                  (id == static_cast<uint8_t>(OutEventID::resetLineClear)))
+         {
+            position = 2;
+         }
+         else
+         {
+            return;
+         }
+
+         const uint16_t dn = feedback(eventSection(en), position);
+         Move move{time + NEEDLE_TRAVEL_US, {}};
+
+         move.frame.id = (DEFAULT_PRIORITY << 7) | CANMIO_CANID;
+         move.frame.len = 5;
+         move.frame.data[0] = OPC_ASON;
+         move.frame.data[1] = CANMIO_NN >> 8;
+         move.frame.data[2] = CANMIO_NN & 0xFF;
+         move.frame.data[3] = dn >> 8;
+         move.frame.data[4] = dn & 0xFF;
+         m_moves.push_back(move);
+      }
+
+      SimHarness &m_sim;
+      std::deque<Move> m_moves;
+   };
+
+   /// Host cost of the learned event dispatch: index lookup then eventhandler(), of every event the variant takes
+   void dispatchCost()
+   {
+      SimHarness sim(1);
+      sim.measureLoops = false;
+      bootUntaught(sim);
+
+      const SimNodeOps &node = sim.ops(0);
+      const ModuleVariant &variant = *node.variant;
+      std::vector<CANFrame> frames;
+
+      for (uint8_t s = 0; s < variant.sections; s++)
+      {
+         for (uint8_t id = 0; id < MAX_EVENT_ID; id++)
+         {
+            // A CANMIO needle only replies with its position
+            if (!variant.paired() && (id != static_cast<uint8_t>(InEventID::lineClearAck)) &&
+                (id != static_cast<uint8_t>(InEventID::trainOnTrackAck)) &&
+                (id != static_cast<uint8_t>(InEventID::blockClearedAck)))
+            {
+               continue;
+            }
+
+            const uint16_t en = sectionEventBase(s) + id;
+            sim.teach(0, REMOTE_NN, en, sectionEventBase(s) + id);
+
+            // OFF events change no state, so every run dispatches alike
+            CANFrame frame{};
+            frame.len = 5;
+            frame.data[0] = OPC_ACOF;
+            frame.data[1] = REMOTE_NN >> 8;
+            frame.data[2] = REMOTE_NN & 0xFF;
+            frame.data[3] = en >> 8;
+            frame.data[4] = en & 0xFF;
+            frames.push_back(frame);
+         }
+      }
+
+      double ns = 0.0;
+
+      sim.with(0, [&]()
+               {
+                  const EventIndex &index = node.cbus->getEventIndex();
+                  const auto start = std::chrono::steady_clock::now();
+
+                  for (uint32_t run = 0; run < DISPATCH_RUNS; run++)
+                  {
+                     for (const CANFrame &frame : frames)
+                     {
+                        const uint16_t nn = (frame.data[1] << 8) | frame.data[2];
+                        const uint16_t en = (frame.data[3] << 8) | frame.data[4];
+                        node.eventhandler(index.find(nn, en), frame);
+                     }
+                  }
+
+                  const auto elapsed = std::chrono::steady_clock::now() - start;
+                  ns = std::chrono::duration<double, std::nano>(elapsed).count() / (DISPATCH_RUNS * frames.size()); });
+
+      printf("  dispatch of a learned event  avg %.1f ns over %zu events, %u runs (host time)\n", ns, frames.size(),
+             DISPATCH_RUNS);
+   }
+
+   /// Operate a switch on every section together, the time until every section reaches the state
+   bool transition(SimHarness &sim, uint8_t SectionPins::*pin, BlockState target, Latency &latency)
+   {
+      const SimNodeOps &local = sim.ops(0);
+      const uint64_t start = sim::now();
+
+      for (uint8_t s = 0; s < local.numSections; s++)
+      {
+         sim.press(0, local.pins[s].*pin);
+      }
+
+      const bool ok = sim.runUntil([&]()
+                                   { return std::all_of(local.localBoxState, local.localBoxState + local.numSections,
+                                                        [&](BlockState state)
+                                                        { return state == target; }); },
+                                   2 * SEC);
+
+      if (ok)
+      {
+         latency.samples.push_back(sim::now() - start);
+      }
+
+      for (uint8_t s = 0; s < local.numSections; s++)
+      {
+         sim.release(0, local.pins[s].*pin);
+      }
+
+      sim.runFor(50 * MS);
+      return ok;
+   }
+
+   /// Block cycles on every section, against another CANBlock or a CANMIO needle
+   bool blockCycles(int cycles)
+   {
+      const ModuleVariant &variant = *simNodes[0].variant;
+      SimHarness sim(variant.paired() ? 2 : 1);
+      bootUntaught(sim);
+
+      std::unique_ptr<NeedleStandIn> needle;
+
+      if (variant.paired())
+      {
+         for (uint8_t s = 0; s < variant.sections; s++)
+         {
+            sim.pair(0, 1, s);
+         }
+      }
+      else
+      {
+         needle = std::make_unique<NeedleStandIn>(sim);
+         sim.onStep = [&]()
+         { needle->step(); };
+      }
+
+      sim.runFor(100 * MS);
+      sim.loopStats.clear();
+
+      Latency lineClear{"Line Clear switch -> state", {}};
+      Latency trainOnTrack{"Train on Track switch -> state", {}};
+      Latency normal{"Normal switch -> state", {}};
+      int failures = 0;
+
+      for (int i = 0; i < cycles; i++)
+      {
+         failures += !transition(sim, &SectionPins::lineClear, BlockState::LineClear, lineClear);
+         failures += !transition(sim, &SectionPins::trainOnTrack, BlockState::TrainOnTrack, trainOnTrack);
+         failures += !transition(sim, &SectionPins::normal, BlockState::Normal, normal);
+      }
+
+      sim.onStep = nullptr;
+
+      printf("  %d block cycles with every section switched together, against %s: failed transitions %d, bus frames %u, "
+             "requests sent again %u\n",
+             cycles, pairingName(variant.pairing), failures, sim.bus().frames(), sim.ops(0).requests->getRetries());
+      lineClear.report();
+      trainOnTrack.report();
+      normal.report();
+      printf("  loop() host cost  min %llu ns  avg %.1f ns  max %llu ns  (%llu calls)\n",
+             static_cast<unsigned long long>(sim.loopStats.minNs), sim.loopStats.avgNs(),
+             static_cast<unsigned long long>(sim.loopStats.maxNs), static_cast<unsigned long long>(sim.loopStats.count));
+
+      return failures == 0;
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const int cycles = (argc > 1) ? atoi(argv[1]) : 20;
+   const SimNodeOps &node = simNodes[0];
+   const ModuleVariant &variant = *node.variant;
+
+   printf("CANBlock variant %s: %u block sections, %u port expanders, paired with %s\n", variant.name,
+          variant.sections, variant.expanders, pairingName(variant.pairing));
+   printf("  event table %u entries (%u a section), %u NVs, events from %lu, bell %s\n", variant.numEvents(),
+          variant.eventsPerSection(), variant.numNVs, static_cast<unsigned long>(variant.eventsStart()),
+          variant.bellFitted() ? "fitted" : "not fitted");
+   printf("  module objects and state %zu bytes of RAM (host sizes)\n", node.stateBytes);
+
+   dispatchCost();
+   const bool pass = blockCycles(cycles);
+   printf("\n");
+
+   return pass ? 0 : 1;
+}
@@ -0,0 +1,459 @@
+//
+/// CANBlock host simulator - virtual clock, simulated GPIO and CAN bus
+//
+
+#include "SimBus.h"
+
+#include "hardware/flash.h"
+
+#include <algorithm>
+#include <cassert>
+#include <unistd.h>
+
+namespace sim
+{
+   namespace
+   {
+      uint64_t s_now{0};
+      Node *s_current{nullptr};
+      Bus s_bus;
+   }
+
+   uint64_t now()
+   {
+      return s_now;
+   }
+
+   void advance(uint64_t us)
+   {
+      s_now += us;
+   }
+
+   void resetClock()
+   {
+      s_now = 0;
+   }
+
+   void sleepUs(uint64_t us)
+   {
+      // A blocking sleep in module code lets the bus run on
+      s_now += us;
+      s_bus.advanceTo(s_now);
+   }
+
+   uint32_t frameBits(const CANFrame &frame)
+   {
+      // SOF, arbitration, control, CRC, ACK, EOF and 3 bit interframe space
+      // bit stuffing is not modelled
+      const uint32_t overhead = frame.ext ? 67 : 47;
+      return overhead + (frame.rtr ? 0 : 8u * frame.len);
+   }
+
+   Node *current()
+   {
+      return s_current;
+   }
+
+   void setCurrent(Node *node)
+   {
+      s_current = node;
+   }
+
+   Bus &bus()
+   {
+      return s_bus;
+   }
+
+   //
+   /// Node
+   //
+
+   Node::Node(uint8_t id) : id(id)
+   {
+   }
+
+   Node::~Node()
+   {
+      if (usbFd >= 0)
+      {
+         close(usbFd);
+      }
+   }
+
+   void Node::powerOn()
+   {
+      m_out = 0;
+      m_oe = 0;
+      m_pullUp = 0;
+      m_pullDown = 0;
+      m_irqFall = 0;
+      m_irqRise = 0;
+      m_irqCallback = nullptr;
+      event = false;
+      canIrq = false;
+      wakeAt = 0;
+      canStarted = false;
+      rx.clear();
+      tx.clear();
+      peripherals.clear();
+
+      // Expanders lose their registers, the outside world still drives the inputs
+      for (Expander &expander : expanders)
+      {
+         expander = Expander{0xFFFF, 0, 0, 0, expander.driven, expander.level, 0};
+      }
+
+      expanderInt = 0xFF;
+      toneLevels = 0;
+   }
+
+   uint16_t Expander::pins() const
+   {
+      const uint16_t inputs = (driven & level) | (~driven & gppu);
+      return static_cast<uint16_t>((~iodir & olat) | (iodir & inputs));
+   }
+
+   void Node::setExpanderInput(uint8_t device, uint8_t bit, bool level)
+   {
+      Expander &expander = expanders[device];
+      expander.driven |= 1u << bit;
+      expander.level = level ? (expander.level | (1u << bit)) : (expander.level & ~(1u << bit));
+      expanderInterrupt();
+   }
+
+   void Node::expanderInterrupt()
+   {
+      if (expanderInt >= NUM_GPIO)
+      {
+         return;
+      }
+
+      bool active = false;
+
+      for (const Expander &expander : expanders)
+      {
+         active = active || expander.interrupt();
+      }
+
+      // Open drain and pulled up, any device pulls it low
+      if (active != !((read() >> expanderInt) & 1u))
+      {
+         setInput(expanderInt, !active);
+      }
+   }
+
+   uint32_t Node::read() const
+   {
+      // Floating inputs read low unless pulled up
+      const uint32_t inputs = (m_driven & m_level) | (~m_driven & m_pullUp);
+      return (m_oe & m_out) | (~m_oe & inputs);
+   }
+
+   void Node::setInput(uint8_t pin, bool level)
+   {
+      const uint32_t before = read();
+      m_driven |= 1u << pin;
+      m_level = level ? (m_level | (1u << pin)) : (m_level & ~(1u << pin));
+      inputChanged(before);
+   }
+
+   void Node::releaseInput(uint8_t pin)
+   {
+      const uint32_t before = read();
+      m_driven &= ~(1u << pin);
+      inputChanged(before);
+   }
+
+   void Node::inputChanged(uint32_t before)
+   {
+      const uint32_t after = read();
+      const uint32_t fell = before & ~after & m_irqFall;
+      const uint32_t rose = ~before & after & m_irqRise;
+
+      if (!(fell | rose))
+      {
+         return;
+      }
+
+      // The interrupt is taken, which also wakes a core waiting for an event
+      event = true;
+
+      if (!m_irqCallback)
+      {
+         return;
+      }
+
+      Node *previous = s_current;
+      s_current = this;
+
+      for (uint32_t pin = 0; pin < NUM_GPIO; pin++)
+      {
+         const uint32_t events = (((fell >> pin) & 1u) ? 0x4u : 0) | (((rose >> pin) & 1u) ? 0x8u : 0);
+
+         if (events)
+         {
+            m_irqCallback(pin, events);
+         }
+      }
+
+      s_current = previous;
+   }
+
+   void sendEvent()
+   {
+      assert(s_current);
+      s_current->event = true;
+   }
+
+   bool waitForEvent(uint64_t timeout)
+   {
+      assert(s_current);
+      s_current->wakeAt = timeout;
+      return false;
+   }
+
+   //
+   /// GPIO access from the Pico SDK stand-in
+   //
+
+   uint32_t gpioGetAll()
+   {
+      assert(s_current);
+      return s_current->read();
+   }
+
+   void gpioSetDir(uint32_t mask, uint32_t value)
+   {
+      assert(s_current);
+      s_current->m_oe = (s_current->m_oe & ~mask) | (value & mask);
+   }
+
+   void gpioPutMasked(uint32_t mask, uint32_t value)
+   {
+      assert(s_current);
+      s_current->m_out = (s_current->m_out & ~mask) | (value & mask);
+   }
+
+   void gpioSetPulls(uint32_t pin, bool up, bool down)
+   {
+      assert(s_current);
+      const uint32_t bit = 1u << pin;
+      s_current->m_pullUp = up ? (s_current->m_pullUp | bit) : (s_current->m_pullUp & ~bit);
+      s_current->m_pullDown = down ? (s_current->m_pullDown | bit) : (s_current->m_pullDown & ~bit);
+   }
+
+   void gpioSetIrq(uint32_t pin, uint32_t events, bool enabled, void (*callback)(unsigned int, uint32_t))
+   {
+      assert(s_current);
+      const uint32_t bit = 1u << pin;
+
+      if (events & 0x4u)
+      {
+         s_current->m_irqFall = enabled ? (s_current->m_irqFall | bit) : (s_current->m_irqFall & ~bit);
+      }
+
+      if (events & 0x8u)
+      {
+         s_current->m_irqRise = enabled ? (s_current->m_irqRise | bit) : (s_current->m_irqRise & ~bit);
+      }
+
+      // One handler for all pins, as on the Pico
+      if (callback)
+      {
+         s_current->m_irqCallback = callback;
+      }
+   }
+
+   //
+   /// Flash access from the Pico SDK stand-in
+   //
+
+   namespace
+   {
+      std::vector<uint8_t> &flash()
+      {
+         assert(s_current);
+
+         if (s_current->flash.empty())
+         {
+            s_current->flash.assign(PICO_FLASH_SIZE_BYTES, 0xFF);
+         }
+
+         return s_current->flash;
+      }
+   }
+
+   void launchCore1()
+   {
+      assert(s_current);
+
+      if (s_current->core1Launch)
+      {
+         s_current->core1Launch();
+      }
+   }
+
+   const uint8_t *flashMemory()
+   {
+      return flash().data();
+   }
+
+   void flashErase(uint32_t offset, size_t count)
+   {
+      assert(((offset % FLASH_SECTOR_SIZE) == 0) && ((count % FLASH_SECTOR_SIZE) == 0));
+      assert((offset + count) <= PICO_FLASH_SIZE_BYTES);
+
+      std::fill_n(flash().begin() + offset, count, 0xFF);
+      s_current->flashErases += count / FLASH_SECTOR_SIZE;
+      sleepUs((count / FLASH_SECTOR_SIZE) * FLASH_ERASE_US);
+   }
+
+   void flashProgram(uint32_t offset, const uint8_t *data, size_t count)
+   {
+      assert(((offset % FLASH_PAGE_SIZE) == 0) && ((count % FLASH_PAGE_SIZE) == 0));
+      assert((offset + count) <= PICO_FLASH_SIZE_BYTES);
+
+      // Programming can only clear bits
+      std::vector<uint8_t> &memory = flash();
+
+      for (size_t i = 0; i < count; i++)
+      {
+         memory[offset + i] &= data[i];
+      }
+
+      s_current->flashPrograms += count / FLASH_PAGE_SIZE;
+      sleepUs((count / FLASH_PAGE_SIZE) * FLASH_PROGRAM_US);
+   }
+
+   //
+   /// Bus
+   //
+
+   void Bus::attach(Node &node)
+   {
+      if (std::find(m_nodes.begin(), m_nodes.end(), &node) == m_nodes.end())
+      {
+         m_nodes.push_back(&node);
+      }
+   }
+
+   void Bus::detach(Node &node)
+   {
+      m_nodes.erase(std::remove(m_nodes.begin(), m_nodes.end(), &node), m_nodes.end());
+
+      if (m_busy && (m_sender == &node))
+      {
+         // Transmission is aborted
+         m_busy = false;
+         m_sender = nullptr;
+      }
+   }
+
+   void Bus::inject(const CANFrame &frame)
+   {
+      m_foreign.push_back({frame, s_now});
+   }
+
+   bool Bus::startNext()
+   {
+      // Arbitration - lowest identifier wins, foreign traffic competes as one more node
+      Node *winner = nullptr;
+      const TxEntry *best = m_foreign.empty() ? nullptr : &m_foreign.front();
+
+      for (Node *node : m_nodes)
+      {
+         if (!node->tx.empty() && (!best || (node->tx.front().frame.id < best->frame.id)))
+         {
+            best = &node->tx.front();
+            winner = node;
+         }
+      }
+
+      if (!best)
+      {
+         return false;
+      }
+
+      m_busy = true;
+      m_sender = winner;
+      m_frame = *best;
+      m_time = std::max(m_time, m_frame.queuedAt);
+      m_end = m_time + (frameBits(m_frame.frame) * 1000000ull) / CAN_BITRATE;
+
+      return true;
+   }
+
+   void Bus::deliver()
+   {
+      m_busyTime += m_end - m_time;
+      m_time = m_end;
+      m_busy = false;
+      m_frames++;
+
+      // Free the transmit slot, the TX complete interrupt lets held frames go.  The queue
+      // may have been cleared while the frame was on the bus, the frame is still delivered
+      if (m_sender)
+      {
+         if (!m_sender->tx.empty())
+         {
+            m_sender->tx.pop_front();
+         }
+
+         m_sender->txFrames++;
+         m_sender->canIrq = true;
+      }
+      else
+      {
+         m_foreign.pop_front();
+      }
+
+      const bool lost = lose && lose(m_sender, m_frame.frame);
+      m_lost += lost;
+
+      for (Node *node : m_nodes)
+      {
+         if ((node == m_sender) || !node->canStarted || lost)
+         {
+            continue;
+         }
+
+         if (node->rx.size() < node->rxCapacity)
+         {
+            node->rx.push_back(m_frame.frame);
+            node->rxFrames++;
+            node->canIrq = true;
+         }
+         else
+         {
+            node->rxOverflows++;
+         }
+      }
+
+      if (observer)
+      {
+         observer(m_time, m_sender, m_frame);
+      }
+
+      m_sender = nullptr;
+   }
+
+   void Bus::advanceTo(uint64_t t)
+   {
+      while (true)
+      {
+         if (!m_busy && !startNext())
+         {
+            // Bus idle
+            m_time = std::max(m_time, t);
+            return;
+         }
+
+         if (m_end > t)
+         {
+            return;
+         }
+
+         deliver();
+      }
+   }
+}
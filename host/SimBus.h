@@ -0,0 +1,212 @@
+//
+/// CANBlock host simulator - virtual clock, simulated GPIO and CAN bus
+///
+/// Every simulated module is a Node with its own GPIO bank and CAN controller
+/// queues.  The harness makes a node "current" while it runs that node's code,
+/// the Pico SDK and CBUS library stand-ins route their accesses to it.
+///
+/// Time is virtual and only moves when the harness advances it, so runs are
+/// deterministic and bus timing is modelled at the CAN bit rate.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "CBUS.h"
+
+namespace sim
+{
+   constexpr uint32_t CAN_BITRATE = 125000;   ///< CBUS bit rate
+   constexpr uint32_t NUM_GPIO = 30;          ///< GPIO pins per node
+   constexpr uint32_t FLASH_ERASE_US = 45000; ///< Typical sector erase time of the Pico's flash (us)
+   constexpr uint32_t FLASH_PROGRAM_US = 400; ///< Typical page program time of the Pico's flash (us)
+
+   /// Virtual time since simulated power on (us)
+   uint64_t now();
+
+   /// Advance virtual time
+   void advance(uint64_t us);
+
+   /// Restart virtual time from zero
+   void resetClock();
+
+   /// Number of bits a frame occupies on the wire, including interframe space
+   uint32_t frameBits(const CANFrame &frame);
+
+   /// Frame waiting in a CAN controller transmit queue
+   struct TxEntry
+   {
+      CANFrame frame;    ///< Encoded frame
+      uint64_t queuedAt; ///< Virtual time the frame was queued (us)
+   };
+
+   /// MCP23017 port expander on a node's I2C bus, the registers the module uses
+   struct Expander
+   {
+      uint16_t iodir{0xFFFF}; ///< Pins that are inputs
+      uint16_t gppu{0};       ///< Input pull ups
+      uint16_t gpinten{0};    ///< Inputs interrupting on change
+      uint16_t olat{0};       ///< Output latches
+      uint16_t driven{0};     ///< Pins driven by the outside world
+      uint16_t level{0};      ///< Level of externally driven pins
+      uint16_t captured{0};   ///< Levels at the last read, changes from them interrupt
+
+      /// Levels on the pins
+      uint16_t pins() const;
+
+      /// INTA is pulled low
+      bool interrupt() const { return ((pins() ^ captured) & gpinten & iodir) != 0; }
+   };
+
+   /// A simulated module
+   class Node
+   {
+   public:
+      explicit Node(uint8_t id);
+      ~Node();
+
+      /// Restore the power on state of GPIO and CAN controller
+      void powerOn();
+
+      // GPIO
+      uint32_t read() const;
+      void setInput(uint8_t pin, bool level);
+      void releaseInput(uint8_t pin);
+      bool output(uint8_t pin) const { return (m_out >> pin) & 1u; }
+
+      /// Raise the GPIO interrupt for pins whose level changed
+      void inputChanged(uint32_t before);
+
+      // I2C port expanders
+      void setExpanderInput(uint8_t device, uint8_t bit, bool level);
+      bool expanderOutput(uint8_t device, uint8_t bit) const { return (expanders[device].pins() >> bit) & 1u; }
+
+      /// Drive the GPIO wired to the expanders' open drain INTA outputs
+      void expanderInterrupt();
+
+      uint8_t id;             ///< Node index on the simulated bus
+      uint32_t m_out{0};      ///< Output register
+      uint32_t m_oe{0};       ///< Output enable register
+      uint32_t m_pullUp{0};   ///< Pull up enables
+      uint32_t m_pullDown{0}; ///< Pull down enables
+      uint32_t m_driven{0};   ///< Pins driven by the outside world
+      uint32_t m_level{0};    ///< Level of externally driven pins
+      uint32_t m_irqFall{0};  ///< Falling edge interrupt enables
+      uint32_t m_irqRise{0};  ///< Rising edge interrupt enables
+      void (*m_irqCallback)(unsigned int, uint32_t){nullptr}; ///< GPIO interrupt handler
+
+      // Core 0 wait for event
+      bool event{false};  ///< Event register, set by interrupts and by core 1
+      bool canIrq{false}; ///< CAN controller interrupt raised by a received or sent frame
+      uint64_t wakeAt{0}; ///< Timeout of the wait core 0 is in (us)
+
+      // CAN controller
+      bool canStarted{false};
+      size_t rxCapacity{4};
+      size_t txCapacity{2};
+      std::deque<CANFrame> rx;
+      std::deque<TxEntry> tx;
+
+      // Core 1, started by multicore_launch_core1()
+      std::function<void()> core1Launch; ///< Set by the harness
+
+      // PIO state machines and DMA, run by the harness every step
+      std::vector<std::function<void()>> peripherals;
+
+      // I2C port expanders, at addresses 0x20 on
+      Expander expanders[8];
+      uint8_t expanderInt{0xFF}; ///< GPIO wired to INTA, set when the module starts the expanders
+
+      // Bell and buzzer tone slice, the compare word last written: buzzer in the low half, bell in the high
+      uint32_t toneLevels{0};
+      std::vector<uint64_t> bellStrokes; ///< Times the bell was struck, kept across power cycles (us)
+      uint64_t buzzUs{0};                ///< Time the buzzer has sounded (us)
+
+      // USB CDC port, a pseudo-terminal kept across power cycles as a PC keeps its port open
+      int usbFd{-1};           ///< Module's side of the pseudo-terminal, opened by the module
+      std::string usbPath;     ///< Device the PC opens
+      bool usbHost{false};     ///< The PC has the port open (DTR), set by the harness
+      bool usbReadable{false}; ///< The PC has sent text the module has not read
+
+      // Flash, erased until first used, kept across power cycles
+      std::vector<uint8_t> flash;
+
+      // statistics
+      uint32_t rxFrames{0};      ///< Frames delivered into the RX queue
+      uint32_t rxOverflows{0};   ///< Frames lost because the RX queue was full
+      uint32_t txFrames{0};      ///< Frames sent on the bus
+      uint32_t txFull{0};        ///< Transmit attempts rejected with a full TX queue
+      uint32_t flashErases{0};   ///< Flash sectors erased
+      uint32_t flashPrograms{0}; ///< Flash pages programmed
+   };
+
+   /// Send an event to the current node's core 0
+   void sendEvent();
+
+   /// Start the current node's core 1, see multicore_launch_core1()
+   void launchCore1();
+
+   /// Current node's core 0 waits for an event or the timeout (us), see SimHarness::step()
+   bool waitForEvent(uint64_t timeout);
+
+   /// Node whose code is currently executing
+   Node *current();
+   void setCurrent(Node *node);
+
+   /// Called when a frame completes on the bus
+   /// sender is nullptr for frames injected by the harness
+   using FrameObserver = std::function<void(uint64_t time, const Node *sender, const TxEntry &entry)>;
+
+   /// CAN bus shared by all attached nodes
+   class Bus
+   {
+   public:
+      void attach(Node &node);
+      void detach(Node &node);
+
+      /// Queue a frame from a foreign (non simulated) module
+      void inject(const CANFrame &frame);
+      size_t injectPending() const { return m_foreign.size(); }
+
+      /// Run the bus up to virtual time t, delivering completed frames
+      void advanceTo(uint64_t t);
+
+      /// Time the bus has spent transmitting (us)
+      uint64_t busyTime() const { return m_busyTime; }
+
+      /// Frames transmitted on the bus
+      uint32_t frames() const { return m_frames; }
+
+      FrameObserver observer;
+
+      /// Frames every receiver misses, as on a noisy bus, true to lose the frame
+      std::function<bool(const Node *sender, const CANFrame &frame)> lose;
+
+      /// Frames lost by lose()
+      uint32_t lost() const { return m_lost; }
+
+   private:
+      bool startNext();
+      void deliver();
+
+      std::vector<Node *> m_nodes;
+      std::deque<TxEntry> m_foreign;
+      bool m_busy{false};
+      Node *m_sender{nullptr};
+      TxEntry m_frame{};
+      uint64_t m_time{0};
+      uint64_t m_end{0};
+      uint64_t m_busyTime{0};
+      uint32_t m_frames{0};
+      uint32_t m_lost{0};
+   };
+
+   /// The bus the simulated CAN controllers attach to
+   Bus &bus();
+}
@@ -0,0 +1,828 @@
+//
+/// CANBlock host simulator - CBUS library stand-ins
+///
+/// Behaviour follows the CBUS library closely enough to run the module code:
+/// learned event lookup and dispatch, learn / unlearn, node variables, the
+/// module UI objects and the CAN2040 transport over the simulated bus.
+//
+
+#include "CBUSACAN2040.h"
+#include "CBUSConfig.h"
+#include "CBUSLED.h"
+#include "CBUSParams.h"
+#include "CBUSSwitch.h"
+#include "CBUSUtil.h"
+#include "cbusdefs.h"
+
+#include "SimBus.h"
+
+#include <hardware/gpio.h>
+#include <pico/time.h>
+
+#include <cstring>
+
+namespace
+{
+   uint32_t millis()
+   {
+      return static_cast<uint32_t>(sim::now() / 1000);
+   }
+
+   constexpr uint32_t EE_FLIM = 0;  ///< EEPROM offset of the FLiM flag
+   constexpr uint32_t EE_CANID = 1; ///< EEPROM offset of the CAN ID
+   constexpr uint32_t EE_NN = 2;    ///< EEPROM offset of the node number (2 bytes)
+   constexpr uint32_t EE_RESET = 5; ///< EEPROM offset of the reset flag
+}
+
+//
+/// CBUSLED
+//
+
+CBUSLED::CBUSLED()
+    : m_node(nullptr), m_pin(0), m_active(true), m_state(false), m_blink(false), m_pulse(false), m_lastTime(0), m_pulseStart(0)
+{
+}
+
+void CBUSLED::setPin(uint8_t pin, bool active)
+{
+   m_node = sim::current();
+   m_pin = pin;
+   m_active = active;
+
+   sim::gpioSetDir(1u << pin, 1u << pin);
+   write(false);
+}
+
+bool CBUSLED::getState()
+{
+   return m_state;
+}
+
+void CBUSLED::on()
+{
+   m_state = true;
+   m_blink = false;
+}
+
+void CBUSLED::off()
+{
+   m_state = false;
+   m_blink = false;
+}
+
+void CBUSLED::toggle()
+{
+   m_state = !m_state;
+}
+
+void CBUSLED::blink()
+{
+   m_blink = true;
+}
+
+void CBUSLED::pulse(bool shortPulse)
+{
+   m_pulse = true;
+   m_state = true;
+   m_pulseStart = millis();
+}
+
+void CBUSLED::run()
+{
+   if (m_blink && ((millis() - m_lastTime) >= BLINK_RATE))
+   {
+      m_state = !m_state;
+      m_lastTime = millis();
+   }
+
+   if (m_pulse && ((millis() - m_pulseStart) >= PULSE_ON_TIME))
+   {
+      m_pulse = false;
+      m_state = false;
+   }
+
+   write(m_state);
+}
+
+void CBUSLED::write(bool level)
+{
+   if (!m_node)
+   {
+      return;
+   }
+
+   const uint32_t bit = 1u << m_pin;
+   const bool pinLevel = m_active ? level : !level;
+   m_node->m_out = pinLevel ? (m_node->m_out | bit) : (m_node->m_out & ~bit);
+}
+
+//
+/// CBUSSwitch
+//
+
+CBUSSwitch::CBUSSwitch()
+    : m_node(nullptr), m_pin(0), m_pressedState(false), m_currentState(true), m_lastState(true), m_state(true), m_stateChanged(false),
+      m_lastStateChangeTime(0), m_lastStateDuration(0), m_prevReleaseTime(0), m_prevStateDuration(0)
+{
+}
+
+void CBUSSwitch::setPin(uint8_t pin, bool pressedState)
+{
+   m_node = sim::current();
+   m_pin = pin;
+   m_pressedState = pressedState;
+
+   sim::gpioSetDir(1u << pin, 0);
+   sim::gpioSetPulls(pin, !pressedState, pressedState);
+
+   reset();
+   m_state = readPin();
+   m_currentState = m_state;
+   m_lastState = m_state;
+}
+
+void CBUSSwitch::reset()
+{
+   m_lastState = !m_pressedState;
+   m_state = !m_pressedState;
+   m_stateChanged = false;
+   m_lastStateChangeTime = 0;
+   m_lastStateDuration = 0;
+   m_prevReleaseTime = 0;
+   m_prevStateDuration = 0;
+}
+
+bool CBUSSwitch::readPin()
+{
+   return m_node ? ((m_node->read() >> m_pin) & 1u) : !m_pressedState;
+}
+
+void CBUSSwitch::run()
+{
+   m_currentState = readPin();
+   m_stateChanged = false;
+
+   if (m_currentState != m_lastState)
+   {
+      // Input moved, restart the debounce period
+      m_lastStateChangeTime = millis();
+      m_lastState = m_currentState;
+   }
+   else if ((m_currentState != m_state) && ((millis() - m_lastStateChangeTime) >= DEBOUNCE_DELAY))
+   {
+      // Input stable for the debounce period
+      m_lastStateDuration = millis() - m_prevStateDuration;
+      m_prevStateDuration = millis();
+      m_state = m_currentState;
+      m_stateChanged = true;
+   }
+}
+
+bool CBUSSwitch::stateChanged()
+{
+   return m_stateChanged;
+}
+
+bool CBUSSwitch::getState()
+{
+   return m_state;
+}
+
+bool CBUSSwitch::isPressed()
+{
+   return m_state == m_pressedState;
+}
+
+uint32_t CBUSSwitch::getCurrentStateDuration()
+{
+   return millis() - m_prevStateDuration;
+}
+
+uint32_t CBUSSwitch::getLastStateDuration()
+{
+   return m_lastStateDuration;
+}
+
+uint32_t CBUSSwitch::getLastStateChangeTime()
+{
+   return m_lastStateChangeTime;
+}
+
+void CBUSSwitch::resetCurrentDuration()
+{
+   m_prevStateDuration = millis();
+}
+
+//
+/// CBUSConfig
+//
+
+CBUSConfig::CBUSConfig()
+{
+   memset(m_eeprom, 0xFF, sizeof(m_eeprom));
+}
+
+void CBUSConfig::setEEPROMtype(EEPROM_TYPE type)
+{
+   m_type = type;
+}
+
+void CBUSConfig::begin()
+{
+   // Fresh (erased) store, initialise to SLiM defaults
+   if (m_eeprom[EE_FLIM] == 0xFF)
+   {
+      resetModule();
+   }
+
+   m_FLiM = m_eeprom[EE_FLIM];
+   m_CANID = m_eeprom[EE_CANID];
+   m_nodeNum = (m_eeprom[EE_NN] << 8) | m_eeprom[EE_NN + 1];
+}
+
+uint8_t CBUSConfig::findExistingEvent(uint16_t nn, uint16_t en)
+{
+   for (uint8_t i = 0; i < EE_MAX_EVENTS; i++)
+   {
+      uint8_t ev[4];
+      readEvent(i, ev);
+
+      if ((ev[0] == highByte(nn)) && (ev[1] == lowByte(nn)) && (ev[2] == highByte(en)) && (ev[3] == lowByte(en)))
+      {
+         return i;
+      }
+   }
+
+   return EE_MAX_EVENTS;
+}
+
+uint8_t CBUSConfig::findEventSpace()
+{
+   for (uint8_t i = 0; i < EE_MAX_EVENTS; i++)
+   {
+      if (readEEPROM(EE_EVENTS_START + (i * EE_BYTES_PER_EVENT)) == 0xFF)
+      {
+         return i;
+      }
+   }
+
+   return EE_MAX_EVENTS;
+}
+
+uint8_t CBUSConfig::getEventEVval(uint8_t idx, uint8_t evnum)
+{
+   return readEEPROM(EE_EVENTS_START + (idx * EE_BYTES_PER_EVENT) + 3 + evnum);
+}
+
+void CBUSConfig::writeEventEV(uint8_t idx, uint8_t evnum, uint8_t evval)
+{
+   writeEEPROM(EE_EVENTS_START + (idx * EE_BYTES_PER_EVENT) + 3 + evnum, evval);
+}
+
+void CBUSConfig::readEvent(uint8_t idx, uint8_t tarr[])
+{
+   readBytesEEPROM(EE_EVENTS_START + (idx * EE_BYTES_PER_EVENT), 4, tarr);
+}
+
+void CBUSConfig::writeEvent(uint8_t index, const uint8_t data[])
+{
+   writeBytesEEPROM(EE_EVENTS_START + (index * EE_BYTES_PER_EVENT), data, 4);
+}
+
+void CBUSConfig::cleareventEEPROM(uint8_t index)
+{
+   const uint8_t unused[4]{0xFF, 0xFF, 0xFF, 0xFF};
+   writeEvent(index, unused);
+}
+
+void CBUSConfig::clearEventsEEPROM()
+{
+   for (uint8_t i = 0; i < EE_MAX_EVENTS; i++)
+   {
+      memset(&m_eeprom[EE_EVENTS_START + (i * EE_BYTES_PER_EVENT)], 0xFF, EE_BYTES_PER_EVENT);
+   }
+
+   commit();
+}
+
+uint8_t CBUSConfig::numEventsUsed()
+{
+   uint8_t used = 0;
+
+   for (uint8_t i = 0; i < EE_MAX_EVENTS; i++)
+   {
+      if (readEEPROM(EE_EVENTS_START + (i * EE_BYTES_PER_EVENT)) != 0xFF)
+      {
+         used++;
+      }
+   }
+
+   return used;
+}
+
+uint8_t CBUSConfig::getNV(uint8_t idx)
+{
+   return readEEPROM(EE_NVS_START + (idx - 1));
+}
+
+bool CBUSConfig::setNV(uint8_t idx, uint8_t val)
+{
+   if ((idx == 0) || (idx > EE_NUM_NVS))
+   {
+      return false;
+   }
+
+   writeEEPROM(EE_NVS_START + (idx - 1), val);
+   return true;
+}
+
+uint8_t CBUSConfig::readEEPROM(uint32_t eeaddress)
+{
+   readCount++;
+   return (eeaddress < EEPROM_SIZE) ? m_eeprom[eeaddress] : 0xFF;
+}
+
+uint8_t CBUSConfig::readBytesEEPROM(uint32_t eeaddress, uint8_t nbytes, uint8_t dest[])
+{
+   for (uint8_t i = 0; i < nbytes; i++)
+   {
+      dest[i] = readEEPROM(eeaddress + i);
+   }
+
+   return nbytes;
+}
+
+void CBUSConfig::writeEEPROM(uint32_t eeaddress, uint8_t data)
+{
+   if (eeaddress < EEPROM_SIZE)
+   {
+      m_eeprom[eeaddress] = data;
+      commit();
+   }
+}
+
+void CBUSConfig::writeBytesEEPROM(uint32_t eeaddress, const uint8_t src[], uint8_t numbytes)
+{
+   if ((eeaddress + numbytes) <= EEPROM_SIZE)
+   {
+      memcpy(&m_eeprom[eeaddress], src, numbytes);
+      commit();
+   }
+}
+
+void CBUSConfig::commit()
+{
+   // With flash emulation every write is a sector erase and program, which stalls the node
+   writeCount++;
+
+   if (m_type == EEPROM_TYPE::EEPROM_USES_FLASH)
+   {
+      sim::sleepUs(sim::FLASH_ERASE_US + (EEPROM_SIZE / 256) * sim::FLASH_PROGRAM_US);
+   }
+}
+
+void CBUSConfig::resetModule(CBUSLED &green, CBUSLED &yellow, CBUSSwitch &sw)
+{
+   resetModule();
+}
+
+void CBUSConfig::resetModule()
+{
+   memset(m_eeprom, 0xFF, sizeof(m_eeprom));
+   m_eeprom[EE_FLIM] = 0;
+   m_eeprom[EE_CANID] = 0;
+   m_eeprom[EE_NN] = 0;
+   m_eeprom[EE_NN + 1] = 0;
+   m_eeprom[EE_RESET] = 0x99;
+
+   for (uint8_t i = 0; i < EE_NUM_NVS; i++)
+   {
+      m_eeprom[EE_NVS_START + i] = 0;
+   }
+
+   commit();
+}
+
+void CBUSConfig::setFLiM(bool f)
+{
+   m_FLiM = f;
+   writeEEPROM(EE_FLIM, f);
+}
+
+void CBUSConfig::setCANID(uint8_t canid)
+{
+   m_CANID = canid;
+   writeEEPROM(EE_CANID, canid);
+}
+
+void CBUSConfig::setNodeNum(uint16_t nn)
+{
+   m_nodeNum = nn;
+   m_eeprom[EE_NN] = highByte(nn);
+   m_eeprom[EE_NN + 1] = lowByte(nn);
+   commit();
+}
+
+void CBUSConfig::setResetFlag()
+{
+   writeEEPROM(EE_RESET, 0x99);
+}
+
+void CBUSConfig::clearResetFlag()
+{
+   writeEEPROM(EE_RESET, 0);
+}
+
+bool CBUSConfig::isResetFlagSet()
+{
+   return readEEPROM(EE_RESET) == 0x99;
+}
+
+//
+/// CBUSParams
+//
+
+uint8_t CBUSParams::m_params[21];
+
+CBUSParams::CBUSParams(CBUSConfig &config)
+{
+   m_params[0] = 20;
+   m_params[1] = 0xA5; // MERG manufacturer ID
+   m_params[4] = config.EE_MAX_EVENTS;
+   m_params[5] = config.EE_NUM_EVS;
+   m_params[6] = config.EE_NUM_NVS;
+}
+
+void CBUSParams::setVersion(uint8_t major, char minor, uint8_t beta)
+{
+   m_params[7] = major;
+   m_params[2] = minor;
+   m_params[20] = beta;
+}
+
+void CBUSParams::setModuleId(uint8_t id)
+{
+   m_params[3] = id;
+}
+
+void CBUSParams::setFlags(uint8_t flags)
+{
+   m_params[8] = flags;
+}
+
+uint8_t *CBUSParams::getParams()
+{
+   return m_params;
+}
+
+//
+/// CBUSbase
+//
+
+CBUSbase::CBUSbase(CBUSConfig &config) : m_config(config)
+{
+}
+
+void CBUSbase::setParams(uint8_t *mparams)
+{
+   m_mparams = mparams;
+}
+
+void CBUSbase::setName(module_name_t *mname)
+{
+   m_mname = mname;
+}
+
+void CBUSbase::setEventHandlerCB(eventCallback_t fptr)
+{
+   m_eventHandler = fptr;
+}
+
+void CBUSbase::setFrameHandlerCB(frameCallback_t fptr, uint8_t *opcodes, uint8_t num_opcodes)
+{
+   m_frameHandler = fptr;
+   m_opcodes = opcodes;
+   m_numOpcodes = num_opcodes;
+}
+
+void CBUSbase::indicateFLiMMode(bool bFLiM)
+{
+   if (bFLiM)
+   {
+      m_ledGrn.off();
+      m_ledYlw.on();
+   }
+   else
+   {
+      m_ledGrn.on();
+      m_ledYlw.off();
+   }
+}
+
+void CBUSbase::makeHeader(CANFrame &msg, uint8_t priority)
+{
+   msg.id = (static_cast<uint32_t>(priority) << 7) | (m_config.getCANID() & 0x7F);
+}
+
+bool CBUSbase::sendMyEvent(uint8_t eventNum, bool onOff)
+{
+   CANFrame msg{};
+   msg.len = 5;
+   msg.data[0] = onOff ? OPC_ACON : OPC_ACOF;
+   msg.data[1] = highByte(m_config.getNodeNum());
+   msg.data[2] = lowByte(m_config.getNodeNum());
+   msg.data[3] = 0;
+   msg.data[4] = eventNum;
+
+   return sendMessage(msg);
+}
+
+bool CBUSbase::sendWRACK()
+{
+   CANFrame msg{};
+   msg.len = 3;
+   msg.data[0] = OPC_WRACK;
+   msg.data[1] = highByte(m_config.getNodeNum());
+   msg.data[2] = lowByte(m_config.getNodeNum());
+
+   return sendMessage(msg);
+}
+
+bool CBUSbase::sendCMDERR(uint8_t cerrno)
+{
+   CANFrame msg{};
+   msg.len = 4;
+   msg.data[0] = OPC_CMDERR;
+   msg.data[1] = highByte(m_config.getNodeNum());
+   msg.data[2] = lowByte(m_config.getNodeNum());
+   msg.data[3] = cerrno;
+
+   return sendMessage(msg);
+}
+
+void CBUSbase::processAccessoryEvent(const CANFrame &msg, uint16_t nn, uint16_t en)
+{
+   const uint8_t index = m_config.findExistingEvent(nn, en);
+
+   if ((index < m_config.EE_MAX_EVENTS) && m_eventHandler)
+   {
+      (*m_eventHandler)(index, msg);
+   }
+}
+
+void CBUSbase::process(uint8_t num_messages)
+{
+   // UI objects
+   m_sw.run();
+   m_ledGrn.run();
+   m_ledYlw.run();
+
+   for (uint8_t mcount = 0; (mcount < num_messages) && available(); mcount++)
+   {
+      CANFrame msg = getNextMessage();
+      m_numMsgsRcvd++;
+
+      if (msg.rtr || (msg.len == 0))
+      {
+         continue;
+      }
+
+      const uint8_t opc = msg.data[0];
+      const uint16_t nn = (msg.data[1] << 8) | msg.data[2];
+      const uint16_t en = (msg.data[3] << 8) | msg.data[4];
+      const bool forUs = nn == m_config.getNodeNum();
+
+      // User frame handler sees the frame first
+      if (m_frameHandler)
+      {
+         bool match = m_numOpcodes == 0;
+
+         for (uint8_t i = 0; !match && (i < m_numOpcodes); i++)
+         {
+            match = m_opcodes[i] == opc;
+         }
+
+         if (match)
+         {
+            (*m_frameHandler)(msg);
+         }
+      }
+
+      switch (opc)
+      {
+      case OPC_ACON:
+      case OPC_ACOF:
+      case OPC_ACON1:
+      case OPC_ACOF1:
+      case OPC_ACON2:
+      case OPC_ACOF2:
+      case OPC_ACON3:
+      case OPC_ACOF3:
+         processAccessoryEvent(msg, nn, en);
+         break;
+
+      case OPC_ASON:
+      case OPC_ASOF:
+      case OPC_ASON1:
+      case OPC_ASOF1:
+      case OPC_ASON2:
+      case OPC_ASOF2:
+      case OPC_ASON3:
+      case OPC_ASOF3:
+         // Short events match on device number only
+         processAccessoryEvent(msg, 0, en);
+         break;
+
+      case OPC_NNLRN:
+         if (forUs)
+         {
+            m_bLearn = true;
+         }
+         break;
+
+      case OPC_NNULN:
+         if (forUs)
+         {
+            m_bLearn = false;
+         }
+         break;
+
+      case OPC_NNCLR:
+         if (forUs && m_bLearn)
+         {
+            m_config.clearEventsEEPROM();
+            sendWRACK();
+         }
+         break;
+
+      case OPC_EVLRN:
+         if (m_bLearn)
+         {
+            uint8_t index = m_config.findExistingEvent(nn, en);
+
+            if (index >= m_config.EE_MAX_EVENTS)
+            {
+               index = m_config.findEventSpace();
+            }
+
+            if (index < m_config.EE_MAX_EVENTS)
+            {
+               m_config.writeEvent(index, &msg.data[1]);
+
+               if (msg.data[5] > 0)
+               {
+                  m_config.writeEventEV(index, msg.data[5], msg.data[6]);
+               }
+
+               sendWRACK();
+            }
+            else
+            {
+               sendCMDERR(CMDERR_TOO_MANY_EVENTS);
+            }
+         }
+         break;
+
+      case OPC_EVULN:
+         if (m_bLearn)
+         {
+            const uint8_t index = m_config.findExistingEvent(nn, en);
+
+            if (index < m_config.EE_MAX_EVENTS)
+            {
+               m_config.cleareventEEPROM(index);
+               sendWRACK();
+            }
+            else
+            {
+               sendCMDERR(CMDERR_INVALID_EVENT);
+            }
+         }
+         break;
+
+      case OPC_NVSET:
+         if (forUs)
+         {
+            if (m_config.setNV(msg.data[3], msg.data[4]))
+            {
+               sendWRACK();
+            }
+            else
+            {
+               sendCMDERR(CMDERR_INV_NV_IDX);
+            }
+         }
+         break;
+
+      case OPC_NVRD:
+         if (forUs && (msg.data[3] > 0) && (msg.data[3] <= m_config.EE_NUM_NVS))
+         {
+            CANFrame reply{};
+            reply.len = 5;
+            reply.data[0] = OPC_NVANS;
+            reply.data[1] = msg.data[1];
+            reply.data[2] = msg.data[2];
+            reply.data[3] = msg.data[3];
+            reply.data[4] = m_config.getNV(msg.data[3]);
+            sendMessage(reply);
+         }
+         break;
+
+      case OPC_QNN:
+         if (m_mparams)
+         {
+            CANFrame reply{};
+            reply.len = 6;
+            reply.data[0] = OPC_PNN;
+            reply.data[1] = highByte(m_config.getNodeNum());
+            reply.data[2] = lowByte(m_config.getNodeNum());
+            reply.data[3] = m_mparams[1];
+            reply.data[4] = m_mparams[3];
+            reply.data[5] = m_mparams[8];
+            sendMessage(reply);
+         }
+         break;
+
+      default:
+         break;
+      }
+   }
+}
+
+//
+/// CBUSACAN2040
+//
+
+CBUSACAN2040::CBUSACAN2040(CBUSConfig &config) : CBUSbase(config)
+{
+}
+
+void CBUSACAN2040::setNumBuffers(uint8_t num_rx_buffers, uint8_t num_tx_buffers)
+{
+   m_numRxBuffers = num_rx_buffers;
+   m_numTxBuffers = num_tx_buffers;
+}
+
+void CBUSACAN2040::setPins(uint8_t tx_pin, uint8_t rx_pin)
+{
+}
+
+bool CBUSACAN2040::begin()
+{
+   m_node = sim::current();
+
+   if (!m_node)
+   {
+      return false;
+   }
+
+   m_node->rxCapacity = m_numRxBuffers;
+   m_node->txCapacity = m_numTxBuffers;
+   m_node->canStarted = true;
+   sim::bus().attach(*m_node);
+
+   return true;
+}
+
+bool CBUSACAN2040::available()
+{
+   return m_node && !m_node->rx.empty();
+}
+
+CANFrame CBUSACAN2040::getNextMessage()
+{
+   CANFrame msg = m_node->rx.front();
+   m_node->rx.pop_front();
+   return msg;
+}
+
+bool CBUSACAN2040::sendMessage(CANFrame &msg, bool rtr, bool ext, uint8_t priority)
+{
+   if (!m_node || !m_node->canStarted)
+   {
+      return false;
+   }
+
+   if (m_node->tx.size() >= m_node->txCapacity)
+   {
+      m_node->txFull++;
+      return false;
+   }
+
+   makeHeader(msg, priority);
+   msg.rtr = rtr;
+   msg.ext = ext;
+   m_node->tx.push_back({msg, sim::now()});
+   m_numMsgsSent++;
+
+   return true;
+}
+
+void CBUSACAN2040::reset()
+{
+   if (m_node)
+   {
+      m_node->rx.clear();
+      m_node->tx.clear();
+   }
+}
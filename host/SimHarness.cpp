@@ -0,0 +1,255 @@
+//
+/// CANBlock host simulator - harness running several CANBlock nodes on one bus
+//
+
+#include "SimHarness.h"
+#include "PinMask.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+void SimLoopStats::add(uint64_t ns)
+{
+   count++;
+   totalNs += ns;
+   minNs = std::min(minNs, ns);
+   maxNs = std::max(maxNs, ns);
+}
+
+SimHarness::SimHarness(size_t numNodes, uint32_t loopQuantumUs) : m_quantum(loopQuantumUs)
+{
+   assert(numNodes <= SIM_MAX_NODES);
+
+   sim::resetClock();
+   sim::bus() = sim::Bus{};
+
+   for (size_t i = 0; i < numNodes; i++)
+   {
+      m_nodes.push_back(new sim::Node(static_cast<uint8_t>(i)));
+   }
+
+   m_core0Busy.resize(numNodes, 0);
+}
+
+SimHarness::~SimHarness()
+{
+   for (sim::Node *node : m_nodes)
+   {
+      sim::bus().detach(*node);
+      delete node;
+   }
+
+   sim::setCurrent(nullptr);
+}
+
+void SimHarness::boot()
+{
+   for (size_t i = 0; i < m_nodes.size(); i++)
+   {
+      reset(i);
+
+      // Assign node number and CAN ID, as FLiM setup with an FCU would
+      with(i, [&]()
+           {
+              CBUSConfig &config = *ops(i).config;
+              config.setFLiM(true);
+              config.setNodeNum(nodeNumber(i));
+              config.setCANID(static_cast<uint8_t>(i + 1)); });
+   }
+}
+
+void SimHarness::reset(size_t index)
+{
+   sim::Node &n = node(index);
+
+   sim::bus().detach(n);
+   n.powerOn();
+   ops(index).powerOn();
+   ops(index).cbus->setDualCore(dualCore);
+   m_core0Busy[index] = 0;
+
+   // setup() launches core 1 as soon as the CAN controller is configured
+   n.core1Launch = [this, index]()
+   {
+      ops(index).cbus->beginCore1();
+   };
+
+   with(index, [&]()
+        { ops(index).setup(); });
+}
+
+void SimHarness::teach(size_t index, uint16_t nn, uint16_t en, uint8_t ev)
+{
+   with(index, [&]()
+        {
+           CBUSConfig &config = *ops(index).config;
+           uint8_t slot = config.findExistingEvent(nn, en);
+
+           if (slot >= config.EE_MAX_EVENTS)
+           {
+              slot = config.findEventSpace();
+           }
+
+           assert(slot < config.EE_MAX_EVENTS);
+
+           const uint8_t event[4]{static_cast<uint8_t>(nn >> 8), static_cast<uint8_t>(nn),
+                                  static_cast<uint8_t>(en >> 8), static_cast<uint8_t>(en)};
+           config.writeEvent(slot, event);
+           config.writeEventEV(slot, 1, ev);
+           ops(index).cbus->rebuildEventIndex(); });
+}
+
+void SimHarness::pair(size_t local, size_t remote, uint8_t section)
+{
+   auto en = [section](OutEventID id)
+   { return static_cast<uint16_t>(sectionEventBase(section) + static_cast<uint8_t>(id)); };
+   auto ev = [section](InEventID id)
+   { return static_cast<uint8_t>(sectionEventBase(section) + static_cast<uint8_t>(id)); };
+
+   const uint16_t localNN = nodeNumber(local);
+   const uint16_t remoteNN = nodeNumber(remote);
+
+   // Requests from the local box
+   teach(remote, localNN, en(OutEventID::lineClear), ev(InEventID::lineClear));
+   teach(remote, localNN, en(OutEventID::trainOnTrack), ev(InEventID::trainOnTrack));
+   teach(remote, localNN, en(OutEventID::blockCleared), ev(InEventID::blockCleared));
+   teach(remote, localNN, en(OutEventID::attentionBell), ev(InEventID::attentionBell));
+   teach(remote, localNN, en(OutEventID::resetLineClear), ev(InEventID::resetLineClear));
+
+   // ACK / NACK from the box in advance
+   teach(local, remoteNN, en(OutEventID::lineClearBlocked), ev(InEventID::lineClearBlocked));
+   teach(local, remoteNN, en(OutEventID::lineClearAck), ev(InEventID::lineClearAck));
+   teach(local, remoteNN, en(OutEventID::trainOnTrackAck), ev(InEventID::trainOnTrackAck));
+   teach(local, remoteNN, en(OutEventID::blockClearedAck), ev(InEventID::blockClearedAck));
+}
+
+void SimHarness::step()
+{
+   if (onStep)
+   {
+      onStep();
+   }
+
+   for (size_t i = 0; i < m_nodes.size(); i++)
+   {
+      sim::setCurrent(m_nodes[i]);
+
+      if (dualCore)
+      {
+         ops(i).cbus->serviceCore1();
+      }
+
+      sim::Node &n = node(i);
+
+      // Peripherals run on whatever the cores are doing
+      for (const auto &peripheral : n.peripherals)
+      {
+         peripheral();
+      }
+
+      // The CAN interrupt is taken on core 0 unless core 1 owns the controller
+      const bool canIrq = n.canIrq && !dualCore;
+      n.canIrq = false;
+
+      if (canIrq)
+      {
+         n.event = true;
+      }
+
+      if (sim::now() < m_core0Busy[i])
+      {
+         continue;
+      }
+
+      // Core 0 sleeps in idle() until an event or its timeout
+      if (!n.event && (sim::now() < n.wakeAt))
+      {
+         continue;
+      }
+
+      n.event = false;
+
+      if (measureLoops)
+      {
+         const auto start = std::chrono::steady_clock::now();
+         ops(i).loop();
+         const auto end = std::chrono::steady_clock::now();
+         loopStats.add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+      }
+      else
+      {
+         ops(i).loop();
+      }
+
+      ops(i).scheduler->idle();
+   }
+
+   sim::setCurrent(nullptr);
+   sim::advance(m_quantum);
+   sim::bus().advanceTo(sim::now());
+}
+
+void SimHarness::runFor(uint64_t us)
+{
+   const uint64_t end = sim::now() + us;
+
+   while (sim::now() < end)
+   {
+      step();
+   }
+}
+
+bool SimHarness::runUntil(const std::function<bool()> &done, uint64_t timeoutUs)
+{
+   const uint64_t end = sim::now() + timeoutUs;
+
+   while (!done())
+   {
+      if (sim::now() >= end)
+      {
+         return false;
+      }
+
+      step();
+   }
+
+   return true;
+}
+
+void SimHarness::press(size_t index, uint8_t pin)
+{
+   if (pin >= EXPANDER_PIN_BASE)
+   {
+      const uint8_t bit = pin - EXPANDER_PIN_BASE;
+      node(index).setExpanderInput(bit / EXPANDER_PINS, bit % EXPANDER_PINS, false);
+      return;
+   }
+
+   node(index).setInput(pin, false);
+}
+
+void SimHarness::release(size_t index, uint8_t pin)
+{
+   if (pin >= EXPANDER_PIN_BASE)
+   {
+      const uint8_t bit = pin - EXPANDER_PIN_BASE;
+      node(index).setExpanderInput(bit / EXPANDER_PINS, bit % EXPANDER_PINS, true);
+      return;
+   }
+
+   node(index).setInput(pin, true);
+}
+
+void SimHarness::stallCore0(size_t index, uint64_t us)
+{
+   m_core0Busy[index] = sim::now() + us;
+}
+
+void SimHarness::with(size_t index, const std::function<void()> &fn)
+{
+   sim::Node *previous = sim::current();
+   sim::setCurrent(m_nodes[index]);
+   fn();
+   sim::setCurrent(previous);
+}
@@ -0,0 +1,85 @@
+//
+/// CANBlock host simulator - harness running several CANBlock nodes on one bus
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "SimBus.h"
+#include "SimNode.h"
+
+/// Host cost of module code, measured with the host clock
+struct SimLoopStats
+{
+   uint64_t count{0};       ///< Calls measured
+   uint64_t totalNs{0};     ///< Total host time (ns)
+   uint64_t minNs{UINT64_MAX}; ///< Fastest call (ns)
+   uint64_t maxNs{0};       ///< Slowest call (ns)
+
+   void add(uint64_t ns);
+   void clear() { *this = SimLoopStats{}; }
+   double avgNs() const { return count ? static_cast<double>(totalNs) / count : 0.0; }
+};
+
+class SimHarness
+{
+public:
+   /// @param numNodes number of CANBlock nodes on the bus (up to SIM_MAX_NODES)
+   /// @param loopQuantumUs virtual time one pass of loop() on every node takes, and the resolution of wakes
+   explicit SimHarness(size_t numNodes, uint32_t loopQuantumUs = 20);
+   ~SimHarness();
+
+   /// Power on all nodes, run setup() and assign node numbers and CAN ID's
+   void boot();
+
+   /// Power cycle one node, its configuration store is kept
+   void reset(size_t index);
+
+   /// Node number assigned to a node
+   static uint16_t nodeNumber(size_t index) { return static_cast<uint16_t>(256 + index); }
+
+   /// Teach an event with its single EV to a node, as an FCU would
+   void teach(size_t index, uint16_t nn, uint16_t en, uint8_t ev);
+
+   /// Teach the request / ACK events of a block section between a local box and the box in advance
+   void pair(size_t local, size_t remote, uint8_t section = 0);
+
+   /// Run one pass of loop() on every node that is awake, then advance virtual time by one quantum
+   /// A node's core 0 wakes on an interrupt, an event from core 1 or its idle() timeout
+   void step();
+
+   /// Run for a period of virtual time
+   void runFor(uint64_t us);
+
+   /// Run until a condition holds or a timeout (us) expires
+   bool runUntil(const std::function<bool()> &done, uint64_t timeoutUs);
+
+   /// Drive a switch input of a node, switches are active low
+   void press(size_t index, uint8_t pin);
+   void release(size_t index, uint8_t pin);
+
+   /// Keep a node's core 0 busy, as a long blocking operation would, core 1 keeps running
+   void stallCore0(size_t index, uint64_t us);
+
+   /// Call a function with a node current, e.g. to invoke module entry points directly
+   void with(size_t index, const std::function<void()> &fn);
+
+   size_t size() const { return m_nodes.size(); }
+   sim::Node &node(size_t index) { return *m_nodes[index]; }
+   const SimNodeOps &ops(size_t index) const { return simNodes[index]; }
+   sim::Bus &bus() { return sim::bus(); }
+
+   SimLoopStats loopStats; ///< Host cost of loop() over all nodes
+   bool measureLoops{true}; ///< Time every loop() call with the host clock
+   bool dualCore{false};    ///< Nodes service CAN on core 1, takes effect at reset
+   std::function<void()> onStep; ///< Called before every step, e.g. to generate traffic
+
+private:
+   std::vector<sim::Node *> m_nodes;
+   std::vector<uint64_t> m_core0Busy; ///< Time each node's core 0 is stalled until
+   uint32_t m_quantum;
+};
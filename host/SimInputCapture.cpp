@@ -0,0 +1,47 @@
+//
+/// CANBlock host simulator - input capture
+///
+/// Stands in for the PIO state machine and DMA channels of InputCapture.cpp.
+/// The harness runs the sampler of each node every step, whether or not the
+/// node's core 0 is busy, and it writes a sample of the node's GPIO into the
+/// ring for each sample time that has passed.
+//
+
+#include "InputCapture.h"
+
+#include "SimBus.h"
+
+bool InputCapture::begin(uint32_t sampleUs)
+{
+   sim::Node *node = sim::current();
+
+   if (!node || !sampleUs)
+   {
+      return false;
+   }
+
+   m_written = 0;
+   m_read = 0;
+   m_armed = 0;
+   m_overruns = 0;
+   m_sampleUs = sampleUs;
+   m_startUs = sim::now();
+   m_sm = 0;
+   m_channel = 0;
+   m_next = 1;
+
+   node->peripherals.push_back([this, node]()
+   {
+      while ((m_startUs + static_cast<uint64_t>(m_written) * m_sampleUs) <= sim::now())
+      {
+         m_ring[m_written % RING_SAMPLES] = node->read();
+         m_written = m_written + 1;
+      }
+   });
+
+   return true;
+}
+
+void InputCapture::update()
+{
+}
@@ -0,0 +1,60 @@
+//
+/// CANBlock host simulator - entry points of one simulated CANBlock module
+///
+/// The module source keeps its state in globals, so CANBlockNodes.cpp compiles
+/// CANBlock.cpp once per simulated node, each copy in its own namespace.  This
+/// table gives the harness access to each copy.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "CANBlock.h"
+#include "ModuleVariant.h"
+#include "BlockStateMachine.h"
+#include "CBUSDispatch.h"
+#include "CBUSConfig.h"
+#include "LoopScheduler.h"
+#include "Telemetry.h"
+#include "ConfigJournal.h"
+#include "RequestTracker.h"
+#include "StateResync.h"
+#include "FrameTrace.h"
+#include "PortExpander.h"
+#include "BellOutput.h"
+#include "GridConnectBridge.h"
+
+/// Entry points and state of one compiled copy of the module
+struct SimNodeOps
+{
+   const char *name;                                 ///< Namespace of the copy
+   const ModuleVariant *variant;                     ///< Variant the copy was built as
+   size_t stateBytes;                                ///< RAM taken by the module's own objects and state
+   void (*setup)();                                  ///< setup()
+   void (*loop)();                                   ///< loop()
+   void (*eventhandler)(uint8_t, const CANFrame &);  ///< eventhandler()
+   void (*processRemoteStateMachine)(uint8_t, RemoteInput); ///< processRemoteStateMachine()
+   void (*powerOn)();                                ///< Restore RAM state to its power on values
+   uint8_t numSections;                              ///< Block sections run by the module
+   BlockState *localBoxState;                        ///< Local box state machines, by section
+   BlockState *remoteBoxState;                       ///< Remote box state machines, by section
+   bool *lineClearReleased;                          ///< Commutator releases, by section
+   const SectionPins *pins;                          ///< Switch and indicator pins, by section
+   CBUSConfig *config;                               ///< Module configuration
+   CBUSDispatch *cbus;                               ///< CBUS object
+   LoopScheduler *scheduler;                         ///< Main loop scheduler, idle() follows each loop()
+   Telemetry *telemetry;                             ///< Performance counters
+   ConfigJournal *settings;                          ///< Module settings
+   RequestTracker *requests;                         ///< Requests waiting for the box in advance
+   StateResync *resync;                              ///< State queries to the box at the other end after a reset
+   FrameTrace *trace;                                ///< Frame, state machine and switch trace
+   PortExpander *expander;                           ///< I2C port expanders of the panel sections
+   BellOutput *bell;                                 ///< Attention bell and warning buzzer
+   GridConnectBridge *gateway;                       ///< GridConnect gateway to a PC on USB
+};
+
+constexpr size_t SIM_MAX_NODES = 4; ///< Number of compiled module copies
+
+extern const SimNodeOps simNodes[SIM_MAX_NODES];
@@ -0,0 +1,155 @@
+//
+/// CANBlock host simulator - I2C port expanders
+///
+/// Stands in for the I2C controller and DMA channels of PortExpander.cpp,
+/// against the fake MCP23017s of the node (sim::Expander).  Each device's
+/// transaction takes the bus time of the longest one, latches are written and
+/// inputs read as it starts, and its end raises the DMA interrupt, which
+/// wakes core 0 and starts the next device.
+//
+
+#include "PortExpander.h"
+
+#include "SimBus.h"
+
+#include <pico/stdlib.h>
+
+namespace
+{
+   /// Bus time of a transaction that writes both latches and reads both ports (us): two
+   /// address bytes and six data bytes, each of 9 bits
+   constexpr uint64_t TRANSACTION_US = (8 * 9 * 1000000ull) / PortExpander::I2C_BAUD;
+}
+
+bool PortExpander::begin(uint8_t devices, const PinMask &inputs, uint8_t intPin)
+{
+   sim::Node *node = sim::current();
+
+   m_devices = 0;
+
+   if (!node)
+   {
+      return false;
+   }
+
+   gpio_init(intPin);
+   gpio_set_dir(intPin, false);
+   gpio_pull_up(intPin);
+
+   for (uint8_t d = 0; d < devices; d++)
+   {
+      sim::Expander &device = node->expanders[d];
+      const uint16_t in = inputs.expander(d);
+
+      device.olat = 0;
+      device.iodir = in;
+      device.gppu = in;
+      device.gpinten = in;
+      device.captured = device.pins();
+      m_inputs.setExpander(d, device.captured);
+   }
+
+   node->expanderInt = intPin;
+   node->expanderInterrupt();
+
+   m_outputs = PinMask{};
+   m_written = PinMask{};
+   m_dirty = 0;
+   m_intPin = intPin;
+   m_devices = devices;
+   m_scanning = false;
+   m_complete = false;
+
+   node->peripherals.push_back([this, node]()
+                               {
+      while (m_scanning && (sim::now() >= (m_scanStart + (m_device + 1) * TRANSACTION_US)))
+      {
+         // The DMA interrupt, taken on core 0
+         node->event = true;
+         deviceDone();
+      } });
+
+   return true;
+}
+
+void PortExpander::write(const PinMask &levels)
+{
+   for (uint8_t d = 0; d < m_devices; d++)
+   {
+      m_outputs.setExpander(d, levels.expander(d));
+
+      if (m_outputs.expander(d) != m_written.expander(d))
+      {
+         m_dirty |= 1u << d;
+      }
+   }
+}
+
+void PortExpander::run()
+{
+   if (!m_devices || m_scanning)
+   {
+      return;
+   }
+
+   if (m_requested || m_dirty || !gpio_get(m_intPin))
+   {
+      m_requested = false;
+      m_scanning = true;
+      m_scanStart = time_us_64();
+      startDevice(0);
+   }
+}
+
+bool PortExpander::takeScan()
+{
+   const bool complete = m_complete;
+   m_complete = false;
+   return complete;
+}
+
+uint64_t PortExpander::nextRunUs() const
+{
+   return m_scanning ? (m_scanStart + SCAN_TIMEOUT_US) : UINT64_MAX;
+}
+
+void PortExpander::startDevice(uint8_t device)
+{
+   sim::Node *node = sim::current();
+   sim::Expander &expander = node->expanders[device];
+
+   m_device = device;
+
+   if (m_dirty & (1u << device))
+   {
+      m_dirty &= ~(1u << device);
+      expander.olat = m_outputs.expander(device);
+      m_written.setExpander(device, expander.olat);
+      m_writes++;
+   }
+
+   // Reading the ports clears the interrupt
+   expander.captured = expander.pins();
+   m_rx[0] = static_cast<uint8_t>(expander.captured);
+   m_rx[1] = static_cast<uint8_t>(expander.captured >> 8);
+   node->expanderInterrupt();
+}
+
+void PortExpander::deviceDone()
+{
+   m_inputs.setExpander(m_device, m_rx[0] | (m_rx[1] << 8));
+
+   if ((m_device + 1) < m_devices)
+   {
+      startDevice(m_device + 1);
+      return;
+   }
+
+   m_scans++;
+   m_scanning = false;
+   m_complete = true;
+}
+
+void PortExpander::dmaIrq()
+{
+}
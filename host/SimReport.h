@@ -0,0 +1,57 @@
+//
+/// CANBlock host simulator - helpers shared by the simulator programs
+///
+/// Virtual time units, the pseudo random source of generated traffic and
+/// operations, and the latency rows every program reports in the same form.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace sim
+{
+   constexpr uint64_t MS = 1000;       ///< One millisecond of virtual time (us)
+   constexpr uint64_t SEC = 1000 * MS; ///< One second of virtual time (us)
+
+   /// Deterministic pseudo random source, so runs with the same seed repeat
+   inline uint32_t lcg(uint32_t &state)
+   {
+      state = state * 1664525u + 1013904223u;
+      return state >> 8;
+   }
+
+   /// Virtual time samples of one measurement, reported as one row
+   struct Latency
+   {
+      const char *name;
+      std::vector<uint64_t> samples;
+
+      void report() const
+      {
+         if (samples.empty())
+         {
+            printf("  %-28s n=0\n", name);
+            return;
+         }
+
+         std::vector<uint64_t> sorted(samples);
+         std::sort(sorted.begin(), sorted.end());
+         uint64_t total = 0;
+
+         for (uint64_t s : sorted)
+         {
+            total += s;
+         }
+
+         const uint64_t p99 = sorted[(sorted.size() * 99 + 99) / 100 - 1]; // nearest rank
+
+         printf("  %-28s n=%-5zu min %7.3f ms  avg %7.3f ms  p99 %7.3f ms  max %7.3f ms\n", name, sorted.size(),
+                sorted.front() / 1000.0, (total / 1000.0) / sorted.size(), p99 / 1000.0, sorted.back() / 1000.0);
+      }
+   };
+}
@@ -0,0 +1,75 @@
+//
+/// CANBlock host simulator - bell and buzzer tone player
+///
+/// Stands in for the PWM slices and DMA channel of TonePlayer.cpp.  The
+/// harness runs the player of each node every step, and it writes each step
+/// of the pattern to the node's tone slice as its pacer wrap passes: step n
+/// of a pattern lands n + 1 steps after play().  Bell strokes and buzzer time
+/// are logged on the node as they would be heard.
+//
+
+#include "TonePlayer.h"
+
+#include "SimBus.h"
+
+namespace
+{
+   constexpr uint32_t BUZZER_ON = 0x0000FFFF; ///< Compare word of the buzzer, channel A
+   constexpr uint32_t BELL_ON = 0xFFFF0000;   ///< Compare word of the bell, channel B
+}
+
+bool TonePlayer::begin(uint8_t buzzerPin, uint8_t bellPin, uint32_t stepUs)
+{
+   sim::Node *node = sim::current();
+
+   // Slices pair even and odd pins, as on the RP2040
+   if (!node || ((buzzerPin / 2) != (bellPin / 2)) || (buzzerPin == bellPin) || !stepUs)
+   {
+      return false;
+   }
+
+   m_buzzerOn = BUZZER_ON;
+   m_bellOn = BELL_ON;
+   m_stepUs = stepUs;
+   m_count = 0;
+   m_channel = 0;
+   node->toneLevels = 0;
+
+   node->peripherals.push_back([this, node, started = UINT64_MAX, played = uint16_t{0}]() mutable
+   {
+      // A new pattern restarts the DMA transfer
+      if (started != m_startUs)
+      {
+         started = m_startUs;
+         played = 0;
+      }
+
+      while ((played < m_count) && ((m_startUs + static_cast<uint64_t>(played + 1) * m_stepUs) <= sim::now()))
+      {
+         const uint64_t at = m_startUs + static_cast<uint64_t>(played + 1) * m_stepUs;
+         const uint32_t levels = m_steps[played++];
+
+         if ((levels & BELL_ON) && !(node->toneLevels & BELL_ON))
+         {
+            node->bellStrokes.push_back(at);
+         }
+
+         node->buzzUs += (levels & BUZZER_ON) ? m_stepUs : 0;
+         node->toneLevels = levels;
+      }
+   });
+
+   return true;
+}
+
+void TonePlayer::play(const uint32_t *steps, uint16_t count)
+{
+   m_startUs = sim::now();
+   m_count = count;
+   m_steps = steps;
+}
+
+bool TonePlayer::isPlaying() const
+{
+   return sim::now() < (m_startUs + static_cast<uint64_t>(m_count) * m_stepUs);
+}
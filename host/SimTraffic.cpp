@@ -0,0 +1,306 @@
+//
+/// CANBlock host simulator - traffic generator for load tests
+//
+
+#include "SimTraffic.h"
+
+#include "GridConnectBridge.h"
+#include "SimReport.h"
+#include "cbusdefs.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+   constexpr uint8_t FOREIGN_CANID_BASE = 0x20;  ///< Foreign CAN ID's start clear of the simulated nodes'
+   constexpr uint8_t FOREIGN_CANIDS = 0x5F;      ///< Foreign CAN ID's, shared round robin when there are more modules
+   constexpr uint16_t FOREIGN_NN_BASE = 0x1000;  ///< Node number of the first foreign module
+   constexpr size_t MAX_BLOCK_EVENTS = 64;       ///< Distinct block events kept for malformed copies
+   constexpr size_t MAX_PENDING = 2;             ///< Foreign frames waiting for the bus
+
+   bool isAccessoryEvent(const CANFrame &frame)
+   {
+      const uint8_t opCode = frame.data[0];
+
+      return !frame.rtr && !frame.ext && (frame.len >= 5) &&
+             ((opCode == OPC_ACON) || (opCode == OPC_ACOF) || (opCode == OPC_ASON) || (opCode == OPC_ASOF));
+   }
+
+   bool sameEvent(const CANFrame &a, const CANFrame &b)
+   {
+      return (a.data[0] == b.data[0]) && (memcmp(&a.data[1], &b.data[1], 4) == 0);
+   }
+}
+
+SimTraffic::SimTraffic(SimHarness &sim, uint32_t seed) : m_sim(sim), m_previous(sim.bus().observer), m_seed(seed)
+{
+   sim.bus().observer = [this](uint64_t time, const sim::Node *sender, const sim::TxEntry &entry)
+   {
+      observe(time, sender, entry);
+   };
+}
+
+SimTraffic::~SimTraffic()
+{
+   m_sim.bus().observer = m_previous;
+
+   if (m_log)
+   {
+      fclose(m_log);
+   }
+}
+
+void SimTraffic::mix(const TrafficMix &mix)
+{
+   CANFrame frame{};
+   frame.len = 5;
+
+   m_mix = mix;
+   m_mix.foreignNodes = std::max<uint16_t>(mix.foreignNodes, 1);
+   m_foreignInterval = (mix.foreignLoad > 0.0)
+                           ? static_cast<uint64_t>((sim::frameBits(frame) * 1e6 / sim::CAN_BITRATE) / mix.foreignLoad)
+                           : 0;
+   m_nextForeign = sim::now();
+}
+
+bool SimTraffic::load(const char *path)
+{
+   FILE *in = fopen(path, "r");
+
+   if (!in)
+   {
+      return false;
+   }
+
+   const uint16_t firstNN = SimHarness::nodeNumber(0);
+   const uint16_t lastNN = SimHarness::nodeNumber(m_sim.size() - 1);
+   char line[256];
+   double firstMs = -1.0;
+   double lastMs = 0.0;
+
+   m_capture.clear();
+
+   while (fgets(line, sizeof(line), in))
+   {
+      const char *frameText = strchr(line, ':');
+      CANFrame frame{};
+
+      if (!frameText || !parse(frameText, frame))
+      {
+         continue;
+      }
+
+      // A time before the frame dates it, frames without one follow the last back to back
+      char *end;
+      const double ms = strtod(line, &end);
+
+      if ((end != line) && (end <= frameText))
+      {
+         firstMs = (firstMs < 0.0) ? ms : firstMs;
+         lastMs = std::max(lastMs, ms - firstMs);
+      }
+
+      // The simulated nodes send their own block events live
+      const uint16_t nn = (frame.data[1] << 8) | frame.data[2];
+
+      if (isAccessoryEvent(frame) && (nn >= firstNN) && (nn <= lastNN))
+      {
+         m_skipped++;
+         continue;
+      }
+
+      m_capture.push_back({static_cast<uint64_t>(lastMs * 1000.0), frame});
+   }
+
+   fclose(in);
+   return !m_capture.empty();
+}
+
+void SimTraffic::replay(double speed)
+{
+   m_speed = speed;
+   m_replayNext = 0;
+   m_replayStart = sim::now();
+   m_replaying = !m_capture.empty();
+}
+
+bool SimTraffic::capture(const char *path)
+{
+   if (m_log)
+   {
+      fclose(m_log);
+   }
+
+   m_log = fopen(path, "w");
+   return m_log != nullptr;
+}
+
+void SimTraffic::step()
+{
+   sim::Bus &bus = m_sim.bus();
+   const uint64_t now = sim::now();
+
+   // Foreign modules hold frames in their own queues while the bus is busy, so a
+   // full bus does not build a backlog that block event copies wait behind
+   while (m_foreignInterval && (m_nextForeign <= now) && (bus.injectPending() < MAX_PENDING))
+   {
+      const uint32_t share = static_cast<uint32_t>(m_mix.malformedShare * 10000);
+
+      if ((random() % 10000) < share)
+      {
+         bus.inject(malformedFrame());
+         m_malformed++;
+      }
+      else
+      {
+         bus.inject(foreignEvent());
+         m_foreign++;
+      }
+
+      m_nextForeign += m_foreignInterval;
+   }
+
+   while (m_replaying)
+   {
+      const Captured &next = m_capture[m_replayNext];
+
+      // Unpaced replay keeps the queue full, paced replay falls behind when the bus is full
+      if ((bus.injectPending() >= MAX_PENDING) ||
+          ((m_speed > 0.0) && (m_replayStart + static_cast<uint64_t>(next.timeUs / m_speed) > now)))
+      {
+         break;
+      }
+
+      bus.inject(next.frame);
+      m_replayed++;
+
+      if (++m_replayNext == m_capture.size())
+      {
+         m_replayNext = 0;
+         m_replayStart = now;
+         break;
+      }
+   }
+}
+
+bool SimTraffic::parse(const char *line, CANFrame &frame)
+{
+   const char *end = strchr(line, ';');
+
+   return end && GridConnectBridge::decode(line, end - line + 1, frame);
+}
+
+int SimTraffic::format(const CANFrame &frame, char *text, size_t size)
+{
+   if (size <= GridConnectBridge::MAX_FRAME_TEXT)
+   {
+      return -1;
+   }
+
+   const size_t n = GridConnectBridge::encode(frame, text);
+   text[n] = '\0';
+   return static_cast<int>(n);
+}
+
+CANFrame SimTraffic::foreignEvent()
+{
+   CANFrame frame{};
+   const uint32_t r = random();
+   const uint16_t module = r % m_mix.foreignNodes;
+   const uint16_t nn = FOREIGN_NN_BASE + module;
+   const uint8_t en = 1 + ((r >> 16) & 0x3F);
+
+   frame.id = (DEFAULT_PRIORITY << 7) | (FOREIGN_CANID_BASE + (module % FOREIGN_CANIDS));
+   frame.len = 5;
+   frame.data[0] = (r & 0x400000) ? OPC_ACON : OPC_ACOF;
+   frame.data[1] = nn >> 8;
+   frame.data[2] = nn & 0xFF;
+   frame.data[3] = 0;
+   frame.data[4] = en;
+   return frame;
+}
+
+///
+/// Frames no module should act on, most made from a block event seen on the bus
+/// so a receiver that does not check the frame would act on a learned event
+///
+CANFrame SimTraffic::malformedFrame()
+{
+   CANFrame frame = m_blockEvents.empty() ? foreignEvent() : m_blockEvents[random() % m_blockEvents.size()];
+   const uint32_t r = random();
+
+   frame.id = (DEFAULT_PRIORITY << 7) | (FOREIGN_CANID_BASE + (r % FOREIGN_CANIDS));
+
+   switch ((r >> 8) % 5)
+   {
+   case 0:
+      // Truncated, the event number is cut short
+      frame.len = 1 + ((r >> 12) % 4);
+      break;
+   case 1:
+      // Remote request carrying the event
+      frame.rtr = true;
+      break;
+   case 2:
+      // Extended frame carrying the event, as the bootloader's frames could
+      frame.ext = true;
+      frame.id = (r >> 3) & 0x1FFFFFFF;
+      break;
+   case 3:
+      // No data
+      frame.len = 0;
+      break;
+   default:
+      // Any opcode at any length
+      frame.len = 1 + ((r >> 12) % 8);
+
+      for (uint8_t i = 0; i < frame.len; i++)
+      {
+         frame.data[i] = static_cast<uint8_t>(random());
+      }
+      break;
+   }
+
+   return frame;
+}
+
+void SimTraffic::observe(uint64_t time, const sim::Node *sender, const sim::TxEntry &entry)
+{
+   const CANFrame &frame = entry.frame;
+
+   if (m_log)
+   {
+      char text[40];
+      format(frame, text, sizeof(text));
+      fprintf(m_log, "%.3f %s\n", time / 1000.0, text);
+   }
+
+   // Block events of the simulated nodes, copied as a module retransmitting would
+   if (sender && isAccessoryEvent(frame))
+   {
+      for (uint8_t i = 0; i < m_mix.echoes; i++)
+      {
+         m_sim.bus().inject(frame);
+         m_echoes++;
+      }
+
+      if ((m_blockEvents.size() < MAX_BLOCK_EVENTS) &&
+          std::none_of(m_blockEvents.begin(), m_blockEvents.end(), [&](const CANFrame &seen)
+                       { return sameEvent(seen, frame); }))
+      {
+         m_blockEvents.push_back(frame);
+      }
+   }
+
+   if (m_previous)
+   {
+      m_previous(time, sender, entry);
+   }
+}
+
+uint32_t SimTraffic::random()
+{
+   return sim::lcg(m_seed);
+}
@@ -0,0 +1,103 @@
+//
+/// CANBlock host simulator - traffic generator for load tests
+///
+/// Feeds the simulated bus with
+///   - a capture, replayed at its original timing, faster or slower, or as fast
+///     as the bus takes it.  Captures are GridConnect logs, one frame a line,
+///     each optionally preceded by its time in ms
+///   - synthetic traffic: foreign modules sending ACON / ACOF, extra copies of
+///     every block event the simulated nodes send, and malformed frames
+/// and can log every frame on the bus as a GridConnect capture for replay.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "SimHarness.h"
+
+/// Synthetic traffic, shares are of the bus capacity or of the generated frames
+struct TrafficMix
+{
+   uint16_t foreignNodes{32};   ///< Foreign modules sending ACON / ACOF, each with its own CAN ID and node number
+   double foreignLoad{0.0};     ///< Share of the bus the foreign modules fill
+   uint8_t echoes{0};           ///< Extra copies of every block event sent, as a module retransmitting
+   double malformedShare{0.0};  ///< Share of the foreign frames replaced by malformed frames
+};
+
+class SimTraffic
+{
+public:
+   /// Takes over the bus observer, chaining to any observer already set
+   explicit SimTraffic(SimHarness &sim, uint32_t seed = 12345);
+   ~SimTraffic();
+
+   /// Set the synthetic traffic
+   void mix(const TrafficMix &mix);
+
+   /// Read a GridConnect capture to replay, block events of the simulated nodes are skipped
+   /// @return false if the file cannot be read or holds no frames
+   bool load(const char *path);
+
+   /// Start replaying the capture, from the start and then over again
+   /// @param speed multiple of the captured timing, 0 to send frames as fast as the bus takes them
+   void replay(double speed);
+
+   /// Log every frame on the bus to a GridConnect capture
+   bool capture(const char *path);
+
+   /// Queue the traffic due by now, call from SimHarness::onStep
+   void step();
+
+   /// Parse the frame of a GridConnect line, e.g. ":SB020N9001010006;"
+   static bool parse(const char *line, CANFrame &frame);
+
+   /// Write a frame in GridConnect form, returns the length written
+   static int format(const CANFrame &frame, char *text, size_t size);
+
+   uint32_t getForeign() const { return m_foreign; }       ///< Foreign events queued
+   uint32_t getEchoes() const { return m_echoes; }         ///< Block event copies queued
+   uint32_t getMalformed() const { return m_malformed; }   ///< Malformed frames queued
+   uint32_t getReplayed() const { return m_replayed; }     ///< Captured frames queued
+   uint32_t getSkipped() const { return m_skipped; }       ///< Captured block events of the simulated nodes skipped
+   size_t getCaptureSize() const { return m_capture.size(); } ///< Frames read by load()
+
+private:
+   /// Captured frame and its time from the start of the capture
+   struct Captured
+   {
+      uint64_t timeUs;
+      CANFrame frame;
+   };
+
+   CANFrame foreignEvent();
+   CANFrame malformedFrame();
+   void observe(uint64_t time, const sim::Node *sender, const sim::TxEntry &entry);
+   uint32_t random();
+
+   SimHarness &m_sim;
+   sim::FrameObserver m_previous;
+   uint32_t m_seed;
+   TrafficMix m_mix{};
+   uint64_t m_foreignInterval{0};
+   uint64_t m_nextForeign{0};
+
+   std::vector<CANFrame> m_blockEvents; ///< Distinct block events seen on the bus, for malformed copies
+
+   std::vector<Captured> m_capture;
+   size_t m_replayNext{0};
+   uint64_t m_replayStart{0};
+   double m_speed{0.0};
+   bool m_replaying{false};
+
+   FILE *m_log{nullptr};
+
+   uint32_t m_foreign{0};
+   uint32_t m_echoes{0};
+   uint32_t m_malformed{0};
+   uint32_t m_replayed{0};
+   uint32_t m_skipped{0};
+};
@@ -0,0 +1,132 @@
+//
+/// CANBlock host simulator - USB CDC serial port
+///
+/// Stands in for the USB stdio port of UsbSerial.cpp with a pseudo-terminal,
+/// so a GridConnect gateway can be tried with a PC program, or driven by the
+/// harness, on its device.  The module writes and reads the master side,
+/// without blocking, and the PC the slave side.  The harness sets usbHost on
+/// the node while the PC has the port open, as DTR would.  Once a USB frame
+/// (1 ms) the port is polled for text from the PC, which wakes core 0 as the
+/// USB interrupt would.
+//
+
+#include "UsbSerial.h"
+
+#include "SimBus.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace
+{
+   constexpr uint64_t USB_FRAME_US = 1000; ///< Full speed USB frame (us)
+}
+
+bool UsbSerial::begin()
+{
+   sim::Node *node = sim::current();
+
+   if (!node)
+   {
+      return false;
+   }
+
+   // The PC keeps its end open while the module resets
+   if (node->usbFd < 0)
+   {
+      const int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+      if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0))
+      {
+         if (fd >= 0)
+         {
+            close(fd);
+         }
+
+         return false;
+      }
+
+      // A CDC port carries bytes, no line discipline
+      termios raw;
+      tcgetattr(fd, &raw);
+      cfmakeraw(&raw);
+      tcsetattr(fd, TCSANOW, &raw);
+
+      node->usbFd = fd;
+      node->usbPath = ptsname(fd);
+   }
+
+   node->usbReadable = false;
+
+   node->peripherals.push_back([node, nextFrame = uint64_t{0}]() mutable
+   {
+      if (sim::now() < nextFrame)
+      {
+         return;
+      }
+
+      nextFrame = sim::now() + USB_FRAME_US;
+
+      if (!node->usbHost || node->usbReadable)
+      {
+         return;
+      }
+
+      pollfd port{node->usbFd, POLLIN, 0};
+
+      if ((poll(&port, 1, 0) > 0) && (port.revents & POLLIN))
+      {
+         node->usbReadable = true;
+         node->event = true;
+      }
+   });
+
+   return true;
+}
+
+bool UsbSerial::connected() const
+{
+   const sim::Node *node = sim::current();
+
+   return node && (node->usbFd >= 0) && node->usbHost;
+}
+
+size_t UsbSerial::write(const char *data, size_t length)
+{
+   if (!connected())
+   {
+      return 0;
+   }
+
+   const ssize_t count = ::write(sim::current()->usbFd, data, length);
+
+   return (count > 0) ? static_cast<size_t>(count) : 0;
+}
+
+void UsbSerial::flush()
+{
+   // A pseudo-terminal has no packets, written text is already with the PC
+}
+
+size_t UsbSerial::read(char *data, size_t length)
+{
+   sim::Node *node = sim::current();
+
+   if (!connected() || !node->usbReadable)
+   {
+      return 0;
+   }
+
+   const ssize_t count = ::read(node->usbFd, data, length);
+
+   // Drained, the next USB frame looks again
+   if (count < static_cast<ssize_t>(length))
+   {
+      node->usbReadable = false;
+   }
+
+   return (count > 0) ? static_cast<size_t>(count) : 0;
+}
@@ -0,0 +1,78 @@
+//
+/// Host build stand-in for the CBUS library base class
+/// Implements the subset of CBUS message processing the module relies on
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "CBUSConfig.h"
+#include "CBUSLED.h"
+#include "CBUSSwitch.h"
+
+constexpr uint8_t DEFAULT_PRIORITY = 0xB; ///< Default CAN frame priority
+
+/// CAN frame
+struct CANFrame
+{
+   uint32_t id;
+   bool ext;
+   bool rtr;
+   uint8_t len;
+   uint8_t data[8];
+};
+
+/// module name, 7 characters
+typedef uint8_t module_name_t[7];
+
+typedef void (*eventCallback_t)(uint8_t index, const CANFrame &msg);
+typedef void (*frameCallback_t)(CANFrame &msg);
+
+class CBUSbase
+{
+public:
+   explicit CBUSbase(CBUSConfig &config);
+   virtual ~CBUSbase() = default;
+
+   // CAN controller specific
+   virtual bool begin() = 0;
+   virtual bool available() = 0;
+   virtual CANFrame getNextMessage() = 0;
+   virtual bool sendMessage(CANFrame &msg, bool rtr = false, bool ext = false, uint8_t priority = DEFAULT_PRIORITY) = 0;
+   virtual void reset() = 0;
+
+   void setParams(uint8_t *mparams);
+   void setName(module_name_t *mname);
+   void setEventHandlerCB(eventCallback_t fptr);
+   void setFrameHandlerCB(frameCallback_t fptr, uint8_t *opcodes = nullptr, uint8_t num_opcodes = 0);
+
+   CBUSLED &getCBUSGreenLED() { return m_ledGrn; }
+   CBUSLED &getCBUSYellowLED() { return m_ledYlw; }
+   CBUSSwitch &getCBUSSwitch() { return m_sw; }
+   void indicateFLiMMode(bool bFLiM);
+
+   void process(uint8_t num_messages = 3);
+   bool sendMyEvent(uint8_t eventNum, bool onOff);
+   bool sendWRACK();
+   bool sendCMDERR(uint8_t cerrno);
+   void makeHeader(CANFrame &msg, uint8_t priority = DEFAULT_PRIORITY);
+
+   uint32_t m_numMsgsSent{0};
+   uint32_t m_numMsgsRcvd{0};
+
+protected:
+   void processAccessoryEvent(const CANFrame &msg, uint16_t nn, uint16_t en);
+
+   CBUSConfig &m_config;
+   CBUSLED m_ledGrn;
+   CBUSLED m_ledYlw;
+   CBUSSwitch m_sw;
+   uint8_t *m_mparams{nullptr};
+   module_name_t *m_mname{nullptr};
+   eventCallback_t m_eventHandler{nullptr};
+   frameCallback_t m_frameHandler{nullptr};
+   uint8_t *m_opcodes{nullptr};
+   uint8_t m_numOpcodes{0};
+   bool m_bLearn{false};
+};
@@ -0,0 +1,35 @@
+//
+/// Host build stand-in for the CAN2040 CBUS transport
+/// Frames are exchanged over the simulated bus of the node that called begin()
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "CBUS.h"
+
+namespace sim
+{
+   class Node;
+}
+
+class CBUSACAN2040 : public CBUSbase
+{
+public:
+   explicit CBUSACAN2040(CBUSConfig &config);
+
+   bool begin() override;
+   bool available() override;
+   CANFrame getNextMessage() override;
+   bool sendMessage(CANFrame &msg, bool rtr = false, bool ext = false, uint8_t priority = DEFAULT_PRIORITY) override;
+   void reset() override;
+
+   void setNumBuffers(uint8_t num_rx_buffers, uint8_t num_tx_buffers);
+   void setPins(uint8_t tx_pin, uint8_t rx_pin);
+
+private:
+   sim::Node *m_node{nullptr};
+   uint8_t m_numRxBuffers{4};
+   uint8_t m_numTxBuffers{2};
+};
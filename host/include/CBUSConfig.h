@@ -0,0 +1,83 @@
+//
+/// Host build stand-in for the CBUS library configuration class
+/// The emulated EEPROM is a RAM array, accesses are counted so the simulator
+/// can report how often the module touches the configuration store
+//
+
+#pragma once
+
+#include <cstdint>
+
+class CBUSLED;
+class CBUSSwitch;
+
+/// Backing store type for the configuration
+enum class EEPROM_TYPE
+{
+   EEPROM_INTERNAL,
+   EEPROM_EXTERNAL,
+   EEPROM_USES_FLASH
+};
+
+constexpr uint16_t EEPROM_SIZE = 4096; ///< Size of the emulated EEPROM (one flash sector)
+
+class CBUSConfig
+{
+public:
+   CBUSConfig();
+
+   void setEEPROMtype(EEPROM_TYPE type);
+   void begin();
+
+   uint8_t findExistingEvent(uint16_t nn, uint16_t en);
+   uint8_t findEventSpace();
+   uint8_t getEventEVval(uint8_t idx, uint8_t evnum);
+   void writeEventEV(uint8_t idx, uint8_t evnum, uint8_t evval);
+   void readEvent(uint8_t idx, uint8_t tarr[]);
+   void writeEvent(uint8_t index, const uint8_t data[]);
+   void cleareventEEPROM(uint8_t index);
+   void clearEventsEEPROM();
+   uint8_t numEventsUsed();
+
+   uint8_t getNV(uint8_t idx);
+   bool setNV(uint8_t idx, uint8_t val);
+
+   uint8_t readEEPROM(uint32_t eeaddress);
+   uint8_t readBytesEEPROM(uint32_t eeaddress, uint8_t nbytes, uint8_t dest[]);
+   void writeEEPROM(uint32_t eeaddress, uint8_t data);
+   void writeBytesEEPROM(uint32_t eeaddress, const uint8_t src[], uint8_t numbytes);
+   void resetModule(CBUSLED &green, CBUSLED &yellow, CBUSSwitch &sw);
+   void resetModule();
+
+   bool getFLiM() const { return m_FLiM; }
+   uint8_t getCANID() const { return m_CANID; }
+   uint16_t getNodeNum() const { return m_nodeNum; }
+   void setFLiM(bool f);
+   void setCANID(uint8_t canid);
+   void setNodeNum(uint16_t nn);
+
+   void setResetFlag();
+   void clearResetFlag();
+   bool isResetFlagSet();
+
+   // layout parameters, set by the module before begin()
+   uint32_t EE_EVENTS_START{0};
+   uint8_t EE_MAX_EVENTS{0};
+   uint8_t EE_NUM_EVS{0};
+   uint8_t EE_BYTES_PER_EVENT{0};
+   uint32_t EE_NVS_START{0};
+   uint8_t EE_NUM_NVS{0};
+
+   // simulator instrumentation
+   uint32_t readCount{0};  ///< Number of EEPROM byte reads
+   uint32_t writeCount{0}; ///< Number of EEPROM write operations (flash programs when using flash)
+
+private:
+   void commit();
+
+   EEPROM_TYPE m_type{EEPROM_TYPE::EEPROM_USES_FLASH};
+   uint8_t m_eeprom[EEPROM_SIZE];
+   bool m_FLiM{false};
+   uint8_t m_CANID{0};
+   uint16_t m_nodeNum{0};
+};
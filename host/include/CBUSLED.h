@@ -0,0 +1,42 @@
+//
+/// Host build stand-in for the CBUS library LED class
+/// Drives a pin of the simulated node that was running when setPin() was called
+//
+
+#pragma once
+
+#include <cstdint>
+
+namespace sim
+{
+   class Node;
+}
+
+constexpr uint32_t BLINK_RATE = 500; ///< LED blink period (ms)
+constexpr uint32_t PULSE_ON_TIME = 5; ///< LED pulse duration (ms)
+
+class CBUSLED
+{
+public:
+   CBUSLED();
+   void setPin(uint8_t pin, bool active = true);
+   bool getState();
+   void on();
+   void off();
+   void toggle();
+   void blink();
+   virtual void run();
+   void pulse(bool shortPulse = false);
+
+private:
+   void write(bool level);
+
+   sim::Node *m_node;
+   uint8_t m_pin;
+   bool m_active;
+   bool m_state;
+   bool m_blink;
+   bool m_pulse;
+   uint32_t m_lastTime;
+   uint32_t m_pulseStart;
+};
@@ -0,0 +1,22 @@
+//
+/// Host build stand-in for the CBUS library module parameter block
+//
+
+#pragma once
+
+#include <cstdint>
+
+class CBUSConfig;
+
+class CBUSParams
+{
+public:
+   explicit CBUSParams(CBUSConfig &config);
+   void setVersion(uint8_t major, char minor, uint8_t beta);
+   void setModuleId(uint8_t id);
+   void setFlags(uint8_t flags);
+   uint8_t *getParams();
+
+private:
+   static uint8_t m_params[21];
+};
@@ -0,0 +1,46 @@
+//
+/// Host build stand-in for the CBUS library switch class
+/// Reads a pin of the simulated node that was running when setPin() was called
+//
+
+#pragma once
+
+#include <cstdint>
+
+namespace sim
+{
+   class Node;
+}
+
+constexpr uint32_t DEBOUNCE_DELAY = 20; ///< Switch debounce time (ms)
+
+class CBUSSwitch
+{
+public:
+   CBUSSwitch();
+   void setPin(uint8_t pin, bool pressedState);
+   void run();
+   void reset();
+   bool stateChanged();
+   bool getState();
+   bool isPressed();
+   uint32_t getCurrentStateDuration();
+   uint32_t getLastStateDuration();
+   uint32_t getLastStateChangeTime();
+   void resetCurrentDuration();
+
+private:
+   bool readPin();
+
+   sim::Node *m_node;
+   uint8_t m_pin;
+   bool m_pressedState;
+   bool m_currentState;
+   bool m_lastState;
+   bool m_state;
+   bool m_stateChanged;
+   uint32_t m_lastStateChangeTime;
+   uint32_t m_lastStateDuration;
+   uint32_t m_prevReleaseTime;
+   uint32_t m_prevStateDuration;
+};
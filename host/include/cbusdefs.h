@@ -0,0 +1,119 @@
+//
+/// Host build subset of the MERG cbusdefs constants used by the module and simulator
+/// Values match cbusdefs, the real header is used for the Pico build
+//
+
+#pragma once
+
+// Parameter flags
+#define PF_NOEVENTS 0
+#define PF_CONSUMER 1
+#define PF_PRODUCER 2
+#define PF_COMBI 3
+#define PF_FLiM 4
+#define PF_BOOT 8
+
+// Error codes for OPC_CMDERR
+#define CMDERR_INV_CMD 1
+#define CMDERR_NOT_LRN 2
+#define CMDERR_NOT_SETUP 3
+#define CMDERR_TOO_MANY_EVENTS 4
+#define CMDERR_NO_EV 5
+#define CMDERR_INV_EV_IDX 6
+#define CMDERR_INVALID_EVENT 7
+#define CMDERR_INV_EN_IDX 8
+#define CMDERR_INV_PARAM_IDX 9
+#define CMDERR_INV_NV_IDX 10
+#define CMDERR_INV_EV_VALUE 11
+#define CMDERR_INV_NV_VALUE 12
+
+// Opcodes
+#define OPC_ACK 0x00
+#define OPC_NAK 0x01
+#define OPC_HLT 0x02
+#define OPC_BON 0x03
+#define OPC_TOF 0x04
+#define OPC_TON 0x05
+#define OPC_ESTOP 0x06
+#define OPC_ARST 0x07
+#define OPC_RTOF 0x08
+#define OPC_RTON 0x09
+#define OPC_RESTP 0x0A
+#define OPC_RSTAT 0x0C
+#define OPC_QNN 0x0D
+#define OPC_RQNP 0x10
+#define OPC_RQMN 0x11
+
+#define OPC_SNN 0x42
+#define OPC_DSPD 0x47
+
+#define OPC_RQNN 0x50
+#define OPC_NNREL 0x51
+#define OPC_NNACK 0x52
+#define OPC_NNLRN 0x53
+#define OPC_NNULN 0x54
+#define OPC_NNCLR 0x55
+#define OPC_NNEVN 0x56
+#define OPC_NERD 0x57
+#define OPC_RQEVN 0x58
+#define OPC_WRACK 0x59
+#define OPC_RQDAT 0x5A
+#define OPC_RQDDS 0x5B
+#define OPC_BOOT 0x5C
+#define OPC_ENUM 0x5D
+#define OPC_NNRST 0x5E
+#define OPC_EXTC1 0x5F
+
+#define OPC_CMDERR 0x6F
+#define OPC_EVNLF 0x70
+#define OPC_NVRD 0x71
+#define OPC_NENRD 0x72
+#define OPC_RQNPN 0x73
+#define OPC_NUMEV 0x74
+#define OPC_CANID 0x75
+
+#define OPC_RDGN 0x87
+
+#define OPC_ACON 0x90
+#define OPC_ACOF 0x91
+#define OPC_AREQ 0x92
+#define OPC_ARON 0x93
+#define OPC_AROF 0x94
+#define OPC_EVULN 0x95
+#define OPC_NVSET 0x96
+#define OPC_NVANS 0x97
+#define OPC_ASON 0x98
+#define OPC_ASOF 0x99
+#define OPC_ASRQ 0x9A
+#define OPC_PARAN 0x9B
+#define OPC_REVAL 0x9C
+#define OPC_ARSON 0x9D
+#define OPC_ARSOF 0x9E
+
+#define OPC_ACON1 0xB0
+#define OPC_ACOF1 0xB1
+#define OPC_REQEV 0xB2
+#define OPC_ARON1 0xB3
+#define OPC_AROF1 0xB4
+#define OPC_NEVAL 0xB5
+#define OPC_PNN 0xB6
+#define OPC_ASON1 0xB8
+#define OPC_ASOF1 0xB9
+
+#define OPC_DGN 0xC7
+
+#define OPC_ACON2 0xD0
+#define OPC_ACOF2 0xD1
+#define OPC_EVLRN 0xD2
+#define OPC_EVANS 0xD3
+#define OPC_ASON2 0xD8
+#define OPC_ASOF2 0xD9
+
+#define OPC_NAME 0xE2
+#define OPC_PARAMS 0xEF
+
+#define OPC_ACON3 0xF0
+#define OPC_ACOF3 0xF1
+#define OPC_ENRSP 0xF2
+#define OPC_ASON3 0xF8
+#define OPC_ASOF3 0xF9
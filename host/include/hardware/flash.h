@@ -0,0 +1,31 @@
+//
+/// Host build stand-in for the Pico SDK flash API
+/// Each simulated node has its own flash, which keeps its contents across
+/// resets.  Programming clears bits as NOR flash does, and erase and program
+/// block the calling node for their typical duration.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+#endif
+
+namespace sim
+{
+   const uint8_t *flashMemory();
+   void flashErase(uint32_t offset, size_t count);
+   void flashProgram(uint32_t offset, const uint8_t *data, size_t count);
+}
+
+/// Flash is read through the XIP window, here the current node's flash
+#define XIP_BASE (reinterpret_cast<uintptr_t>(sim::flashMemory()))
+
+inline void flash_range_erase(uint32_t flash_offs, size_t count) { sim::flashErase(flash_offs, count); }
+inline void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) { sim::flashProgram(flash_offs, data, count); }
@@ -0,0 +1,61 @@
+//
+/// Host build stand-in for the Pico SDK GPIO API
+/// All accesses are routed to the GPIO bank of the simulated node currently running
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "pico/types.h"
+
+#define GPIO_IN false
+#define GPIO_OUT true
+
+#define GPIO_IRQ_LEVEL_LOW 0x1u
+#define GPIO_IRQ_LEVEL_HIGH 0x2u
+#define GPIO_IRQ_EDGE_FALL 0x4u
+#define GPIO_IRQ_EDGE_RISE 0x8u
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+namespace sim
+{
+   uint32_t gpioGetAll();
+   void gpioSetDir(uint32_t mask, uint32_t value);
+   void gpioPutMasked(uint32_t mask, uint32_t value);
+   void gpioSetPulls(uint32_t pin, bool up, bool down);
+   void gpioSetIrq(uint32_t pin, uint32_t events, bool enabled, gpio_irq_callback_t callback);
+}
+
+inline void gpio_init(uint32_t gpio)
+{
+   sim::gpioSetDir(1u << gpio, 0);
+   sim::gpioPutMasked(1u << gpio, 0);
+}
+
+inline void gpio_set_dir(uint32_t gpio, bool out) { sim::gpioSetDir(1u << gpio, out ? (1u << gpio) : 0); }
+inline void gpio_set_dir_out_masked(uint32_t mask) { sim::gpioSetDir(mask, mask); }
+inline void gpio_set_dir_in_masked(uint32_t mask) { sim::gpioSetDir(mask, 0); }
+inline void gpio_pull_up(uint32_t gpio) { sim::gpioSetPulls(gpio, true, false); }
+inline void gpio_pull_down(uint32_t gpio) { sim::gpioSetPulls(gpio, false, true); }
+inline void gpio_disable_pulls(uint32_t gpio) { sim::gpioSetPulls(gpio, false, false); }
+
+inline uint32_t gpio_get_all(void) { return sim::gpioGetAll(); }
+inline bool gpio_get(uint32_t gpio) { return (sim::gpioGetAll() >> gpio) & 1u; }
+inline void gpio_put(uint32_t gpio, bool value) { sim::gpioPutMasked(1u << gpio, value ? (1u << gpio) : 0); }
+inline void gpio_put_masked(uint32_t mask, uint32_t value) { sim::gpioPutMasked(mask, value); }
+inline void gpio_set_mask(uint32_t mask) { sim::gpioPutMasked(mask, mask); }
+inline void gpio_clr_mask(uint32_t mask) { sim::gpioPutMasked(mask, 0); }
+
+inline void gpio_init_mask(uint32_t mask)
+{
+   sim::gpioSetDir(mask, 0);
+   sim::gpioPutMasked(mask, 0);
+}
+
+inline void gpio_set_irq_enabled(uint32_t gpio, uint32_t events, bool enabled) { sim::gpioSetIrq(gpio, events, enabled, nullptr); }
+inline void gpio_set_irq_enabled_with_callback(uint32_t gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback)
+{
+   sim::gpioSetIrq(gpio, events, enabled, callback);
+}
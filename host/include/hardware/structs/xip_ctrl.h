@@ -0,0 +1,19 @@
+//
+/// Host build stand-in for the Pico SDK XIP cache control registers
+/// There is no XIP cache, so a flush has nothing to do and completes at once.
+//
+
+#pragma once
+
+#include <cstdint>
+
+struct xip_ctrl_hw_t
+{
+   volatile uint32_t ctrl;
+   volatile uint32_t flush;
+   volatile uint32_t stat;
+};
+
+inline xip_ctrl_hw_t xipCtrlStandIn{};
+
+#define xip_ctrl_hw (&xipCtrlStandIn)
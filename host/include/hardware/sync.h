@@ -0,0 +1,21 @@
+//
+/// Host build stand-in for the Pico SDK core synchronisation primitives
+/// An event sent from core 1 wakes core 0 of the current simulated node
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "pico/platform.h"
+
+namespace sim
+{
+   void sendEvent();
+}
+
+inline void __sev(void) { sim::sendEvent(); }
+inline uint32_t save_and_disable_interrupts(void) { return 0; }
+inline void restore_interrupts(uint32_t status) {}
+inline void __wfe(void) {}
+inline void __dmb(void) {}
@@ -0,0 +1,8 @@
+//
+/// Host build stand-in for Picotool binary info, declarations are discarded
+//
+
+#pragma once
+
+#define bi_decl(_decl)
+#define bi_decl_if_func_used(_decl)
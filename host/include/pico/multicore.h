@@ -0,0 +1,18 @@
+//
+/// Host build stand-in for the Pico SDK multicore functions
+/// The simulator runs core 1 work from the harness, so there is no other core
+/// to pause.  Launching core 1 starts the node's CAN controller through the
+/// harness rather than running the entry function.
+//
+
+#pragma once
+
+namespace sim
+{
+   void launchCore1();
+}
+
+inline void multicore_lockout_victim_init(void) {}
+inline void multicore_lockout_start_blocking(void) {}
+inline void multicore_lockout_end_blocking(void) {}
+inline void multicore_launch_core1(void (*entry)(void)) { sim::launchCore1(); }
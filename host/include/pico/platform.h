@@ -0,0 +1,14 @@
+//
+/// Host build stand-in for the Pico SDK platform definitions
+/// All module code of a simulated node runs as core 0, and there are no
+/// scratch RAM banks or flash to execute in place from, so data placed in
+/// them is ordinary data and functions placed in RAM are ordinary functions.
+//
+
+#pragma once
+
+#define __scratch_x(group)
+#define __scratch_y(group)
+#define __not_in_flash_func(func_name) func_name
+
+inline unsigned int get_core_num(void) { return 0; }
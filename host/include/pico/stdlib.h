@@ -0,0 +1,19 @@
+//
+/// Host build stand-in for the Pico SDK standard library header
+/// Time is the simulator's virtual clock, GPIO is the current simulated node
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#define PICO_ERROR_TIMEOUT (-1)
+
+inline bool stdio_init_all(void) { return true; }
+
+/// No console is attached to a simulated node
+inline int getchar_timeout_us(uint32_t timeout_us) { return PICO_ERROR_TIMEOUT; }
@@ -0,0 +1,28 @@
+//
+/// Host build stand-in for the Pico SDK time functions, driven by the simulator clock
+//
+
+#pragma once
+
+#include <cstdint>
+
+namespace sim
+{
+   uint64_t now();
+   void sleepUs(uint64_t us);
+   bool waitForEvent(uint64_t timeout);
+}
+
+typedef uint64_t absolute_time_t;
+
+inline uint64_t time_us_64(void) { return sim::now(); }
+inline uint32_t time_us_32(void) { return static_cast<uint32_t>(sim::now()); }
+inline absolute_time_t get_absolute_time(void) { return sim::now(); }
+inline uint32_t to_ms_since_boot(absolute_time_t t) { return static_cast<uint32_t>(t / 1000); }
+inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+inline void sleep_us(uint64_t us) { sim::sleepUs(us); }
+inline void sleep_ms(uint32_t ms) { sim::sleepUs(static_cast<uint64_t>(ms) * 1000); }
+
+/// The calling node's core 0 waits until an event or the timeout, see SimHarness::step()
+inline bool best_effort_wfe_or_timeout(absolute_time_t timeout) { return sim::waitForEvent(timeout); }
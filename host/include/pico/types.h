@@ -0,0 +1,9 @@
+//
+/// Host build stand-in for the Pico SDK common types
+//
+
+#pragma once
+
+#include <cstdint>
+
+typedef unsigned int uint;
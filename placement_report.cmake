@@ -0,0 +1,123 @@
+# Placement report - where the receive -> dispatch -> transmit path landed
+#
+# Run after the link with
+#   cmake -DNM=<nm> -DELF=<elf> -DREPORT=<report file> -DRAM_HOT_PATH=<ON|OFF> -P placement_report.cmake
+#
+# Lists every hot path function and hot state object with the memory it was
+# placed in (XIP flash, RAM, SCRATCH_X or SCRATCH_Y) and its size, and totals
+# code and data by memory.  Hot path code left in flash is flagged, and is a
+# warning when the build asked for the hot path in RAM.
+
+# Symbols of the hot path, as demangled by nm
+set(HOT_CODE
+   "^can2040_"
+   "^CBUSbase::" "^CBUSACAN2040::" "^ACAN2040::" "^circular_buffer::"
+   "^CBUSDispatch::" "^EventIndex::" "^SpscRing<" "^FrameTrace::" "^RequestTracker::"
+   "^IndicatorOutput::set" "^BellOutput::(ring|buzz|queue)" "^GridConnectBridge::fromBus"
+   "^eventhandler\\(" "^processRemoteStateMachine\\(" "^processLocalStateMachine\\(" "^sendTransitionEvents\\("
+   "^sendEvents\\(" "^updateIndicators\\(" "^core1Main\\("
+)
+
+set(HOT_STATE
+   "^CBUS$" "^remoteBoxState$" "^localBoxState$" "^lineClearReleased$" "^requests$"
+   "^core0Trace$" "^core1Trace$"
+)
+
+# SysV format gives the symbol type, functions placed in RAM are in .data so the letter of the BSD format says data
+execute_process(COMMAND ${NM} -C --defined-only --format=sysv ${ELF} OUTPUT_VARIABLE SYMBOLS RESULT_VARIABLE NM_RESULT)
+
+if (NOT NM_RESULT EQUAL 0)
+   message(WARNING "Placement report: ${NM} could not read ${ELF}")
+   return()
+endif()
+
+# Memory of an address, from the RP2040 memory map and the regions of memmap_block.ld
+function(region address out)
+   math(EXPR value "0x${address}" OUTPUT_FORMAT DECIMAL)
+
+   if (value GREATER_EQUAL 268435456 AND value LESS 301989888)       # 0x10000000 - 0x12000000
+      set(${out} "flash" PARENT_SCOPE)
+   elseif (value GREATER_EQUAL 536870912 AND value LESS 537133056)   # 0x20000000 - 0x20040000
+      set(${out} "RAM" PARENT_SCOPE)
+   elseif (value GREATER_EQUAL 537133056 AND value LESS 537137152)   # 0x20040000 - 0x20041000
+      set(${out} "SCRATCH_X" PARENT_SCOPE)
+   elseif (value GREATER_EQUAL 537137152 AND value LESS 537141248)   # 0x20041000 - 0x20042000
+      set(${out} "SCRATCH_Y" PARENT_SCOPE)
+   else()
+      set(${out} "other" PARENT_SCOPE)
+   endif()
+endfunction()
+
+# Semicolons would split the list of lines
+string(REPLACE ";" "," SYMBOLS "${SYMBOLS}")
+string(REPLACE "\n" ";" SYMBOLS "${SYMBOLS}")
+
+set(LINES "")
+set(IN_FLASH 0)
+
+foreach (memory flash RAM SCRATCH_X SCRATCH_Y)
+   set(CODE_${memory} 0)
+   set(DATA_${memory} 0)
+endforeach()
+
+foreach (line IN LISTS SYMBOLS)
+   # name|value|class|type|size|line|section
+   if (NOT line MATCHES "^([^|]*[^ |]) *\\|([0-9a-f]+)\\|[^|]*\\| *([A-Z]*) *\\|([0-9a-f]+)\\|")
+      continue()
+   endif()
+
+   set(name "${CMAKE_MATCH_1}")
+   set(address ${CMAKE_MATCH_2})
+   set(type ${CMAKE_MATCH_3})
+   math(EXPR size "0x${CMAKE_MATCH_4}" OUTPUT_FORMAT DECIMAL)
+   region(${address} memory)
+
+   if ((memory STREQUAL "other") OR NOT (type MATCHES "^(FUNC|OBJECT)$"))
+      continue()
+   endif()
+
+   if (type STREQUAL "FUNC")
+      math(EXPR CODE_${memory} "${CODE_${memory}} + ${size}")
+      set(patterns ${HOT_CODE})
+   else()
+      math(EXPR DATA_${memory} "${DATA_${memory}} + ${size}")
+      set(patterns ${HOT_STATE})
+   endif()
+
+   foreach (pattern IN LISTS patterns)
+      if (name MATCHES "${pattern}")
+         set(flag "")
+
+         if ((memory STREQUAL "flash") AND (type STREQUAL "FUNC"))
+            set(flag "  <- runs from flash")
+            math(EXPR IN_FLASH "${IN_FLASH} + 1")
+         endif()
+
+         string(LENGTH "${size}" width)
+         math(EXPR pad "8 - ${width}")
+         string(REPEAT " " ${pad} padding)
+         list(APPEND LINES "${memory}\t${padding}${size}  ${name}${flag}")
+         break()
+      endif()
+   endforeach()
+endforeach()
+
+list(SORT LINES)
+string(REPLACE ";" "\n" LINES "${LINES}")
+
+set(TEXT "CANBlock placement report, hot path in RAM ${RAM_HOT_PATH}\n\n")
+string(APPEND TEXT "Memory\tCode\tData\n")
+
+foreach (memory flash RAM SCRATCH_X SCRATCH_Y)
+   string(APPEND TEXT "${memory}\t${CODE_${memory}}\t${DATA_${memory}}\n")
+endforeach()
+
+string(APPEND TEXT "\nHot path symbols (memory, size, name)\n${LINES}\n")
+file(WRITE ${REPORT} "${TEXT}")
+
+message("Placement report written to ${REPORT}: code flash ${CODE_flash} RAM ${CODE_RAM} bytes, "
+        "hot path functions in flash ${IN_FLASH}")
+
+if (RAM_HOT_PATH AND IN_FLASH)
+   message(WARNING "${IN_FLASH} hot path functions run from flash, see ${REPORT}")
+endif()
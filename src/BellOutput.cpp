@@ -0,0 +1,216 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "BellOutput.h"
+
+namespace
+{
+   constexpr uint16_t STROKE_STEPS = BellOutput::STROKE_US / BellOutput::STEP_US;
+   constexpr uint16_t STROKE_PERIOD_STEPS = BellOutput::STROKE_PERIOD_US / BellOutput::STEP_US;
+   constexpr uint16_t GROUP_PERIOD_STEPS = BellOutput::GROUP_PERIOD_US / BellOutput::STEP_US;
+   constexpr uint16_t BUZZ_GAP_STEPS = BellOutput::BUZZ_GAP_US / BellOutput::STEP_US;
+
+   static_assert((STROKE_STEPS > 0) && (STROKE_STEPS < STROKE_PERIOD_STEPS) &&
+                     (STROKE_PERIOD_STEPS <= GROUP_PERIOD_STEPS) && (BUZZ_GAP_STEPS > 0),
+                 "Bell timing out of step");
+
+   /// Groups of a bell code, first group first
+   /// @return number of groups, 0 if a group has no strokes
+   uint8_t groups(uint32_t code, uint8_t (&digits)[10])
+   {
+      uint8_t n = 0;
+
+      for (; code; code /= 10)
+      {
+         if (!(code % 10))
+         {
+            return 0;
+         }
+
+         digits[n++] = code % 10;
+      }
+
+      for (uint8_t i = 0; i < (n / 2); i++)
+      {
+         const uint8_t digit = digits[i];
+         digits[i] = digits[n - 1 - i];
+         digits[n - 1 - i] = digit;
+      }
+
+      return n;
+   }
+}
+
+bool BellOutput::begin(TonePlayer &player, uint8_t buzzerPin, uint8_t bellPin)
+{
+   m_head = 0;
+   m_count = 0;
+   m_player = player.begin(buzzerPin, bellPin, STEP_US) ? &player : nullptr;
+   return m_player != nullptr;
+}
+
+bool BellOutput::ring(uint32_t code)
+{
+   uint8_t digits[10];
+   const uint8_t n = groups(code, digits);
+
+   if (!n || !queue({code, 0}))
+   {
+      return false;
+   }
+
+   for (uint8_t g = 0; g < n; g++)
+   {
+      m_strokes += digits[g];
+   }
+
+   return true;
+}
+
+bool BellOutput::buzz(uint32_t us)
+{
+   const uint32_t steps = (us + STEP_US - 1) / STEP_US;
+   return steps && (steps < MAX_STEPS) && queue({0, static_cast<uint16_t>(steps)});
+}
+
+void BellOutput::run()
+{
+   if (!m_player || !m_count || m_player->isPlaying())
+   {
+      return;
+   }
+
+   // Every queued sound that fits goes out in one pattern
+   uint16_t steps = 0;
+
+   while (m_count && ((steps + length(m_queue[m_head])) <= MAX_STEPS))
+   {
+      steps = render(m_queue[m_head], steps);
+      m_head = (m_head + 1) % QUEUE_SOUNDS;
+      m_count--;
+   }
+
+   m_player->play(m_steps, steps);
+}
+
+uint64_t BellOutput::nextRunUs() const
+{
+   return (m_player && m_count) ? m_player->endUs() : UINT64_MAX;
+}
+
+///
+/// @brief Steps a sound takes, its strokes or buzz and the silence after them
+///
+uint16_t BellOutput::length(const Sound &sound)
+{
+   if (!sound.code)
+   {
+      return sound.buzzSteps + BUZZ_GAP_STEPS;
+   }
+
+   uint8_t digits[10];
+   const uint8_t n = groups(sound.code, digits);
+   uint32_t steps = (n - 1) * GROUP_PERIOD_STEPS;
+
+   for (uint8_t g = 0; g < n; g++)
+   {
+      steps += (digits[g] - 1) * STROKE_PERIOD_STEPS;
+   }
+
+   // The last stroke and the stroke period after it, so codes queued together stay apart
+   steps += STROKE_PERIOD_STEPS;
+   return (steps > MAX_STEPS) ? (MAX_STEPS + 1) : static_cast<uint16_t>(steps);
+}
+
+bool BellOutput::queue(const Sound &sound)
+{
+   if (!m_player || (m_count == QUEUE_SOUNDS) || (length(sound) > MAX_STEPS))
+   {
+      m_dropped++;
+      return false;
+   }
+
+   m_queue[(m_head + m_count) % QUEUE_SOUNDS] = sound;
+   m_count++;
+   return true;
+}
+
+///
+/// @brief Write the steps of a sound into the pattern
+///
+/// @return the step after the sound, which ends silent
+///
+uint16_t BellOutput::render(const Sound &sound, uint16_t at)
+{
+   const uint16_t end = at + length(sound);
+
+   for (uint16_t i = at; i < end; i++)
+   {
+      m_steps[i] = 0;
+   }
+
+   if (!sound.code)
+   {
+      for (uint16_t i = 0; i < sound.buzzSteps; i++)
+      {
+         m_steps[at + i] = m_player->buzzerOn();
+      }
+
+      return end;
+   }
+
+   uint8_t digits[10];
+   const uint8_t n = groups(sound.code, digits);
+   uint16_t stroke = at;
+
+   for (uint8_t g = 0; g < n; g++)
+   {
+      for (uint8_t s = 0; s < digits[g]; s++)
+      {
+         for (uint16_t i = 0; i < STROKE_STEPS; i++)
+         {
+            m_steps[stroke + i] = m_player->bellOn();
+         }
+
+         stroke += ((s + 1) < digits[g]) ? STROKE_PERIOD_STEPS : GROUP_PERIOD_STEPS;
+      }
+   }
+
+   return end;
+}
@@ -0,0 +1,114 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "TonePlayer.h"
+
+#include <cstdint>
+
+///
+/// @brief Attention bell and warning buzzer, sounded without holding up the loop
+///
+/// Bell codes and buzzes are queued, and run() renders every queued sound
+/// that fits into one pattern of STEP_US steps for the TonePlayer, which
+/// plays it by DMA.  The CPU does nothing per stroke, and the sounds queued
+/// while a pattern plays go out in the next one.
+///
+/// A bell code gives the strokes of each group as a decimal digit, most
+/// significant first: 1 is one stroke, 12 is 1-pause-2 and 313 is 3-pause-1-pause-3.
+///
+class BellOutput
+{
+public:
+   static constexpr uint32_t STEP_US = 10000;           ///< Time each step of a pattern is held (us)
+   static constexpr uint16_t MAX_STEPS = 512;           ///< Steps of one pattern
+   static constexpr uint8_t QUEUE_SOUNDS = 8;           ///< Sounds waiting for the next pattern
+   static constexpr uint32_t STROKE_US = 40000;         ///< Bell striker pulse (us)
+   static constexpr uint32_t STROKE_PERIOD_US = 250000; ///< Stroke to stroke within a group (us)
+   static constexpr uint32_t GROUP_PERIOD_US = 750000;  ///< Last stroke of a group to the first of the next (us)
+   static constexpr uint32_t BUZZ_GAP_US = 250000;      ///< Silence after a buzz (us)
+
+   /// Start the player, the bell then sounds what is queued
+   /// @return false if the player cannot start, sounds are then refused
+   bool begin(TonePlayer &player, uint8_t buzzerPin, uint8_t bellPin);
+
+   /// Queue a bell code
+   /// @return false if the code has a group of no strokes, is too long to play or the queue is full
+   bool ring(uint32_t code);
+
+   /// Queue a buzz
+   /// @return false if it is too long to play or the queue is full
+   bool buzz(uint32_t us);
+
+   /// Start playing the queued sounds once the last pattern has played
+   void run();
+
+   /// Time run() must next be called by (us since boot), UINT64_MAX if nothing is queued
+   uint64_t nextRunUs() const;
+
+   /// The bell and buzzer are fitted and their player started
+   bool isFitted() const { return m_player != nullptr; }
+
+   /// Bell strokes queued
+   uint32_t getStrokes() const { return m_strokes; }
+
+   /// Sounds refused, for a full queue or an unplayable code
+   uint32_t getDropped() const { return m_dropped; }
+
+private:
+   /// Queued sound, a bell code or a buzz of buzzSteps if code is 0
+   struct Sound
+   {
+      uint32_t code;
+      uint16_t buzzSteps;
+   };
+
+   static uint16_t length(const Sound &sound);
+   bool queue(const Sound &sound);
+   uint16_t render(const Sound &sound, uint16_t at);
+
+   TonePlayer *m_player{nullptr};
+   uint32_t m_steps[MAX_STEPS]{}; ///< Pattern being played, read by the player's DMA
+   Sound m_queue[QUEUE_SOUNDS]{};
+   uint8_t m_head{0};
+   uint8_t m_count{0};
+   uint32_t m_strokes{0};
+   uint32_t m_dropped{0};
+};
@@ -0,0 +1,504 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CANBlock.h" // Block event and state definitions
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//
+/// Block instrument state machines as compile time transition tables
+///
+/// The remote machine answers requests from the box in rear, the local machine
+/// sends our requests and follows the ACK's from the box in advance.  Each
+/// table is generated from a short list of rules, every (state, input) pair
+/// not named by a rule leaves the state unchanged and sends nothing.
+///
+/// Dispatch is a single indexed lookup, and the tables are checked at compile
+/// time so every state is reachable and has a way back to Normal.
+//
+
+constexpr size_t NUM_BLOCK_STATES = 4;        ///< Number of BlockState values
+constexpr size_t MAX_TRANSITION_EVENTS = 3;   ///< Most events sent by a single transition
+
+/// Inputs to the remote box state machine
+enum class RemoteInput : uint8_t
+{
+   LineClearRequest,    ///< Box in rear requests Line Clear
+   TrainOnTrackRequest, ///< Box in rear reports Train on Track
+   BlockClearedRequest, ///< Box in rear reports the block cleared (or cancels a blocked request)
+   ResetRequest,        ///< Box in rear resets Line Clear back to Normal
+   CommutatorLocked,    ///< Commutator lock applied
+   CommutatorReleased,  ///< Commutator lock released
+   None                 ///< No input (event not for this machine)
+};
+
+constexpr size_t NUM_REMOTE_INPUTS = static_cast<size_t>(RemoteInput::None);
+
+/// Inputs to the local box state machine
+enum class LocalInput : uint8_t
+{
+   LineClearSwitch,    ///< Line Clear switch operated
+   TrainOnTrackSwitch, ///< Train on Track switch operated
+   NormalSwitch,       ///< Normal switch operated
+   LineClearAck,       ///< Box in advance ACK's Line Clear
+   TrainOnTrackAck,    ///< Box in advance ACK's Train on Track
+   BlockClearedAck,    ///< Box in advance ACK's Normal
+   LineClearNack,      ///< Box in advance has Line Clear blocked
+   None                ///< No input (event not for this machine)
+};
+
+constexpr size_t NUM_LOCAL_INPUTS = static_cast<size_t>(LocalInput::None);
+
+/// Commutator lock condition a remote rule applies to
+enum class Lock : uint8_t
+{
+   Released, ///< Only when the commutator is released
+   Locked,   ///< Only when the commutator is locked
+   Either    ///< Regardless of the commutator
+};
+
+constexpr size_t NUM_LOCK_STATES = 2; ///< Released, Locked
+
+/// Outgoing event of a transition
+struct OutEvent
+{
+   OutEventID id; ///< Event
+   bool on;       ///< ACON (true) or ACOF (false)
+};
+
+/// Table entry, the new state and the events to send
+struct Transition
+{
+   BlockState next;                            ///< State after the input
+   uint8_t numEvents;                          ///< Number of events to send
+   OutEvent events[MAX_TRANSITION_EVENTS];     ///< Events to send, in order
+};
+
+/// Rule of the remote machine
+struct RemoteRule
+{
+   BlockState from;
+   RemoteInput input;
+   Lock lock;
+   Transition to;
+};
+
+/// Rule of the local machine, anyState applies the rule to every state
+struct LocalRule
+{
+   BlockState from;
+   bool anyState;
+   LocalInput input;
+   Transition to;
+};
+
+using RemoteTable = std::array<std::array<std::array<Transition, NUM_REMOTE_INPUTS>, NUM_BLOCK_STATES>, NUM_LOCK_STATES>;
+using LocalTable = std::array<std::array<Transition, NUM_LOCAL_INPUTS>, NUM_BLOCK_STATES>;
+
+constexpr size_t idx(BlockState s) { return static_cast<size_t>(s); }
+constexpr size_t idx(RemoteInput i) { return static_cast<size_t>(i); }
+constexpr size_t idx(LocalInput i) { return static_cast<size_t>(i); }
+
+/// Events are written as ON(id) / OFF(id) in the rules
+constexpr OutEvent ON(OutEventID id) { return {id, true}; }
+constexpr OutEvent OFF(OutEventID id) { return {id, false}; }
+
+//
+/// Remote box - requests from the box in rear
+//
+
+constexpr RemoteRule remoteRules[] = {
+    // Normal - Line Clear is given if the commutator is free, otherwise blocked
+    {BlockState::Normal, RemoteInput::LineClearRequest, Lock::Released,
+     {BlockState::LineClear, 2, {OFF(OutEventID::blockClearedAck), ON(OutEventID::lineClearAck)}}},
+    {BlockState::Normal, RemoteInput::LineClearRequest, Lock::Locked,
+     {BlockState::LCBlocked, 1, {ON(OutEventID::lineClearBlocked)}}},
+
+    // Line Clear - train enters the block, or an abnormal reset to Normal
+    {BlockState::LineClear, RemoteInput::TrainOnTrackRequest, Lock::Either,
+     {BlockState::TrainOnTrack, 2, {OFF(OutEventID::lineClearAck), ON(OutEventID::trainOnTrackAck)}}},
+    {BlockState::LineClear, RemoteInput::ResetRequest, Lock::Either,
+     {BlockState::Normal, 2, {OFF(OutEventID::lineClearAck), ON(OutEventID::blockClearedAck)}}},
+
+    // Train on Track - train leaves the block
+    {BlockState::TrainOnTrack, RemoteInput::BlockClearedRequest, Lock::Either,
+     {BlockState::Normal, 2, {OFF(OutEventID::trainOnTrackAck), ON(OutEventID::blockClearedAck)}}},
+
+    // Line Clear blocked - given once the commutator is released, or the request is withdrawn
+    {BlockState::LCBlocked, RemoteInput::CommutatorReleased, Lock::Released,
+     {BlockState::LineClear, 3, {OFF(OutEventID::lineClearBlocked), OFF(OutEventID::blockClearedAck), ON(OutEventID::lineClearAck)}}},
+    {BlockState::LCBlocked, RemoteInput::LineClearRequest, Lock::Released,
+     {BlockState::LineClear, 3, {OFF(OutEventID::lineClearBlocked), OFF(OutEventID::blockClearedAck), ON(OutEventID::lineClearAck)}}},
+    {BlockState::LCBlocked, RemoteInput::BlockClearedRequest, Lock::Either,
+     {BlockState::Normal, 2, {OFF(OutEventID::lineClearBlocked), ON(OutEventID::blockClearedAck)}}},
+
+    // A repeated request is answered again, the box in rear retries when a reply is lost
+    {BlockState::LineClear, RemoteInput::LineClearRequest, Lock::Either,
+     {BlockState::LineClear, 1, {ON(OutEventID::lineClearAck)}}},
+    {BlockState::LCBlocked, RemoteInput::LineClearRequest, Lock::Locked,
+     {BlockState::LCBlocked, 1, {ON(OutEventID::lineClearBlocked)}}},
+    {BlockState::TrainOnTrack, RemoteInput::TrainOnTrackRequest, Lock::Either,
+     {BlockState::TrainOnTrack, 1, {ON(OutEventID::trainOnTrackAck)}}},
+    {BlockState::Normal, RemoteInput::BlockClearedRequest, Lock::Either,
+     {BlockState::Normal, 1, {ON(OutEventID::blockClearedAck)}}},
+    {BlockState::Normal, RemoteInput::ResetRequest, Lock::Either,
+     {BlockState::Normal, 1, {ON(OutEventID::blockClearedAck)}}},
+};
+
+//
+/// Local box - our requests to the box in advance and its replies
+//
+
+constexpr LocalRule localRules[] = {
+    // Switch operations send requests, the state follows the reply
+    {BlockState::Normal, false, LocalInput::LineClearSwitch,
+     {BlockState::Normal, 2, {OFF(OutEventID::blockCleared), ON(OutEventID::lineClear)}}},
+    {BlockState::LineClear, false, LocalInput::TrainOnTrackSwitch,
+     {BlockState::LineClear, 2, {OFF(OutEventID::lineClear), ON(OutEventID::trainOnTrack)}}},
+    {BlockState::LineClear, false, LocalInput::NormalSwitch,
+     {BlockState::LineClear, 2, {OFF(OutEventID::lineClear), ON(OutEventID::resetLineClear)}}},
+    {BlockState::TrainOnTrack, false, LocalInput::NormalSwitch,
+     {BlockState::TrainOnTrack, 2, {OFF(OutEventID::trainOnTrack), ON(OutEventID::blockCleared)}}},
+    {BlockState::LCBlocked, false, LocalInput::NormalSwitch,
+     {BlockState::LCBlocked, 2, {OFF(OutEventID::lineClear), ON(OutEventID::blockCleared)}}},
+
+    // Replies from the box in advance set the state, whatever we last requested
+    {BlockState::Normal, true, LocalInput::LineClearAck, {BlockState::LineClear, 0, {}}},
+    {BlockState::Normal, true, LocalInput::TrainOnTrackAck, {BlockState::TrainOnTrack, 0, {}}},
+    {BlockState::Normal, true, LocalInput::BlockClearedAck, {BlockState::Normal, 0, {}}},
+    {BlockState::Normal, true, LocalInput::LineClearNack, {BlockState::LCBlocked, 0, {}}},
+};
+
+//
+/// Table generation
+//
+
+template <size_t N>
+constexpr RemoteTable makeRemoteTable(const RemoteRule (&rules)[N])
+{
+   RemoteTable table{};
+
+   for (size_t lock = 0; lock < NUM_LOCK_STATES; lock++)
+   {
+      for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+      {
+         for (size_t input = 0; input < NUM_REMOTE_INPUTS; input++)
+         {
+            table[lock][state][input] = {static_cast<BlockState>(state), 0, {}};
+         }
+      }
+   }
+
+   for (const RemoteRule &rule : rules)
+   {
+      for (size_t lock = 0; lock < NUM_LOCK_STATES; lock++)
+      {
+         if ((rule.lock == Lock::Either) || (static_cast<size_t>(rule.lock) == lock))
+         {
+            table[lock][idx(rule.from)][idx(rule.input)] = rule.to;
+         }
+      }
+   }
+
+   return table;
+}
+
+template <size_t N>
+constexpr LocalTable makeLocalTable(const LocalRule (&rules)[N])
+{
+   LocalTable table{};
+
+   for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+   {
+      for (size_t input = 0; input < NUM_LOCAL_INPUTS; input++)
+      {
+         table[state][input] = {static_cast<BlockState>(state), 0, {}};
+      }
+   }
+
+   for (const LocalRule &rule : rules)
+   {
+      for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+      {
+         if (rule.anyState || (idx(rule.from) == state))
+         {
+            table[state][idx(rule.input)] = rule.to;
+         }
+      }
+   }
+
+   return table;
+}
+
+constexpr RemoteTable remoteTransitions = makeRemoteTable(remoteRules); ///< [lock][state][input]
+constexpr LocalTable localTransitions = makeLocalTable(localRules);     ///< [state][input]
+
+//
+/// Compile time checks
+//
+
+/// Successor states of each state, as bit masks
+struct Successors
+{
+   uint8_t next[NUM_BLOCK_STATES];
+};
+
+/// Successors of each state over every input of a [state][input] table
+template <typename Table>
+constexpr Successors successors(const Table &table)
+{
+   Successors s{};
+
+   for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+   {
+      for (const Transition &t : table[state])
+      {
+         s.next[state] |= 1u << idx(t.next);
+      }
+   }
+
+   return s;
+}
+
+/// Successors when either of two tables may apply (e.g. the commutator can change at any time)
+constexpr Successors merge(const Successors &a, const Successors &b)
+{
+   Successors s{};
+
+   for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+   {
+      s.next[state] = a.next[state] | b.next[state];
+   }
+
+   return s;
+}
+
+/// States reachable from a start state
+constexpr uint8_t reachable(const Successors &s, BlockState from)
+{
+   uint8_t seen = 1u << idx(from);
+
+   for (size_t pass = 0; pass < NUM_BLOCK_STATES; pass++)
+   {
+      for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+      {
+         if (seen & (1u << state))
+         {
+            seen |= s.next[state];
+         }
+      }
+   }
+
+   return seen;
+}
+
+/// Normal can be reached from every state, i.e. no state or group of states is a dead end
+constexpr bool returnsToNormal(const Successors &s)
+{
+   for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+   {
+      if (!(reachable(s, static_cast<BlockState>(state)) & (1u << idx(BlockState::Normal))))
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/// Every state is reachable from Normal and can get back to it
+constexpr bool isLive(const Successors &s)
+{
+   return (reachable(s, BlockState::Normal) == ((1u << NUM_BLOCK_STATES) - 1)) && returnsToNormal(s);
+}
+
+/// A state has at least one input that leaves it
+template <typename Row>
+constexpr bool hasExit(const Row &row, BlockState state)
+{
+   for (const Transition &t : row)
+   {
+      if (t.next != state)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+constexpr size_t RELEASED = 0; ///< Lock index - commutator released
+constexpr size_t LOCKED = 1;   ///< Lock index - commutator locked
+
+static_assert(isLive(successors(localTransitions)), "Local block state machine has an unreachable state or a dead end");
+static_assert(hasExit(localTransitions[idx(BlockState::LCBlocked)], BlockState::LCBlocked), "Local LCBlocked has no exit");
+
+static_assert(isLive(merge(successors(remoteTransitions[RELEASED]), successors(remoteTransitions[LOCKED]))),
+              "Remote block state machine has an unreachable state or a dead end");
+static_assert(returnsToNormal(successors(remoteTransitions[LOCKED])), "Remote block can not return to Normal while the commutator is locked");
+static_assert(hasExit(remoteTransitions[RELEASED][idx(BlockState::LCBlocked)], BlockState::LCBlocked), "Remote LCBlocked has no exit when released");
+static_assert(hasExit(remoteTransitions[LOCKED][idx(BlockState::LCBlocked)], BlockState::LCBlocked), "Remote LCBlocked has no exit while locked");
+
+//
+/// Indicators
+//
+
+/// Indicator bits of an LED pattern
+enum Indicator : uint8_t
+{
+   IND_TRAIN_ON_TRACK = 1u << 0, ///< Train on Track
+   IND_NORMAL = 1u << 1,         ///< Normal
+   IND_LINE_CLEAR = 1u << 2,     ///< Line Clear
+   IND_WARNING = 1u << 3,        ///< Line Clear blocked warning
+   IND_OCCUPIED = 1u << 4,       ///< Block occupied
+};
+
+/// Indicators lit (on) and flashing (blink) for a state
+struct LedPattern
+{
+   uint8_t on;
+   uint8_t blink;
+};
+
+/// Remote box indicators by state
+constexpr LedPattern remoteIndicators[NUM_BLOCK_STATES] = {
+    {IND_NORMAL, 0},                          // Normal
+    {IND_LINE_CLEAR | IND_OCCUPIED, 0},       // LineClear
+    {IND_TRAIN_ON_TRACK | IND_OCCUPIED, 0},   // TrainOnTrack
+    {IND_NORMAL | IND_WARNING, IND_LINE_CLEAR}, // LCBlocked
+};
+
+/// Local box indicators by state
+constexpr LedPattern localIndicators[NUM_BLOCK_STATES] = {
+    {IND_NORMAL, 0},                 // Normal
+    {IND_LINE_CLEAR, 0},             // LineClear
+    {IND_TRAIN_ON_TRACK, 0},         // TrainOnTrack
+    {IND_NORMAL, IND_LINE_CLEAR},    // LCBlocked
+};
+
+//
+/// Routing of incoming events to the state machines
+//
+
+/// State machine inputs of an incoming event, for ACOF and ACON
+struct EventRoute
+{
+   RemoteInput remote[2]; ///< [off, on]
+   LocalInput local[2];   ///< [off, on]
+};
+
+constexpr EventRoute eventRoutes[MAX_EVENT_ID] = {
+    // commutatorLock
+    {{RemoteInput::CommutatorReleased, RemoteInput::CommutatorLocked}, {LocalInput::None, LocalInput::None}},
+    // lineClear
+    {{RemoteInput::None, RemoteInput::LineClearRequest}, {LocalInput::None, LocalInput::None}},
+    // trainOnTrack
+    {{RemoteInput::None, RemoteInput::TrainOnTrackRequest}, {LocalInput::None, LocalInput::None}},
+    // blockCleared
+    {{RemoteInput::None, RemoteInput::BlockClearedRequest}, {LocalInput::None, LocalInput::None}},
+    // attentionBell
+    {{RemoteInput::None, RemoteInput::None}, {LocalInput::None, LocalInput::None}},
+    // resetLineClear
+    {{RemoteInput::None, RemoteInput::ResetRequest}, {LocalInput::None, LocalInput::None}},
+    // lineClearAck
+    {{RemoteInput::None, RemoteInput::None}, {LocalInput::None, LocalInput::LineClearAck}},
+    // trainOnTrackAck
+    {{RemoteInput::None, RemoteInput::None}, {LocalInput::None, LocalInput::TrainOnTrackAck}},
+    // blockClearedAck
+    {{RemoteInput::None, RemoteInput::None}, {LocalInput::None, LocalInput::BlockClearedAck}},
+    // lineClearBlocked
+    {{RemoteInput::None, RemoteInput::None}, {LocalInput::None, LocalInput::LineClearNack}},
+};
+
+//
+/// Block states as event states
+///
+/// The transitions into each remote state leave one ACK ON, and each local
+/// state follows one request left ON, so a box can answer a query for the
+/// state of one of its events after the box at the other end has been reset.
+//
+
+/// ACK left ON in each remote state
+constexpr OutEventID remoteStateAck[NUM_BLOCK_STATES] = {
+    OutEventID::blockClearedAck,  // Normal
+    OutEventID::lineClearAck,     // LineClear
+    OutEventID::trainOnTrackAck,  // TrainOnTrack
+    OutEventID::lineClearBlocked, // LCBlocked
+};
+
+/// Request left ON in each local state, a blocked Line Clear request stays ON
+constexpr OutEventID localStateRequest[NUM_BLOCK_STATES] = {
+    OutEventID::blockCleared, // Normal
+    OutEventID::lineClear,    // LineClear
+    OutEventID::trainOnTrack, // TrainOnTrack
+    OutEventID::lineClear,    // LCBlocked
+};
+
+/// True if every remote transition to another state turns the ACK of that state ON
+constexpr bool leavesStateAck(const RemoteTable &table)
+{
+   for (const auto &lock : table)
+   {
+      for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+      {
+         for (const Transition &t : lock[state])
+         {
+            bool on = (idx(t.next) == state);
+
+            for (uint8_t i = 0; i < t.numEvents; i++)
+            {
+               on |= t.events[i].on && (t.events[i].id == remoteStateAck[idx(t.next)]);
+            }
+
+            if (!on)
+            {
+               return false;
+            }
+         }
+      }
+   }
+
+   return true;
+}
+
+static_assert(leavesStateAck(remoteTransitions), "A remote transition does not leave the ACK of its state ON");
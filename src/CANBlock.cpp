@@ -47,9 +47,31 @@
 #include "cbusdefs.h"     // CBUS constants
 #include "CBUSUtil.h"     // Utility macros
 
+#include "CANBlock.h"     // Block event and state definitions
+#include "ModuleVariant.h" // Compile time module variant
+#include "CBUSDispatch.h" // CBUS transport with learned event fast path
+#include "BlockStateMachine.h" // Block state machine transition tables
+#include "IndicatorOutput.h" // Block indicator LED output stage
+#include "LoopScheduler.h" // Event driven main loop
+#include "Telemetry.h" // Performance counters, readable over CBUS
+#include "ConfigJournal.h" // Module settings, journalled to flash
+#include "RequestTracker.h" // Request timeouts and retries
+#include "StateResync.h" // State queries to the box at the other end after a reset
+#include "FrameTrace.h" // Frame and state trace, dumped over USB stdio
+#include "SwitchInput.h" // Debounced switch inputs
+#include "InputCapture.h" // PIO sampling of the switch inputs
+#include "PortExpander.h" // I2C port expanders of panel sections
+#include "BellOutput.h" // Attention bell and warning buzzer
+#include "TonePlayer.h" // PWM and DMA player of the bell patterns
+#include "GridConnectBridge.h" // GridConnect gateway to a PC on USB
+#include "UsbSerial.h" // USB CDC port
+
 #include <cstdio>
 #include <pico/stdlib.h>
 #include <pico/binary_info.h>
+#include <pico/multicore.h>
+#include <hardware/sync.h>
+#include <hardware/structs/xip_ctrl.h>
 
 // constants
 constexpr uint8_t VER_MAJ = 1;   ///< module code major version
@@ -67,8 +89,8 @@ constexpr uint8_t CAN_RX = 11; ///< CAN2040 Rx pin
 constexpr uint8_t CAN_TX = 12; ///< CAN2040 Tx pin
 
 // Map Module IO Pins
-constexpr uint8_t INST_BUZZ = 2;      ///< Block Instrument Warning Buzzer (currently not used)
-constexpr uint8_t INST_BELL = 3;      ///< Block Instrument Bell (currently not used)
+constexpr uint8_t INST_BUZZ = 2;      ///< Block Instrument Warning Buzzer
+constexpr uint8_t INST_BELL = 3;      ///< Block Instrument Bell
 constexpr uint8_t LED_TRAIN_OT_R = 4; ///< Train on Track Remote indication
 constexpr uint8_t LED_TRAIN_OT_L = 5; ///< Train on Track Local indication
 constexpr uint8_t LED_NORMAL_R = 6;   ///< Line Normal Remote indication
@@ -84,83 +106,288 @@ constexpr uint8_t BELL_PUSH = 18;      ///< Attention bell push (to remote box)
 constexpr uint8_t WARN_LED = 22; ///< Line Clear request (commucator) locked warning
 constexpr uint8_t OCCP_LED = 25; ///< Line 'Occupied LED
 
-// CBUS objects
-CBUSConfig module_config; ///< CBUS configuration object
+constexpr uint8_t EXPANDER_INT = 13; ///< Port expander INTA outputs, wired together
 
-// Construct CBUS Object and assign the module configuration
-CBUSACAN2040 CBUS(module_config);
+#ifndef CANBLOCK_NUM_SECTIONS
+#define CANBLOCK_NUM_SECTIONS 1
+#endif
 
-// Block Instrument objects
-CBUSLED totremoteLED; ///< Train on Track - remote box indicator
-CBUSLED totlocalLED;  ///< Train on Track - local box indicator
-CBUSLED nrmremoteLED; ///< Normal - remote box indicator
-CBUSLED nrmlocalLED;  ///< Normal - local box indicator
-CBUSLED clrremoteLED; ///< Line Clear - remote box indicator
-CBUSLED clrlocalLED;  ///< Line Clear - local box indicator
+#ifndef CANBLOCK_TRACE
+#define CANBLOCK_TRACE 1
+#endif
+
+#ifndef CANBLOCK_DEBOUNCE_MS
+#define CANBLOCK_DEBOUNCE_MS 20
+#endif
 
-CBUSSwitch lineClearSW;    ///< Line Clear Switch
-CBUSSwitch trainOnTrackSW; ///< Train on Track Switch
-CBUSSwitch normalSW;       ///< Normal Switch
-CBUSSwitch bellPush;       ///< Remote box attention plunger
+#ifndef CANBLOCK_INPUT_CAPTURE
+#define CANBLOCK_INPUT_CAPTURE 1
+#endif
 
-CBUSLED warnLED; ///< Line Clear request blocked warning indicator
-CBUSLED occpLED; ///< Block Occupied indicator
+#ifndef CANBLOCK_RAM_HOT_PATH
+#define CANBLOCK_RAM_HOT_PATH 0
+#endif
 
-// module name, must be 7 characters, space padded.
-module_name_t moduleName = {'B', 'L', 'O', 'C', 'K', ' ', ' '};
+#ifndef CANBLOCK_GRIDCONNECT
+#define CANBLOCK_GRIDCONNECT 0
+#endif
 
-/// Event Constants
-enum class InEventID
-{
-   // Incoming event ID's from remote box
-   commutatorLock,  ///< Commutator is locked (prevent Line Clear)
-   lineClear,       ///< Line Clear
-   trainOnTrack,    ///< Train entered block
-   blockCleared,    ///< Train left block
-   attentionBell,   ///< Attention bell from remote box
-   resetLineClear,  ///< Reset from Line Clear state to Normal (abnormal state transition)
-   // Incoming event ID's to ACK (or NACK) local changes of state
-   lineClearAck,    ///< ACK of our request for Line Clear
-   trainOnTrackAck, ///< ACK of our request for Train on Track
-   blockClearedAck, ///< ACK of our requst for Block Cleared (Normal)
-   lineClearBlocked ///< NACK of our request for Line Clear
-};
+#ifndef CANBLOCK_NEEDLE
+#define CANBLOCK_NEEDLE 0
+#endif
 
-/// Outgoing events
-enum class OutEventID
-{
-   lineClearBlocked, ///< Line Clear NACK
-   lineClearAck,     ///< Line Clear ACK
-   trainOnTrackAck,  ///< Train entered block ACK
-   blockClearedAck,  ///< Train left block ACK
-   attentionBell,    ///< Call attention to remote box
-   resetLineClear,   ///< @todo 
-   lineClear,        ///< Line Clear request
-   trainOnTrack,     ///< Train on Track 
-   blockCleared      ///< Train left block
+#ifndef CANBLOCK_VARIANT_NAME
+#define CANBLOCK_VARIANT_NAME "custom"
+#endif
+
+// Functions of the receive -> dispatch -> transmit path, and the state they write, are kept
+// out of flash, so an XIP cache miss cannot stall them.  The library objects of the path are
+// placed in RAM by the linker script.
+#if CANBLOCK_RAM_HOT_PATH
+#define HOT_PATH_FUNC(name) __not_in_flash_func(name)
+#define HOT_PATH_STATE __scratch_y("hot_path")
+#else
+#define HOT_PATH_FUNC(name) name
+#define HOT_PATH_STATE
+#endif
+
+constexpr int TRACE_DUMP_KEY = 'T'; ///< Character on stdio that asks for a trace dump
+constexpr int BENCHMARK_KEY = 'B';  ///< Character on stdio that asks for the dispatch benchmark
+constexpr uint16_t BENCHMARK_RUNS = 100; ///< Dispatches timed by the benchmark, warm and cold
+constexpr uint32_t DEBOUNCE_US = CANBLOCK_DEBOUNCE_MS * 1000; ///< Time a switch input must be steady to change (us)
+
+constexpr uint8_t VARIANT_NVS = 10;        ///< Node variables of every variant, the event table follows them
+constexpr uint8_t VARIANT_RX_BUFFERS = 25; ///< Library CAN RX buffers of every variant
+
+/// This build of the module, every size and feature below follows from it
+constexpr ModuleVariant VARIANT{CANBLOCK_VARIANT_NAME, CANBLOCK_NUM_SECTIONS, NUM_EXPANDERS,
+                                CANBLOCK_NEEDLE ? Pairing::CANMIO : Pairing::CANBlock, VARIANT_NVS,
+                                VARIANT_RX_BUFFERS};
+
+static_assert(VARIANT.eventsStart() == 20, "Moving the event table loses the events taught to existing modules");
+
+constexpr uint8_t NUM_SECTIONS = VARIANT.sections;      ///< Block sections run by this module
+constexpr bool BELL_FITTED = VARIANT.bellFitted();      ///< Bell fitted and section 1 has not taken its pins
+constexpr uint32_t WARNING_BUZZ_US = 1000000;          ///< Buzz when the box in advance refuses Line Clear (us)
+constexpr uint8_t EVENTS_PER_SECTION = VARIANT.eventsPerSection(); ///< Event table entries per section
+constexpr uint8_t NUM_NVS = VARIANT.numNVs;             ///< Node variables
+constexpr uint8_t SETTINGS_NVS = 0;                     ///< Offset of NV 1 in the module settings
+constexpr uint8_t SETTINGS_BLOCK_STATE = SETTINGS_NVS + NUM_NVS; ///< Offset of the section 0 block state
+
+static_assert((SETTINGS_BLOCK_STATE + NUM_SECTIONS) <= ConfigJournal::SIZE, "Block states do not fit the module settings");
+
+// Block state setting of a section, see saveBlockStates()
+constexpr uint8_t BLOCK_STATE_VALID = 0x80;    ///< Clear in a block state never saved
+constexpr uint8_t BLOCK_STATE_RELEASED = 0x10; ///< Line Clear commutator released
+constexpr uint8_t BLOCK_STATE_MASK = 0x03;     ///< Local state, and remote state shifted left 2
+
+/// Pin map of a section on a port expander, indicators on port A and switches on port B
+constexpr SectionPins expanderSectionPins(uint8_t device)
+{
+   return {expanderPin(device, 8), expanderPin(device, 9), expanderPin(device, 10), expanderPin(device, 11),
+           expanderPin(device, 0), expanderPin(device, 1), expanderPin(device, 2), expanderPin(device, 3),
+           expanderPin(device, 4), expanderPin(device, 5), expanderPin(device, 6), expanderPin(device, 7)};
+}
+
+/// Block section pin maps, section 0 uses the original single section pins
+constexpr SectionPins sectionPins[] = {
+    {LINE_CLEAR, TRAIN_ON_TRACK, NORMAL, BELL_PUSH,
+     LED_TRAIN_OT_R, LED_TRAIN_OT_L, LED_NORMAL_R, LED_NORMAL_L, LED_LINE_CLR_R, LED_LINE_CLR_L,
+     WARN_LED, OCCP_LED},
+#if CANBLOCK_EXPANDERS
+    // Sections 1 on are panels of one port expander each, GP0 / GP1 are the I2C bus
+    expanderSectionPins(0), expanderSectionPins(1), expanderSectionPins(2), expanderSectionPins(3),
+    expanderSectionPins(4), expanderSectionPins(5), expanderSectionPins(6),
+#else
+    // Section 1 takes the remaining GPIO, including the unused buzzer and bell pins
+    {26, 28, 27, 19,
+     0, 1, 2, 3, 10, 13,
+     NO_PIN, NO_PIN},
+#endif
 };
 
-constexpr uint8_t MAX_EVENT_ID = 10; ///< Maximum number of incoming event ID's
+static_assert((NUM_SECTIONS >= 1) && (NUM_SECTIONS <= MAX_SECTIONS), "Unsupported number of block sections");
+static_assert(!NUM_EXPANDERS || (NUM_SECTIONS <= (1 + NUM_EXPANDERS)), "A block section has no port expander");
+static_assert(NUM_SECTIONS <= (sizeof(sectionPins) / sizeof(sectionPins[0])), "No pin map for a block section");
+static_assert((EVENTS_PER_SECTION * NUM_SECTIONS) <= EventIndex::MAX_EVENTS, "Event table too large to index");
+
+/// Pins of the remote box indicators of a section in an indicator set
+constexpr PinMask remotePins(const SectionPins &pins, uint8_t ind)
+{
+   return ((ind & IND_TRAIN_ON_TRACK) ? pinBit(pins.trainOnTrackRemote) : PinMask{}) |
+          ((ind & IND_NORMAL) ? pinBit(pins.normalRemote) : PinMask{}) |
+          ((ind & IND_LINE_CLEAR) ? pinBit(pins.lineClearRemote) : PinMask{}) |
+          ((ind & IND_WARNING) ? pinBit(pins.warning) : PinMask{}) |
+          ((ind & IND_OCCUPIED) ? pinBit(pins.occupied) : PinMask{});
+}
+
+/// Pins of the local box indicators of a section in an indicator set
+constexpr PinMask localPins(const SectionPins &pins, uint8_t ind)
+{
+   return ((ind & IND_TRAIN_ON_TRACK) ? pinBit(pins.trainOnTrackLocal) : PinMask{}) |
+          ((ind & IND_NORMAL) ? pinBit(pins.normalLocal) : PinMask{}) |
+          ((ind & IND_LINE_CLEAR) ? pinBit(pins.lineClearLocal) : PinMask{});
+}
+
+/// Pins of the switch inputs of a section
+constexpr PinMask switchPins(const SectionPins &pins)
+{
+   return pinBit(pins.lineClear) | pinBit(pins.trainOnTrack) | pinBit(pins.normal) | pinBit(pins.bellPush);
+}
+
+/// All indicator pins, of every section
+constexpr PinMask allIndicatorPins()
+{
+   PinMask mask{};
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      // A CANMIO's needle shows the state of the box in advance
+      mask |= (VARIANT.paired() ? remotePins(sectionPins[s], 0xFF) : PinMask{}) | localPins(sectionPins[s], 0xFF);
+   }
+
+   return mask;
+}
+
+/// All switch input pins, of every section
+constexpr PinMask allSwitchPins()
+{
+   PinMask mask{};
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      mask |= switchPins(sectionPins[s]);
+   }
+
+   return mask;
+}
+
+/// True if no two sections, nor the CBUS, CAN and I2C pins, share a pin
+constexpr bool sectionPinsDistinct()
+{
+   PinMask used = pinBit(LED_GRN) | pinBit(LED_YLW) | pinBit(SWITCH0) | pinBit(CAN_RX) | pinBit(CAN_TX);
+
+   if (NUM_EXPANDERS)
+   {
+      used |= pinBit(PortExpander::I2C_SDA) | pinBit(PortExpander::I2C_SCL) | pinBit(EXPANDER_INT);
+   }
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      const SectionPins &pins = sectionPins[s];
+      const uint8_t list[] = {pins.lineClear, pins.trainOnTrack, pins.normal, pins.bellPush,
+                              pins.trainOnTrackRemote, pins.trainOnTrackLocal, pins.normalRemote, pins.normalLocal,
+                              pins.lineClearRemote, pins.lineClearLocal, pins.warning, pins.occupied};
+
+      for (uint8_t pin : list)
+      {
+         if (used & pinBit(pin))
+         {
+            return false;
+         }
+
+         used |= pinBit(pin);
+      }
+   }
+
+   return true;
+}
+
+static_assert(sectionPinsDistinct(), "Block section pin maps overlap");
+
+/// All indicator pins
+constexpr PinMask INDICATOR_PINS = allIndicatorPins();
 
-/// Block Instrument state machine states
-enum class BlockState
+/// Indicator pins lit and flashing for a state
+struct PinPattern
 {
-   Normal,       ///< Block is Normal (unoccupied)
-   LineClear,    ///< Line Clear authorised
-   TrainOnTrack, ///< Train in block
-   LCBlocked,    ///< Line Clear request blocked
+   PinMask on;
+   PinMask blink;
 };
 
-// State machine state records
-BlockState remoteBoxState{BlockState::Normal}; ///< Remote Box
-BlockState localBoxState{BlockState::Normal};  ///< Local Box
+/// Indicator pins of each section by state
+using SectionPinPatterns = std::array<std::array<PinPattern, NUM_BLOCK_STATES>, NUM_SECTIONS>;
+
+/// Build the pin patterns of every section from the indicator sets of a box
+constexpr SectionPinPatterns makePinPatterns(PinMask (*pins)(const SectionPins &, uint8_t),
+                                             const LedPattern (&sets)[NUM_BLOCK_STATES])
+{
+   SectionPinPatterns patterns{};
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      for (size_t state = 0; state < NUM_BLOCK_STATES; state++)
+      {
+         patterns[s][state] = {pins(sectionPins[s], sets[state].on), pins(sectionPins[s], sets[state].blink)};
+      }
+   }
+
+   return patterns;
+}
+
+/// Remote box indicator pins by section and state, none with a CANMIO needle
+constexpr SectionPinPatterns remotePinPatterns =
+    VARIANT.paired() ? makePinPatterns(remotePins, remoteIndicators) : SectionPinPatterns{};
+
+/// Local box indicator pins by section and state
+constexpr SectionPinPatterns localPinPatterns = makePinPatterns(localPins, localIndicators);
+
+// CBUS objects
+CBUSConfig module_config; ///< CBUS configuration object
+
+// Construct CBUS Object and assign the module configuration
+CBUSDispatch CBUS(module_config);
 
-/// Line Clear (commutator) release
-bool lineClearReleased{true};
+// Block Instrument objects
+IndicatorOutput indicators; ///< Block indicator LEDs
+LoopScheduler scheduler;    ///< Wakes loop() on inputs, CAN frames and deadlines
+Telemetry telemetry;        ///< Performance counters
+ConfigJournal settings;     ///< Module settings, journalled to flash
+HOT_PATH_STATE RequestTracker requests; ///< Requests waiting for the box in advance, core 0's scratch bank
+StateResync resync;         ///< State queries to the box at the other end after a reset
+FrameTrace trace;           ///< Frame, state machine and switch trace
+SwitchInput switches;       ///< Switch inputs of every section, debounced together
+InputCapture capture;       ///< PIO sampler of the switch inputs
+PortExpander expander;      ///< I2C port expanders of the panel sections
+TonePlayer tones;           ///< PWM and DMA player of the bell and buzzer patterns
+BellOutput bell;            ///< Attention bell and warning buzzer
+UsbSerial usb;              ///< USB CDC port, shared with stdio
+GridConnectBridge gateway;  ///< GridConnect gateway to a PC on the USB port
+
+#if CANBLOCK_TRACE
+// Trace records of each core, in the scratch banks below the core stacks
+__scratch_y("trace") FrameTrace::Ring core0Trace;
+__scratch_x("trace") FrameTrace::Ring core1Trace;
+#endif
+
+// module name, must be 7 characters, space padded.
+module_name_t moduleName = {'B', 'L', 'O', 'C', 'K', ' ', ' '};
+
+// State machine state records, indexed by section, set up by setup(), written by
+// the dispatch path on core 0 so kept in its scratch bank with the hot path in RAM
+HOT_PATH_STATE BlockState remoteBoxState[NUM_SECTIONS]; ///< Remote Box
+HOT_PATH_STATE BlockState localBoxState[NUM_SECTIONS];  ///< Local Box
+
+/// Line Clear (commutator) release, indexed by section
+HOT_PATH_STATE bool lineClearReleased[NUM_SECTIONS];
 
 // forward function declarations
 void eventhandler(uint8_t index, const CANFrame &msg);
-void processModuleSwitchChange(void);
+void switchEdge(uint gpio, uint32_t events);
+bool diagnostics(uint8_t service, uint8_t code, uint16_t &value);
+bool nodeVariable(uint8_t index, bool write, uint8_t &value);
+bool eventState(uint16_t en, bool &on);
+void defaultSettings(void);
+uint8_t restoreBlockStates(void);
+void saveBlockStates(void);
+void startResync(void);
+void resyncBlockStates(void);
+void processStateAnswer(uint8_t EV, bool on);
+void core1Main(void);
+void processModuleSwitchChange(uint8_t section);
+void retryRequests(void);
+void updateIndicators(void);
+void dispatchBenchmark(void);
 
 //
 /// setup CBUS - runs once at power on from setup()
@@ -170,6 +397,7 @@ void setupCBUS()
 {
    // Declare binary info for Picotool
    bi_decl(bi_program_description("CBUS Pico Block Instrument module"));
+   bi_decl(bi_program_feature("Variant " CANBLOCK_VARIANT_NAME));
 
    // Notify pin setup for Picotool
    bi_decl(bi_1pin_with_name(LED_GRN, "CBUS Green LED"));
@@ -180,24 +408,34 @@ void setupCBUS()
 
    bi_decl(bi_1pin_with_name(WARN_LED, "Warning LED"));
 
+#if ((CANBLOCK_NUM_SECTIONS < 2) || CANBLOCK_EXPANDERS) && !CANBLOCK_NEEDLE
+   // Taken by section 1 in a multi-section module without port expanders
    bi_decl(bi_1pin_with_name(INST_BUZZ, "Block Instrument Warning Buzzer"));
    bi_decl(bi_1pin_with_name(INST_BELL, "Block Instrument Attention Bell"));
+#endif
+#if !CANBLOCK_NEEDLE
+   // A CANMIO's needle shows the box in advance, and has no bell
    bi_decl(bi_1pin_with_name(LED_TRAIN_OT_R, "Train on Track Remote indication"));
-   bi_decl(bi_1pin_with_name(LED_TRAIN_OT_L, "Train on Track Remote indication"));
    bi_decl(bi_1pin_with_name(LED_NORMAL_R, "Line Normal Remote indication"));
-   bi_decl(bi_1pin_with_name(LED_NORMAL_L, "Line Normal Local indication"));
    bi_decl(bi_1pin_with_name(LED_LINE_CLR_R, "Line Clear Remote indication"));
+   bi_decl(bi_1pin_with_name(BELL_PUSH, "Attention Bell push"));
+#endif
+   bi_decl(bi_1pin_with_name(LED_TRAIN_OT_L, "Train on Track Local indication"));
+   bi_decl(bi_1pin_with_name(LED_NORMAL_L, "Line Normal Local indication"));
    bi_decl(bi_1pin_with_name(LED_LINE_CLR_L, "Line Clear Local indication"));
 
-   bi_decl(bi_1pin_with_name(BELL_PUSH, "Attention Bell push"));
+#if CANBLOCK_EXPANDERS
+   bi_decl(bi_2pins_with_func(PortExpander::I2C_SDA, PortExpander::I2C_SCL, GPIO_FUNC_I2C));
+   bi_decl(bi_1pin_with_name(EXPANDER_INT, "Port expander interrupt"));
+#endif
 
-   // set config layout parameters
-   module_config.EE_NVS_START = 10;    // Offset start of Node Variables
-   module_config.EE_NUM_NVS = 10;      // Number of Node Variables
-   module_config.EE_EVENTS_START = 20; // Offset start of Events
-   module_config.EE_MAX_EVENTS = 10;   // Maximum number of events
-   module_config.EE_NUM_EVS = 1;       // Number of Event Variables per event (the InEventID)
-   module_config.EE_BYTES_PER_EVENT = (module_config.EE_NUM_EVS + 4);
+   // set config layout parameters, all fixed by the variant
+   module_config.EE_NVS_START = ModuleVariant::NVS_START;    // Offset start of Node Variables
+   module_config.EE_NUM_NVS = NUM_NVS;                       // Number of Node Variables
+   module_config.EE_EVENTS_START = VARIANT.eventsStart();    // Offset start of Events
+   module_config.EE_MAX_EVENTS = VARIANT.numEvents();        // Maximum number of events
+   module_config.EE_NUM_EVS = ModuleVariant::NUM_EVS;        // Number of Event Variables per event (the InEventID)
+   module_config.EE_BYTES_PER_EVENT = (ModuleVariant::NUM_EVS + 4);
 
    // initialise and load configuration
    module_config.setEEPROMtype(EEPROM_TYPE::EEPROM_USES_FLASH);
@@ -232,26 +470,70 @@ void setupCBUS()
       module_config.resetModule(ledGrn, ledYlw, sw);
    }
 
-   // opportunity to set default NVs after module reset
+#if CANBLOCK_DUAL_CORE
+   // CAN2040 servicing and frame filtering run on core 1, see core1Main()
+   CBUS.setDualCore(true);
+#endif
+
+#if CANBLOCK_TRACE
+   // trace from the first frame
+   trace.begin(core0Trace, core1Trace);
+   CBUS.setTrace(&trace);
+#endif
+
+#if CANBLOCK_GRIDCONNECT
+   // pass the bus to a PC on the USB port, frames flow once it opens the port
+   gateway.begin(usb);
+   CBUS.setGateway(&gateway);
+#endif
+
+   // configure and start CAN bus as early as the node number and CAN ID are known,
+   // frames that arrive before loop() runs wait in the RX buffers
+   CBUS.setNumBuffers(VARIANT.rxBuffers, CBUSDispatch::MAX_BURST_EVENTS); // TX holds one burst of events
+   CBUS.setPins(CAN_TX, CAN_RX); // select pins for CAN tx and rx
+
+   if (!CBUS.begin())
+   {
+      // Init OK
+   }
+
+   if (CBUS.isDualCore())
+   {
+      multicore_launch_core1(core1Main);
+   }
+
+   // load the module settings from the newest journal records, a new module starts from defaults
+   if (!settings.begin())
+   {
+      defaultSettings();
+   }
+
+   // set default NVs after module reset
    if (module_config.isResetFlagSet())
    {
+      defaultSettings();
+      CBUS.pauseCore1();
       module_config.clearResetFlag();
+      CBUS.resumeCore1();
    }
 
    // register our CBUS event handler, to receive event messages of learned events
    CBUS.setEventHandlerCB(eventhandler);
 
-   // set CBUS LEDs to indicate mode
-   CBUS.indicateFLiMMode(module_config.getFLiM());
+   // node variables are kept in the module settings rather than by the library
+   CBUS.setNodeVariableHandler(nodeVariable);
 
-   // configure and start CAN bus and CBUS message processing
-   CBUS.setNumBuffers(25, 4);    // more buffers = more memory used, fewer = less
-   CBUS.setPins(CAN_TX, CAN_RX); // select pins for CAN tx and rx
+   // answer the box at the other end asking for the block states after a reset
+   CBUS.setEventStateHandler(eventState);
 
-   if (!CBUS.begin())
-   {
-      // Init OK
-   }
+   // serve the performance counters to diagnostic requests
+   requests.begin(VARIANT.replyTimeoutUs());
+   resync.begin();
+   telemetry.begin(CBUS, settings, requests, resync);
+   CBUS.setDiagnosticHandler(diagnostics, Telemetry::NUM_SERVICES);
+
+   // set CBUS LEDs to indicate mode
+   CBUS.indicateFLiMMode(module_config.getFLiM());
 }
 
 //
@@ -260,50 +542,68 @@ void setupCBUS()
 
 void setup()
 {
-   // Setup CBUS Library
+   const uint32_t bootStart = time_us_32();
+
+   // Setup CBUS Library, the bus is running when it returns
    setupCBUS();
 
-   // Setup IO - LED Outputs
-   totremoteLED.setPin(LED_TRAIN_OT_R);
-   totlocalLED.setPin(LED_TRAIN_OT_L);
-   nrmremoteLED.setPin(LED_NORMAL_R);
-   nrmlocalLED.setPin(LED_NORMAL_L);
-   clrremoteLED.setPin(LED_LINE_CLR_R);
-   clrlocalLED.setPin(LED_LINE_CLR_L);
-
-   // Switch Inputs - active LOW with internal Pull-Up
-   lineClearSW.setPin(LINE_CLEAR, false);
-   trainOnTrackSW.setPin(TRAIN_ON_TRACK, false);
-   normalSW.setPin(NORMAL, false);
-   bellPush.setPin(BELL_PUSH, false);
-
-   // Indicator LED's
-   warnLED.setPin(WARN_LED);
-   occpLED.setPin(OCCP_LED);
-
-   // Set default LED states - block NORMAL
-   totremoteLED.off();
-   totlocalLED.off();
-   nrmremoteLED.on();
-   nrmlocalLED.on();
-   clrremoteLED.off();
-   clrlocalLED.off();
-   warnLED.off();
-   occpLED.off();
-
-   // Map configuration settings to NV's
-   uint8_t NVs[module_config.EE_NUM_NVS]{};
-
-   // Block write the NV's from the configuration settings from the SD card
-   module_config.writeBytesEEPROM(module_config.EE_NVS_START, NVs, module_config.EE_NUM_NVS);
+   // Block states as they were before power off, then show them at once, and
+   // ask the box at the other end whether it has moved on while this one was off
+   telemetry.statesRestored(restoreBlockStates());
+   startResync();
+
+   // Port expanders of the panel sections, their switch pins are inputs and the rest indicator outputs
+   PortExpander *panel = nullptr;
+   PinMask edgePins = allSwitchPins() | pinBit(SWITCH0);
+
+#if CANBLOCK_EXPANDERS
+   if (expander.begin(NUM_EXPANDERS, allSwitchPins(), EXPANDER_INT))
+   {
+      panel = &expander;
+      edgePins |= pinBit(EXPANDER_INT);
+   }
+#endif
+
+   // Setup IO - LED Outputs, block and indicator LED's, the expanders' go out with their first scan
+   indicators.begin(INDICATOR_PINS, panel);
+   updateIndicators();
+   expander.run();
+
+   // Switch Inputs of every section - active LOW with internal Pull-Up, sampled by the PIO when it is free
+#if CANBLOCK_INPUT_CAPTURE
+   switches.begin(allSwitchPins(), allSwitchPins(), DEBOUNCE_US, &capture, panel);
+#else
+   switches.begin(allSwitchPins(), allSwitchPins(), DEBOUNCE_US, nullptr, panel);
+#endif
+
+   // Wake the main loop on any switch edge, including the FLiM switch and the expanders' interrupt
+   scheduler.begin(edgePins.gpio(), switchEdge);
+
+   // Attention bell and warning buzzer, unless section 1 has their pins
+   if (BELL_FITTED)
+   {
+      bell.begin(tones, INST_BUZZ, INST_BELL);
+   }
+
+   telemetry.bootTime(time_us_32() - bootStart);
 }
 
 //
-/// loop - runs forever
+/// loop - runs each time the scheduler wakes the core
 //
 
 void loop()
 {
+   scheduler.startPass();
+   const uint32_t passStart = time_us_32();
+
+   //
+   /// pass bus frames to a PC on the USB port, and take the frames it sends,
+   /// for CBUS processing to send on
+   //
+
+   gateway.run();
+
    //
    /// do CBUS message, switch and LED processing
    //
@@ -311,295 +611,879 @@ void loop()
    CBUS.process();
 
    //
-   /// give the switch and LED code some time to run
+   /// send again requests the box in advance has not answered in time
    //
 
-   warnLED.run();
-   occpLED.run();
+   retryRequests();
 
-   totremoteLED.run();
-   totlocalLED.run();
-   nrmremoteLED.run();
-   nrmlocalLED.run();
-   clrremoteLED.run();
-   clrlocalLED.run();
+   //
+   /// ask the box at the other end for the block states after a reset, until it answers
+   //
 
-   lineClearSW.run();
-   trainOnTrackSW.run();
-   normalSW.run();
-   bellPush.run();
+   resyncBlockStates();
 
    //
-   /// Check if switch changed and do any processing for this change.
+   /// note block state changes in the settings, then
+   /// write changed settings once their batch window has passed,
+   /// core 1 runs from flash so is paused while flash is written
    //
 
-   processModuleSwitchChange();
-}
+   saveBlockStates();
 
-//
-/// Process switch inputs - transmit ACON / ACOF events based on switch states
-//
-void processModuleSwitchChange()
-{
-   // Generate request events based on local state machine
-   if (BlockState::Normal == localBoxState)
+   if (settings.flushDue())
    {
-      // From Normal we can only request Line Clear
-      if (lineClearSW.stateChanged())
-      {
-         if (lineClearSW.isPressed())
-         {
-            // Send line clear request
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::blockCleared), false);
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClear), true);
-         }
-      }
+      CBUS.pauseCore1();
+      settings.flush();
+      CBUS.resumeCore1();
    }
-   else if (BlockState::LineClear == localBoxState)
+
+   //
+   /// give the switch and LED code some time to run
+   //
+
+   indicators.run();
+
+   //
+   /// Read the switches of every section together, then do any processing for a change
+   //
+
+   switches.run();
+
+   if (switches.getChanged())
    {
-      // From Line Clear we can only request Train on Track
-      if (trainOnTrackSW.stateChanged())
+      for (uint8_t s = 0; s < NUM_SECTIONS; s++)
       {
-         if (trainOnTrackSW.isPressed())
-         {
-            // Send Train on Track request
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClear), false);
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::trainOnTrack), true);
-         }
+         processModuleSwitchChange(s);
       }
    }
-   else if (BlockState::TrainOnTrack == localBoxState)
+
+   //
+   /// Start the bell codes and buzzes queued by this pass, the PWM and DMA sound them
+   //
+
+   bell.run();
+
+   //
+   /// Write the indicators of the expander panels changed by this pass, and read
+   /// their switches, in one scan
+   //
+
+   expander.run();
+
+   //
+   /// Wake again in time for the next blink phase
+   //
+
+   scheduler.wakeBy(indicators.nextChangeUs());
+   scheduler.wakeBy(switches.nextSampleUs());
+   scheduler.wakeBy(expander.nextRunUs());
+   scheduler.wakeBy(bell.nextRunUs());
+   scheduler.wakeBy(settings.nextFlushUs());
+   scheduler.wakeBy(requests.nextDeadlineUs());
+   scheduler.wakeBy(resync.nextDeadlineUs());
+   scheduler.wakeBy(gateway.nextRunUs());
+
+   // A backlog of frames, e.g. after a flash write, is worked through pass by pass
+   if (CBUS.hasPending())
    {
-      // From Train on Track we can only request Block Cleared
-      if (normalSW.stateChanged())
-      {
-         if (normalSW.isPressed())
-         {
-            // Set Block Cleared (Normal) request
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::trainOnTrack), false);
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::blockCleared), true);
-         }
-      }
+      scheduler.wakeBy(0);
+   }
+
+#if CANBLOCK_TRACE
+   //
+   /// dump the trace, or time the dispatch path, when asked to on stdio,
+   /// or by the gateway's PC while it has the port, the gateway only
+   /// giving the key once its last batch is written whole, so the
+   /// printout falls between frames
+   //
+
+   const int key = gateway.isOpen() ? gateway.takeKey() : getchar_timeout_us(0);
+
+   if (key == TRACE_DUMP_KEY)
+   {
+      trace.dump(stdout);
    }
-   else if (BlockState::LCBlocked == localBoxState)
+   else if (key == BENCHMARK_KEY)
    {
-      // hmm think @todo
+      dispatchBenchmark();
    }
+#endif
+
+   telemetry.loopTime(time_us_32() - passStart);
+}
+
+//
+/// switch input interrupt - wakes the main loop
+//
+
+void switchEdge(uint gpio, uint32_t events)
+{
+   trace.edge(gpio, events);
 
-   // Transmit bell events based on bell push switch state
-   if (bellPush.stateChanged())
+   // The expanders' interrupt starts a scan, their switches are debounced from the scans
+   if (gpio == EXPANDER_INT)
    {
-      CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::attentionBell), bellPush.isPressed());
+      scheduler.inputEdge(false);
+      return;
    }
+
+   switches.inputEdge();
+
+   // Captured switches are woken for by SwitchInput, the FLiM switch is polled by the library
+   scheduler.inputEdge((gpio == SWITCH0) || !switches.isCapturing());
 }
 
-///
-/// @brief Process the Remote State machine requests
-/// 
-/// @param eventID event ID of the incoming event being processed
-///
-void processRemoteStateMachine(InEventID eventID)
+//
+/// diagnostic request handler - values for RDGN from the performance counters
+//
+
+bool diagnostics(uint8_t service, uint8_t code, uint16_t &value)
 {
-   if (BlockState::Normal == remoteBoxState) // Block is NORMAL
-   {
-      // From Normal, we can only switch to Line Clear
-      if (InEventID::lineClear == eventID)
-      {
-         // Check for commutator released
-         if (lineClearReleased)
-         {
-            // OK to set line clear
-            remoteBoxState = BlockState::LineClear;
+   return telemetry.read(service, code, value);
+}
 
-            // Notify remote box
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::blockClearedAck), false); // Normal OFF
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClearAck), true);     // Line Clear ON
-         }
-         else
-         {
-            // Setting Line Clear is blocked
-            remoteBoxState = BlockState::LCBlocked;
+//
+/// node variable handler - NVRD / NVSET, the NVs are held in the module settings
+//
 
-            // Notify remote box
-            CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClearBlocked), true); // Line Clear Blocked
-         }
-      }
-   }
-   else if (BlockState::LineClear == remoteBoxState) // Block is Line Clear
+bool nodeVariable(uint8_t index, bool write, uint8_t &value)
+{
+   if ((index == 0) || (index > NUM_NVS))
    {
-      // From Line Clear, we can only switch to Train on Track
-      if (InEventID::trainOnTrack == eventID)
-      {
-         // Set Train on Track
-         remoteBoxState = BlockState::TrainOnTrack;
-
-         // Notify remote box
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClearAck), false);   // Line Clear OFF
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::trainOnTrackAck), true); // Train on Track ON
-      }
+      return false;
    }
-   else if (BlockState::TrainOnTrack == remoteBoxState) // Block is Train on Track
-   {
-      // From Train on Track, we can only switch to Normal
-      if (InEventID::blockCleared == eventID)
-      {
-         // Set Normal
-         remoteBoxState = BlockState::Normal;
 
-         // Notify remote box
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::trainOnTrackAck), false); // Train in Track OFF
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::blockClearedAck), true);  // Normal ON
-      }
-   }
-   else if (BlockState::LCBlocked == remoteBoxState) // Block is Normal with (blocked) request for Line Clear
+   if (write)
    {
-      // From Line Clear blocked, check for release of lock
-      if (lineClearReleased)
-      {
-         // OK to set line clear
-         remoteBoxState = BlockState::LineClear;
-
-         // Notify remote box
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClearBlocked), false); // Line Clear Blocked OFF
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::blockClearedAck), false); // Normal OFF
-         CBUS.sendMyEvent(static_cast<uint8_t>(OutEventID::lineClearAck), true);  // Line Clear ON
-      }
+      return settings.write(SETTINGS_NVS + index - 1, value);
    }
+
+   value = settings.read(SETTINGS_NVS + index - 1);
+   return true;
 }
 
 //
-/// user-defined event processing function
-/// called from the CBUS library when a learned event is received
-/// it receives the event table index and the CAN frame
+/// event state handler - AREQ for one of our events, the state it stands for now:
+/// the ACK of the remote state and the request of the local state are ON, the
+/// bell and the Line Clear reset are momentary so always OFF.  A request still
+/// waiting for its ACK stands for the state it leads to, as the box in advance
+/// takes it, or has already
 //
 
-void eventhandler(uint8_t index, const CANFrame &msg)
+bool eventState(uint16_t en, bool &on)
 {
-   // Get OpCode of event
-   uint8_t opCode = msg.data[0];
+   const uint8_t section = eventSection(en);
+   const OutEventID id = static_cast<OutEventID>(sectionEventID(en));
 
-   // Check for Long or Short Accessory events
-   if ((opCode == OPC_ACON) || (opCode == OPC_ACOF) || (opCode == OPC_ASON) || (opCode == OPC_ASOF))
+   if ((en > 0xFF) || (section >= NUM_SECTIONS) || (id > OutEventID::blockCleared))
    {
-      // read the value of the (single) event variable (EV) associated with this learned event, this is the eventID
-      uint8_t ID = module_config.getEventEVval(index, 1);
+      return false;
+   }
 
-      // Validate before processing
-      if (ID >= MAX_EVENT_ID)
-      {
-         return;
-      }
+   OutEventID request = localStateRequest[idx(localBoxState[section])];
 
-      // Convert to type safe enum
-      InEventID eventID = static_cast<InEventID>(ID);
+   if (requests.outstanding(section, request) && (request == OutEventID::resetLineClear))
+   {
+      request = OutEventID::blockCleared;
+   }
 
-      switch (eventID)
-      {
-      case InEventID::commutatorLock:
-         
-         // Lock or release Line Clear commutator
-         lineClearReleased = opCode == OPC_ACON ? false : true;
+   on = (id == remoteStateAck[idx(remoteBoxState[section])]) || (id == request);
 
-         // Process state machine on both ACON and ACOF
-         processRemoteStateMachine(eventID);
-         break;
-      case InEventID::lineClear:
-      case InEventID::trainOnTrack:
-      case InEventID::blockCleared:
-         // Only process state machine notification on rising edge (event going ON)
-         if (opCode == OPC_ACON)
-         {
-            processRemoteStateMachine(eventID);
-         }
-         break;
-      case InEventID::resetLineClear:
-         /// @todo reset to Line Clear
-         break;
-      case InEventID::attentionBell:
-         /// @todo Set Bell output
-         break;
-      case InEventID::lineClearAck:
-         // ACK of our Line Clear request
-         localBoxState = BlockState::LineClear;
-         break;
-      case InEventID::trainOnTrackAck:
-         // ACK of our Train on Track request
-         localBoxState = BlockState::TrainOnTrack;
-         break;
-      case InEventID::blockClearedAck:
-         // ACK of our Line Normal request
-         localBoxState = BlockState::Normal;
-         break;
-      case InEventID::lineClearBlocked:
-         // NACK of our Line Clear request
-         localBoxState = BlockState::LCBlocked;
+   // Only a box in rear that has been reset asks for our ACK's
+   if (id <= OutEventID::blockClearedAck)
+   {
+      resync.queried(section);
+   }
+
+   return true;
+}
+
+//
+/// default module settings - on a new module and after a module reset
+/// only changes are written, at once, so the first pass of loop() is not held up
+//
+
+void defaultSettings()
+{
+   for (uint8_t i = 0; i < NUM_NVS; i++)
+   {
+      settings.write(SETTINGS_NVS + i, 0);
+   }
+
+   // Block states never saved, back to Normal at the next power on
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      settings.write(SETTINGS_BLOCK_STATE + s, 0);
+   }
+
+   CBUS.pauseCore1();
+   settings.flush();
+   CBUS.resumeCore1();
+}
+
+///
+/// @brief Set the block states from the module settings
+///
+/// Sections with no valid saved state start Normal, with the Line Clear
+/// commutator released.
+///
+/// @return number of sections restored
+///
+uint8_t restoreBlockStates()
+{
+   uint8_t restored = 0;
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      const uint8_t saved = settings.read(SETTINGS_BLOCK_STATE + s);
+      const uint8_t local = saved & BLOCK_STATE_MASK;
+      const uint8_t remote = (saved >> 2) & BLOCK_STATE_MASK;
+
+      remoteBoxState[s] = BlockState::Normal;
+      localBoxState[s] = BlockState::Normal;
+      lineClearReleased[s] = true;
+
+      if (!(saved & BLOCK_STATE_VALID) || (local >= NUM_BLOCK_STATES) || (remote >= NUM_BLOCK_STATES))
+      {
+         continue;
+      }
+
+      localBoxState[s] = static_cast<BlockState>(local);
+      remoteBoxState[s] = static_cast<BlockState>(remote);
+      lineClearReleased[s] = saved & BLOCK_STATE_RELEASED;
+      restored++;
+   }
+
+   return restored;
+}
+
+///
+/// @brief Note the block states in the module settings
+///
+/// Only sections whose state changed make a journal record, and the journal
+/// batches changes close together into one flash write.
+///
+void saveBlockStates()
+{
+   static_assert(NUM_BLOCK_STATES <= (BLOCK_STATE_MASK + 1), "Block states do not fit their setting");
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      const uint8_t state = BLOCK_STATE_VALID |
+                            static_cast<uint8_t>(idx(localBoxState[s])) |
+                            static_cast<uint8_t>(idx(remoteBoxState[s]) << 2) |
+                            (lineClearReleased[s] ? BLOCK_STATE_RELEASED : 0);
+
+      settings.write(SETTINGS_BLOCK_STATE + s, state);
+   }
+}
+
+///
+/// @brief Side of a section (StateResync LOCAL / REMOTE) the answer about a learned event sets
+///
+/// @param id InEventID of the event
+/// @return LOCAL for the box in advance's ACK's, REMOTE for the box in rear's requests, else 0
+///
+constexpr uint8_t answeredSide(uint8_t id)
+{
+   switch (static_cast<InEventID>(id))
+   {
+   case InEventID::lineClearAck:
+   case InEventID::trainOnTrackAck:
+   case InEventID::blockClearedAck:
+   case InEventID::lineClearBlocked:
+      return StateResync::LOCAL;
+   case InEventID::lineClear:
+   case InEventID::trainOnTrack:
+   case InEventID::blockCleared:
+      return StateResync::REMOTE;
+   default:
+      return 0;
+   }
+}
+
+///
+/// @brief Remote state a request of the box in rear left ON stands for
+///
+/// A Line Clear request is given or blocked as the restored state has it, as
+/// the commutator may have been locked since it was given, else as the
+/// commutator allows now.
+///
+/// @param request request that is ON
+/// @param restored remote state restored from the module settings
+/// @param released Line Clear commutator released
+///
+constexpr BlockState answeredRemoteState(InEventID request, BlockState restored, bool released)
+{
+   switch (request)
+   {
+   case InEventID::lineClear:
+      if ((restored == BlockState::LineClear) || (restored == BlockState::LCBlocked))
+      {
+         return restored;
+      }
+
+      return released ? BlockState::LineClear : BlockState::LCBlocked;
+   case InEventID::trainOnTrack:
+      return BlockState::TrainOnTrack;
+   default:
+      return BlockState::Normal;
+   }
+}
+
+///
+/// @brief Ask the box at the other end of a section for the states of the events learned from it
+///
+/// The commutator lock is asked for as well, if its sender answers.  Only long
+/// events can be asked for, by the node number of the module that sends them.
+///
+/// @param section block section
+/// @param send send the queries (AREQ), or only find the sides their answers set
+/// @return sides of the section (StateResync LOCAL / REMOTE) the answers set
+///
+uint8_t queryBlockStates(uint8_t section, bool send)
+{
+   const EventIndex &index = CBUS.getEventIndex();
+   uint8_t sides = 0;
+
+   for (uint8_t i = 0; i < module_config.EE_MAX_EVENTS; i++)
+   {
+      const uint8_t EV = index.eventID(i);
+      const uint8_t ID = sectionEventID(EV);
+
+      if ((eventSection(EV) != section) ||
+          (!answeredSide(ID) && (ID != static_cast<uint8_t>(InEventID::commutatorLock))))
+      {
+         continue;
+      }
+
+      uint8_t key[4];
+      module_config.readEvent(i, key);
+
+      const uint16_t nn = (key[0] << 8) | key[1];
+      const uint16_t en = (key[2] << 8) | key[3];
+
+      if (nn == 0)
+      {
+         continue;
+      }
+
+      sides |= answeredSide(ID);
+
+      if (send)
+      {
+         CBUS.sendEventRequest(nn, en);
+      }
+   }
+
+   return sides;
+}
+
+///
+/// @brief Send the events of a state machine transition
+///
+/// The events go out as one burst, so the box at the other end never acts on
+/// half of a transition.
+///
+/// @param section block section making the transition
+/// @param transition table entry of the transition
+/// @return false if the TX ring had no room for the burst
+///
+bool HOT_PATH_FUNC(sendEvents)(uint8_t section, const Transition &transition)
+{
+   static_assert(MAX_TRANSITION_EVENTS <= CBUSDispatch::MAX_BURST_EVENTS, "Transition does not fit one burst");
+
+   CBUSDispatch::MyEvent burst[MAX_TRANSITION_EVENTS];
+
+   for (uint8_t i = 0; i < transition.numEvents; i++)
+   {
+      burst[i] = {static_cast<uint8_t>(sectionEventBase(section) + static_cast<uint8_t>(transition.events[i].id)),
+                  transition.events[i].on};
+   }
+
+   return CBUS.sendMyEvents(burst, transition.numEvents);
+}
+
+///
+/// @brief Send the events of a state machine transition and track its request
+///
+/// A request is tracked even if its burst could not be queued, the retry
+/// sends it once the TX ring has room.
+///
+/// @param section block section making the transition
+/// @param transition table entry of the transition
+///
+void HOT_PATH_FUNC(sendTransitionEvents)(uint8_t section, const Transition &transition)
+{
+   const bool sent = sendEvents(section, transition);
+
+   for (uint8_t i = 0; i < transition.numEvents; i++)
+   {
+      const OutEvent &event = transition.events[i];
+
+      if (event.on && RequestTracker::isRequest(event.id))
+      {
+         requests.sent(section, event.id, transition);
+      }
+
+      // Time the round trip of requests to the box in advance
+      if (sent && event.on && RequestTracker::isRequest(event.id, true))
+      {
+         telemetry.requestSent(section, event.id);
+      }
+   }
+}
+
+///
+/// @brief Send again the requests that have timed out, with their whole transition
+///
+void retryRequests()
+{
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      if (const Transition *transition = requests.due(s))
+      {
+         sendEvents(s, *transition);
+      }
+   }
+}
+
+///
+/// @brief Transition whose request drives a CANMIO's needle to a local state
+///
+const Transition &needleTransition(BlockState state)
+{
+   switch (state)
+   {
+   case BlockState::LineClear:
+      return localTransitions[idx(BlockState::Normal)][idx(LocalInput::LineClearSwitch)];
+   case BlockState::TrainOnTrack:
+      return localTransitions[idx(BlockState::LineClear)][idx(LocalInput::TrainOnTrackSwitch)];
+   default:
+      return localTransitions[idx(BlockState::TrainOnTrack)][idx(LocalInput::NormalSwitch)];
+   }
+}
+
+///
+/// @brief Bring the restored block states into step with the box at the other end
+///
+/// A section paired with a CANBlock queries it, see resyncBlockStates().  A
+/// CANMIO does not answer, so a section with a taught needle sends the request
+/// of its restored state again instead, the needle moves there if it is not
+/// there already, and its feedback confirms the state.
+///
+void startResync()
+{
+   const EventIndex &index = CBUS.getEventIndex();
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      if constexpr (VARIANT.paired())
+      {
+         resync.start(s, queryBlockStates(s, false));
+         continue;
+      }
+
+      for (uint8_t i = 0; i < module_config.EE_MAX_EVENTS; i++)
+      {
+         const uint8_t EV = index.eventID(i);
+
+         if ((eventSection(EV) == s) && (answeredSide(sectionEventID(EV)) == StateResync::LOCAL))
+         {
+            sendTransitionEvents(s, needleTransition(localBoxState[s]));
+            break;
+         }
+      }
+   }
+}
+
+///
+/// @brief Send the state query of a section when it is due, first or again
+///
+/// One section a pass, so the queries of a many section module do not fill
+/// the TX ring.
+///
+void resyncBlockStates()
+{
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      if (resync.due(s))
+      {
+         queryBlockStates(s, true);
+         return;
+      }
+   }
+}
+
+///
+/// @brief Process the Local State machine
+///
+/// @param section block section of the state machine
+/// @param input switch operation or reply from the box in advance
+///
+void HOT_PATH_FUNC(processLocalStateMachine)(uint8_t section, LocalInput input)
+{
+   const Transition &transition = localTransitions[idx(localBoxState[section])][idx(input)];
+
+   trace.step(TraceKind::Local, section, idx(localBoxState[section]), idx(transition.next), idx(input));
+   localBoxState[section] = transition.next;
+   sendTransitionEvents(section, transition);
+}
+
+//
+/// Process switch inputs of a section - transmit ACON / ACOF events based on switch states
+//
+void processModuleSwitchChange(uint8_t section)
+{
+   const SectionPins &pins = sectionPins[section];
+   const PinMask &pressed = switches.getPressedEdges();
+
+   // Generate request events based on local state machine, the table
+   // decides which switch is valid in the current state
+   if (pressed & pinBit(pins.lineClear))
+   {
+      processLocalStateMachine(section, LocalInput::LineClearSwitch);
+   }
+
+   if (pressed & pinBit(pins.trainOnTrack))
+   {
+      processLocalStateMachine(section, LocalInput::TrainOnTrackSwitch);
+   }
+
+   if (pressed & pinBit(pins.normal))
+   {
+      processLocalStateMachine(section, LocalInput::NormalSwitch);
+   }
+
+   // A CANMIO has no bell to ring
+   if constexpr (!VARIANT.paired())
+   {
+      return;
+   }
+
+   // Transmit bell events based on bell push switch state, a push and release
+   // in one batch of samples sends both, ending with the state the push is in now
+   const PinMask bell = pinBit(pins.bellPush);
+   const uint8_t bellEvent = sectionEventBase(section) + static_cast<uint8_t>(OutEventID::attentionBell);
+
+   if (switches.getChanged() & bell)
+   {
+      const bool ringing = static_cast<bool>(switches.getPressed() & bell);
+
+      if (switches.getPressedEdges() & switches.getReleasedEdges() & bell)
+      {
+         CBUS.sendMyEvent(bellEvent, !ringing);
+      }
+
+      CBUS.sendMyEvent(bellEvent, ringing);
+   }
+}
+
+///
+/// @brief Process the Remote State machine requests
+/// 
+/// @param section block section of the state machine
+/// @param input request from the box in rear or commutator lock change
+///
+void HOT_PATH_FUNC(processRemoteStateMachine)(uint8_t section, RemoteInput input)
+{
+   const size_t lock = lineClearReleased[section] ? RELEASED : LOCKED;
+   const Transition &transition = remoteTransitions[lock][idx(remoteBoxState[section])][idx(input)];
+
+   trace.step(TraceKind::Remote, section, idx(remoteBoxState[section]), idx(transition.next), idx(input));
+   remoteBoxState[section] = transition.next;
+   sendTransitionEvents(section, transition);
+}
+
+///
+/// @brief Update the block indicators from the state machines
+///
+/// All sections go out in one write, which only touches the LED outputs if
+/// the states have changed
+///
+void HOT_PATH_FUNC(updateIndicators)()
+{
+   PinMask on{};
+   PinMask blink{};
+
+   for (uint8_t s = 0; s < NUM_SECTIONS; s++)
+   {
+      const PinPattern &local = localPinPatterns[s][idx(localBoxState[s])];
+
+      on |= local.on;
+      blink |= local.blink;
+
+      if constexpr (VARIANT.paired())
+      {
+         const PinPattern &remote = remotePinPatterns[s][idx(remoteBoxState[s])];
+
+         on |= remote.on;
+         blink |= remote.blink;
+      }
+   }
+
+   indicators.set(on, blink);
+}
+
+///
+/// @brief Set the state of a section from an answer to its state query
+///
+/// Only answers a section is waiting for are taken, later ones repeat them or
+/// answer another module.  The ACK of the box in advance that is ON sets the
+/// local state as the ACK itself does, the request of the box in rear that is
+/// ON sets the remote state.  The commutator lock is taken as an event.
+///
+/// @param EV event variable of the learned event answered about
+/// @param on the event is ON (ARON / ARSON)
+///
+void processStateAnswer(uint8_t EV, bool on)
+{
+   const uint8_t section = eventSection(EV);
+   const uint8_t ID = sectionEventID(EV);
+
+   if ((section >= NUM_SECTIONS) || (ID >= MAX_EVENT_ID) ||
+       !resync.waiting(section, StateResync::LOCAL | StateResync::REMOTE))
+   {
+      return;
+   }
+
+   const EventRoute &route = eventRoutes[ID];
+   const uint8_t side = answeredSide(ID);
+
+   if (static_cast<uint8_t>(InEventID::commutatorLock) == ID)
+   {
+      lineClearReleased[section] = !on;
+      processRemoteStateMachine(section, route.remote[on]);
+   }
+   else if (on && (side == StateResync::LOCAL) && resync.waiting(section, side))
+   {
+      processLocalStateMachine(section, route.local[on]);
+      resync.answered(section, side);
+   }
+   else if (on && (side == StateResync::REMOTE) && resync.waiting(section, side))
+   {
+      const BlockState next = answeredRemoteState(static_cast<InEventID>(ID), remoteBoxState[section],
+                                                  lineClearReleased[section]);
+
+      trace.step(TraceKind::Remote, section, idx(remoteBoxState[section]), idx(next), idx(route.remote[on]));
+      remoteBoxState[section] = next;
+      resync.answered(section, side);
+   }
+}
+
+//
+/// user-defined event processing function
+/// called from the CBUS library when a learned event is received
+/// it receives the event table index and the CAN frame
+//
+
+void HOT_PATH_FUNC(eventhandler)(uint8_t index, const CANFrame &msg)
+{
+   // Get OpCode of event
+   uint8_t opCode = msg.data[0];
+
+   // Check for Long or Short Accessory events
+   if ((opCode == OPC_ACON) || (opCode == OPC_ACOF) || (opCode == OPC_ASON) || (opCode == OPC_ASOF))
+   {
+      // the value of the (single) event variable (EV) associated with this learned event is the section
+      // and eventID, taken from the RAM event index rather than the configuration store
+      const uint8_t EV = CBUS.getEventIndex().eventID(index);
+      const uint8_t section = eventSection(EV);
+      const uint8_t ID = sectionEventID(EV);
+
+      // Validate before processing
+      if ((section >= NUM_SECTIONS) || (ID >= MAX_EVENT_ID))
+      {
+         return;
+      }
+
+      const bool on = (opCode == OPC_ACON) || (opCode == OPC_ASON);
+      OutEventID request;
+
+      if (on && RequestTracker::answers(static_cast<InEventID>(ID), request))
+      {
+         // The box in advance answers each retry, act on the first answer only
+         if (!requests.replyReceived(section, static_cast<InEventID>(ID)))
+         {
+            return;
+         }
+
+         telemetry.replyReceived(section, request);
+      }
+
+      // Requests drive the remote state machine, replies the local one
+      const EventRoute &route = eventRoutes[ID];
+      const BlockState localBefore = localBoxState[section];
+      const BlockState remoteBefore = remoteBoxState[section];
+
+      // A CANMIO only replies, the commutator, bell and remote state machine are CANBlock to CANBlock
+      if constexpr (VARIANT.paired())
+      {
+         // Lock or release Line Clear commutator
+         if (static_cast<uint8_t>(InEventID::commutatorLock) == ID)
+         {
+            lineClearReleased[section] = !on;
+         }
+
+         // One stroke of the bell for each push of the remote box's bell plunger, so the
+         // signaller there beats out the code, strokes arriving while one sounds are queued
+         if (on && (static_cast<uint8_t>(InEventID::attentionBell) == ID))
+         {
+            bell.ring(1);
+         }
+
+         // Warn the signaller that the box in advance has refused Line Clear
+         if (on && (static_cast<uint8_t>(InEventID::lineClearBlocked) == ID))
+         {
+            bell.buzz(WARNING_BUZZ_US);
+         }
+
+         if (route.remote[on] != RemoteInput::None)
+         {
+            processRemoteStateMachine(section, route.remote[on]);
+         }
+      }
+
+      if (route.local[on] != LocalInput::None)
+      {
+         processLocalStateMachine(section, route.local[on]);
+      }
+
+      // A request or ACK sent since the reset that moved the state on is newer than the answer to the
+      // state query, one the restored state could not take waits for the answer, then is sent again
+      const uint8_t side = answeredSide(ID);
+
+      if (on && resync.waiting(section, side) &&
+          ((side == StateResync::LOCAL) ? (localBoxState[section] != localBefore)
+                                        : (remoteBoxState[section] != remoteBefore)))
+      {
+         resync.answered(section, side);
+      }
+   }
+   else if ((opCode == OPC_ARON) || (opCode == OPC_AROF) || (opCode == OPC_ARSON) || (opCode == OPC_ARSOF))
+   {
+      // Answers to the state queries of a reset, only a CANBlock answers them
+      if constexpr (VARIANT.paired())
+      {
+         processStateAnswer(CBUS.getEventIndex().eventID(index), (opCode == OPC_ARON) || (opCode == OPC_ARSON));
+      }
+   }
+
+   updateIndicators();
+}
+
+///
+/// @brief Time the dispatch of a learned event, with the XIP cache warm and flushed
+///
+/// Dispatches an OFF event of section 0 that changes no state, the
+/// attentionBell event, or the blockClearedAck event when paired with a
+/// CANMIO needle.  It takes the path CBUSDispatch gives a received frame, the
+/// event index lookup and then the event handler.  Each cold run flushes the
+/// XIP cache first, so any of the path left in flash is fetched from it again,
+/// the worst case the path meets, e.g. when the configuration code has just
+/// run.  The times are written to stdio.
+///
+void dispatchBenchmark()
+{
+   constexpr InEventID timed = VARIANT.paired() ? InEventID::attentionBell : InEventID::blockClearedAck;
+   const uint8_t timedEV = sectionEventBase(0) + static_cast<uint8_t>(timed);
+   const EventIndex &index = CBUS.getEventIndex();
+   uint8_t learned = EventIndex::NO_EVENT;
+
+   for (uint8_t i = 0; i < module_config.EE_MAX_EVENTS; i++)
+   {
+      if (index.eventID(i) == timedEV)
+      {
+         learned = i;
          break;
       }
    }
 
-   // Update block status LEDs from the remote box
-   switch (remoteBoxState)
-   {
-   case BlockState::Normal: // Normal (unoccupied) state
-      totremoteLED.off();
-      nrmremoteLED.on();
-      clrremoteLED.off();
-      warnLED.off();
-      occpLED.off();
-      break;
-   case BlockState::LineClear: // Line Clear authorised
-      totremoteLED.off();
-      nrmremoteLED.off();
-      clrremoteLED.on();
-      warnLED.off();
-      occpLED.on();
-      break;
-   case BlockState::TrainOnTrack: // Train is on Track
-      totremoteLED.on();
-      nrmremoteLED.off();
-      clrremoteLED.off();
-      warnLED.off();
-      occpLED.on();
-      break;
-   case BlockState::LCBlocked: // Line Clear authorisation blocked (commutator locked)
-      totremoteLED.off();
-      nrmremoteLED.on();
-      clrremoteLED.blink();
-      warnLED.on();
-      occpLED.off();
-      break;
-   };
-
-   // Update block status LEDs for the local box
-   switch (localBoxState)
-   {
-   case BlockState::Normal: // Normal (unoccupied) state
-      totlocalLED.off();
-      nrmlocalLED.on();
-      clrlocalLED.off();
-      break;
-   case BlockState::LineClear: // Line Clear authorised
-      totlocalLED.off();
-      nrmlocalLED.off();
-      clrlocalLED.on();
-      break;
-   case BlockState::TrainOnTrack: // Train is on Track
-      totlocalLED.on();
-      nrmlocalLED.off();
-      clrlocalLED.off();
-      break;
-   case BlockState::LCBlocked: // Line Clear authorisation blocked (commutator locked)
-      totlocalLED.off();
-      nrmlocalLED.on();
-      clrlocalLED.blink();
-      break;
-   };
+   if (learned == EventIndex::NO_EVENT)
+   {
+      printf("dispatch benchmark needs the %s event of section 0 taught\n",
+             VARIANT.paired() ? "attentionBell" : "blockClearedAck");
+      return;
+   }
+
+   // NN and EN of the learned event, as an ACOF received from the box at the other end
+   uint8_t key[4];
+   module_config.readEvent(learned, key);
+
+   CANFrame msg{};
+   msg.len = 5;
+   msg.data[0] = OPC_ACOF;
+
+   for (uint8_t i = 0; i < sizeof(key); i++)
+   {
+      msg.data[1 + i] = key[i];
+   }
+
+   const uint16_t nn = (key[0] << 8) | key[1];
+   const uint16_t en = (key[2] << 8) | key[3];
+
+   for (uint8_t cold = 0; cold < 2; cold++)
+   {
+      uint32_t minUs = UINT32_MAX;
+      uint32_t maxUs = 0;
+      uint32_t totalUs = 0;
+
+      for (uint16_t run = 0; run < BENCHMARK_RUNS; run++)
+      {
+         if (cold)
+         {
+            // Reading back the flush waits for it to complete
+            xip_ctrl_hw->flush = 1;
+            (void)xip_ctrl_hw->flush;
+         }
+
+         const uint32_t start = time_us_32();
+         eventhandler(index.find(nn, en), msg);
+         const uint32_t us = time_us_32() - start;
+
+         minUs = (us < minUs) ? us : minUs;
+         maxUs = (us > maxUs) ? us : maxUs;
+         totalUs += us;
+      }
+
+      printf("%s dispatch %s XIP cache, hot path in %s: min %lu us avg %lu us max %lu us (%u runs)\n", VARIANT.name,
+             cold ? "flushed" : "warm", CANBLOCK_RAM_HOT_PATH ? "RAM" : "flash", static_cast<unsigned long>(minUs),
+             static_cast<unsigned long>(totalUs / BENCHMARK_RUNS), static_cast<unsigned long>(maxUs), BENCHMARK_RUNS);
+   }
 }
 
 // MODULE MAIN ENTRY
 
+//
+/// core 1 entry - owns the CAN2040 controller and its PIO interrupt,
+/// filters received frames and passes them to core 0
+/// launched by setupCBUS() as soon as the controller is configured
+//
+
+void HOT_PATH_FUNC(core1Main)()
+{
+   // Allow core 0 to pause this core while the configuration is written to flash
+   multicore_lockout_victim_init();
+
+   CBUS.beginCore1();
+
+   while (1)
+   {
+      // Sleep until the next CAN interrupt or a frame queued by core 0
+      if (CBUS.serviceCore1())
+      {
+         __wfe();
+      }
+   }
+}
+
+#ifndef CANBLOCK_HOST_BUILD
+
 extern "C" int main(int, char **)
 {
+   // Initialize - bus first, stdio is only for logging so waits until after
+   setup();
+
    // Init stdio lib (only really required if UART logging etc.)
    stdio_init_all();
 
@@ -607,15 +1491,15 @@ extern "C" int main(int, char **)
    // Setup CRLF options
    stdio_set_translate_crlf(&stdio_semihosting, false);
 
-   printf("CANLocking : Initializing\n");
+   printf("CANLocking : Initialized\n");
 #endif
 
-   // Initialize
-   setup();
-
-   // Run periodic processing - forever
+   // Run periodic processing - forever, sleeping until there is work to do
    while (1)
    {
       loop();
+      scheduler.idle();
    }
 }
+
+#endif // CANBLOCK_HOST_BUILD
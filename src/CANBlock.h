@@ -0,0 +1,131 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/// Event Constants
+enum class InEventID
+{
+   // Incoming event ID's from remote box
+   commutatorLock,  ///< Commutator is locked (prevent Line Clear)
+   lineClear,       ///< Line Clear
+   trainOnTrack,    ///< Train entered block
+   blockCleared,    ///< Train left block
+   attentionBell,   ///< Attention bell from remote box
+   resetLineClear,  ///< Reset from Line Clear state to Normal (abnormal state transition)
+   // Incoming event ID's to ACK (or NACK) local changes of state
+   lineClearAck,    ///< ACK of our request for Line Clear
+   trainOnTrackAck, ///< ACK of our request for Train on Track
+   blockClearedAck, ///< ACK of our requst for Block Cleared (Normal)
+   lineClearBlocked ///< NACK of our request for Line Clear
+};
+
+/// Outgoing events
+enum class OutEventID
+{
+   lineClearBlocked, ///< Line Clear NACK
+   lineClearAck,     ///< Line Clear ACK
+   trainOnTrackAck,  ///< Train entered block ACK
+   blockClearedAck,  ///< Train left block ACK
+   attentionBell,    ///< Call attention to remote box
+   resetLineClear,   ///< Line Clear withdrawn, back to Normal
+   lineClear,        ///< Line Clear request
+   trainOnTrack,     ///< Train on Track 
+   blockCleared      ///< Train left block
+};
+
+constexpr uint8_t MAX_EVENT_ID = 10; ///< Maximum number of incoming event ID's
+
+/// Block Instrument state machine states
+enum class BlockState
+{
+   Normal,       ///< Block is Normal (unoccupied)
+   LineClear,    ///< Line Clear authorised
+   TrainOnTrack, ///< Train in block
+   LCBlocked,    ///< Line Clear request blocked
+};
+
+//
+/// Block sections
+///
+/// A module can run several block sections, each with its own state machines,
+/// switches and indicators.  The event numbers of the events a section sends
+/// (OutEventID) and the event variables of the events it receives (InEventID)
+/// are offset by the section number times SECTION_EVENT_STRIDE, so section 0
+/// uses the same events as a single section module.
+//
+
+constexpr uint8_t MAX_SECTIONS = 8;          ///< Most block sections one module can run
+constexpr uint8_t SECTION_EVENT_STRIDE = 16; ///< Event numbers and event variables per section
+constexpr uint8_t NO_PIN = 0xFF;             ///< Pin map entry of an output that is not fitted
+
+/// First event number / event variable of a section
+constexpr uint8_t sectionEventBase(uint8_t section) { return section * SECTION_EVENT_STRIDE; }
+
+/// Section of an event number / event variable
+constexpr uint8_t eventSection(uint8_t event) { return event / SECTION_EVENT_STRIDE; }
+
+/// Event ID within its section of an event number / event variable
+constexpr uint8_t sectionEventID(uint8_t event) { return event % SECTION_EVENT_STRIDE; }
+
+/// GPIO pins of one block section
+struct SectionPins
+{
+   // Switch inputs, from the local box
+   uint8_t lineClear;    ///< Line Clear request switch
+   uint8_t trainOnTrack; ///< Train on Track switch
+   uint8_t normal;       ///< Line Normal switch
+   uint8_t bellPush;     ///< Attention bell push
+
+   // Indicator outputs, NO_PIN if not fitted
+   uint8_t trainOnTrackRemote; ///< Train on Track remote indication
+   uint8_t trainOnTrackLocal;  ///< Train on Track local indication
+   uint8_t normalRemote;       ///< Line Normal remote indication
+   uint8_t normalLocal;        ///< Line Normal local indication
+   uint8_t lineClearRemote;    ///< Line Clear remote indication
+   uint8_t lineClearLocal;     ///< Line Clear local indication
+   uint8_t warning;            ///< Line Clear request (commutator) locked warning
+   uint8_t occupied;           ///< Line occupied
+};
+
+static_assert(static_cast<uint8_t>(OutEventID::blockCleared) < SECTION_EVENT_STRIDE, "Outgoing events overflow a section");
+static_assert(MAX_EVENT_ID <= SECTION_EVENT_STRIDE, "Incoming events overflow a section");
+static_assert(MAX_SECTIONS * SECTION_EVENT_STRIDE <= 256, "Section events do not fit an event variable");
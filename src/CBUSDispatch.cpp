@@ -0,0 +1,959 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "CBUSDispatch.h"
+
+#include "cbusdefs.h" // CBUS constants
+#include "CBUSUtil.h" // Utility macros
+
+#include <hardware/sync.h>
+#include <pico/multicore.h>
+#include <pico/stdlib.h>
+
+#include <array>
+
+/// Node management and configuration opcodes the CBUS library acts on, and diagnostic and accessory requests
+constexpr uint8_t libraryOpcodes[] = {
+    OPC_QNN,   OPC_RQNP,  OPC_RQMN,  OPC_SNN,   OPC_NNLRN, OPC_NNULN, OPC_NNCLR, OPC_NNEVN,
+    OPC_NERD,  OPC_RQEVN, OPC_BOOT,  OPC_ENUM,  OPC_NVRD,  OPC_NENRD, OPC_RQNPN, OPC_CANID,
+    OPC_EVULN, OPC_NVSET, OPC_REVAL, OPC_REQEV, OPC_EVLRN, OPC_RDGN,  OPC_AREQ,
+};
+
+/// One bit per opcode, set for the opcodes in the list
+template <size_t N>
+constexpr std::array<uint32_t, 8> makeOpcodeFilter(const uint8_t (&opcodes)[N])
+{
+   std::array<uint32_t, 8> filter{};
+
+   for (uint8_t opCode : opcodes)
+   {
+      filter[opCode / 32] |= 1u << (opCode % 32);
+   }
+
+   return filter;
+}
+
+constexpr std::array<uint32_t, 8> libraryOpcodeFilter = makeOpcodeFilter(libraryOpcodes);
+
+CBUSDispatch::CBUSDispatch(CBUSConfig &config) : CBUSACAN2040(config), m_moduleConfig(config)
+{
+}
+
+///
+/// @brief Reset the counters, build the event index and start the CAN controller
+///
+/// In dual core mode the controller is started by core 1 in beginCore1(), which
+/// must only be launched after begin() has returned.
+///
+bool CBUSDispatch::begin()
+{
+   m_framePending = false;
+   m_rxRing.clear();
+   m_txRing.clear();
+   m_txHolding = false;
+   m_rxRun = 0;
+   m_dgnActive = false;
+   m_core1Paused = false;
+   m_core1Pauses = 0;
+
+   m_rxFrames.store(0, std::memory_order_relaxed);
+   m_txFrames.store(0, std::memory_order_relaxed);
+   m_rxBufferMax.store(0, std::memory_order_relaxed);
+   m_rxRingMax.store(0, std::memory_order_relaxed);
+   m_rxFiltered.store(0, std::memory_order_relaxed);
+   m_rxRingFull.store(0, std::memory_order_relaxed);
+   m_txStallsAvoided.store(0, std::memory_order_relaxed);
+   m_txRingFull = 0;
+   m_indexGeneration.store(0, std::memory_order_relaxed);
+   m_core1Generation.store(0, std::memory_order_relaxed);
+   m_busReadyUs.store(NOT_YET, std::memory_order_relaxed);
+   m_firstAcceptUs.store(NOT_YET, std::memory_order_relaxed);
+
+   rebuildEventIndex();
+
+   if (m_dualCore)
+   {
+      return true;
+   }
+
+   return startController();
+}
+
+void CBUSDispatch::setDiagnosticHandler(DiagnosticHandler handler, uint8_t numServices)
+{
+   m_diagnosticHandler = handler;
+   m_numDiagnosticServices = numServices;
+}
+
+void CBUSDispatch::pauseCore1()
+{
+   if (m_dualCore && (m_core1Pauses++ == 0))
+   {
+      multicore_lockout_start_blocking();
+   }
+}
+
+void CBUSDispatch::resumeCore1()
+{
+   if (m_dualCore && (m_core1Pauses > 0) && (--m_core1Pauses == 0))
+   {
+      multicore_lockout_end_blocking();
+   }
+}
+
+void CBUSDispatch::rebuildEventIndex()
+{
+   m_indexStale = true;
+   updateEventIndex();
+}
+
+///
+/// @brief Rebuild the spare event index and publish it
+///
+/// @return false if core 1 has not yet moved off the spare index, try again later
+///
+bool CBUSDispatch::updateEventIndex()
+{
+   const uint32_t generation = m_indexGeneration.load(std::memory_order_relaxed);
+
+   if (m_dualCore && (m_core1Generation.load(std::memory_order_acquire) != generation))
+   {
+      return false;
+   }
+
+   m_eventIndex[(generation + 1) & 1].build(m_moduleConfig);
+   m_indexGeneration.store(generation + 1, std::memory_order_release);
+   m_indexStale = false;
+
+   return true;
+}
+
+///
+/// @brief Check for a frame for the CBUS library
+///
+/// Accessory events found in the receive buffer are consumed here, up to
+/// MAX_EVENTS_PER_POLL per call, the first other frame is held for the library.
+///
+/// @return true if a frame is waiting for the library
+///
+bool CBUSDispatch::available()
+{
+   // Frames held while the controller TX queue was full
+   if (!m_dualCore)
+   {
+      flushTx();
+   }
+
+   // Continue a diagnostic reply
+   sendDiagnostics();
+
+   // The library has finished with the previous frame, let core 1 run again
+   if (m_core1Paused)
+   {
+      resumeCore1();
+      m_core1Paused = false;
+   }
+
+   if (m_framePending)
+   {
+      return true;
+   }
+
+   // The library has processed the previous frame, pick up any event table change,
+   // events are left queued until the index is current
+   if (m_indexStale && !updateEventIndex())
+   {
+      return false;
+   }
+
+   CANFrame msg;
+
+   for (uint8_t events = 0; (events < MAX_EVENTS_PER_POLL) && receive(msg);)
+   {
+      if (dispatchEvent(msg))
+      {
+         events++;
+         continue;
+      }
+
+      if (requestsDiagnostics(msg) || handlesNodeVariables(msg) || answersEventState(msg))
+      {
+         continue;
+      }
+
+      if ((msg.len > 0) && changesEvents(msg.data[0]))
+      {
+         m_indexStale = true;
+      }
+
+      m_frame = msg;
+      m_framePending = true;
+      return true;
+   }
+
+   return false;
+}
+
+///
+/// @brief Check for received frames not yet taken
+///
+/// Looks at the controller receive buffer, or the ring from core 1, without
+/// taking anything, so the main loop can run again at once rather than leave
+/// a backlog to the next wake.
+///
+bool CBUSDispatch::hasPending()
+{
+   return m_dualCore ? !m_rxRing.empty() : CBUSACAN2040::available();
+}
+
+CANFrame CBUSDispatch::getNextMessage()
+{
+   // Core 1 runs from flash, pause it while the library writes the configuration
+   if (m_dualCore && (m_frame.len > 0) && writesConfig(m_frame.data[0]))
+   {
+      pauseCore1();
+      m_core1Paused = true;
+   }
+
+   m_framePending = false;
+   return m_frame;
+}
+
+///
+/// @brief Send a frame, through core 1 in dual core mode
+///
+/// In single core mode the frame goes straight to the controller, unless frames
+/// held from a burst are still waiting, when it is queued behind them.
+///
+bool CBUSDispatch::sendMessage(CANFrame &msg, bool rtr, bool ext, uint8_t priority)
+{
+   msg.rtr = rtr;
+   msg.ext = ext;
+
+   if (!m_dualCore && m_txRing.empty())
+   {
+      return sendFrame(msg, priority);
+   }
+
+   if (!m_txRing.push({msg, priority}))
+   {
+      m_txRingFull++;
+      return false;
+   }
+
+   if (!m_dualCore)
+   {
+      flushTx();
+      return true;
+   }
+
+   // Wake core 1
+   __sev();
+   return true;
+}
+
+///
+/// @brief Send a run of produced events as one burst
+///
+/// The frames are encoded first and queued on the TX ring in one step, so either
+/// the whole burst is sent, in order, or none of it is.
+///
+/// @param events events to send, in order
+/// @param count number of events, up to MAX_BURST_EVENTS
+/// @return false if the TX ring has no room for the whole burst
+///
+bool CBUSDispatch::sendMyEvents(const MyEvent *events, uint8_t count)
+{
+   if (count > MAX_BURST_EVENTS)
+   {
+      return false;
+   }
+
+   TxFrame burst[MAX_BURST_EVENTS];
+   const uint16_t nodeNum = m_moduleConfig.getNodeNum();
+
+   for (uint8_t i = 0; i < count; i++)
+   {
+      CANFrame &msg = burst[i].frame;
+
+      msg = {};
+      msg.len = 5;
+      msg.data[0] = events[i].on ? OPC_ACON : OPC_ACOF;
+      msg.data[1] = highByte(nodeNum);
+      msg.data[2] = lowByte(nodeNum);
+      msg.data[3] = 0;
+      msg.data[4] = events[i].eventNum;
+      burst[i].priority = DEFAULT_PRIORITY;
+   }
+
+   if (!m_txRing.push(burst, count))
+   {
+      m_txRingFull++;
+      return false;
+   }
+
+   if (!m_dualCore)
+   {
+      flushTx();
+      return true;
+   }
+
+   // Wake core 1, once for the whole burst
+   __sev();
+   return true;
+}
+
+///
+/// @brief Take the next received frame, from the controller or from core 1,
+/// then from the gateway's PC
+///
+/// In single core mode frames the acceptance filter rejects are dropped here,
+/// and do not count against the events handled per poll.
+///
+bool CBUSDispatch::receive(CANFrame &msg)
+{
+   if (m_dualCore)
+   {
+      return m_rxRing.pop(msg) || receiveFromHost(msg);
+   }
+
+   while (CBUSACAN2040::available())
+   {
+      takeFrame(msg);
+
+      if (accept(msg, getEventIndex()))
+      {
+         accepted(msg);
+         return true;
+      }
+
+      count(m_rxFiltered);
+   }
+
+   m_rxRun = 0;
+   return receiveFromHost(msg);
+}
+
+///
+/// @brief Send the frames from the gateway's PC, and take those this module wants
+///
+/// Frames are only taken from the gateway while the TX ring has room for them,
+/// the rest wait in the gateway.  The PC's own CAN ID is replaced by this
+/// module's as the frame is sent, its priority is kept.
+///
+/// @return true if a frame from the PC passed the acceptance filter
+///
+bool CBUSDispatch::receiveFromHost(CANFrame &msg)
+{
+   bool queued = false;
+   bool wanted = false;
+
+   while (m_gateway && !wanted && !m_txRing.full() && m_gateway->fromHost(msg))
+   {
+      TxFrame tx{msg, static_cast<uint8_t>((msg.id >> 7) & 0x0F), true};
+
+      m_txRing.push(tx);
+      queued = true;
+      wanted = accept(msg, getEventIndex());
+   }
+
+   if (queued)
+   {
+      if (m_dualCore)
+      {
+         __sev();
+      }
+      else
+      {
+         flushTx();
+      }
+   }
+
+   return wanted;
+}
+
+///
+/// @brief Take a frame from the controller receive buffer and count it
+///
+void CBUSDispatch::takeFrame(CANFrame &msg)
+{
+   msg = CBUSACAN2040::getNextMessage();
+   count(m_rxFrames);
+   countMax(m_rxBufferMax, ++m_rxRun);
+
+   if (m_gateway)
+   {
+      m_gateway->fromBus(msg);
+   }
+}
+
+///
+/// @brief Hand a frame to the controller, count and trace it, and pass it to the gateway
+///
+bool CBUSDispatch::sendFrame(CANFrame &msg, uint8_t priority, bool toGateway)
+{
+   if (!CBUSACAN2040::sendMessage(msg, msg.rtr, msg.ext, priority))
+   {
+      return false;
+   }
+
+   if (m_trace)
+   {
+      m_trace->frame(TraceKind::TX, msg);
+   }
+
+   if (m_gateway && toGateway)
+   {
+      m_gateway->fromBus(msg);
+   }
+
+   count(m_txFrames);
+   return true;
+}
+
+bool CBUSDispatch::beginCore1()
+{
+   return startController();
+}
+
+///
+/// @brief Start the CAN controller and note when the bus came up
+///
+bool CBUSDispatch::startController()
+{
+   const bool result = CBUSACAN2040::begin();
+   m_busReadyUs.store(time_us_32(), std::memory_order_relaxed);
+   return result;
+}
+
+///
+/// @brief Trace a frame that passed the acceptance filter, and note when the first did
+///
+void CBUSDispatch::accepted(const CANFrame &msg)
+{
+   if (m_trace)
+   {
+      m_trace->frame(TraceKind::RX, msg);
+   }
+
+   if (m_firstAcceptUs.load(std::memory_order_relaxed) == NOT_YET)
+   {
+      m_firstAcceptUs.store(time_us_32(), std::memory_order_relaxed);
+   }
+}
+
+///
+/// @brief One pass of the core 1 frame service
+///
+/// Drains the controller receive buffer into the RX ring, dropping frames the
+/// acceptance filter rejects, then hands frames from the TX ring to the
+/// controller.
+///
+/// @return true if both the controller receive buffer and the TX ring are empty
+///
+bool CBUSDispatch::serviceCore1()
+{
+   // Filter with the index core 0 last published, core 0 will not rebuild it until
+   // this core has moved on to a newer one
+   const uint32_t generation = m_indexGeneration.load(std::memory_order_acquire);
+   m_core1Generation.store(generation, std::memory_order_release);
+   const EventIndex &index = m_eventIndex[generation & 1];
+   const uint32_t toHost = m_gateway ? m_gateway->getToHost() : 0;
+   bool received = false;
+   bool idle = true;
+
+   while (CBUSACAN2040::available())
+   {
+      if (m_rxRing.full())
+      {
+         count(m_rxRingFull);
+         idle = false;
+         break;
+      }
+
+      CANFrame msg;
+      takeFrame(msg);
+
+      if (!accept(msg, index))
+      {
+         count(m_rxFiltered);
+         continue;
+      }
+
+      accepted(msg);
+      m_rxRing.push(msg);
+      countMax(m_rxRingMax, m_rxRing.size());
+      received = true;
+   }
+
+   if (idle)
+   {
+      m_rxRun = 0;
+   }
+
+   const uint32_t sent = m_txFrames.load(std::memory_order_relaxed);
+   const bool flushed = flushTx();
+
+   // Wake core 0 for the frames received or for the PC, or to queue more frames in the space freed
+   if (received || (m_txFrames.load(std::memory_order_relaxed) != sent) || (m_gateway && (m_gateway->getToHost() != toHost)))
+   {
+      __sev();
+   }
+
+   return flushed && idle;
+}
+
+///
+/// @brief Hand frames from the TX ring to the controller
+///
+/// Called by the core that owns the controller.  A frame the controller cannot
+/// take yet stays on the ring for the next call.
+///
+/// @return true if the TX ring is empty
+///
+bool CBUSDispatch::flushTx()
+{
+   while (const TxFrame *tx = m_txRing.peek())
+   {
+      CANFrame msg = tx->frame;
+
+      if (!sendFrame(msg, tx->priority, !tx->fromHost))
+      {
+         // Count each time the controller fills, not every retry
+         if (!m_txHolding)
+         {
+            count(m_txStallsAvoided);
+            m_txHolding = true;
+         }
+
+         return false;
+      }
+
+      m_txRing.pop();
+      m_txHolding = false;
+   }
+
+   return true;
+}
+
+///
+/// @brief Start a reply to a diagnostic request addressed to this node
+///
+/// RDGN carries a service index and a diagnostic code, zero for every service
+/// or for every code of the service.  A request for a single code the handler
+/// does not provide gets no reply.
+///
+/// @param msg received frame
+/// @return true if the frame was a diagnostic request for this node
+///
+bool CBUSDispatch::requestsDiagnostics(const CANFrame &msg)
+{
+   if (msg.rtr || (msg.len < 5) || (msg.data[0] != OPC_RDGN))
+   {
+      return false;
+   }
+
+   if (((msg.data[1] << 8) | msg.data[2]) != m_moduleConfig.getNodeNum())
+   {
+      return true;
+   }
+
+   if (!m_diagnosticHandler)
+   {
+      return true;
+   }
+
+   // A new request replaces one still being answered
+   m_dgnAllServices = (msg.data[3] == 0);
+   m_dgnAllCodes = m_dgnAllServices || (msg.data[4] == 0);
+   m_dgnService = m_dgnAllServices ? 1 : msg.data[3];
+   m_dgnCode = m_dgnAllCodes ? 1 : msg.data[4];
+   m_dgnActive = true;
+
+   sendDiagnostics();
+   return true;
+}
+
+///
+/// @brief Send DGN frames of the reply in progress while there is TX space
+///
+void CBUSDispatch::sendDiagnostics()
+{
+   while (m_dgnActive)
+   {
+      uint16_t value;
+
+      if ((m_dgnService <= m_numDiagnosticServices) && (*m_diagnosticHandler)(m_dgnService, m_dgnCode, value))
+      {
+         // Leave room rather than count a refused frame, the rest goes on a later call
+         if (m_txRing.full())
+         {
+            return;
+         }
+
+         const uint16_t nodeNum = m_moduleConfig.getNodeNum();
+         CANFrame msg{};
+         msg.len = 7;
+         msg.data[0] = OPC_DGN;
+         msg.data[1] = highByte(nodeNum);
+         msg.data[2] = lowByte(nodeNum);
+         msg.data[3] = m_dgnService;
+         msg.data[4] = m_dgnCode;
+         msg.data[5] = highByte(value);
+         msg.data[6] = lowByte(value);
+
+         if (!sendMessage(msg))
+         {
+            return;
+         }
+      }
+
+      nextDiagnostic();
+   }
+}
+
+///
+/// @brief Move the reply in progress on to the next service and code
+///
+void CBUSDispatch::nextDiagnostic()
+{
+   if (m_dgnAllCodes && (m_dgnCode < 0xFF))
+   {
+      m_dgnCode++;
+      return;
+   }
+
+   if (m_dgnAllServices && (m_dgnService < m_numDiagnosticServices))
+   {
+      m_dgnService++;
+      m_dgnCode = 1;
+      return;
+   }
+
+   m_dgnActive = false;
+}
+
+///
+/// @brief Answer a node variable read or write addressed to this node
+///
+/// @param msg received frame
+/// @return true if the frame was a node variable request and has been dealt with
+///
+bool CBUSDispatch::handlesNodeVariables(const CANFrame &msg)
+{
+   if (!m_nodeVariableHandler || msg.rtr || (msg.len < 4) || ((msg.data[0] != OPC_NVRD) && (msg.data[0] != OPC_NVSET)))
+   {
+      return false;
+   }
+
+   if (((msg.data[1] << 8) | msg.data[2]) != m_moduleConfig.getNodeNum())
+   {
+      return true;
+   }
+
+   const bool write = (msg.data[0] == OPC_NVSET);
+
+   if (write && (msg.len < 5))
+   {
+      return true;
+   }
+
+   const uint8_t index = msg.data[3];
+   uint8_t value = write ? msg.data[4] : 0;
+
+   if (!(*m_nodeVariableHandler)(index, write, value))
+   {
+      sendNodeReply(OPC_CMDERR, 4, CMDERR_INV_NV_IDX);
+   }
+   else if (write)
+   {
+      sendNodeReply(OPC_WRACK, 3);
+   }
+   else
+   {
+      sendNodeReply(OPC_NVANS, 5, index, value);
+   }
+
+   return true;
+}
+
+///
+/// @brief Answer an accessory request for one of this node's events
+///
+/// @param msg received frame
+/// @return true if the frame was an accessory request and has been dealt with
+///
+bool CBUSDispatch::answersEventState(const CANFrame &msg)
+{
+   if (!m_eventStateHandler || msg.rtr || (msg.len < 5) || (msg.data[0] != OPC_AREQ))
+   {
+      return false;
+   }
+
+   if (((msg.data[1] << 8) | msg.data[2]) != m_moduleConfig.getNodeNum())
+   {
+      return true;
+   }
+
+   bool on;
+
+   if ((*m_eventStateHandler)((msg.data[3] << 8) | msg.data[4], on))
+   {
+      sendNodeReply(on ? OPC_ARON : OPC_AROF, 5, msg.data[3], msg.data[4]);
+   }
+
+   return true;
+}
+
+///
+/// @brief Ask the producer of a long event for its state
+///
+/// Queued on the TX ring in both modes, so the requests of a section, sent one
+/// after another, wait there rather than being refused by a full controller.
+///
+/// @param nn node number of the event
+/// @param en event number
+/// @return false if the TX ring is full
+///
+bool CBUSDispatch::sendEventRequest(uint16_t nn, uint16_t en)
+{
+   TxFrame tx{};
+   tx.frame.len = 5;
+   tx.frame.data[0] = OPC_AREQ;
+   tx.frame.data[1] = highByte(nn);
+   tx.frame.data[2] = lowByte(nn);
+   tx.frame.data[3] = highByte(en);
+   tx.frame.data[4] = lowByte(en);
+   tx.priority = DEFAULT_PRIORITY;
+
+   if (!m_txRing.push(tx))
+   {
+      m_txRingFull++;
+      return false;
+   }
+
+   if (!m_dualCore)
+   {
+      flushTx();
+      return true;
+   }
+
+   // Wake core 1
+   __sev();
+   return true;
+}
+
+///
+/// @brief Send a reply carrying this node's number
+///
+void CBUSDispatch::sendNodeReply(uint8_t opCode, uint8_t len, uint8_t data0, uint8_t data1)
+{
+   const uint16_t nodeNum = m_moduleConfig.getNodeNum();
+   CANFrame msg{};
+   msg.len = len;
+   msg.data[0] = opCode;
+   msg.data[1] = highByte(nodeNum);
+   msg.data[2] = lowByte(nodeNum);
+   msg.data[3] = data0;
+   msg.data[4] = data1;
+
+   sendMessage(msg);
+}
+
+///
+/// @brief Acceptance filter, applied as frames leave the controller
+///
+/// Passes learned accessory events and the answers to requests for them, the
+/// opcodes the CBUS library acts on, and the frames it uses for CAN ID
+/// enumeration: RTR and zero length frames, and any frame sent with this
+/// module's CAN ID.  Everything else on the bus, such
+/// as other modules' events and replies, and cab traffic, is dropped, as are
+/// extended frames, which carry no CBUS messages.
+///
+/// @param msg received frame
+/// @param index event index to match accessory events against
+/// @return true if the frame is wanted
+///
+bool CBUSDispatch::accept(const CANFrame &msg, const EventIndex &index) const
+{
+   if (msg.ext)
+   {
+      return false;
+   }
+
+   if (msg.rtr || (msg.len == 0) || ((msg.id & 0x7F) == m_moduleConfig.getCANID()))
+   {
+      return true;
+   }
+
+   uint16_t nn;
+   uint16_t en;
+
+   if (decodeEvent(msg, nn, en))
+   {
+      return index.find(nn, en) != EventIndex::NO_EVENT;
+   }
+
+   const uint8_t opCode = msg.data[0];
+
+   return libraryOpcodeFilter[opCode / 32] & (1u << (opCode % 32));
+}
+
+///
+/// @brief Handle an accessory event frame
+///
+/// @param msg received frame
+/// @return true if the frame was an accessory event (learned or not)
+///
+bool CBUSDispatch::dispatchEvent(const CANFrame &msg)
+{
+   uint16_t nn;
+   uint16_t en;
+
+   if (!decodeEvent(msg, nn, en))
+   {
+      return false;
+   }
+
+   const uint8_t index = getEventIndex().find(nn, en);
+
+   if ((index != EventIndex::NO_EVENT) && m_eventHandler)
+   {
+      (*m_eventHandler)(index, msg);
+   }
+
+   return true;
+}
+
+///
+/// @brief Decode the event key of an accessory event frame, or of the answer to an accessory request
+///
+/// @param msg received frame
+/// @param nn node number of the event, 0 for short events
+/// @param en event number
+/// @return true if the frame is an accessory event
+///
+bool CBUSDispatch::decodeEvent(const CANFrame &msg, uint16_t &nn, uint16_t &en)
+{
+   if (msg.rtr || msg.ext || (msg.len < 5))
+   {
+      return false;
+   }
+
+   nn = (msg.data[1] << 8) | msg.data[2];
+   en = (msg.data[3] << 8) | msg.data[4];
+
+   switch (msg.data[0])
+   {
+   case OPC_ASON:
+   case OPC_ASOF:
+   case OPC_ASON1:
+   case OPC_ASOF1:
+   case OPC_ASON2:
+   case OPC_ASOF2:
+   case OPC_ASON3:
+   case OPC_ASOF3:
+   case OPC_ARSON:
+   case OPC_ARSOF:
+      // Short events are learned by device number only
+      nn = 0;
+      return true;
+   case OPC_ACON:
+   case OPC_ACOF:
+   case OPC_ACON1:
+   case OPC_ACOF1:
+   case OPC_ACON2:
+   case OPC_ACOF2:
+   case OPC_ACON3:
+   case OPC_ACOF3:
+   case OPC_ARON:
+   case OPC_AROF:
+      return true;
+   default:
+      return false;
+   }
+}
+
+///
+/// @brief Opcodes the library handles by changing the event table
+///
+bool CBUSDispatch::changesEvents(uint8_t opCode)
+{
+   return (opCode == OPC_EVLRN) || (opCode == OPC_EVULN) || (opCode == OPC_NNCLR);
+}
+
+///
+/// @brief Opcodes the library may handle by writing the configuration to flash
+///
+bool CBUSDispatch::writesConfig(uint8_t opCode)
+{
+   switch (opCode)
+   {
+   case OPC_EVLRN:
+   case OPC_EVULN:
+   case OPC_NNCLR:
+   case OPC_NVSET:
+   case OPC_SNN:
+   case OPC_CANID:
+   case OPC_ENUM:
+   case OPC_NNULN:
+      return true;
+   default:
+      return false;
+   }
+}
+
+///
+/// @brief Count an event on core 1, the counter has a single writer
+///
+void CBUSDispatch::count(std::atomic<uint32_t> &counter)
+{
+   counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+///
+/// @brief Raise a high-water mark, the counter has a single writer
+///
+void CBUSDispatch::countMax(std::atomic<uint32_t> &counter, uint32_t value)
+{
+   if (value > counter.load(std::memory_order_relaxed))
+   {
+      counter.store(value, std::memory_order_relaxed);
+   }
+}
@@ -0,0 +1,291 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CBUSACAN2040.h" // CAN controller and CBUS class
+#include "EventIndex.h"   // RAM index of learned events
+#include "FrameTrace.h"   // Frame trace recorder
+#include "GridConnectBridge.h" // GridConnect gateway to a PC
+#include "SpscRing.h"     // Lock-free rings between the cores
+
+#include <atomic>
+#include <cstdint>
+
+///
+/// @brief CBUS transport with a RAM fast path for learned events
+///
+/// Frames pass an acceptance filter as they are taken from the CAN2040 receive
+/// buffer.  Accessory events are matched against the EventIndex and learned
+/// events are passed straight to the module's event handler.  Other frames are
+/// only kept if they carry an opcode the CBUS library acts on, so the library
+/// only sees node management and configuration traffic, and never searches the
+/// event table.
+///
+/// The index is rebuilt at begin() and after the library has processed any
+/// frame that can change the event table.
+///
+/// In dual core mode core 1 owns the CAN2040 controller.  It calls beginCore1()
+/// once and then serviceCore1() continuously, dropping frames the acceptance
+/// filter rejects and passing the remaining frames to core 0 over a lock-free ring.
+/// Frames sent by core 0 go back to core 1 over a second ring.  Each side sends
+/// an event after queuing frames, to wake the other core from WFE.  Core 0 sees the
+/// same available() / getNextMessage() / sendMessage() interface in both modes.
+///
+/// The index is double buffered between the cores: core 0 only rebuilds the
+/// copy core 1 is not filtering with, and publishes it by bumping a generation.
+///
+/// Diagnostic requests (RDGN) addressed to this node are answered here with a
+/// DGN frame for each value the module's diagnostic handler provides.  A reply
+/// to a request for a whole service, or for all services, is sent a few frames
+/// at a time as TX space allows.
+///
+/// Node variable reads and writes (NVRD / NVSET) addressed to this node are
+/// likewise answered here when the module registers a node variable handler,
+/// so the module rather than the library decides how they are stored.
+///
+/// Accessory requests (AREQ) for this node's events are answered here with
+/// ARON / AROF when the module registers an event state handler, so another
+/// module can ask for the state of a block after a reset.  Their answers to
+/// this node's own requests, long (ARON / AROF) or short (ARSON / ARSOF), are
+/// matched against the EventIndex and passed to the event handler like events.
+///
+/// With a GridConnect gateway attached every frame taken from the controller,
+/// before the acceptance filter, and every frame sent is passed to it for the
+/// PC.  Frames from the PC are queued to send like the module's own, but not
+/// passed back to the PC, and are then taken as if received, so the PC can
+/// configure this module through its own USB port.
+///
+/// sendMyEvents() sends the events of a block transition as one burst.  The
+/// frames are encoded up front and queued on the TX ring together, so core 1
+/// sees the whole transition at once and is woken once.  Frames the controller
+/// cannot take yet are held on the ring and sent on a later pass, rather than
+/// refused, and the ring is also used for this in single core mode.
+///
+class CBUSDispatch : public CBUSACAN2040
+{
+public:
+   /// Learned event handler, called with the event table index and the frame
+   using EventHandler = void (*)(uint8_t index, const CANFrame &msg);
+
+   /// Diagnostic value handler, false if the service has no such code
+   using DiagnosticHandler = bool (*)(uint8_t service, uint8_t code, uint16_t &value);
+
+   /// Node variable handler, reads or writes an NV numbered from 1, false if there is no such NV
+   using NodeVariableHandler = bool (*)(uint8_t index, bool write, uint8_t &value);
+
+   /// Event state handler, the state a produced event stands for now, false if the node does not produce it
+   using EventStateHandler = bool (*)(uint16_t en, bool &on);
+
+   static constexpr uint8_t MAX_EVENTS_PER_POLL = 8; ///< Event frames handled per available() call
+   static constexpr size_t RX_RING_SIZE = 32;       ///< Frames buffered from core 1 to core 0
+   static constexpr size_t TX_RING_SIZE = 16;       ///< Frames buffered from core 0 to core 1
+   static constexpr uint8_t MAX_BURST_EVENTS = 4;   ///< Events sent by one sendMyEvents() call
+   static constexpr uint32_t NOT_YET = UINT32_MAX;   ///< Boot time of a step that has not happened
+
+   /// Event of a burst
+   struct MyEvent
+   {
+      uint8_t eventNum; ///< Produced event number
+      bool on;          ///< ACON (true) or ACOF (false)
+   };
+
+   explicit CBUSDispatch(CBUSConfig &config);
+
+   bool begin() override;
+   bool available() override;
+   CANFrame getNextMessage() override;
+
+   /// Received frames are still waiting, left by available() handling MAX_EVENTS_PER_POLL a call
+   bool hasPending();
+   bool sendMessage(CANFrame &msg, bool rtr = false, bool ext = false, uint8_t priority = DEFAULT_PRIORITY) override;
+
+   /// Send a run of produced events as one burst, all or none
+   bool sendMyEvents(const MyEvent *events, uint8_t count);
+
+   /// Register the learned event handler (replaces the library event handler)
+   void setEventHandlerCB(EventHandler handler) { m_eventHandler = handler; }
+
+   /// Register the diagnostic value handler, services are numbered from 1
+   void setDiagnosticHandler(DiagnosticHandler handler, uint8_t numServices);
+
+   /// Register the node variable handler, replacing the library's node variable storage
+   void setNodeVariableHandler(NodeVariableHandler handler) { m_nodeVariableHandler = handler; }
+
+   /// Answer accessory requests (AREQ) for this node's events from a handler
+   void setEventStateHandler(EventStateHandler handler) { m_eventStateHandler = handler; }
+
+   /// Ask the producer of a long event for its state (AREQ), it answers ARON / AROF
+   bool sendEventRequest(uint16_t nn, uint16_t en);
+
+   /// Record accepted and sent frames in a trace, by the core that handles them, nullptr to stop
+   void setTrace(FrameTrace *trace) { m_trace = trace; }
+
+   /// Pass the bus to a PC through a GridConnect gateway, before begin(), nullptr for none
+   void setGateway(GridConnectBridge *gateway) { m_gateway = gateway; }
+
+   /// GridConnect gateway, nullptr if none
+   const GridConnectBridge *getGateway() const { return m_gateway; }
+
+   /// Core 0 - pause core 1 while flash is written, pauses nest
+   void pauseCore1();
+
+   /// Core 0 - let core 1 run again after pauseCore1()
+   void resumeCore1();
+
+   /// Rebuild the event index, e.g. after changing events outside the CBUS library
+   void rebuildEventIndex();
+
+   /// RAM index of the learned events
+   const EventIndex &getEventIndex() const { return m_eventIndex[m_indexGeneration.load(std::memory_order_relaxed) & 1]; }
+
+   /// Select dual core mode, before begin()
+   void setDualCore(bool dualCore) { m_dualCore = dualCore; }
+
+   /// True if core 1 services the CAN controller
+   bool isDualCore() const { return m_dualCore; }
+
+   /// Core 1 - start the CAN controller, its interrupt is taken on this core
+   bool beginCore1();
+
+   /// Core 1 - move received frames to core 0 and frames sent by core 0 to the controller
+   /// @return true if nothing is left to do until the next interrupt or event
+   bool serviceCore1();
+
+   /// Frames taken from the controller receive buffer
+   uint32_t getRxFrames() const { return m_rxFrames.load(std::memory_order_relaxed); }
+
+   /// Frames handed to the controller to send
+   uint32_t getTxFrames() const { return m_txFrames.load(std::memory_order_relaxed); }
+
+   /// Most frames found waiting in the controller receive buffer at once
+   uint32_t getRxBufferMax() const { return m_rxBufferMax.load(std::memory_order_relaxed); }
+
+   /// Most frames waiting on the RX ring for core 0
+   uint32_t getRxRingMax() const { return m_rxRingMax.load(std::memory_order_relaxed); }
+
+   /// Frames dropped by the acceptance filter, on core 1 in dual core mode
+   uint32_t getRxFiltered() const { return m_rxFiltered.load(std::memory_order_relaxed); }
+
+   /// Core 1 passes that left frames in the controller because the RX ring was full
+   uint32_t getRxRingFull() const { return m_rxRingFull.load(std::memory_order_relaxed); }
+
+   /// Frames refused because the TX ring was full
+   uint32_t getTxRingFull() const { return m_txRingFull; }
+
+   /// Times the controller TX queue filled and frames were held on the TX ring instead of refused
+   uint32_t getTxStallsAvoided() const { return m_txStallsAvoided.load(std::memory_order_relaxed); }
+
+   /// Time the CAN controller started receiving (us since reset), NOT_YET before then
+   uint32_t getBusReadyUs() const { return m_busReadyUs.load(std::memory_order_relaxed); }
+
+   /// Time the first frame passed the acceptance filter (us since reset), NOT_YET before then
+   uint32_t getFirstAcceptUs() const { return m_firstAcceptUs.load(std::memory_order_relaxed); }
+
+private:
+   /// Frame queued for core 1 to send
+   struct TxFrame
+   {
+      CANFrame frame;
+      uint8_t priority;
+      bool fromHost{false}; ///< Sent by the gateway's PC, not passed back to it
+   };
+
+   bool receive(CANFrame &msg);
+   bool accept(const CANFrame &msg, const EventIndex &index) const;
+   void accepted(const CANFrame &msg);
+   bool startController();
+   bool flushTx();
+   bool sendFrame(CANFrame &msg, uint8_t priority, bool toGateway = true);
+   bool receiveFromHost(CANFrame &msg);
+   void takeFrame(CANFrame &msg);
+   bool requestsDiagnostics(const CANFrame &msg);
+   bool handlesNodeVariables(const CANFrame &msg);
+   bool answersEventState(const CANFrame &msg);
+   void sendNodeReply(uint8_t opCode, uint8_t len, uint8_t data0 = 0, uint8_t data1 = 0);
+   void sendDiagnostics();
+   void nextDiagnostic();
+   bool updateEventIndex();
+   bool dispatchEvent(const CANFrame &msg);
+   static bool decodeEvent(const CANFrame &msg, uint16_t &nn, uint16_t &en);
+   static bool changesEvents(uint8_t opCode);
+   static bool writesConfig(uint8_t opCode);
+   static void count(std::atomic<uint32_t> &counter);
+   static void countMax(std::atomic<uint32_t> &counter, uint32_t value);
+
+   CBUSConfig &m_moduleConfig;
+   EventIndex m_eventIndex[2];   ///< Event index, in use and spare
+   EventHandler m_eventHandler{nullptr};
+   DiagnosticHandler m_diagnosticHandler{nullptr};
+   uint8_t m_numDiagnosticServices{0};
+   NodeVariableHandler m_nodeVariableHandler{nullptr};
+   EventStateHandler m_eventStateHandler{nullptr};
+   FrameTrace *m_trace{nullptr};
+   GridConnectBridge *m_gateway{nullptr};
+   CANFrame m_frame{};           ///< Frame waiting to be read by the library
+   bool m_framePending{false};   ///< m_frame is valid
+   bool m_indexStale{true};      ///< Event table may have changed since the index was built
+   bool m_dualCore{false};       ///< Core 1 services the CAN controller
+   bool m_core1Paused{false};    ///< Core 1 is locked out while the library writes flash
+   uint8_t m_core1Pauses{0};     ///< Nesting of pauseCore1()
+   bool m_txHolding{false};      ///< The controller refused the frame at the head of the TX ring
+   uint32_t m_rxRun{0};          ///< Frames taken since the controller receive buffer was last empty
+
+   // Diagnostic reply in progress
+   bool m_dgnActive{false};      ///< Reply values still to send
+   bool m_dgnAllServices{false}; ///< Every service was requested
+   bool m_dgnAllCodes{false};    ///< Every code of the service was requested
+   uint8_t m_dgnService{0};      ///< Service of the next value
+   uint8_t m_dgnCode{0};         ///< Code of the next value
+
+   std::atomic<uint32_t> m_indexGeneration{0}; ///< Published index, written by core 0
+   std::atomic<uint32_t> m_core1Generation{0}; ///< Index core 1 filters with, written by core 1
+   SpscRing<CANFrame, RX_RING_SIZE> m_rxRing;  ///< Received frames, core 1 to core 0
+   SpscRing<TxFrame, TX_RING_SIZE> m_txRing;   ///< Frames to send, core 0 to core 1
+   std::atomic<uint32_t> m_rxFrames{0};        ///< Written by the core that owns the controller
+   std::atomic<uint32_t> m_txFrames{0};        ///< Written by the core that owns the controller
+   std::atomic<uint32_t> m_rxBufferMax{0};     ///< Written by the core that owns the controller
+   std::atomic<uint32_t> m_rxRingMax{0};       ///< Written by core 1
+   std::atomic<uint32_t> m_rxFiltered{0};      ///< Written by the core that owns the controller
+   std::atomic<uint32_t> m_rxRingFull{0};      ///< Written by core 1
+   uint32_t m_txRingFull{0};                   ///< Written by core 0
+   std::atomic<uint32_t> m_txStallsAvoided{0}; ///< Written by the core that drains the TX ring
+   std::atomic<uint32_t> m_busReadyUs{NOT_YET};    ///< Written by the core that owns the controller
+   std::atomic<uint32_t> m_firstAcceptUs{NOT_YET}; ///< Written by the core that owns the controller
+};
@@ -0,0 +1,307 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "ConfigJournal.h"
+
+#include <pico/stdlib.h>
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+
+#include <cstring>
+
+static_assert(ConfigJournal::SECTOR_SIZE == FLASH_SECTOR_SIZE, "Journal sector is not the flash erase size");
+static_assert(ConfigJournal::PAGE_SIZE == FLASH_PAGE_SIZE, "Journal page is not the flash program size");
+
+///
+/// @brief Load the settings from the newest snapshot and the records after it
+///
+/// @return false if no snapshot was found, the settings are then erased (0xFF)
+///
+bool ConfigJournal::begin()
+{
+   const uint32_t start = time_us_32();
+
+   memset(m_shadow, 0xFF, sizeof(m_shadow));
+   m_dirty = false;
+   m_sector = NO_SECTOR;
+   m_writePos = 0;
+   m_sequence = 0;
+   m_restored = 0;
+   m_records = 0;
+   m_programs = 0;
+   m_erases = 0;
+   m_bytesWritten = 0;
+
+   // The newest snapshot starts the sector in use
+   for (uint8_t sector = 0; sector < NUM_SECTORS; sector++)
+   {
+      Header header;
+      const uint32_t base = flashOffset(sector);
+
+      if (readRecord(base, base + SECTOR_SIZE, header) && (header.offset == 0) && (header.length == SIZE) &&
+          ((m_sector == NO_SECTOR) || (static_cast<int16_t>(header.sequence - m_sequence) > 0)))
+      {
+         m_sector = sector;
+         m_sequence = header.sequence;
+      }
+   }
+
+   if (m_sector != NO_SECTOR)
+   {
+      // Replay the snapshot and the records that follow it in sequence
+      const uint32_t base = flashOffset(m_sector);
+      uint16_t expected = m_sequence;
+      Header header;
+
+      while (readRecord(base + m_writePos, base + SECTOR_SIZE, header) && (header.sequence == expected))
+      {
+         memcpy(&m_shadow[header.offset], flashData(base + m_writePos + sizeof(Header)), header.length);
+         m_sequence = header.sequence;
+         m_writePos += recordSize(header.length);
+         m_restored++;
+         expected++;
+      }
+
+      // A record cut short by a power loss leaves programmed bytes, start afresh in the other sector
+      const uint8_t *rest = flashData(base + m_writePos);
+
+      for (uint32_t i = 0; i < (SECTOR_SIZE - m_writePos); i++)
+      {
+         if (rest[i] != 0xFF)
+         {
+            m_writePos = SECTOR_SIZE;
+            break;
+         }
+      }
+   }
+
+   m_restoreUs = time_us_32() - start;
+   return m_sector != NO_SECTOR;
+}
+
+///
+/// @brief Change a setting
+///
+/// @param offset setting to change
+/// @param value new value, nothing is written if the setting already has it
+/// @return false if there is no such setting
+///
+bool ConfigJournal::write(uint8_t offset, uint8_t value)
+{
+   if (offset >= SIZE)
+   {
+      return false;
+   }
+
+   if (m_shadow[offset] == value)
+   {
+      return true;
+   }
+
+   m_shadow[offset] = value;
+
+   if (!m_dirty)
+   {
+      // The batch window starts with its first change
+      m_dirty = true;
+      m_dirtyFirst = offset;
+      m_dirtyLast = offset;
+      m_flushAt = time_us_64() + BATCH_US;
+   }
+   else
+   {
+      m_dirtyFirst = (offset < m_dirtyFirst) ? offset : m_dirtyFirst;
+      m_dirtyLast = (offset > m_dirtyLast) ? offset : m_dirtyLast;
+   }
+
+   return true;
+}
+
+bool ConfigJournal::flushDue() const
+{
+   return m_dirty && (time_us_64() >= m_flushAt);
+}
+
+void ConfigJournal::flush()
+{
+   if (!m_dirty)
+   {
+      return;
+   }
+
+   append(m_dirtyFirst, (m_dirtyLast - m_dirtyFirst) + 1);
+   m_dirty = false;
+}
+
+///
+/// @brief Append a record of a run of settings
+///
+/// If the record does not fit the sector in use, a snapshot of all the settings
+/// starts the other sector instead.
+///
+/// @param offset first setting
+/// @param length number of settings
+///
+void ConfigJournal::append(uint8_t offset, uint8_t length)
+{
+   if ((m_sector == NO_SECTOR) || ((m_writePos + recordSize(length)) > SECTOR_SIZE))
+   {
+      // The sector in use stays valid until the snapshot is written
+      m_sector = (m_sector == 0) ? 1 : 0;
+      m_writePos = 0;
+      erase(m_sector);
+
+      offset = 0;
+      length = SIZE;
+   }
+
+   uint8_t record[sizeof(Header) + SIZE + 3];
+   memset(record, 0xFF, sizeof(record));
+
+   Header header{RECORD_MAGIC, static_cast<uint16_t>(m_sequence + 1), offset, length, 0};
+   header.check = checksum(header, &m_shadow[offset]);
+
+   memcpy(record, &header, sizeof(header));
+   memcpy(&record[sizeof(header)], &m_shadow[offset], length);
+
+   program(flashOffset(m_sector) + m_writePos, record, recordSize(length));
+
+   m_sequence = header.sequence;
+   m_writePos += recordSize(length);
+   m_records++;
+   m_bytesWritten += length;
+}
+
+///
+/// @brief Program bytes into erased flash
+///
+/// Flash is programmed in whole pages.  The bytes of a page outside the range
+/// are programmed as 0xFF, which leaves them as they are, so records can share
+/// a page.
+///
+void ConfigJournal::program(uint32_t offset, const uint8_t *data, uint32_t count)
+{
+   uint8_t page[PAGE_SIZE];
+
+   for (uint32_t done = 0; done < count;)
+   {
+      const uint32_t pageStart = (offset + done) & ~(PAGE_SIZE - 1);
+      const uint32_t at = (offset + done) - pageStart;
+      const uint32_t length = ((PAGE_SIZE - at) < (count - done)) ? (PAGE_SIZE - at) : (count - done);
+
+      memset(page, 0xFF, sizeof(page));
+      memcpy(&page[at], &data[done], length);
+
+      const uint32_t interrupts = save_and_disable_interrupts();
+      flash_range_program(pageStart, page, PAGE_SIZE);
+      restore_interrupts(interrupts);
+
+      m_programs++;
+      done += length;
+   }
+}
+
+void ConfigJournal::erase(uint8_t sector)
+{
+   const uint32_t interrupts = save_and_disable_interrupts();
+   flash_range_erase(flashOffset(sector), SECTOR_SIZE);
+   restore_interrupts(interrupts);
+
+   m_erases++;
+}
+
+///
+/// @brief Read and check the record header at a flash offset
+///
+/// @param offset flash offset of the record
+/// @param end flash offset of the end of its sector
+/// @param header the header read
+/// @return false if there is no valid record
+///
+bool ConfigJournal::readRecord(uint32_t offset, uint32_t end, Header &header)
+{
+   if ((offset + sizeof(Header)) > end)
+   {
+      return false;
+   }
+
+   memcpy(&header, flashData(offset), sizeof(header));
+
+   return (header.magic == RECORD_MAGIC) && (header.length > 0) && ((header.offset + header.length) <= SIZE) &&
+          ((offset + recordSize(header.length)) <= end) &&
+          (header.check == checksum(header, flashData(offset + sizeof(Header))));
+}
+
+///
+/// @brief Fletcher-16 of the sequence, position and data of a record
+///
+uint16_t ConfigJournal::checksum(const Header &header, const uint8_t *data)
+{
+   const uint8_t fields[] = {static_cast<uint8_t>(header.sequence >> 8), static_cast<uint8_t>(header.sequence),
+                             header.offset, header.length};
+   uint16_t sum1 = 0;
+   uint16_t sum2 = 0;
+
+   for (uint8_t byte : fields)
+   {
+      sum1 = (sum1 + byte) % 255;
+      sum2 = (sum2 + sum1) % 255;
+   }
+
+   for (uint8_t i = 0; i < header.length; i++)
+   {
+      sum1 = (sum1 + data[i]) % 255;
+      sum2 = (sum2 + sum1) % 255;
+   }
+
+   return static_cast<uint16_t>((sum2 << 8) | sum1);
+}
+
+///
+/// @brief Flash offset of a journal sector, the sectors sit below the last sector of flash
+///
+uint32_t ConfigJournal::flashOffset(uint8_t sector)
+{
+   return PICO_FLASH_SIZE_BYTES - ((NUM_SECTORS + 1 - sector) * SECTOR_SIZE);
+}
+
+const uint8_t *ConfigJournal::flashData(uint32_t offset)
+{
+   return reinterpret_cast<const uint8_t *>(XIP_BASE + offset);
+}
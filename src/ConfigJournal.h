@@ -0,0 +1,150 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+///
+/// @brief Log structured store for the module settings, with a RAM shadow
+///
+/// The settings are held in RAM and read from there.  Changes are journalled
+/// to flash as records of the changed bytes, appended after the records already
+/// written, so a flash sector is only erased once it is full.  Writing a value
+/// that is already stored costs nothing, and changes made close together, such
+/// as a configuration tool setting several node variables, are gathered into
+/// one record once the batch window has passed.
+///
+/// The journal uses two flash sectors below the last sector of flash, which the
+/// CBUS library keeps its configuration in.  Each sector starts with a snapshot
+/// of all the settings, followed by records of later changes.  When a record
+/// does not fit the current sector the other sector is erased and a snapshot
+/// written to it, so a complete copy survives a power loss at any point.  At
+/// boot the newest snapshot is loaded and the records after it are replayed,
+/// stopping at the first record that is blank or fails its check.
+///
+/// Flash is programmed with interrupts disabled.  Core 1 runs from flash, so in
+/// dual core mode the caller pauses it around flush().
+///
+class ConfigJournal
+{
+public:
+   static constexpr uint8_t SIZE = 64;           ///< Bytes of settings
+   static constexpr uint32_t BATCH_US = 500000;  ///< Changes are gathered this long before writing (us)
+   static constexpr uint8_t NUM_SECTORS = 2;     ///< Flash sectors used by the journal
+   static constexpr uint32_t SECTOR_SIZE = 4096; ///< Flash erase size
+   static constexpr uint32_t PAGE_SIZE = 256;    ///< Flash program size
+
+   /// Load the settings from the newest records, false if the journal was empty and the settings are erased (0xFF)
+   bool begin();
+
+   /// Setting at an offset
+   uint8_t read(uint8_t offset) const { return (offset < SIZE) ? m_shadow[offset] : 0xFF; }
+
+   /// Change a setting, the journal is written once the batch window has passed
+   bool write(uint8_t offset, uint8_t value);
+
+   /// True once waiting changes have passed the batch window
+   bool flushDue() const;
+
+   /// Write any waiting changes now
+   void flush();
+
+   /// Time the waiting changes are due to be written (us since boot), UINT64_MAX if there are none
+   uint64_t nextFlushUs() const { return m_dirty ? m_flushAt : UINT64_MAX; }
+
+   /// Time begin() took to load the settings (us)
+   uint32_t getRestoreUs() const { return m_restoreUs; }
+
+   /// Records replayed by begin()
+   uint32_t getRestored() const { return m_restored; }
+
+   /// Records written since begin()
+   uint32_t getRecords() const { return m_records; }
+
+   /// Flash pages programmed since begin()
+   uint32_t getPrograms() const { return m_programs; }
+
+   /// Flash sectors erased since begin()
+   uint32_t getErases() const { return m_erases; }
+
+   /// Setting bytes written to flash since begin()
+   uint32_t getBytesWritten() const { return m_bytesWritten; }
+
+private:
+   /// Record header, followed by the data padded to a multiple of four bytes
+   struct Header
+   {
+      uint16_t magic;    ///< RECORD_MAGIC, 0xFFFF where nothing has been written
+      uint16_t sequence; ///< Increases by one for each record
+      uint8_t offset;    ///< First setting in the record
+      uint8_t length;    ///< Settings in the record
+      uint16_t check;    ///< Fletcher-16 of the header fields above and the data
+   };
+
+   static constexpr uint16_t RECORD_MAGIC = 0xC0F1;
+   static constexpr uint8_t NO_SECTOR = 0xFF;
+
+   static uint32_t recordSize(uint8_t length) { return sizeof(Header) + ((length + 3u) & ~3u); }
+   static uint16_t checksum(const Header &header, const uint8_t *data);
+   static uint32_t flashOffset(uint8_t sector);
+   static const uint8_t *flashData(uint32_t offset);
+
+   static bool readRecord(uint32_t offset, uint32_t end, Header &header);
+   void append(uint8_t offset, uint8_t length);
+   void program(uint32_t offset, const uint8_t *data, uint32_t count);
+   void erase(uint8_t sector);
+
+   uint8_t m_shadow[SIZE];      ///< Current settings
+   bool m_dirty{false};         ///< Settings changed since the last record
+   uint8_t m_dirtyFirst{0};     ///< First changed setting
+   uint8_t m_dirtyLast{0};      ///< Last changed setting
+   uint64_t m_flushAt{0};       ///< Time the changes are due to be written (us)
+   uint8_t m_sector{NO_SECTOR}; ///< Sector being appended to
+   uint32_t m_writePos{0};      ///< Offset of the next record in the sector
+   uint16_t m_sequence{0};      ///< Sequence of the last record written
+
+   uint32_t m_restoreUs{0};
+   uint32_t m_restored{0};
+   uint32_t m_records{0};
+   uint32_t m_programs{0};
+   uint32_t m_erases{0};
+   uint32_t m_bytesWritten{0};
+};
@@ -0,0 +1,136 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "EventIndex.h"
+
+#include "CBUSConfig.h"
+
+#include <cstring>
+
+EventIndex::EventIndex() : m_filter{}, m_key{}, m_eventID{}, m_size{0}
+{
+   memset(m_index, NO_EVENT, sizeof(m_index));
+   memset(m_eventID, NO_EVENT, sizeof(m_eventID));
+}
+
+///
+/// @brief Rebuild the index from the configuration
+///
+/// Reads every event table entry once, this is the only place the event table
+/// is read from the configuration store.
+///
+/// @param config module configuration holding the learned events
+///
+void EventIndex::build(CBUSConfig &config)
+{
+   memset(m_filter, 0, sizeof(m_filter));
+   memset(m_index, NO_EVENT, sizeof(m_index));
+   memset(m_eventID, NO_EVENT, sizeof(m_eventID));
+   m_size = 0;
+
+   const uint8_t numEvents = (config.EE_MAX_EVENTS < MAX_EVENTS) ? config.EE_MAX_EVENTS : MAX_EVENTS;
+
+   for (uint8_t index = 0; index < numEvents; index++)
+   {
+      uint8_t event[4];
+      config.readEvent(index, event);
+
+      // Unused entries are erased
+      if ((event[0] == 0xFF) && (event[1] == 0xFF) && (event[2] == 0xFF) && (event[3] == 0xFF))
+      {
+         continue;
+      }
+
+      const uint32_t key = makeKey((event[0] << 8) | event[1], (event[2] << 8) | event[3]);
+
+      // Linear probe for a free slot, the first learned copy of an event wins
+      uint16_t slot = hash(key);
+
+      while ((m_index[slot] != NO_EVENT) && (m_key[slot] != key))
+      {
+         slot = (slot + 1) & (HASH_SLOTS - 1);
+      }
+
+      if (m_index[slot] == NO_EVENT)
+      {
+         m_key[slot] = key;
+         m_index[slot] = index;
+      }
+
+      const uint16_t bit = filterBit(key);
+      m_filter[bit / 32] |= 1u << (bit % 32);
+
+      m_eventID[index] = config.getEventEVval(index, 1);
+      m_size++;
+   }
+}
+
+///
+/// @brief Find a learned event
+///
+/// @param nn node number of the event, zero for short events
+/// @param en event (or device) number
+/// @return event table index, NO_EVENT if the event has not been learned
+///
+uint8_t EventIndex::find(uint16_t nn, uint16_t en) const
+{
+   const uint32_t key = makeKey(nn, en);
+   const uint16_t bit = filterBit(key);
+
+   // Most events that were not learned stop here
+   if (!(m_filter[bit / 32] & (1u << (bit % 32))))
+   {
+      return NO_EVENT;
+   }
+
+   uint16_t slot = hash(key);
+
+   // The table is never more than half full, so an empty slot ends every probe
+   while (m_index[slot] != NO_EVENT)
+   {
+      if (m_key[slot] == key)
+      {
+         return m_index[slot];
+      }
+
+      slot = (slot + 1) & (HASH_SLOTS - 1);
+   }
+
+   return NO_EVENT;
+}
@@ -0,0 +1,92 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstdint>
+
+class CBUSConfig;
+
+///
+/// @brief RAM index of the learned event table
+///
+/// Maps a learned event, by table index or by its (NN, EN) key, directly to the
+/// value of its event variable, without calling into the configuration store.
+/// The index must be rebuilt from the configuration whenever events are
+/// learned or unlearned.
+///
+/// A bitmap of the learned keys, indexed by a second hash, is tested before the
+/// hash table is probed, so most events that were not learned are rejected by
+/// a single bit test.
+///
+class EventIndex
+{
+public:
+   static constexpr uint8_t MAX_EVENTS = 64;  ///< Largest event table that can be indexed
+   static constexpr uint8_t NO_EVENT = 0xFF;  ///< Lookup result for an unknown event
+
+   EventIndex();
+
+   /// Rebuild the index from the learned events in the configuration
+   void build(CBUSConfig &config);
+
+   /// Find the event table index of a learned event, NO_EVENT if not learned
+   uint8_t find(uint16_t nn, uint16_t en) const;
+
+   /// Event variable of the event at a table index, NO_EVENT if unused
+   uint8_t eventID(uint8_t index) const { return (index < MAX_EVENTS) ? m_eventID[index] : NO_EVENT; }
+
+   /// Number of learned events
+   uint8_t size() const { return m_size; }
+
+private:
+   static constexpr uint16_t HASH_BITS = 7;                ///< log2 of hash table size
+   static constexpr uint16_t HASH_SLOTS = 1u << HASH_BITS; ///< Hash slots, at least twice MAX_EVENTS
+   static constexpr uint16_t FILTER_BITS = 8;              ///< log2 of filter bitmap size, four times MAX_EVENTS
+
+   static uint32_t makeKey(uint16_t nn, uint16_t en) { return (static_cast<uint32_t>(nn) << 16) | en; }
+   static uint16_t hash(uint32_t key) { return static_cast<uint16_t>((key * 2654435761u) >> (32 - HASH_BITS)); }
+   static uint16_t filterBit(uint32_t key) { return static_cast<uint16_t>((key * 0x85EBCA6Bu) >> (32 - FILTER_BITS)); }
+
+   uint32_t m_filter[(1u << FILTER_BITS) / 32]; ///< Bit set for each learned key
+   uint32_t m_key[HASH_SLOTS];    ///< (NN, EN) key of each hash slot
+   uint8_t m_index[HASH_SLOTS];   ///< Event table index of each hash slot, NO_EVENT if empty
+   uint8_t m_eventID[MAX_EVENTS]; ///< Event variable by event table index
+   uint8_t m_size;                ///< Number of learned events
+};
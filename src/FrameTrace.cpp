@@ -0,0 +1,148 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "FrameTrace.h"
+
+#include <pico/stdlib.h>
+#include <hardware/sync.h>
+
+#include <cstring>
+
+void FrameTrace::begin(Ring &core0, Ring &core1)
+{
+   m_rings[0] = core0;
+   m_rings[1] = core1;
+
+   for (uint8_t core = 0; core < NUM_CORES; core++)
+   {
+      memset(m_rings[core], 0, sizeof(Ring));
+      m_next[core] = 0;
+   }
+
+   m_paused = false;
+}
+
+///
+/// @brief Add a record to the ring of the calling core
+///
+void FrameTrace::add(uint8_t kind, uint8_t tag, const uint8_t *data, uint8_t length)
+{
+   if (m_paused)
+   {
+      return;
+   }
+
+   const uint32_t interrupts = save_and_disable_interrupts();
+   const uint32_t core = get_core_num();
+   const uint32_t next = m_next[core];
+   TraceRecord &record = m_rings[core][next & (RECORDS - 1)];
+
+   record.time = time_us_32();
+   record.kind = kind;
+   record.tag = tag;
+   memcpy(record.data, data, length);
+   memset(record.data + length, 0, sizeof(record.data) - length);
+   m_next[core] = next + 1;
+
+   restore_interrupts(interrupts);
+}
+
+void FrameTrace::frame(TraceKind kind, const CANFrame &frame)
+{
+   const uint8_t length = frame.rtr ? 0 : frame.len;
+
+   add(static_cast<uint8_t>((static_cast<uint8_t>(kind) << 4) | (length & 0x0F)), static_cast<uint8_t>(frame.id & 0x7F),
+       frame.data, (length < sizeof(TraceRecord::data)) ? length : sizeof(TraceRecord::data));
+}
+
+void FrameTrace::step(TraceKind kind, uint8_t section, uint8_t from, uint8_t to, uint8_t input)
+{
+   const uint8_t data[] = {from, to, input};
+
+   add(static_cast<uint8_t>(kind) << 4, section, data, sizeof(data));
+}
+
+void FrameTrace::edge(uint8_t gpio, uint32_t events)
+{
+   const uint8_t data[] = {static_cast<uint8_t>(events)};
+
+   add(static_cast<uint8_t>(TraceKind::Switch) << 4, gpio, data, sizeof(data));
+}
+
+///
+/// @brief Write the rings as text
+///
+/// Each core's ring is a header line, one line of 24 hex digits per record in
+/// memory order (time little endian first) and an end line:
+///
+///     trace core 0 records 128
+///     4c1d00001502900101000700
+///     ...
+///     end
+///
+void FrameTrace::dump(FILE *out)
+{
+   m_paused = true;
+
+   for (uint8_t core = 0; core < NUM_CORES; core++)
+   {
+      const uint32_t next = m_next[core];
+      const uint32_t count = (next < RECORDS) ? next : RECORDS;
+
+      fprintf(out, "trace core %u records %lu\n", core, static_cast<unsigned long>(count));
+
+      for (uint32_t i = next - count; i != next; i++)
+      {
+         const TraceRecord &record = m_rings[core][i & (RECORDS - 1)];
+         const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&record);
+
+         for (size_t b = 0; b < sizeof(TraceRecord); b++)
+         {
+            fprintf(out, "%02x", bytes[b]);
+         }
+
+         fputc('\n', out);
+      }
+
+      fprintf(out, "end\n");
+   }
+
+   fflush(out);
+   m_paused = false;
+}
@@ -0,0 +1,122 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CBUS.h" // CANFrame
+
+#include <cstdint>
+#include <cstdio>
+
+/// Kinds of trace record
+enum class TraceKind : uint8_t
+{
+   Empty,  ///< Slot never written
+   RX,     ///< Frame accepted by the acceptance filter
+   TX,     ///< Frame handed to the CAN controller
+   Local,  ///< Local box state machine step
+   Remote, ///< Remote box state machine step
+   Switch  ///< Switch input edge
+};
+
+///
+/// @brief One trace record, packed into 12 bytes
+///
+/// | Kind          | tag        | data                                   |
+/// |---------------|------------|----------------------------------------|
+/// | RX / TX       | CAN ID     | First 6 bytes of the frame             |
+/// | Local, Remote | Section    | From state, to state, input            |
+/// | Switch        | GPIO       | GPIO interrupt events (edge bits)      |
+///
+struct TraceRecord
+{
+   uint32_t time;   ///< Time of the record (us since boot)
+   uint8_t kind;    ///< TraceKind in the high nibble, frame length in the low nibble
+   uint8_t tag;     ///< See the table above
+   uint8_t data[6]; ///< See the table above
+};
+
+static_assert(sizeof(TraceRecord) == 12, "Trace record is not packed");
+
+///
+/// @brief Timestamped trace of frames, state machine steps and switch edges
+///
+/// Each core records into its own ring, so recording needs no lock between
+/// the cores, only interrupts masked on the recording core.  A record is a
+/// timer read and a 12 byte store.  The oldest records are overwritten.
+///
+/// The rings are supplied by the module so they can be placed in the scratch
+/// RAM banks, which hold little more than the core stacks.  dump() writes both
+/// rings as hex text for the CANBlockTrace host tool to decode into a timeline.
+///
+class FrameTrace
+{
+public:
+   static constexpr uint16_t RECORDS = 128; ///< Records per core, a power of two
+   static constexpr uint8_t NUM_CORES = 2;
+
+   using Ring = TraceRecord[RECORDS];
+
+   static_assert((RECORDS & (RECORDS - 1)) == 0, "Trace ring size is not a power of two");
+
+   /// Clear the rings and start recording
+   void begin(Ring &core0, Ring &core1);
+
+   /// Record a received or sent frame
+   void frame(TraceKind kind, const CANFrame &frame);
+
+   /// Record a state machine step of a block section
+   void step(TraceKind kind, uint8_t section, uint8_t from, uint8_t to, uint8_t input);
+
+   /// Record a switch input edge, from the GPIO interrupt
+   void edge(uint8_t gpio, uint32_t events);
+
+   /// Write the records of both cores, oldest first, recording stops while they are written
+   void dump(FILE *out);
+
+   /// Records made since begin(), by both cores
+   uint32_t getRecorded() const { return m_next[0] + m_next[1]; }
+
+private:
+   void add(uint8_t kind, uint8_t tag, const uint8_t *data, uint8_t length);
+
+   TraceRecord *m_rings[NUM_CORES]{};
+   volatile uint32_t m_next[NUM_CORES]{}; ///< Records made by each core, the next slot is this modulo RECORDS
+   volatile bool m_paused{true};
+};
@@ -0,0 +1,469 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "GridConnectBridge.h"
+
+#include <pico/time.h>
+
+namespace
+{
+   constexpr char HEX_DIGITS[] = "0123456789ABCDEF";
+
+   /// Write the low digits of a value as hex, most significant first
+   char *hex(char *text, uint32_t value, uint8_t digits)
+   {
+      for (uint8_t i = digits; i > 0; i--)
+      {
+         text[i - 1] = HEX_DIGITS[value & 0x0F];
+         value >>= 4;
+      }
+
+      return text + digits;
+   }
+
+   /// Value of a run of hex digits, either case, false if any is not a hex digit
+   bool unhex(const char *text, uint8_t digits, uint32_t &value)
+   {
+      value = 0;
+
+      for (uint8_t i = 0; i < digits; i++)
+      {
+         const char c = text[i];
+         uint32_t nibble;
+
+         if ((c >= '0') && (c <= '9'))
+         {
+            nibble = c - '0';
+         }
+         else if ((c >= 'A') && (c <= 'F'))
+         {
+            nibble = c - 'A' + 10;
+         }
+         else if ((c >= 'a') && (c <= 'f'))
+         {
+            nibble = c - 'a' + 10;
+         }
+         else
+         {
+            return false;
+         }
+
+         value = (value << 4) | nibble;
+      }
+
+      return true;
+   }
+}
+
+bool GridConnectBridge::begin(UsbSerial &port)
+{
+   m_port = &port;
+   m_batchLength = 0;
+   m_batchWritten = 0;
+   m_readLength = 0;
+   m_readParsed = 0;
+   m_lineLength = 0;
+   m_key = NO_KEY;
+   m_portFull = false;
+   m_flushAtUs = UINT64_MAX;
+   m_open.store(false, std::memory_order_relaxed);
+   m_toHostRing.clear();
+   m_fromHost.clear();
+
+   return port.begin();
+}
+
+///
+/// @brief Queue a frame for the PC, called by the core that owns the controller
+///
+bool GridConnectBridge::fromBus(const CANFrame &frame)
+{
+   if (!m_open.load(std::memory_order_relaxed))
+   {
+      return false;
+   }
+
+   if (!m_toHostRing.push(frame))
+   {
+      m_toHostDropped.store(m_toHostDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+   }
+
+   m_toHostFrames.store(m_toHostFrames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+   return true;
+}
+
+///
+/// @brief Move frames between the rings and the port
+///
+/// Frames waiting when the PC closes the port are dropped, a PC opening it
+/// starts from the frames that follow.
+///
+void GridConnectBridge::run()
+{
+   if (!m_port)
+   {
+      return;
+   }
+
+   const bool open = m_port->connected();
+
+   if (open != m_open.load(std::memory_order_relaxed))
+   {
+      m_open.store(open, std::memory_order_relaxed);
+      m_batchLength = 0;
+      m_batchWritten = 0;
+      m_lineLength = 0;
+      m_flushAtUs = UINT64_MAX;
+   }
+
+   if (!open)
+   {
+      while (m_toHostRing.peek())
+      {
+         m_toHostRing.pop();
+      }
+
+      return;
+   }
+
+   writeHost();
+   readHost();
+}
+
+uint64_t GridConnectBridge::nextRunUs() const
+{
+   if (!isOpen())
+   {
+      return UINT64_MAX;
+   }
+
+   // Frames for the PC go once their batch is due unless the port is full, frames from the PC wait for
+   // room on the bus.  Frames run() has not seen yet are looked at at once, to start their deadline
+   if (!m_toHostRing.empty() && !m_portFull)
+   {
+      if ((m_flushAtUs == UINT64_MAX) || (m_toHostRing.size() >= FLUSH_FRAMES))
+      {
+         return 0;
+      }
+
+      return m_flushAtUs;
+   }
+
+   if (!m_toHostRing.empty() || (m_batchWritten < m_batchLength) || !m_fromHost.empty())
+   {
+      return time_us_64() + RETRY_US;
+   }
+
+   return UINT64_MAX;
+}
+
+///
+/// @brief Take the console key the PC sent, once the stream is between frames
+///
+/// What the key prints shares the port with the frames, so the key is held
+/// while a batch is only part written, until the port has taken the rest.
+/// Frames still on the ring follow the printout whole.
+///
+int GridConnectBridge::takeKey()
+{
+   if (m_batchWritten < m_batchLength)
+   {
+      return NO_KEY;
+   }
+
+   const int key = m_key;
+   m_key = NO_KEY;
+   return key;
+}
+
+///
+/// @brief Encode waiting frames into the batch and write it to the port
+///
+/// The part of a batch the port has no room for is written on a later pass,
+/// and the batch is only refilled once all of it has gone.  The port is
+/// flushed once a batch has gone, so its last, part filled, USB packet is
+/// sent.
+///
+void GridConnectBridge::writeHost()
+{
+   while (true)
+   {
+      if (m_batchWritten == m_batchLength)
+      {
+         if (!batchDue())
+         {
+            return;
+         }
+
+         m_batchLength = 0;
+         m_batchWritten = 0;
+
+         while ((m_batchLength + MAX_FRAME_TEXT) <= BATCH_SIZE)
+         {
+            const CANFrame *frame = m_toHostRing.peek();
+
+            if (!frame)
+            {
+               break;
+            }
+
+            m_batchLength += encode(*frame, &m_batch[m_batchLength]);
+            m_toHostRing.pop();
+         }
+
+         // Frames left over wait no longer than the deadline of the frames before them
+         if (m_toHostRing.empty())
+         {
+            m_flushAtUs = UINT64_MAX;
+         }
+
+         m_batches++;
+      }
+
+      const size_t written = m_port->write(&m_batch[m_batchWritten], m_batchLength - m_batchWritten);
+      m_portFull = !written;
+
+      if (!written)
+      {
+         return;
+      }
+
+      m_batchWritten += written;
+
+      if (m_batchWritten == m_batchLength)
+      {
+         m_port->flush();
+      }
+   }
+}
+
+///
+/// @brief Whether the frames on the ring are to be written now
+///
+/// The first frame seen starts the deadline, later ones share its batch.
+///
+bool GridConnectBridge::batchDue()
+{
+   if (m_toHostRing.empty())
+   {
+      return false;
+   }
+
+   const uint64_t now = time_us_64();
+
+   if (m_flushAtUs == UINT64_MAX)
+   {
+      m_flushAtUs = now + COALESCE_US;
+   }
+
+   return (m_toHostRing.size() >= FLUSH_FRAMES) || (now >= m_flushAtUs);
+}
+
+///
+/// @brief Read from the port and parse frames until the ring of frames for the bus is full
+///
+void GridConnectBridge::readHost()
+{
+   while (!m_fromHost.full())
+   {
+      if (m_readParsed == m_readLength)
+      {
+         m_readParsed = 0;
+         m_readLength = m_port->read(m_read, READ_SIZE);
+
+         if (!m_readLength)
+         {
+            return;
+         }
+      }
+
+      if (parse(m_read[m_readParsed++]))
+      {
+         m_fromHostFrames++;
+      }
+   }
+}
+
+///
+/// @brief Take the next character from the PC
+///
+/// @return true if it completed a frame, which is then on the ring for the bus
+///
+bool GridConnectBridge::parse(char c)
+{
+   // A frame start, also abandons a frame cut short
+   if (c == ':')
+   {
+      m_badLines += (m_lineLength > 0);
+      m_line[0] = c;
+      m_lineLength = 1;
+      return false;
+   }
+
+   if (!m_lineLength)
+   {
+      // Line ends and spacing between frames, anything else is for the console
+      if ((c > ' ') && (c < 0x7F))
+      {
+         m_key = c;
+      }
+
+      return false;
+   }
+
+   if (m_lineLength == MAX_FRAME_TEXT)
+   {
+      m_badLines++;
+      m_lineLength = 0;
+      return false;
+   }
+
+   m_line[m_lineLength++] = c;
+
+   if (c != ';')
+   {
+      return false;
+   }
+
+   CANFrame frame;
+   const bool valid = decode(m_line, m_lineLength, frame);
+   m_lineLength = 0;
+
+   if (!valid)
+   {
+      m_badLines++;
+      return false;
+   }
+
+   m_fromHost.push(frame);
+   return true;
+}
+
+size_t GridConnectBridge::encode(const CANFrame &frame, char *text)
+{
+   char *p = text;
+   *p++ = ':';
+
+   if (frame.ext)
+   {
+      const uint32_t sidl = (((frame.id >> 18) & 0x07) << 5) | 0x08 | ((frame.id >> 16) & 0x03);
+      *p++ = 'X';
+      p = hex(p, (frame.id >> 21) & 0xFF, 2);
+      p = hex(p, sidl, 2);
+      p = hex(p, frame.id & 0xFFFF, 4);
+   }
+   else
+   {
+      *p++ = 'S';
+      p = hex(p, (frame.id & 0x7FF) << 5, 4);
+   }
+
+   *p++ = frame.rtr ? 'R' : 'N';
+
+   for (uint8_t i = 0; (i < frame.len) && (i < sizeof(frame.data)); i++)
+   {
+      p = hex(p, frame.data[i], 2);
+   }
+
+   *p++ = ';';
+   return p - text;
+}
+
+bool GridConnectBridge::decode(const char *text, size_t length, CANFrame &frame)
+{
+   if ((length < 8) || (text[0] != ':') || (text[length - 1] != ';') || ((text[1] != 'S') && (text[1] != 'X')))
+   {
+      return false;
+   }
+
+   frame = CANFrame{};
+   frame.ext = (text[1] == 'X');
+
+   const uint8_t headerDigits = frame.ext ? 8 : 4;
+   const char *p = text + 2;
+   const char *end = text + length - 1;
+   uint32_t header;
+
+   if (((end - p) < (headerDigits + 1)) || !unhex(p, headerDigits, header))
+   {
+      return false;
+   }
+
+   p += headerDigits;
+
+   // The header is the controller's ID registers, SIDH SIDL [EID8 EID0]
+   if (frame.ext)
+   {
+      frame.id = ((header >> 24) << 21) | (((header >> 21) & 0x07) << 18) | (((header >> 16) & 0x03) << 16) |
+                 (header & 0xFFFF);
+   }
+   else
+   {
+      frame.id = (header >> 5) & 0x7FF;
+   }
+
+   if ((*p != 'N') && (*p != 'R'))
+   {
+      return false;
+   }
+
+   frame.rtr = (*p++ == 'R');
+
+   // Whole bytes only, at most eight
+   if ((((end - p) % 2) != 0) || ((end - p) > (2 * static_cast<int>(sizeof(frame.data)))))
+   {
+      return false;
+   }
+
+   while (p < end)
+   {
+      uint32_t value;
+
+      if (!unhex(p, 2, value))
+      {
+         return false;
+      }
+
+      frame.data[frame.len++] = static_cast<uint8_t>(value);
+      p += 2;
+   }
+
+   return true;
+}
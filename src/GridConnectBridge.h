@@ -0,0 +1,161 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CBUS.h"      // CAN frame
+#include "SpscRing.h"  // Lock-free rings between the cores
+#include "UsbSerial.h" // USB CDC port
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+///
+/// @brief GridConnect gateway between the CBUS and a PC on the USB port
+///
+/// Lets the module stand in for a CAN-USB interface, so JMRI or the FCU can
+/// use the bus through it.  Every frame on the bus, and every frame the module
+/// sends, is passed to the PC as a line of GridConnect text, and frames the
+/// PC sends are sent on the bus and also taken by this module as if received.
+///
+/// The core that owns the CAN controller hands each frame to fromBus(), which
+/// only copies it onto a lock-free ring.  run(), on core 0, lets frames gather
+/// on the ring for up to COALESCE_US, or until a batch's worth is waiting, then
+/// encodes them straight into a batch buffer with a table driven hex encoder
+/// rather than printf, and hands the batch to the port in one write and one
+/// flush, so several frames share a USB packet.  Lines from the PC are parsed
+/// as they are read into a ring of frames for CBUSDispatch to send.  Nothing
+/// is allocated.
+///
+/// A frame is ":S" and four hex digits of the 11 bit ID shifted into the SIDH
+/// SIDL register layout, or ":X" and eight hex digits of a 29 bit ID in the
+/// SIDH SIDL EID8 EID0 layout, then "N" for a data frame or "R" for a remote
+/// request, two hex digits per data byte and ";", e.g. ":SB020N9001010006;".
+/// Characters from the PC outside a frame are kept as console keys.
+///
+class GridConnectBridge
+{
+public:
+   static constexpr size_t MAX_FRAME_TEXT = 28;    ///< Longest frame, extended with 8 data bytes
+   static constexpr size_t TO_HOST_RING_SIZE = 128; ///< Bus frames waiting for USB, 100 ms of a full bus of events
+   static constexpr size_t FROM_HOST_RING_SIZE = 16; ///< Frames from the PC waiting for the bus
+   static constexpr size_t BATCH_SIZE = 256;        ///< Text handed to the port at once, the CDC transmit FIFO
+   static constexpr size_t READ_SIZE = 64;          ///< Text read from the port at once, one USB packet
+   static constexpr uint32_t RETRY_US = 1000;       ///< Pass interval while the port or the bus holds frames back (us)
+   static constexpr uint32_t COALESCE_US = 2000;    ///< Longest a frame waits for others, the bus time of a USB packet of events (us)
+   static constexpr size_t FLUSH_FRAMES = BATCH_SIZE / MAX_FRAME_TEXT; ///< Frames waiting that fill a batch, written at once
+   static constexpr int NO_KEY = -1;                ///< No console key waiting
+
+   /// Start the gateway on a port, frames flow while a PC has it open
+   bool begin(UsbSerial &port);
+
+   /// Controller owner - pass a frame seen on, or sent to, the bus to the PC
+   /// @return false if no PC has the port open or the ring is full
+   bool fromBus(const CANFrame &frame);
+
+   /// Core 0 - take the next frame the PC sent, for the bus
+   bool fromHost(CANFrame &frame) { return m_fromHost.pop(frame); }
+
+   /// Core 0 - write waiting frames to the PC and read what it has sent
+   void run();
+
+   /// Time run() must next be called by (us since boot), UINT64_MAX if nothing is waiting
+   uint64_t nextRunUs() const;
+
+   /// Console key sent by the PC outside a frame, NO_KEY if none or a frame is part written
+   int takeKey();
+
+   /// Encode a frame as GridConnect text, without a terminating NUL
+   /// @param text room for MAX_FRAME_TEXT characters
+   /// @return characters written
+   static size_t encode(const CANFrame &frame, char *text);
+
+   /// Decode the GridConnect text of one frame, from ':' to ';'
+   /// @return false if the text is not a well formed frame
+   static bool decode(const char *text, size_t length, CANFrame &frame);
+
+   /// A PC has the port open and frames are passed to it
+   bool isOpen() const { return m_open.load(std::memory_order_relaxed); }
+
+   /// Frames queued for the PC, written by the controller owner
+   uint32_t getToHost() const { return m_toHostFrames.load(std::memory_order_relaxed); }
+
+   /// Frames lost to a full ring while the PC had the port open, written by the controller owner
+   uint32_t getToHostDropped() const { return m_toHostDropped.load(std::memory_order_relaxed); }
+
+   /// Frames received from the PC
+   uint32_t getFromHost() const { return m_fromHostFrames; }
+
+   /// Lines from the PC that were not well formed frames
+   uint32_t getBadLines() const { return m_badLines; }
+
+   /// Batches written to the port
+   uint32_t getBatches() const { return m_batches; }
+
+private:
+   void writeHost();
+   bool batchDue();
+   void readHost();
+   bool parse(char c);
+
+   UsbSerial *m_port{nullptr};
+   std::atomic<bool> m_open{false}; ///< Written by core 0
+   SpscRing<CANFrame, TO_HOST_RING_SIZE> m_toHostRing;     ///< Controller owner to core 0
+   SpscRing<CANFrame, FROM_HOST_RING_SIZE> m_fromHost;     ///< Core 0 to core 0, drained by CBUSDispatch
+
+   char m_batch[BATCH_SIZE];   ///< Encoded frames waiting for the port
+   size_t m_batchLength{0};    ///< Characters in the batch
+   size_t m_batchWritten{0};   ///< Characters of the batch the port has taken
+   bool m_portFull{false};     ///< The port took nothing of the last write
+   uint64_t m_flushAtUs{UINT64_MAX}; ///< Time the frames on the ring are written by, UINT64_MAX if none wait
+
+   char m_read[READ_SIZE];     ///< Text read from the port
+   size_t m_readLength{0};     ///< Characters read
+   size_t m_readParsed{0};     ///< Characters of them parsed
+   char m_line[MAX_FRAME_TEXT]; ///< Frame being received
+   size_t m_lineLength{0};     ///< Characters of the frame so far, 0 outside a frame
+   int m_key{NO_KEY};
+
+   std::atomic<uint32_t> m_toHostFrames{0};  ///< Written by the controller owner
+   std::atomic<uint32_t> m_toHostDropped{0}; ///< Written by the controller owner
+   uint32_t m_fromHostFrames{0};
+   uint32_t m_badLines{0};
+   uint32_t m_batches{0};
+};
@@ -0,0 +1,133 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "IndicatorOutput.h"
+#include "PortExpander.h"
+
+#include <pico/stdlib.h>
+
+///
+/// @brief Claim the indicator pins
+///
+/// @param pinMask pins driven by the output stage
+/// @param expander port expanders of the pins above the GPIO, already set up with them as outputs
+///
+void IndicatorOutput::begin(const PinMask &pinMask, PortExpander *expander)
+{
+   m_pinMask = pinMask;
+   m_on = PinMask{};
+   m_blink = PinMask{};
+   m_outputs = PinMask{};
+   m_expander = expander;
+   m_phase = false;
+
+   gpio_init_mask(pinMask.gpio());
+   gpio_set_dir_out_masked(pinMask.gpio());
+   gpio_put_masked(pinMask.gpio(), 0);
+   m_writes++;
+}
+
+///
+/// @brief Set the wanted indicator pattern
+///
+/// @param onMask pins lit steadily
+/// @param blinkMask pins flashing, takes precedence over onMask
+///
+void IndicatorOutput::set(const PinMask &onMask, const PinMask &blinkMask)
+{
+   const PinMask blink = blinkMask & m_pinMask;
+   const PinMask on = onMask & m_pinMask & ~blink;
+
+   if ((on == m_on) && (blink == m_blink))
+   {
+      return;
+   }
+
+   m_on = on;
+   m_blink = blink;
+   update();
+}
+
+void IndicatorOutput::run()
+{
+   // All flashing LEDs follow the same phase of the system clock
+   const bool phase = ((to_ms_since_boot(get_absolute_time()) / BLINK_PERIOD_MS) & 1u) == 0;
+
+   if (phase != m_phase)
+   {
+      m_phase = phase;
+      update();
+   }
+}
+
+uint64_t IndicatorOutput::nextChangeUs() const
+{
+   if (!m_blink)
+   {
+      return UINT64_MAX;
+   }
+
+   const uint64_t period = BLINK_PERIOD_MS * 1000ull;
+
+   return ((time_us_64() / period) + 1) * period;
+}
+
+void IndicatorOutput::update()
+{
+   const PinMask outputs = m_on | (m_phase ? m_blink : PinMask{});
+
+   if (outputs == m_outputs)
+   {
+      return;
+   }
+
+   // One write for all GPIO indicators, the expanders write theirs on their next scan
+   if (outputs.gpio() != m_outputs.gpio())
+   {
+      gpio_put_masked(m_pinMask.gpio(), outputs.gpio());
+   }
+
+   if (m_expander)
+   {
+      m_expander->write(outputs);
+   }
+
+   m_outputs = outputs;
+   m_writes++;
+}
@@ -0,0 +1,92 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "PinMask.h"
+
+#include <cstdint>
+
+class PortExpander;
+
+///
+/// @brief Block indicator LED output stage
+///
+/// Holds the wanted indicator pattern as pin masks, one mask of LEDs lit and
+/// one of LEDs flashing.  The outputs are only written when the resulting pin
+/// levels change, with a single masked write for all GPIO indicators.  The
+/// levels of indicators on port expanders are staged with the expanders and
+/// go out with their next scan, one write per device however many changed.
+/// Flashing LEDs share one timebase, so they flash in step.
+///
+class IndicatorOutput
+{
+public:
+   static constexpr uint32_t BLINK_PERIOD_MS = 500; ///< Time each blink phase lasts (ms)
+
+   /// Claim the indicator pins as outputs, all off
+   /// @param expander port expanders driving the indicator pins above the GPIO, if any
+   void begin(const PinMask &pinMask, PortExpander *expander = nullptr);
+
+   /// Set the wanted pattern, cheap when nothing changed
+   void set(const PinMask &onMask, const PinMask &blinkMask);
+
+   /// Advance the blink timebase and update the outputs if they changed
+   void run();
+
+   /// Time of the next blink phase change (us since boot), UINT64_MAX if nothing flashes
+   uint64_t nextChangeUs() const;
+
+   /// Current output levels
+   const PinMask &getOutputs() const { return m_outputs; }
+
+   /// Number of output updates made
+   uint32_t getWriteCount() const { return m_writes; }
+
+private:
+   void update();
+
+   PinMask m_pinMask{};   ///< Pins owned by the output stage
+   PinMask m_on{};        ///< Pins lit
+   PinMask m_blink{};     ///< Pins flashing
+   PinMask m_outputs{};   ///< Levels last written
+   PortExpander *m_expander{nullptr};
+   uint32_t m_writes{0};  ///< Output updates made
+   bool m_phase{false};   ///< Blink phase, flashing LEDs are lit in phase true
+};
@@ -0,0 +1,166 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "InputCapture.h"
+#include "InputCapture.pio.h"
+
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/pio.h>
+#include <pico/stdlib.h>
+
+namespace
+{
+   constexpr uint32_t TRANSFERS = 1u << 31; ///< Samples in one DMA transfer, then the other channel takes over
+   constexpr float MAX_CLKDIV = 65535.0f;   ///< Largest state machine clock divider
+
+   // A whole number of rings, so each transfer ends where the other channel starts
+   static_assert((TRANSFERS % InputCapture::RING_SAMPLES) == 0, "DMA transfer is not a whole number of rings");
+
+   PIO const capturePio = pio1;
+}
+
+///
+/// @brief Start sampling the GPIO bank
+///
+/// The pins to be sampled must already be set up as inputs, the state machine
+/// reads the pads without taking them over.
+///
+/// @param sampleUs time between samples (us)
+/// @return true if sampling started
+///
+bool InputCapture::begin(uint32_t sampleUs)
+{
+   const float clkdiv = (clock_get_hz(clk_sys) / 1e6f) * sampleUs / CYCLES_PER_SAMPLE;
+
+   if ((clkdiv < 1.0f) || (clkdiv > MAX_CLKDIV) || !pio_can_add_program(capturePio, &input_capture_program))
+   {
+      return false;
+   }
+
+   m_sm = pio_claim_unused_sm(capturePio, false);
+   m_channel = dma_claim_unused_channel(false);
+   m_next = dma_claim_unused_channel(false);
+
+   if ((m_sm < 0) || (m_channel < 0) || (m_next < 0))
+   {
+      if (m_sm >= 0)
+      {
+         pio_sm_unclaim(capturePio, m_sm);
+      }
+
+      if (m_channel >= 0)
+      {
+         dma_channel_unclaim(m_channel);
+      }
+
+      if (m_next >= 0)
+      {
+         dma_channel_unclaim(m_next);
+      }
+
+      m_sm = -1;
+      m_channel = -1;
+      m_next = -1;
+      return false;
+   }
+
+   const uint offset = pio_add_program(capturePio, &input_capture_program);
+   pio_sm_config config = input_capture_program_get_default_config(offset);
+   sm_config_set_in_pins(&config, 0);
+   sm_config_set_in_shift(&config, false, true, 32);
+   sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+   sm_config_set_clkdiv(&config, clkdiv);
+   pio_sm_init(capturePio, m_sm, offset, &config);
+
+   // Samples go round the ring, the write address wraps on the ring's alignment.  Each channel
+   // starts the other as its transfer ends, which reloads its count, so the FIFO is never left
+   // unread and the samples stay at their exact intervals
+   const int channels[2] = {m_channel, m_next};
+
+   for (int i = 0; i < 2; i++)
+   {
+      dma_channel_config dma = dma_channel_get_default_config(channels[i]);
+      channel_config_set_transfer_data_size(&dma, DMA_SIZE_32);
+      channel_config_set_read_increment(&dma, false);
+      channel_config_set_write_increment(&dma, true);
+      channel_config_set_ring(&dma, true, RING_BITS);
+      channel_config_set_dreq(&dma, pio_get_dreq(capturePio, m_sm, false));
+      channel_config_set_chain_to(&dma, channels[1 - i]);
+      dma_channel_configure(channels[i], &dma, m_ring, &capturePio->rxf[m_sm], TRANSFERS, i == 0);
+   }
+
+   m_written = 0;
+   m_read = 0;
+   m_armed = 0;
+   m_overruns = 0;
+   m_sampleUs = sampleUs;
+   m_startUs = time_us_64();
+   pio_sm_set_enabled(capturePio, m_sm, true);
+
+   return true;
+}
+
+///
+/// @brief Count the samples the DMA channels have written
+///
+/// A transfer runs for 2^31 samples, about 165 days at the debounce sample
+/// rate but only 36 minutes at 1 us, and the other channel takes over as it
+/// ends, the joined FIFO holding the samples meanwhile.  The channels hand
+/// over by themselves, this only has to see each hand over, so it must run at
+/// least once a transfer.
+///
+void InputCapture::update()
+{
+   if (m_channel < 0)
+   {
+      return;
+   }
+
+   // Finished and the other channel running, a channel between the two reads 0 left, all written
+   if (!dma_channel_is_busy(m_channel) && dma_channel_is_busy(m_next))
+   {
+      m_armed += TRANSFERS;
+      const int finished = m_channel;
+      m_channel = m_next;
+      m_next = finished;
+   }
+
+   m_written = m_armed + (TRANSFERS - dma_channel_hw_addr(m_channel)->transfer_count);
+}
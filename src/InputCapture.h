@@ -0,0 +1,123 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstdint>
+
+///
+/// @brief Samples the GPIO bank at a fixed rate into a ring, without the CPU
+///
+/// A state machine of PIO1 (CAN2040 has PIO0) reads all GPIO with one IN
+/// instruction every CYCLES_PER_SAMPLE clocks, its clock divided down to the
+/// sample rate, and two DMA channels, each chained to start the other as it
+/// ends, move each sample from the RX FIFO into a ring in RAM.  Samples are
+/// taken at exact intervals whatever the cores are doing, and the ring holds
+/// RING_SAMPLES of them, so the main loop can take them in batches and still
+/// see a press that came and went while it was busy.
+///
+class InputCapture
+{
+public:
+   static constexpr uint16_t RING_SAMPLES = 256;     ///< Samples held, a power of two
+   static constexpr uint32_t CYCLES_PER_SAMPLE = 32; ///< State machine clocks between samples
+   static constexpr uint8_t RING_BITS = 10;          ///< log2 of the ring size in bytes, for the DMA address wrap
+
+   static_assert((RING_SAMPLES * sizeof(uint32_t)) == (1u << RING_BITS), "Ring size and DMA wrap differ");
+
+   /// Claim a state machine and two DMA channels and start sampling
+   /// @param sampleUs time between samples (us)
+   /// @return false if no state machine or channels are free or the rate is out of range, nothing is claimed
+   bool begin(uint32_t sampleUs);
+
+   /// Take the oldest sample not yet taken
+   /// @param levels GPIO levels of the sample
+   /// @return false if there are none
+   bool pop(uint32_t &levels);
+
+   /// Time a sample not yet taken is made (us since boot)
+   /// @param ahead 1 for the next sample to be taken, 2 for the one after and so on
+   uint64_t sampleTimeUs(uint32_t ahead = 1) const
+   {
+      return m_startUs + static_cast<uint64_t>(m_read + ahead - 1) * m_sampleUs;
+   }
+
+   /// Time between samples (us)
+   uint32_t getSampleUs() const { return m_sampleUs; }
+
+   /// Samples overwritten before they were taken
+   uint32_t getOverruns() const { return m_overruns; }
+
+private:
+   /// Bring m_written up to date
+   void update();
+
+   alignas(1u << RING_BITS) uint32_t m_ring[RING_SAMPLES]{}; ///< Written by the DMA channels
+   volatile uint64_t m_written{0}; ///< Samples made since begin()
+   uint64_t m_read{0};             ///< Samples taken since begin()
+   uint64_t m_armed{0};            ///< Samples made before the DMA transfer running now
+   uint64_t m_startUs{0};          ///< Time of the first sample (us since boot)
+   uint32_t m_sampleUs{0};
+   uint32_t m_overruns{0};
+   int m_sm{-1};
+   int m_channel{-1};              ///< DMA channel of the transfer running now
+   int m_next{-1};                 ///< DMA channel started as it ends
+};
+
+inline bool InputCapture::pop(uint32_t &levels)
+{
+   update();
+
+   // The oldest slot is the next to be written, skip what has been overwritten
+   if ((m_written - m_read) >= RING_SAMPLES)
+   {
+      const uint32_t skip = static_cast<uint32_t>((m_written - m_read) - (RING_SAMPLES - 1));
+      m_overruns += skip;
+      m_read += skip;
+   }
+
+   if (m_read == m_written)
+   {
+      return false;
+   }
+
+   levels = m_ring[m_read % RING_SAMPLES];
+   m_read++;
+   return true;
+}
@@ -0,0 +1,132 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "LoopScheduler.h"
+
+#include <pico/stdlib.h>
+
+///
+/// @brief Enable the switch input interrupts
+///
+/// @param inputMask GPIO pins of the switches
+/// @param callback GPIO interrupt handler, it must call inputEdge()
+///
+void LoopScheduler::begin(uint32_t inputMask, gpio_irq_callback_t callback)
+{
+   m_edgePending = false;
+   m_settlePending = false;
+   m_passTime = time_us_64();
+   m_settleUntil = 0;
+   m_deadline = NEVER;
+
+   for (uint32_t pin = 0; pin < 32; pin++)
+   {
+      if (inputMask & (1u << pin))
+      {
+         gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true, callback);
+      }
+   }
+}
+
+void LoopScheduler::inputEdge(bool settle)
+{
+   // Keep the time of the first edge, a later one is handled by the same pass
+   if (!m_edgePending)
+   {
+      m_edgeTime = time_us_64();
+      m_edgePending = true;
+   }
+
+   if (settle)
+   {
+      m_settlePending = true;
+   }
+}
+
+void LoopScheduler::startPass()
+{
+   m_passTime = time_us_64();
+   m_wakes++;
+
+   // An edge arriving after this is still inside the settle time, or wakes the next pass
+   if (m_edgePending)
+   {
+      const uint32_t latency = static_cast<uint32_t>(m_passTime - m_edgeTime);
+      m_edgePending = false;
+
+      m_edges++;
+      m_edgeLatencyTotal += latency;
+      m_edgeLatencyMax = (latency > m_edgeLatencyMax) ? latency : m_edgeLatencyMax;
+
+      if (m_settlePending)
+      {
+         m_settlePending = false;
+         m_settleUntil = m_passTime + SWITCH_SETTLE_US;
+      }
+   }
+}
+
+void LoopScheduler::wakeBy(uint64_t us)
+{
+   m_deadline = (us < m_deadline) ? us : m_deadline;
+}
+
+///
+/// @brief Wait for the next event or deadline
+///
+/// Returns at once if an interrupt or event arrived since the pass started.
+///
+void LoopScheduler::idle()
+{
+   uint64_t deadline = m_passTime + HOUSEKEEPING_US;
+
+   if (m_passTime < m_settleUntil)
+   {
+      deadline = m_passTime + SWITCH_POLL_US;
+   }
+
+   if (m_deadline < deadline)
+   {
+      deadline = m_deadline;
+   }
+
+   m_deadline = NEVER;
+
+   best_effort_wfe_or_timeout(from_us_since_boot(deadline));
+}
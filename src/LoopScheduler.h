@@ -0,0 +1,108 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <hardware/gpio.h>
+
+#include <cstdint>
+
+///
+/// @brief Wakes the main loop only when there is work to do
+///
+/// Between passes of loop() core 0 waits for an event with WFE.  It is woken by
+/// an edge on a switch input, by a received CAN frame (the CAN2040 interrupt,
+/// or an event sent by core 1 in dual core mode), or by the earliest deadline
+/// the module asked for, such as the next blink phase change.
+///
+/// Switches are polled for a short settle time after an edge so the debounce
+/// in SwitchInput, and in the CBUS library for its FLiM switch, can start
+/// counting, and the CBUS library gets a slow housekeeping pass for its own
+/// LEDs and FLiM switch timing.  Switches sampled by an InputCapture need no
+/// settle polling, SwitchInput asks for a wake when their samples are in.
+///
+class LoopScheduler
+{
+public:
+   static constexpr uint64_t NEVER = UINT64_MAX;         ///< No deadline
+   static constexpr uint32_t SWITCH_POLL_US = 1000;      ///< Pass interval while switches settle (us)
+   static constexpr uint32_t SWITCH_SETTLE_US = 50000;   ///< Switches are polled this long after an edge (us)
+   static constexpr uint32_t HOUSEKEEPING_US = 50000;    ///< Longest time between passes (us)
+
+   /// Enable edge interrupts on the switch inputs
+   void begin(uint32_t inputMask, gpio_irq_callback_t callback);
+
+   /// Record a switch edge, called from the GPIO interrupt
+   /// @param settle poll the switches for the settle time after it
+   void inputEdge(bool settle = true);
+
+   /// Start a pass of loop(), after a wake
+   void startPass();
+
+   /// Ask for a pass no later than a time (us since boot)
+   void wakeBy(uint64_t us);
+
+   /// Wait for an event or the next deadline
+   void idle();
+
+   /// Passes of loop() run
+   uint32_t getWakes() const { return m_wakes; }
+
+   /// Switch edges that woke the loop
+   uint32_t getEdges() const { return m_edges; }
+
+   /// Average time from a switch edge to the pass that handled it (us)
+   uint32_t getEdgeLatencyAvgUs() const { return m_edges ? static_cast<uint32_t>(m_edgeLatencyTotal / m_edges) : 0; }
+
+   /// Longest time from a switch edge to the pass that handled it (us)
+   uint32_t getEdgeLatencyMaxUs() const { return m_edgeLatencyMax; }
+
+private:
+   volatile uint64_t m_edgeTime{0};   ///< Time of the first edge not yet handled, written by the interrupt
+   volatile bool m_edgePending{false}; ///< An edge is waiting for a pass
+   volatile bool m_settlePending{false}; ///< An edge waiting for a pass asked for settle polling
+   uint64_t m_passTime{0};            ///< Start of the last pass
+   uint64_t m_settleUntil{0};         ///< Switches are polled until this time
+   uint64_t m_deadline{NEVER};        ///< Earliest deadline asked for during this pass
+
+   uint32_t m_wakes{0};
+   uint32_t m_edges{0};
+   uint64_t m_edgeLatencyTotal{0};
+   uint32_t m_edgeLatencyMax{0};
+};
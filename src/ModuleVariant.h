@@ -0,0 +1,96 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include "CANBlock.h"
+#include "RequestTracker.h"
+
+/// Box at the other end of the module's block sections
+enum class Pairing : uint8_t
+{
+   CANBlock, ///< Another CANBlock, sending requests and the bell as well as replies
+   CANMIO,   ///< A CANMIO driving a needle servo, only replying with feedback of the needle's position
+};
+
+constexpr uint8_t CANMIO_FEEDBACK_EVENTS = 3; ///< Positions a CANMIO needle reports: Line Clear, Train on Track, Normal
+constexpr uint32_t NEEDLE_TIMEOUT_US = 1000000; ///< Wait for a needle to report its position, a servo travels slowly (us)
+
+//
+/// Module variant
+///
+/// Everything a build of the module fixes at compile time, from the build's
+/// definitions (see CMakeLists.txt for the named variants).  The module's
+/// tables, the library's configuration layout and the feature set are all
+/// derived from the one constexpr instance, so a feature the variant does not
+/// have is folded away by the compiler rather than tested at run time.
+//
+
+struct ModuleVariant
+{
+   const char *name;  ///< Variant name, in the binary info and the host reports
+   uint8_t sections;  ///< Block sections run by the module
+   uint8_t expanders; ///< I2C port expanders, one for each section from section 1
+   Pairing pairing;   ///< Box at the other end of every section
+   uint8_t numNVs;    ///< Node variables
+   uint8_t rxBuffers; ///< Library CAN RX buffers, holding the frames that arrive before loop() runs
+
+   static constexpr uint32_t NVS_START = 10; ///< Configuration offset of the node variables
+   static constexpr uint8_t NUM_EVS = 1;     ///< Event variables of each event, the section and InEventID
+
+   /// Box in advance is another CANBlock, so the remote state machines, remote indicators and bell are used
+   constexpr bool paired() const { return pairing == Pairing::CANBlock; }
+
+   /// Attention bell and warning buzzer fitted, section 1 takes their pins in a GPIO only multi-section module
+   constexpr bool bellFitted() const { return paired() && ((sections < 2) || (expanders > 0)); }
+
+   /// Events each section can be taught, every InEventID from a CANBlock, the needle's feedback from a CANMIO
+   constexpr uint8_t eventsPerSection() const { return paired() ? MAX_EVENT_ID : CANMIO_FEEDBACK_EVENTS; }
+
+   /// Size of the event table
+   constexpr uint8_t numEvents() const { return sections * eventsPerSection(); }
+
+   /// Wait for a reply before a request is first sent again (us)
+   constexpr uint32_t replyTimeoutUs() const { return paired() ? RequestTracker::TIMEOUT_US : NEEDLE_TIMEOUT_US; }
+
+   /// Configuration offset of the event table, straight after the node variables
+   constexpr uint32_t eventsStart() const { return NVS_START + numNVs; }
+};
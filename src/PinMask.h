@@ -0,0 +1,184 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef CANBLOCK_EXPANDERS
+#define CANBLOCK_EXPANDERS 0
+#endif
+
+//
+/// Module pins
+///
+/// Pins 0 to 29 are the Pico's GPIO.  Pins from EXPANDER_PIN_BASE up are the
+/// pins of the I2C port expanders, 16 to a device with port A as bits 0 to 7
+/// and port B as bits 8 to 15.
+//
+
+constexpr uint8_t NUM_EXPANDERS = CANBLOCK_EXPANDERS; ///< Port expanders fitted
+constexpr uint8_t MAX_EXPANDERS = 8;                  ///< Port expanders one I2C bus can address
+constexpr uint8_t EXPANDER_PINS = 16;                 ///< Pins of one port expander
+constexpr uint8_t EXPANDER_PIN_BASE = 32;             ///< Pin number of bit 0 of the first port expander
+
+static_assert(NUM_EXPANDERS <= MAX_EXPANDERS, "Too many port expanders");
+
+/// Pin number of a port expander pin
+constexpr uint8_t expanderPin(uint8_t device, uint8_t bit) { return EXPANDER_PIN_BASE + device * EXPANDER_PINS + bit; }
+
+///
+/// @brief A set of module pins, one bit each
+///
+/// Word 0 holds the GPIO, each word after it the pins of two port expanders.
+/// Without expanders a mask is a single word, so the operators cost what the
+/// plain GPIO masks did.
+///
+struct PinMask
+{
+   static constexpr size_t WORDS = 1 + (NUM_EXPANDERS + 1) / 2; ///< GPIO word and expander words
+
+   uint32_t word[WORDS]{};
+
+   /// GPIO pins
+   constexpr uint32_t gpio() const { return word[0]; }
+
+   /// Pins of one port expander
+   constexpr uint16_t expander(uint8_t device) const
+   {
+      return static_cast<uint16_t>(word[1 + device / 2] >> ((device % 2) * EXPANDER_PINS));
+   }
+
+   /// Set the pins of one port expander
+   constexpr void setExpander(uint8_t device, uint16_t bits)
+   {
+      const uint8_t shift = (device % 2) * EXPANDER_PINS;
+      uint32_t &w = word[1 + device / 2];
+      w = (w & ~(0xFFFFu << shift)) | (static_cast<uint32_t>(bits) << shift);
+   }
+
+   /// Any pin set
+   constexpr explicit operator bool() const
+   {
+      uint32_t any = 0;
+
+      for (size_t i = 0; i < WORDS; i++)
+      {
+         any |= word[i];
+      }
+
+      return any != 0;
+   }
+
+   constexpr PinMask operator~() const
+   {
+      PinMask r{};
+
+      for (size_t i = 0; i < WORDS; i++)
+      {
+         r.word[i] = ~word[i];
+      }
+
+      return r;
+   }
+
+   constexpr PinMask &operator|=(const PinMask &other)
+   {
+      for (size_t i = 0; i < WORDS; i++)
+      {
+         word[i] |= other.word[i];
+      }
+
+      return *this;
+   }
+
+   constexpr PinMask &operator&=(const PinMask &other)
+   {
+      for (size_t i = 0; i < WORDS; i++)
+      {
+         word[i] &= other.word[i];
+      }
+
+      return *this;
+   }
+
+   constexpr PinMask &operator^=(const PinMask &other)
+   {
+      for (size_t i = 0; i < WORDS; i++)
+      {
+         word[i] ^= other.word[i];
+      }
+
+      return *this;
+   }
+};
+
+constexpr PinMask operator|(PinMask a, const PinMask &b) { return a |= b; }
+constexpr PinMask operator&(PinMask a, const PinMask &b) { return a &= b; }
+constexpr PinMask operator^(PinMask a, const PinMask &b) { return a ^= b; }
+
+constexpr bool operator==(const PinMask &a, const PinMask &b) { return !(a ^ b); }
+constexpr bool operator!=(const PinMask &a, const PinMask &b) { return !(a == b); }
+
+/// Mask of one pin, none if not fitted
+constexpr PinMask pinBit(uint8_t pin)
+{
+   PinMask mask{};
+
+   if (pin < 32)
+   {
+      mask.word[0] = 1u << pin;
+   }
+   else if ((pin >= EXPANDER_PIN_BASE) && (pin < (EXPANDER_PIN_BASE + NUM_EXPANDERS * EXPANDER_PINS)))
+   {
+      const uint8_t bit = pin - EXPANDER_PIN_BASE;
+      mask.word[1 + bit / 32] = 1u << (bit % 32);
+   }
+
+   return mask;
+}
+
+/// Mask of GPIO pins
+constexpr PinMask gpioMask(uint32_t gpio)
+{
+   PinMask mask{};
+   mask.word[0] = gpio;
+   return mask;
+}
@@ -0,0 +1,278 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "PortExpander.h"
+
+#include <hardware/dma.h>
+#include <hardware/i2c.h>
+#include <hardware/irq.h>
+#include <pico/stdlib.h>
+
+namespace
+{
+   // MCP23017 registers with IOCON.BANK clear, the A and B registers of a pair are adjacent
+   constexpr uint8_t IODIRA = 0x00;
+   constexpr uint8_t GPINTENA = 0x04;
+   constexpr uint8_t IOCON = 0x0A;
+   constexpr uint8_t GPPUA = 0x0C;
+   constexpr uint8_t GPIOA = 0x12;
+   constexpr uint8_t OLATA = 0x14;
+
+   constexpr uint8_t IOCON_MIRROR = 0x40; ///< INTA and INTB both signal either port
+   constexpr uint8_t IOCON_ODR = 0x04;    ///< INT outputs open drain, so the devices share one line
+
+   i2c_inst_t *const expanderI2c = i2c0;
+
+   PortExpander *instance; ///< Expander served by the DMA interrupt
+
+   /// Write a register pair of a device, blocking
+   bool writePair(uint8_t address, uint8_t reg, uint16_t value)
+   {
+      const uint8_t data[3]{reg, static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8)};
+      return i2c_write_blocking(expanderI2c, address, data, sizeof(data), false) == sizeof(data);
+   }
+}
+
+///
+/// @brief Set up the devices
+///
+/// Every device has its inputs pulled up and interrupting on any change, and
+/// its outputs driven low.  Its inputs are read, which also clears its
+/// interrupt.
+///
+bool PortExpander::begin(uint8_t devices, const PinMask &inputs, uint8_t intPin)
+{
+   m_devices = 0;
+
+   i2c_init(expanderI2c, I2C_BAUD);
+   gpio_set_function(I2C_SDA, GPIO_FUNC_I2C);
+   gpio_set_function(I2C_SCL, GPIO_FUNC_I2C);
+   gpio_pull_up(I2C_SDA);
+   gpio_pull_up(I2C_SCL);
+
+   gpio_init(intPin);
+   gpio_set_dir(intPin, GPIO_IN);
+   gpio_pull_up(intPin);
+
+   for (uint8_t d = 0; d < devices; d++)
+   {
+      const uint8_t address = BASE_ADDRESS + d;
+      const uint16_t in = inputs.expander(d);
+      const uint8_t iocon = IOCON_MIRROR | IOCON_ODR;
+      const uint8_t config[2]{IOCON, iocon};
+      const uint8_t reg = GPIOA;
+      uint8_t levels[2];
+
+      if ((i2c_write_blocking(expanderI2c, address, config, sizeof(config), false) != sizeof(config)) ||
+          !writePair(address, OLATA, 0) || !writePair(address, IODIRA, in) || !writePair(address, GPPUA, in) ||
+          !writePair(address, GPINTENA, in) || (i2c_write_blocking(expanderI2c, address, &reg, 1, true) != 1) ||
+          (i2c_read_blocking(expanderI2c, address, levels, sizeof(levels), false) != sizeof(levels)))
+      {
+         return false;
+      }
+
+      m_inputs.setExpander(d, levels[0] | (levels[1] << 8));
+   }
+
+   m_txChannel = dma_claim_unused_channel(false);
+   m_rxChannel = dma_claim_unused_channel(false);
+
+   if ((m_txChannel < 0) || (m_rxChannel < 0))
+   {
+      if (m_txChannel >= 0)
+      {
+         dma_channel_unclaim(m_txChannel);
+      }
+
+      m_txChannel = -1;
+      m_rxChannel = -1;
+      return false;
+   }
+
+   // Commands go to the I2C FIFO as the controller takes them, the bytes read come back the same way
+   dma_channel_config tx = dma_channel_get_default_config(m_txChannel);
+   channel_config_set_transfer_data_size(&tx, DMA_SIZE_32);
+   channel_config_set_read_increment(&tx, true);
+   channel_config_set_write_increment(&tx, false);
+   channel_config_set_dreq(&tx, i2c_get_dreq(expanderI2c, true));
+   dma_channel_configure(m_txChannel, &tx, &i2c_get_hw(expanderI2c)->data_cmd, m_commands, 0, false);
+
+   dma_channel_config rx = dma_channel_get_default_config(m_rxChannel);
+   channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+   channel_config_set_read_increment(&rx, false);
+   channel_config_set_write_increment(&rx, true);
+   channel_config_set_dreq(&rx, i2c_get_dreq(expanderI2c, false));
+   dma_channel_configure(m_rxChannel, &rx, m_rx, &i2c_get_hw(expanderI2c)->data_cmd, 0, false);
+
+   instance = this;
+   dma_channel_set_irq1_enabled(m_rxChannel, true);
+   irq_add_shared_handler(DMA_IRQ_1, dmaIrq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+   irq_set_enabled(DMA_IRQ_1, true);
+
+   m_outputs = PinMask{};
+   m_written = PinMask{};
+   m_dirty = 0;
+   m_intPin = intPin;
+   m_devices = devices;
+   return true;
+}
+
+void PortExpander::write(const PinMask &levels)
+{
+   for (uint8_t d = 0; d < m_devices; d++)
+   {
+      m_outputs.setExpander(d, levels.expander(d));
+
+      if (m_outputs.expander(d) != m_written.expander(d))
+      {
+         m_dirty |= 1u << d;
+      }
+   }
+}
+
+void PortExpander::run()
+{
+   if (!m_devices)
+   {
+      return;
+   }
+
+   const uint64_t now = time_us_64();
+
+   if (m_scanning)
+   {
+      if ((now - m_scanStart) < SCAN_TIMEOUT_US)
+      {
+         return;
+      }
+
+      // A device that did not answer aborts the transfer and the bytes to read never come
+      dma_channel_abort(m_txChannel);
+      dma_channel_abort(m_rxChannel);
+      (void)i2c_get_hw(expanderI2c)->clr_tx_abrt;
+      m_errors++;
+      m_scanning = false;
+
+      // Latches of the abandoned scan may not have been written, write them all again
+      m_dirty = static_cast<uint8_t>((1u << m_devices) - 1);
+   }
+
+   if (m_requested || m_dirty || !gpio_get(m_intPin))
+   {
+      m_requested = false;
+      m_scanning = true;
+      m_scanStart = now;
+      startDevice(0);
+   }
+}
+
+bool PortExpander::takeScan()
+{
+   const bool complete = m_complete;
+   m_complete = false;
+   return complete;
+}
+
+uint64_t PortExpander::nextRunUs() const
+{
+   // The DMA interrupt wakes the loop when a scan completes
+   return m_scanning ? (m_scanStart + SCAN_TIMEOUT_US) : UINT64_MAX;
+}
+
+///
+/// @brief Start the transaction of one device
+///
+/// Writes both output latches if the staged levels differ from them, then
+/// reads both input ports, with a repeated start between the register
+/// address and the reads.
+///
+void PortExpander::startDevice(uint8_t device)
+{
+   i2c_hw_t *hw = i2c_get_hw(expanderI2c);
+   const uint16_t outputs = m_outputs.expander(device);
+   uint8_t n = 0;
+
+   m_device = device;
+
+   if (m_dirty & (1u << device))
+   {
+      m_dirty &= ~(1u << device);
+      m_commands[n++] = OLATA;
+      m_commands[n++] = outputs & 0xFF;
+      m_commands[n++] = (outputs >> 8) | I2C_IC_DATA_CMD_STOP_BITS;
+      m_written.setExpander(device, outputs);
+      m_writes++;
+   }
+
+   m_commands[n++] = GPIOA;
+   m_commands[n++] = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_RESTART_BITS;
+   m_commands[n++] = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS;
+
+   // The target address can only be changed with the controller disabled
+   hw->enable = 0;
+   hw->tar = BASE_ADDRESS + device;
+   hw->enable = 1;
+
+   dma_channel_transfer_to_buffer_now(m_rxChannel, m_rx, sizeof(m_rx));
+   dma_channel_transfer_from_buffer_now(m_txChannel, m_commands, n);
+}
+
+void PortExpander::deviceDone()
+{
+   m_inputs.setExpander(m_device, m_rx[0] | (m_rx[1] << 8));
+
+   if ((m_device + 1) < m_devices)
+   {
+      startDevice(m_device + 1);
+      return;
+   }
+
+   m_scans++;
+   m_scanning = false;
+   m_complete = true;
+}
+
+void PortExpander::dmaIrq()
+{
+   if (instance && dma_channel_get_irq1_status(instance->m_rxChannel))
+   {
+      dma_channel_acknowledge_irq1(instance->m_rxChannel);
+      instance->deviceDone();
+   }
+}
@@ -0,0 +1,130 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "PinMask.h"
+
+#include <cstdint>
+
+///
+/// @brief MCP23017 I2C port expanders, scanned in batches by DMA
+///
+/// Up to MAX_EXPANDERS devices share I2C0 on GP0 / GP1, at addresses 0x20
+/// upwards.  A scan takes every device in turn: one transaction writes both
+/// output latches if the outputs staged since the last scan changed them, and
+/// reads both input ports.  The commands and the bytes read are moved by two
+/// DMA channels and the DMA interrupt starts the next device, so a scan costs
+/// the CPU a few register writes per device.
+///
+/// Scans are started by run() when outputs are staged, when a scan was asked
+/// for, or when the devices' mirrored, open drain INTA line is low, which they
+/// pull on any input change until the inputs are read.  Nothing is polled
+/// while the inputs are steady.
+///
+class PortExpander
+{
+public:
+   static constexpr uint8_t I2C_SDA = 0;          ///< I2C0 data pin
+   static constexpr uint8_t I2C_SCL = 1;          ///< I2C0 clock pin
+   static constexpr uint32_t I2C_BAUD = 400000;   ///< I2C clock (Hz)
+   static constexpr uint8_t BASE_ADDRESS = 0x20;  ///< I2C address of the first device
+   static constexpr uint32_t SCAN_TIMEOUT_US = 5000; ///< A scan not finished by then is abandoned (us)
+
+   /// Set up the devices and read their inputs, blocking, for setup()
+   /// @param devices number of devices, at consecutive addresses from BASE_ADDRESS
+   /// @param inputs pins of every device that are inputs, pulled up and interrupting on change, the rest are outputs
+   /// @param intPin GPIO wired to the devices' INTA outputs, pulled up
+   /// @return false if a device did not answer, the expanders are then not used
+   bool begin(uint8_t devices, const PinMask &inputs, uint8_t intPin);
+
+   /// Stage the output levels of every device, written by the next scan
+   void write(const PinMask &levels);
+
+   /// Ask for the inputs to be read again by the next scan
+   void requestScan() { m_requested = true; }
+
+   /// Start a scan if one is wanted and none is running, or abandon one that has stalled
+   void run();
+
+   /// True once after each scan completes, when the inputs are new
+   bool takeScan();
+
+   /// Input levels read by the last scan
+   const PinMask &getInputs() const { return m_inputs; }
+
+   /// Time run() must next be called by (us since boot), UINT64_MAX if not before a wake
+   uint64_t nextRunUs() const;
+
+   /// Devices in use
+   uint8_t getDevices() const { return m_devices; }
+
+   /// Scans completed
+   uint32_t getScans() const { return m_scans; }
+
+   /// Output latch writes made, one for both ports of a device
+   uint32_t getWrites() const { return m_writes; }
+
+   /// Scans abandoned for a device that did not answer
+   uint32_t getErrors() const { return m_errors; }
+
+private:
+   void startDevice(uint8_t device);
+   void deviceDone();
+   static void dmaIrq();
+
+   PinMask m_inputs{};          ///< Input levels of the last scan
+   PinMask m_outputs{};         ///< Output levels staged
+   PinMask m_written{};         ///< Output levels in the latches
+   volatile uint8_t m_dirty{0}; ///< Devices whose latches differ from the staged levels
+   uint8_t m_devices{0};
+   uint8_t m_intPin{0};
+   uint8_t m_device{0};         ///< Device being scanned
+   bool m_requested{false};     ///< A scan was asked for
+   volatile bool m_scanning{false};
+   volatile bool m_complete{false}; ///< A scan completed since takeScan()
+   uint64_t m_scanStart{0};
+   uint32_t m_scans{0};
+   uint32_t m_writes{0};
+   uint32_t m_errors{0};
+   int m_txChannel{-1};
+   int m_rxChannel{-1};
+   uint32_t m_commands[8]{};    ///< I2C data / command words of one device's transaction
+   uint8_t m_rx[2]{};           ///< Input ports read, A then B
+};
@@ -0,0 +1,197 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "RequestTracker.h"
+
+#include <pico/stdlib.h>
+
+void RequestTracker::begin(uint32_t timeoutUs)
+{
+   m_timeoutUs = timeoutUs;
+
+   for (Pending &pending : m_pending)
+   {
+      pending = {nullptr, OutEventID::lineClear, 0, 0, NO_REPLY};
+   }
+
+   m_retries = 0;
+   m_timeouts = 0;
+   m_duplicates = 0;
+}
+
+bool RequestTracker::isRequest(OutEventID id, bool timed)
+{
+   if ((id == OutEventID::lineClear) || (id == OutEventID::trainOnTrack) || (id == OutEventID::blockCleared))
+   {
+      return true;
+   }
+
+   return !timed && (id == OutEventID::resetLineClear);
+}
+
+///
+/// @brief Find the request a reply answers
+///
+bool RequestTracker::answers(InEventID reply, OutEventID &request)
+{
+   switch (reply)
+   {
+   case InEventID::lineClearAck:
+   case InEventID::lineClearBlocked:
+      request = OutEventID::lineClear;
+      return true;
+   case InEventID::trainOnTrackAck:
+      request = OutEventID::trainOnTrack;
+      return true;
+   case InEventID::blockClearedAck:
+      request = OutEventID::blockCleared;
+      return true;
+   default:
+      return false;
+   }
+}
+
+void RequestTracker::sent(uint8_t section, OutEventID request, const Transition &transition)
+{
+   Pending &pending = m_pending[section];
+
+   pending.transition = &transition;
+   pending.request = request;
+   pending.retries = 0;
+   pending.deadline = time_us_64() + m_timeoutUs;
+}
+
+///
+/// @brief Match a reply against the outstanding request of its section
+///
+/// @param section block section of the reply
+/// @param reply incoming reply event
+/// @return false if the reply repeats one already acted on
+///
+bool RequestTracker::replyReceived(uint8_t section, InEventID reply)
+{
+   Pending &pending = m_pending[section];
+   OutEventID request;
+
+   // A reset of Line Clear is answered as Block Cleared is
+   const bool answered = answers(reply, request) &&
+                         ((request == pending.request) ||
+                          ((request == OutEventID::blockCleared) && (pending.request == OutEventID::resetLineClear)));
+
+   if (pending.transition && answered)
+   {
+      pending.transition = nullptr;
+   }
+   else if (pending.lastReply == static_cast<uint8_t>(reply))
+   {
+      m_duplicates++;
+      return false;
+   }
+
+   // Replies not asked for still count, e.g. Line Clear given once a blocked request is released
+   pending.lastReply = static_cast<uint8_t>(reply);
+   return true;
+}
+
+///
+/// @brief Check a section for a request that has timed out
+///
+/// The attempt is counted and the next deadline set as the request is handed
+/// back, so the caller only has to send it.
+///
+const Transition *RequestTracker::due(uint8_t section)
+{
+   Pending &pending = m_pending[section];
+
+   if (!pending.transition || (time_us_64() < pending.deadline))
+   {
+      return nullptr;
+   }
+
+   if (pending.retries >= MAX_RETRIES)
+   {
+      pending.transition = nullptr;
+      m_timeouts++;
+      return nullptr;
+   }
+
+   pending.retries++;
+   pending.deadline = time_us_64() + (static_cast<uint64_t>(m_timeoutUs) << pending.retries);
+   m_retries++;
+
+   return pending.transition;
+}
+
+uint64_t RequestTracker::nextDeadlineUs() const
+{
+   uint64_t next = UINT64_MAX;
+
+   for (const Pending &pending : m_pending)
+   {
+      if (pending.transition && (pending.deadline < next))
+      {
+         next = pending.deadline;
+      }
+   }
+
+   return next;
+}
+
+bool RequestTracker::outstanding(uint8_t section, OutEventID &request) const
+{
+   if (!m_pending[section].transition)
+   {
+      return false;
+   }
+
+   request = m_pending[section].request;
+   return true;
+}
+
+uint8_t RequestTracker::getOutstanding() const
+{
+   uint8_t outstanding = 0;
+
+   for (const Pending &pending : m_pending)
+   {
+      outstanding += (pending.transition != nullptr);
+   }
+
+   return outstanding;
+}
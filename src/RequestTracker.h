@@ -0,0 +1,126 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CANBlock.h"          // Block event definitions
+#include "BlockStateMachine.h" // Transitions resent on a timeout
+
+#include <cstdint>
+
+///
+/// @brief Outstanding requests to the box in advance, with timeouts and retries
+///
+/// Each block section has at most one request outstanding, as the local state
+/// machine only moves on once a request is answered, and a new request of a
+/// section replaces one still waiting.  Sections do not wait on each other.
+///
+/// A request not answered in time is sent again, with the timeout doubling
+/// each attempt, and given up after MAX_RETRIES retransmissions.  The box in
+/// advance answers a repeated request again, so a lost request and a lost
+/// reply are both recovered.  A reply that answers no outstanding request and
+/// repeats the last reply of its section is a duplicate and is dropped.
+///
+class RequestTracker
+{
+public:
+   static constexpr uint32_t TIMEOUT_US = 50000; ///< Wait for a reply before the first retransmission (us)
+   static constexpr uint8_t MAX_RETRIES = 5;     ///< Retransmissions before a request is given up
+
+   /// Longest a request is retried before it is given up (us)
+   static constexpr uint64_t GIVE_UP_US = static_cast<uint64_t>(TIMEOUT_US) * ((2u << MAX_RETRIES) - 1);
+
+   /// Forget all outstanding requests and reset the counters
+   /// @param timeoutUs wait for a reply before the first retransmission, longer for a box that is slow to reply
+   void begin(uint32_t timeoutUs = TIMEOUT_US);
+
+   /// True for the events the box in advance replies to
+   /// @param timed only the requests whose round trip Telemetry times, not a reset of Line Clear
+   static bool isRequest(OutEventID id, bool timed = false);
+
+   /// The timed request a reply answers, a reset of Line Clear is answered with Block Cleared's ACK
+   /// @return false if the event is not a reply
+   static bool answers(InEventID reply, OutEventID &request);
+
+   /// A transition sending a request was made, replacing any request of the section still outstanding
+   void sent(uint8_t section, OutEventID request, const Transition &transition);
+
+   /// A reply arrived, false if it is a duplicate to drop
+   bool replyReceived(uint8_t section, InEventID reply);
+
+   /// Transition of a request to send again now, nullptr if none is due
+   const Transition *due(uint8_t section);
+
+   /// Time the next outstanding request times out (us since boot), UINT64_MAX if none is outstanding
+   uint64_t nextDeadlineUs() const;
+
+   /// The request of a section waiting for a reply, false if none is
+   bool outstanding(uint8_t section, OutEventID &request) const;
+
+   /// Requests waiting for a reply
+   uint8_t getOutstanding() const;
+
+   /// Requests sent again
+   uint32_t getRetries() const { return m_retries; }
+
+   /// Requests given up without a reply
+   uint32_t getTimeouts() const { return m_timeouts; }
+
+   /// Duplicate replies dropped
+   uint32_t getDuplicates() const { return m_duplicates; }
+
+private:
+   static constexpr uint8_t NO_REPLY = 0xFF;
+
+   /// Request of one section
+   struct Pending
+   {
+      const Transition *transition; ///< Transition to resend, nullptr if nothing is outstanding
+      OutEventID request;           ///< Request waiting for a reply
+      uint8_t retries;              ///< Retransmissions so far
+      uint64_t deadline;            ///< Time the current attempt times out (us)
+      uint8_t lastReply;            ///< Last reply acted on (InEventID), NO_REPLY before the first
+   };
+
+   Pending m_pending[MAX_SECTIONS]{};
+   uint32_t m_timeoutUs{TIMEOUT_US};
+   uint32_t m_retries{0};
+   uint32_t m_timeouts{0};
+   uint32_t m_duplicates{0};
+};
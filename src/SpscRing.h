@@ -0,0 +1,160 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+///
+/// @brief Lock-free single producer, single consumer ring
+///
+/// Passes items between the two cores without locks or interrupt masking.
+/// Only one core may push and only one core may pop.  Each index is written
+/// by one side only, with plain atomic loads and stores, so no read-modify-
+/// write instructions are needed (the Cortex-M0+ has none).
+///
+/// @tparam T item type, copied in and out
+/// @tparam N number of slots, a power of two
+///
+template <typename T, size_t N>
+class SpscRing
+{
+   static_assert((N > 1) && ((N & (N - 1)) == 0), "SpscRing size must be a power of two");
+
+public:
+   /// Producer - copy an item into the ring, false if full
+   bool push(const T &item)
+   {
+      const uint32_t head = m_head.load(std::memory_order_relaxed);
+
+      if ((head - m_tail.load(std::memory_order_acquire)) >= N)
+      {
+         return false;
+      }
+
+      m_items[head & (N - 1)] = item;
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+   }
+
+   /// Producer - copy a run of items in, all or none, the consumer sees them together
+   bool push(const T *items, size_t count)
+   {
+      const uint32_t head = m_head.load(std::memory_order_relaxed);
+
+      if ((count > N) || ((head - m_tail.load(std::memory_order_acquire)) > (N - count)))
+      {
+         return false;
+      }
+
+      for (size_t i = 0; i < count; i++)
+      {
+         m_items[(head + i) & (N - 1)] = items[i];
+      }
+
+      m_head.store(head + count, std::memory_order_release);
+      return true;
+   }
+
+   /// Consumer - oldest item, nullptr if empty, valid until pop()
+   const T *peek() const
+   {
+      const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+
+      if (m_head.load(std::memory_order_acquire) == tail)
+      {
+         return nullptr;
+      }
+
+      return &m_items[tail & (N - 1)];
+   }
+
+   /// Consumer - release the oldest item, only after peek() returned it
+   void pop()
+   {
+      m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+   }
+
+   /// Consumer - copy out the oldest item, false if empty
+   bool pop(T &item)
+   {
+      const T *next = peek();
+
+      if (!next)
+      {
+         return false;
+      }
+
+      item = *next;
+      pop();
+      return true;
+   }
+
+   /// Either side - true if nothing is waiting (may be stale)
+   bool empty() const
+   {
+      return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+   }
+
+   /// Either side - number of items waiting (may be stale)
+   size_t size() const
+   {
+      return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+   }
+
+   /// Either side - true if no slot is free (may be stale)
+   bool full() const
+   {
+      return (m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire)) >= N;
+   }
+
+   /// Empty the ring, only while neither side is using it
+   void clear()
+   {
+      m_head.store(0, std::memory_order_relaxed);
+      m_tail.store(0, std::memory_order_relaxed);
+   }
+
+private:
+   T m_items[N]{};
+   std::atomic<uint32_t> m_head{0}; ///< Next slot to write, written by the producer
+   std::atomic<uint32_t> m_tail{0}; ///< Next slot to read, written by the consumer
+};
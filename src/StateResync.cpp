@@ -0,0 +1,166 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "StateResync.h"
+
+#include <pico/stdlib.h>
+
+void StateResync::begin(uint32_t timeoutUs)
+{
+   m_timeoutUs = timeoutUs;
+
+   for (Pending &pending : m_pending)
+   {
+      pending = {0, 0, 0};
+   }
+
+   m_synced = 0;
+   m_inStepUs = 0;
+   m_retries = 0;
+   m_timeouts = 0;
+}
+
+///
+/// @brief Start the query of a section, the first is due at once
+///
+/// @param section block section
+/// @param waitFor LOCAL if the section has learned the box in advance's ACK's,
+///                REMOTE if it has learned the box in rear's requests
+///
+void StateResync::start(uint8_t section, uint8_t waitFor)
+{
+   if (!waitFor)
+   {
+      return;
+   }
+
+   m_pending[section] = {waitFor, 0, time_us_64()};
+   m_inStepUs = NOT_YET;
+}
+
+void StateResync::answered(uint8_t section, uint8_t side)
+{
+   Pending &pending = m_pending[section];
+
+   if (!(pending.waiting & side))
+   {
+      return;
+   }
+
+   pending.waiting &= ~side;
+
+   if (!pending.waiting)
+   {
+      m_synced++;
+      finished();
+   }
+}
+
+///
+/// @brief The box at the other end of a section asked for our states
+///
+/// Only a box that has been reset asks, so if this section is waiting too both
+/// were reset together.  The remote state is kept, the box in rear takes it
+/// from our answer, and only the local state is waited for.
+///
+void StateResync::queried(uint8_t section)
+{
+   answered(section, REMOTE);
+}
+
+///
+/// @brief Check a section for a query to send
+///
+/// The attempt is counted and the next deadline set as the query is handed
+/// back, so the caller only has to send it.
+///
+bool StateResync::due(uint8_t section)
+{
+   Pending &pending = m_pending[section];
+
+   if (!pending.waiting || (time_us_64() < pending.deadline))
+   {
+      return false;
+   }
+
+   if (pending.attempts > MAX_RETRIES)
+   {
+      pending.waiting = 0;
+      m_timeouts++;
+      finished();
+      return false;
+   }
+
+   m_retries += (pending.attempts > 0);
+   pending.deadline = time_us_64() + (static_cast<uint64_t>(m_timeoutUs) << pending.attempts);
+   pending.attempts++;
+
+   return true;
+}
+
+uint64_t StateResync::nextDeadlineUs() const
+{
+   uint64_t next = UINT64_MAX;
+
+   for (const Pending &pending : m_pending)
+   {
+      if (pending.waiting && (pending.deadline < next))
+      {
+         next = pending.deadline;
+      }
+   }
+
+   return next;
+}
+
+///
+/// @brief Note the time once no section waits any more
+///
+void StateResync::finished()
+{
+   for (const Pending &pending : m_pending)
+   {
+      if (pending.waiting)
+      {
+         return;
+      }
+   }
+
+   m_inStepUs = time_us_32();
+}
@@ -0,0 +1,124 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CANBlock.h" // Block section definitions
+
+#include <cstdint>
+
+///
+/// @brief State queries to the box at the other end of each section after a reset
+///
+/// The block states restored from the module settings are only as new as the
+/// last journal write, and the box at the other end may have moved on while
+/// this one was off.  After a reset each section asks the box at the other end
+/// for the state of the events it has learned from it (AREQ), and the answers
+/// (ARON / AROF) set the state machines: the local state from the box in
+/// advance's ACK's, the remote state from the box in rear's requests.
+///
+/// A query not fully answered in time is asked again, with the timeout
+/// doubling each attempt, and given up after MAX_RETRIES, leaving the restored
+/// states, e.g. when the box at the other end does not answer AREQ.
+///
+/// When both boxes were reset together each asks the other.  The box in
+/// advance holds the block, so a section that is asked for its states while
+/// its own query is outstanding keeps its remote state, and the box in rear
+/// takes it.
+///
+class StateResync
+{
+public:
+   static constexpr uint32_t TIMEOUT_US = 20000; ///< Wait for the answers before the first retry (us)
+   static constexpr uint8_t MAX_RETRIES = 5;     ///< Queries asked again before a section is given up
+   static constexpr uint8_t LOCAL = 0x01;        ///< Local state waits for the box in advance
+   static constexpr uint8_t REMOTE = 0x02;       ///< Remote state waits for the box in rear
+   static constexpr uint32_t NOT_YET = UINT32_MAX; ///< In step time while a query is outstanding
+
+   /// Forget all queries and reset the counters
+   void begin(uint32_t timeoutUs = TIMEOUT_US);
+
+   /// Start the query of a section, the states it waits for (LOCAL / REMOTE) follow its learned events
+   void start(uint8_t section, uint8_t waitFor);
+
+   /// True if the section still waits for the state of one side (LOCAL / REMOTE)
+   bool waiting(uint8_t section, uint8_t side) const { return m_pending[section].waiting & side; }
+
+   /// An answer set the state of one side of a section
+   void answered(uint8_t section, uint8_t side);
+
+   /// The box at the other end asked for our states, if we are waiting too it was reset as well
+   void queried(uint8_t section);
+
+   /// True if the query of a section is to be sent now, first or again
+   bool due(uint8_t section);
+
+   /// Time the next query is due (us since boot), UINT64_MAX if none is outstanding
+   uint64_t nextDeadlineUs() const;
+
+   /// Sections brought into step with the box at the other end
+   uint32_t getSynced() const { return m_synced; }
+
+   /// Time since boot every section was in step or given up (us), NOT_YET while one waits
+   uint32_t getInStepUs() const { return m_inStepUs; }
+
+   /// Queries asked again
+   uint32_t getRetries() const { return m_retries; }
+
+   /// Sections given up without every answer
+   uint32_t getTimeouts() const { return m_timeouts; }
+
+private:
+   /// Query of one section
+   struct Pending
+   {
+      uint8_t waiting;   ///< Sides still to be answered, LOCAL / REMOTE
+      uint8_t attempts;  ///< Queries sent so far
+      uint64_t deadline; ///< Time the next query is due (us)
+   };
+
+   void finished();
+
+   Pending m_pending[MAX_SECTIONS]{};
+   uint32_t m_timeoutUs{TIMEOUT_US};
+   uint32_t m_synced{0};
+   uint32_t m_inStepUs{0};
+   uint32_t m_retries{0};
+   uint32_t m_timeouts{0};
+};
@@ -0,0 +1,241 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+
+#include "SwitchInput.h"
+#include "InputCapture.h"
+#include "PortExpander.h"
+
+#include <pico/stdlib.h>
+
+///
+/// @brief Claim the switch pins and take their levels as debounced
+///
+/// @param pinMask switch input pins
+/// @param activeLowMask pins pressed when low, pulled up, the others are pulled down
+/// @param debounceUs time an input must be steady to change (us)
+/// @param capture sampler to take the GPIO samples from, or null to poll
+/// @param expander port expanders of the pins above the GPIO, or null if there are none
+///
+void SwitchInput::begin(const PinMask &pinMask, const PinMask &activeLowMask, uint32_t debounceUs,
+                        InputCapture *capture, PortExpander *expander)
+{
+   m_pinMask = pinMask;
+   m_activeLow = activeLowMask & pinMask;
+   // The first sample to see a change is taken as the edge wakes the loop, the last one debounceUs later
+   m_sampleUs = debounceUs / (SAMPLES - 1);
+
+   const uint32_t gpio = pinMask.gpio();
+
+   gpio_init_mask(gpio);
+   gpio_set_dir_in_masked(gpio);
+
+   for (uint32_t pin = 0; pin < 32; pin++)
+   {
+      if (m_activeLow.gpio() & (1u << pin))
+      {
+         gpio_pull_up(pin);
+      }
+      else if (gpio & (1u << pin))
+      {
+         gpio_pull_down(pin);
+      }
+   }
+
+   // A switch held at power on is pressed, not a press
+   m_expander = expander;
+   m_state = PinMask{};
+   m_state.word[0] = read();
+
+   if (m_expander)
+   {
+      m_state |= (m_expander->getInputs() ^ m_activeLow) & m_pinMask & ~gpioMask(gpio);
+   }
+
+   m_count0 = PinMask{};
+   m_count1 = PinMask{};
+   m_changed = PinMask{};
+   m_pressed = PinMask{};
+   m_released = PinMask{};
+   m_nextSample = time_us_64() + m_sampleUs;
+   m_nextScan = 0;
+
+   // The pins are inputs before the state machine samples them
+   m_capture = (capture && capture->begin(m_sampleUs)) ? capture : nullptr;
+}
+
+void SwitchInput::run()
+{
+   m_changed = PinMask{};
+   m_pressed = PinMask{};
+   m_released = PinMask{};
+
+   const uint64_t now = time_us_64();
+
+   if (m_capture)
+   {
+      uint32_t levels;
+
+      while (m_capture->pop(levels))
+      {
+         m_samples++;
+         sample(0, (levels ^ m_activeLow.gpio()) & m_pinMask.gpio());
+      }
+   }
+   else if (now >= m_nextSample)
+   {
+      m_nextSample = now + m_sampleUs;
+      m_samples++;
+      sample(0, read());
+   }
+
+   if (!m_expander)
+   {
+      return;
+   }
+
+   // A completed scan is one sample of every expander pin
+   if (m_expander->takeScan())
+   {
+      const PinMask &inputs = m_expander->getInputs();
+
+      for (size_t w = 1; w < PinMask::WORDS; w++)
+      {
+         sample(w, (inputs.word[w] ^ m_activeLow.word[w]) & m_pinMask.word[w]);
+      }
+
+      m_nextScan = now + m_sampleUs;
+   }
+
+   // Keep scanning at the sample interval while an expander pin is counting, the
+   // scan's interrupt wakes the loop when it completes
+   if (expanderCounting() && (now >= m_nextScan))
+   {
+      m_expander->requestScan();
+      m_nextScan = UINT64_MAX;
+   }
+}
+
+///
+/// @brief Time the loop next needs to run
+///
+/// Polled, that is when the next sample is due.  Captured, it is when the
+/// sample that could end the count is in the ring, or the first sample after a
+/// switch edge that the samples taken do not yet show.  Expander pins that are
+/// counting need a pass to ask for their next scan.
+///
+uint64_t SwitchInput::nextSampleUs() const
+{
+   uint64_t next = UINT64_MAX;
+   const bool counting = (m_count0.gpio() | m_count1.gpio()) != 0;
+
+   if (!m_capture)
+   {
+      next = counting ? m_nextSample : UINT64_MAX;
+   }
+   else if (counting)
+   {
+      // The most advanced counter decides, each sample moves it one on
+      const uint32_t needed = (m_count1.gpio() & m_count0.gpio()) ? 1 : (m_count1.gpio() ? 2 : 3);
+      next = m_capture->sampleTimeUs(needed) + CAPTURE_MARGIN_US;
+   }
+   else if ((m_edgeUs + m_capture->getSampleUs()) > m_capture->sampleTimeUs())
+   {
+      // The edge came after the last sample taken, wait for a sample made since
+      next = m_capture->sampleTimeUs() + CAPTURE_MARGIN_US;
+   }
+
+   if (expanderCounting() && (m_nextScan < next))
+   {
+      next = m_nextScan;
+   }
+
+   return next;
+}
+
+void SwitchInput::inputEdge()
+{
+   m_edgeUs = time_us_64();
+}
+
+uint32_t SwitchInput::read() const
+{
+   // One read for all inputs, inverted so pressed is set
+   return (gpio_get_all() ^ m_activeLow.gpio()) & m_pinMask.gpio();
+}
+
+bool SwitchInput::expanderCounting() const
+{
+   uint32_t counting = 0;
+
+   for (size_t w = 1; w < PinMask::WORDS; w++)
+   {
+      counting |= m_count0.word[w] | m_count1.word[w];
+   }
+
+   return counting != 0;
+}
+
+///
+/// @brief Debounce one sample of a word of pins
+///
+/// Counts the samples in a row each input differs from its debounced level, a
+/// counter that is not counting is held at zero and one that wraps changes its
+/// input.
+///
+/// @param word word of the pin masks sampled, 0 for the GPIO
+/// @param levels inputs pressed in the sample
+///
+void SwitchInput::sample(size_t word, uint32_t levels)
+{
+   uint32_t &count0 = m_count0.word[word];
+   uint32_t &count1 = m_count1.word[word];
+   uint32_t &state = m_state.word[word];
+   const uint32_t delta = levels ^ state;
+
+   count1 = (count1 ^ count0) & delta;
+   count0 = ~count0 & delta;
+
+   const uint32_t changed = delta & ~(count0 | count1);
+
+   state ^= changed;
+   m_changed.word[word] |= changed;
+   m_pressed.word[word] |= changed & state;
+   m_released.word[word] |= changed & ~state;
+}
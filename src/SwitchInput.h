@@ -0,0 +1,137 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+
+#pragma once
+
+#include "PinMask.h"
+
+#include <cstdint>
+
+class InputCapture;
+class PortExpander;
+
+///
+/// @brief Debounces every switch input together
+///
+/// All switch pins are read with one gpio_get_all() and debounced in parallel
+/// with a vertical counter: bit n of two counter words counts the samples in
+/// a row that pin n has differed from its debounced level, and a pin changes
+/// once it has differed for SAMPLES samples.  A pass costs the same few word
+/// operations however many inputs there are, and every input has the same
+/// debounce time.
+///
+/// Levels and edges are reported as pin masks, with a set bit meaning pressed
+/// whatever the active level of the pin.  Edges last until the next call of
+/// run().
+///
+/// Given an InputCapture, samples are taken by the PIO at exact intervals and
+/// run() debounces every sample made since the last call, so the debounce time
+/// does not stretch with the main loop's latency and a press shorter than a
+/// busy pass is still seen.  Without one, run() reads the pins itself.
+///
+/// Switches on port expanders are sampled by the expanders' scans, each scan
+/// counting once for their pins.  Their interrupt line starts a scan on a
+/// change, and while a pin is counting a scan is asked for every sample time.
+///
+class SwitchInput
+{
+public:
+   static constexpr uint8_t SAMPLES = 4;                  ///< Samples in a row that change an input, when the two bit counter wraps
+   static constexpr uint32_t DEFAULT_DEBOUNCE_US = 20000; ///< Debounce time (us)
+   static constexpr uint32_t CAPTURE_MARGIN_US = 100;     ///< Wait past a captured sample's time for it to reach the ring
+
+   /// Claim the switch pins as inputs with pulls to their released level, and take their levels as debounced
+   /// @param pinMask switch input pins
+   /// @param activeLowMask pins pressed when low, pulled up
+   /// @param debounceUs time an input must be steady to change, sampled SAMPLES times from start to end
+   /// @param capture sampler to take the GPIO samples from, the pins are polled if null or it cannot start
+   /// @param expander port expanders of the pins above the GPIO, already set up with them as inputs
+   void begin(const PinMask &pinMask, const PinMask &activeLowMask, uint32_t debounceUs = DEFAULT_DEBOUNCE_US,
+              InputCapture *capture = nullptr, PortExpander *expander = nullptr);
+
+   /// Debounce the samples due or captured since the last call and update the edges
+   void run();
+
+   /// Time the loop next needs to run (us since boot), UINT64_MAX while every input is steady,
+   /// the switch edge interrupt wakes the loop to start counting
+   uint64_t nextSampleUs() const;
+
+   /// Note a switch edge, from the GPIO interrupt, so the loop wakes for the sample that shows it
+   void inputEdge();
+
+   /// Samples are taken by the InputCapture
+   bool isCapturing() const { return m_capture != nullptr; }
+
+   /// Inputs pressed
+   const PinMask &getPressed() const { return m_state; }
+
+   /// Inputs that became pressed in the last run(), an input can be both pressed and released in one run()
+   const PinMask &getPressedEdges() const { return m_pressed; }
+
+   /// Inputs that became released in the last run()
+   const PinMask &getReleasedEdges() const { return m_released; }
+
+   /// Inputs that changed in the last run()
+   const PinMask &getChanged() const { return m_changed; }
+
+   /// Samples taken
+   uint32_t getSamples() const { return m_samples; }
+
+private:
+   uint32_t read() const;
+   bool expanderCounting() const;
+   void sample(size_t word, uint32_t levels);
+
+   PinMask m_pinMask{};        ///< Pins debounced
+   PinMask m_activeLow{};      ///< Pins pressed when low
+   uint32_t m_sampleUs{0};     ///< Time between samples (us)
+   uint64_t m_nextSample{0};   ///< Time of the next sample (us since boot)
+   uint64_t m_nextScan{0};     ///< Time to ask for the next expander scan (us since boot)
+   PinMask m_state{};          ///< Debounced inputs, set when pressed
+   PinMask m_count0{};         ///< Vertical counter, low bits
+   PinMask m_count1{};         ///< Vertical counter, high bits
+   PinMask m_changed{};        ///< Inputs changed by the last run()
+   PinMask m_pressed{};        ///< Inputs pressed by the last run()
+   PinMask m_released{};       ///< Inputs released by the last run()
+   uint32_t m_samples{0};      ///< Samples taken
+   InputCapture *m_capture{nullptr};
+   PortExpander *m_expander{nullptr};
+   volatile uint64_t m_edgeUs{0}; ///< Time of the last switch edge (us since boot)
+};
@@ -0,0 +1,408 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "Telemetry.h"
+
+#include <pico/stdlib.h>
+
+///
+/// @brief Reset the counters
+///
+/// @param cbus CBUS transport whose counters are served as service 1
+/// @param journal settings journal whose counters are served as service 4
+/// @param requests request tracker whose counters are served as service 6
+/// @param resync state queries whose counters are served with the boot times
+///
+void Telemetry::begin(const CBUSDispatch &cbus, const ConfigJournal &journal, const RequestTracker &requests,
+                      const StateResync &resync)
+{
+   m_cbus = &cbus;
+   m_journal = &journal;
+   m_requests = &requests;
+   m_resync = &resync;
+   m_bootUs = 0;
+   m_setupDoneUs = 0;
+   m_statesRestored = 0;
+   m_passes = 0;
+   m_loopMin = UINT32_MAX;
+   m_loopMax = 0;
+   m_loopTotal = 0;
+
+   for (RoundTrip &trip : m_roundTrips)
+   {
+      trip = {};
+   }
+}
+
+void Telemetry::bootTime(uint32_t us)
+{
+   m_bootUs = us;
+   m_setupDoneUs = time_us_32();
+}
+
+void Telemetry::loopTime(uint32_t us)
+{
+   m_passes++;
+   m_loopTotal += us;
+   m_loopMin = (us < m_loopMin) ? us : m_loopMin;
+   m_loopMax = (us > m_loopMax) ? us : m_loopMax;
+}
+
+void Telemetry::requestSent(uint8_t section, OutEventID request)
+{
+   RoundTrip &trip = m_roundTrips[static_cast<size_t>(request)];
+
+   trip.used = true;
+   trip.waiting |= 1u << section;
+   trip.sentAt[section] = time_us_32();
+}
+
+void Telemetry::replyReceived(uint8_t section, OutEventID request)
+{
+   RoundTrip &trip = m_roundTrips[static_cast<size_t>(request)];
+
+   if (!(trip.waiting & (1u << section)))
+   {
+      return;
+   }
+
+   const uint32_t ms = (time_us_32() - trip.sentAt[section]) / 1000;
+   uint8_t bucket = 0;
+
+   while ((bucket < (NUM_BUCKETS - 1)) && (ms >= BUCKET_LIMIT_MS[bucket]))
+   {
+      bucket++;
+   }
+
+   trip.waiting &= ~(1u << section);
+   trip.minMs = (!trip.count || (ms < trip.minMs)) ? ms : trip.minMs;
+   trip.maxMs = (ms > trip.maxMs) ? ms : trip.maxMs;
+   trip.count++;
+   trip.buckets[bucket]++;
+}
+
+///
+/// @brief Read a diagnostic value
+///
+/// @param service diagnostic service, from 1
+/// @param code diagnostic code within the service, from 1
+/// @param value the value, low 16 bits of counters
+/// @return false if the service has no such code
+///
+bool Telemetry::read(uint8_t service, uint8_t code, uint16_t &value) const
+{
+   uint32_t full = 0;
+   bool found = false;
+
+   switch (service)
+   {
+   case SERVICE_CAN:
+      found = readCAN(code, full);
+      break;
+   case SERVICE_LOOP:
+      found = readLoop(code, full);
+      break;
+   case SERVICE_ROUND_TRIP:
+      found = readRoundTrip(code, full);
+      break;
+   case SERVICE_CONFIG:
+      found = readConfig(code, full);
+      break;
+   case SERVICE_BOOT:
+      found = readBoot(code, full);
+      break;
+   case SERVICE_REQUESTS:
+      found = readRequests(code, full);
+      break;
+   case SERVICE_GATEWAY:
+      found = readGateway(code, full);
+      break;
+   default:
+      break;
+   }
+
+   value = static_cast<uint16_t>(full);
+   return found;
+}
+
+bool Telemetry::readCAN(uint8_t code, uint32_t &value) const
+{
+   if (!m_cbus)
+   {
+      return false;
+   }
+
+   switch (code)
+   {
+   case 1:
+      value = m_cbus->getRxFrames();
+      return true;
+   case 2:
+      value = m_cbus->getTxFrames();
+      return true;
+   case 3:
+      value = m_cbus->getRxFiltered();
+      return true;
+   case 4:
+      value = m_cbus->getRxBufferMax();
+      return true;
+   case 5:
+      value = m_cbus->getRxRingMax();
+      return true;
+   case 6:
+      value = m_cbus->getRxRingFull();
+      return true;
+   case 7:
+      value = m_cbus->getTxRingFull();
+      return true;
+   case 8:
+      value = m_cbus->getTxStallsAvoided();
+      return true;
+   default:
+      return false;
+   }
+}
+
+bool Telemetry::readLoop(uint8_t code, uint32_t &value) const
+{
+   switch (code)
+   {
+   case 1:
+      value = m_passes;
+      return true;
+   case 2:
+      value = getLoopMinUs();
+      return true;
+   case 3:
+      value = getLoopAvgUs();
+      return true;
+   case 4:
+      value = m_loopMax;
+      return true;
+   default:
+      return false;
+   }
+}
+
+///
+/// @brief Round trip values, only for requests that have been sent
+///
+bool Telemetry::readRoundTrip(uint8_t code, uint32_t &value) const
+{
+   const size_t request = code / 16;
+   const uint8_t field = code % 16;
+
+   if ((request >= NUM_REQUESTS) || !m_roundTrips[request].used)
+   {
+      return false;
+   }
+
+   const RoundTrip &trip = m_roundTrips[request];
+
+   switch (field)
+   {
+   case 1:
+      value = trip.count;
+      return true;
+   case 2:
+      value = trip.minMs;
+      return true;
+   case 3:
+      value = trip.maxMs;
+      return true;
+   default:
+      if ((field >= 4) && (field < (4 + NUM_BUCKETS)))
+      {
+         value = trip.buckets[field - 4];
+         return true;
+      }
+
+      return false;
+   }
+}
+
+bool Telemetry::readConfig(uint8_t code, uint32_t &value) const
+{
+   if (!m_journal)
+   {
+      return false;
+   }
+
+   switch (code)
+   {
+   case 1:
+      value = (m_bootUs < UINT16_MAX) ? m_bootUs : UINT16_MAX;
+      return true;
+   case 2:
+      value = m_journal->getRestoreUs();
+      return true;
+   case 3:
+      value = m_journal->getRestored();
+      return true;
+   case 4:
+      value = m_journal->getRecords();
+      return true;
+   case 5:
+      value = m_journal->getPrograms();
+      return true;
+   case 6:
+      value = m_journal->getErases();
+      return true;
+   case 7:
+      value = perWeek(m_journal->getRecords());
+      return true;
+   case 8:
+      value = perWeek(m_journal->getErases());
+      return true;
+   default:
+      return false;
+   }
+}
+
+///
+/// @brief Boot times, from the reset of the Pico, whose timer starts at zero
+///
+bool Telemetry::readBoot(uint8_t code, uint32_t &value) const
+{
+   if (!m_cbus)
+   {
+      return false;
+   }
+
+   switch (code)
+   {
+   case 1:
+      value = m_cbus->getBusReadyUs() / 1000;
+      return m_cbus->getBusReadyUs() != CBUSDispatch::NOT_YET;
+   case 2:
+      value = m_cbus->getFirstAcceptUs() / 1000;
+      return m_cbus->getFirstAcceptUs() != CBUSDispatch::NOT_YET;
+   case 3:
+      value = m_setupDoneUs / 1000;
+      return true;
+   case 4:
+      value = m_statesRestored;
+      return true;
+   case 5:
+      value = m_resync->getSynced();
+      return true;
+   case 6:
+      value = m_resync->getInStepUs() / 1000;
+      return m_resync->getInStepUs() != StateResync::NOT_YET;
+   case 7:
+      value = m_resync->getRetries();
+      return true;
+   case 8:
+      value = m_resync->getTimeouts();
+      return true;
+   default:
+      return false;
+   }
+}
+
+bool Telemetry::readRequests(uint8_t code, uint32_t &value) const
+{
+   if (!m_requests)
+   {
+      return false;
+   }
+
+   switch (code)
+   {
+   case 1:
+      value = m_requests->getRetries();
+      return true;
+   case 2:
+      value = m_requests->getTimeouts();
+      return true;
+   case 3:
+      value = m_requests->getDuplicates();
+      return true;
+   case 4:
+      value = m_requests->getOutstanding();
+      return true;
+   default:
+      return false;
+   }
+}
+
+bool Telemetry::readGateway(uint8_t code, uint32_t &value) const
+{
+   const GridConnectBridge *gateway = m_cbus ? m_cbus->getGateway() : nullptr;
+
+   if (!gateway)
+   {
+      return false;
+   }
+
+   switch (code)
+   {
+   case 1:
+      value = gateway->getToHost();
+      return true;
+   case 2:
+      value = gateway->getToHostDropped();
+      return true;
+   case 3:
+      value = gateway->getFromHost();
+      return true;
+   case 4:
+      value = gateway->getBadLines();
+      return true;
+   case 5:
+      value = gateway->getBatches();
+      return true;
+   default:
+      return false;
+   }
+}
+
+///
+/// @brief Project a count since boot to a week of running
+///
+uint32_t Telemetry::perWeek(uint32_t count) const
+{
+   constexpr uint64_t WEEK_S = 7 * 24 * 3600;
+   const uint64_t uptime = time_us_64() / 1000000;
+
+   const uint64_t projected = (count * WEEK_S) / ((uptime > 0) ? uptime : 1);
+
+   // Saturate rather than wrap, a projection early after boot can be large
+   return (projected < UINT16_MAX) ? static_cast<uint32_t>(projected) : UINT16_MAX;
+}
@@ -0,0 +1,199 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include "CANBlock.h"     // Block event definitions
+#include "CBUSDispatch.h" // CBUS transport counters
+#include "ConfigJournal.h" // Module settings store counters
+#include "RequestTracker.h" // Request retry counters
+#include "StateResync.h"   // State query counters
+
+#include <cstddef>
+#include <cstdint>
+
+///
+/// @brief Runtime performance counters, readable over CBUS
+///
+/// Collects the boot times, the main loop pass times and the request to reply
+/// round trip of each request event, and serves them with the CBUS transport,
+/// settings journal, request retry and state query counters as diagnostic
+/// values (RDGN / DGN).  Values are 16 bits, counters report their low 16
+/// bits and wrap.
+///
+/// | Service      | Code          | Value                                           |
+/// |--------------|---------------|-------------------------------------------------|
+/// | 1 CAN        | 1             | Frames received                                 |
+/// |              | 2             | Frames sent                                     |
+/// |              | 3             | Frames dropped by the acceptance filter         |
+/// |              | 4             | Most frames waiting in the controller RX buffer |
+/// |              | 5             | Most frames waiting on the core 1 RX ring       |
+/// |              | 6             | Core 1 passes stopped by a full RX ring         |
+/// |              | 7             | Frames refused by a full TX ring                |
+/// |              | 8             | TX stalls avoided                               |
+/// | 2 Loop       | 1             | Passes of loop()                                |
+/// |              | 2 / 3 / 4     | Pass time min / avg / max (us)                  |
+/// | 3 Round trip | id * 16 + 1   | Replies received to request OutEventID id       |
+/// |              | id * 16 + 2/3 | Round trip min / max (ms)                       |
+/// |              | id * 16 + 4.. | Histogram, one code per bucket                  |
+/// | 4 Config     | 1             | Time setup() took (us, at most 65535)           |
+/// |              | 2             | Time to load the settings from flash (us)       |
+/// |              | 3             | Journal records loaded at boot                  |
+/// |              | 4             | Journal records written                         |
+/// |              | 5             | Flash pages programmed                          |
+/// |              | 6             | Flash sectors erased                            |
+/// |              | 7             | Journal records written per week, projected (*) |
+/// |              | 8             | Flash sectors erased per week, projected (*)    |
+/// | 5 Boot       | 1             | Reset to CAN controller started (ms)            |
+/// |              | 2             | Reset to first frame accepted (ms) (**)         |
+/// |              | 3             | Reset to setup() done (ms)                      |
+/// |              | 4             | Block sections whose state was restored         |
+/// |              | 5             | Block sections brought into step after reset    |
+/// |              | 6             | Reset to every section in step (ms) (***)       |
+/// |              | 7             | State queries asked again                       |
+/// |              | 8             | State queries given up                          |
+/// | 6 Requests   | 1             | Requests sent again after a timeout             |
+/// |              | 2             | Requests given up without a reply               |
+/// |              | 3             | Duplicate replies dropped                       |
+/// |              | 4             | Requests waiting for a reply                    |
+/// | 7 Gateway    | 1             | Frames passed to the PC                         |
+/// |              | 2             | Frames lost to a full ring for the PC           |
+/// |              | 3             | Frames received from the PC                     |
+/// |              | 4             | Lines from the PC that were not frames          |
+/// |              | 5             | Batches written to the USB port                 |
+///
+/// (*) saturates at 65535 rather than wrapping
+/// (**) no value until a frame has been accepted
+/// (***) no value while a section waits for the box at the other end
+///
+class Telemetry
+{
+public:
+   /// Diagnostic services, numbered from 1
+   enum Service : uint8_t
+   {
+      SERVICE_CAN = 1,
+      SERVICE_LOOP,
+      SERVICE_ROUND_TRIP,
+      SERVICE_CONFIG,
+      SERVICE_BOOT,
+      SERVICE_REQUESTS,
+      SERVICE_GATEWAY,
+      NUM_SERVICES = SERVICE_GATEWAY
+   };
+
+   static constexpr uint8_t NUM_BUCKETS = 8; ///< Round trip histogram buckets
+
+   /// Upper bounds of the round trip buckets (ms), the last bucket is open
+   static constexpr uint16_t BUCKET_LIMIT_MS[NUM_BUCKETS - 1] = {5, 10, 20, 50, 100, 200, 500};
+
+   /// Outgoing event IDs, each with its own round trip
+   static constexpr size_t NUM_REQUESTS = static_cast<size_t>(OutEventID::blockCleared) + 1;
+
+   /// Reset the counters and attach the CBUS transport, settings journal, request tracker and state queries
+   void begin(const CBUSDispatch &cbus, const ConfigJournal &journal, const RequestTracker &requests,
+              const StateResync &resync);
+
+   /// Record the time setup() took, call as setup() returns
+   void bootTime(uint32_t us);
+
+   /// Record the number of block sections whose state was restored at boot
+   void statesRestored(uint8_t sections) { m_statesRestored = sections; }
+
+   /// Record the time of one pass of loop()
+   void loopTime(uint32_t us);
+
+   /// A request of a block section was sent, its round trip starts now
+   void requestSent(uint8_t section, OutEventID request);
+
+   /// The reply to a request of a block section arrived, ignored if the request is not outstanding
+   void replyReceived(uint8_t section, OutEventID request);
+
+   /// Diagnostic value of a service and code, false if there is no such value
+   bool read(uint8_t service, uint8_t code, uint16_t &value) const;
+
+   /// Passes of loop() timed
+   uint32_t getLoopPasses() const { return m_passes; }
+
+   /// Shortest pass of loop() (us)
+   uint32_t getLoopMinUs() const { return m_passes ? m_loopMin : 0; }
+
+   /// Average pass of loop() (us)
+   uint32_t getLoopAvgUs() const { return m_passes ? static_cast<uint32_t>(m_loopTotal / m_passes) : 0; }
+
+   /// Longest pass of loop() (us)
+   uint32_t getLoopMaxUs() const { return m_loopMax; }
+
+private:
+   /// Round trips of one request, of all block sections
+   struct RoundTrip
+   {
+      bool used;                     ///< The request has been sent
+      uint8_t waiting;               ///< A reply is outstanding, bit per section
+      uint32_t sentAt[MAX_SECTIONS]; ///< Time the outstanding request was sent (us), by section
+      uint32_t count;                ///< Replies received
+      uint32_t minMs;                ///< Shortest round trip (ms)
+      uint32_t maxMs;                ///< Longest round trip (ms)
+      uint32_t buckets[NUM_BUCKETS]; ///< Round trips by bucket
+   };
+
+   static_assert(MAX_SECTIONS <= 8, "Outstanding request bits do not fit");
+
+   bool readCAN(uint8_t code, uint32_t &value) const;
+   bool readLoop(uint8_t code, uint32_t &value) const;
+   bool readRoundTrip(uint8_t code, uint32_t &value) const;
+   bool readConfig(uint8_t code, uint32_t &value) const;
+   bool readBoot(uint8_t code, uint32_t &value) const;
+   bool readRequests(uint8_t code, uint32_t &value) const;
+   bool readGateway(uint8_t code, uint32_t &value) const;
+   uint32_t perWeek(uint32_t count) const;
+
+   const CBUSDispatch *m_cbus{nullptr};
+   const ConfigJournal *m_journal{nullptr};
+   const RequestTracker *m_requests{nullptr};
+   const StateResync *m_resync{nullptr};
+   uint32_t m_bootUs{0};
+   uint32_t m_setupDoneUs{0};
+   uint8_t m_statesRestored{0};
+   uint32_t m_passes{0};
+   uint32_t m_loopMin{UINT32_MAX};
+   uint32_t m_loopMax{0};
+   uint64_t m_loopTotal{0};
+   RoundTrip m_roundTrips[NUM_REQUESTS]{};
+};
@@ -0,0 +1,111 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "TonePlayer.h"
+
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/pwm.h>
+#include <pico/stdlib.h>
+
+bool TonePlayer::begin(uint8_t buzzerPin, uint8_t bellPin, uint32_t stepUs)
+{
+   const uint32_t clock = clock_get_hz(clk_sys);
+   const uint32_t toneWrap = clock / TONE_DIV / TONE_HZ - 1;
+   const uint64_t pacerWrap = static_cast<uint64_t>(clock / PACER_DIV) * stepUs / 1000000 - 1;
+   const uint8_t slice = pwm_gpio_to_slice_num(buzzerPin);
+
+   if ((pwm_gpio_to_slice_num(bellPin) != slice) || (slice == PACER_SLICE) || (toneWrap > 0xFFFF) ||
+       !stepUs || (pacerWrap > 0xFFFF))
+   {
+      return false;
+   }
+
+   m_channel = dma_claim_unused_channel(false);
+
+   if (m_channel < 0)
+   {
+      return false;
+   }
+
+   // The tone slice starts silent, the bell channel is held high by a level past the wrap
+   pwm_config tone = pwm_get_default_config();
+   pwm_config_set_clkdiv_int(&tone, TONE_DIV);
+   pwm_config_set_wrap(&tone, toneWrap);
+   pwm_init(slice, &tone, false);
+   pwm_set_both_levels(slice, 0, 0);
+   pwm_set_enabled(slice, true);
+   gpio_set_function(buzzerPin, GPIO_FUNC_PWM);
+   gpio_set_function(bellPin, GPIO_FUNC_PWM);
+
+   m_buzzerOn = ((toneWrap + 1) / 2) << (16 * pwm_gpio_to_channel(buzzerPin));
+   m_bellOn = (toneWrap + 1) << (16 * pwm_gpio_to_channel(bellPin));
+
+   // The pacer wraps once a step, its pins are never given to the PWM so it drives nothing
+   pwm_config pacer = pwm_get_default_config();
+   pwm_config_set_clkdiv_int(&pacer, PACER_DIV);
+   pwm_config_set_wrap(&pacer, static_cast<uint16_t>(pacerWrap));
+   pwm_init(PACER_SLICE, &pacer, true);
+
+   // Each pacer wrap moves one compare word, setting both channels of the tone slice together
+   dma_channel_config steps = dma_channel_get_default_config(m_channel);
+   channel_config_set_transfer_data_size(&steps, DMA_SIZE_32);
+   channel_config_set_read_increment(&steps, true);
+   channel_config_set_write_increment(&steps, false);
+   channel_config_set_dreq(&steps, pwm_get_dreq(PACER_SLICE));
+   dma_channel_configure(m_channel, &steps, &pwm_hw->slice[slice].cc, nullptr, 0, false);
+
+   m_slice = slice;
+   m_stepUs = stepUs;
+   m_count = 0;
+   return true;
+}
+
+void TonePlayer::play(const uint32_t *steps, uint16_t count)
+{
+   m_steps = steps;
+   m_startUs = time_us_64();
+   m_count = count;
+   dma_channel_transfer_from_buffer_now(m_channel, steps, count);
+}
+
+bool TonePlayer::isPlaying() const
+{
+   return dma_channel_is_busy(m_channel);
+}
@@ -0,0 +1,93 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstdint>
+
+///
+/// @brief Plays a pattern of PWM compare levels without the CPU
+///
+/// The buzzer and bell pins are the two channels of one PWM slice, which runs
+/// at the buzzer tone.  A second slice, with no pins, is a pacer: each time
+/// its counter wraps it asks a DMA channel to write the next step of the
+/// pattern into the compare register of the tone slice, which sets both
+/// channels at once.  A pattern of any length costs the CPU one DMA start.
+///
+class TonePlayer
+{
+public:
+   static constexpr uint8_t PACER_SLICE = 7;  ///< PWM slice pacing the steps, its pins stay with the SIO
+   static constexpr uint32_t TONE_HZ = 2000;  ///< Buzzer tone (Hz)
+   static constexpr uint8_t TONE_DIV = 4;     ///< Tone slice clock divider, keeps the wrap in 16 bits
+   static constexpr uint8_t PACER_DIV = 250;  ///< Pacer slice clock divider
+
+   /// Claim a DMA channel and start the tone and pacer slices, both pins silent
+   /// @param buzzerPin sounds the tone while on, for a passive sounder
+   /// @param bellPin held high while on, for a bell striker
+   /// @param stepUs time each step of a pattern is held (us)
+   /// @return false if the pins are not on one slice, the step is out of range or no channel is free
+   bool begin(uint8_t buzzerPin, uint8_t bellPin, uint32_t stepUs);
+
+   /// Start playing a pattern, which must stay unchanged until it has played
+   /// @param steps compare words, buzzerOn() and bellOn() or'ed together for each step, the last should be silent
+   void play(const uint32_t *steps, uint16_t count);
+
+   /// A pattern is still playing
+   bool isPlaying() const;
+
+   /// Time the pattern started last has played by (us since boot)
+   uint64_t endUs() const { return m_startUs + static_cast<uint64_t>(m_count + 1) * m_stepUs; }
+
+   /// Compare word of a step sounding the buzzer
+   uint32_t buzzerOn() const { return m_buzzerOn; }
+
+   /// Compare word of a step striking the bell
+   uint32_t bellOn() const { return m_bellOn; }
+
+private:
+   uint32_t m_buzzerOn{0};
+   uint32_t m_bellOn{0};
+   uint32_t m_stepUs{0};
+   const uint32_t *m_steps{nullptr}; ///< Last pattern, read by the DMA channel
+   uint64_t m_startUs{0}; ///< Time the last pattern started (us since boot)
+   uint16_t m_count{0};   ///< Steps of the last pattern
+   uint8_t m_slice{0};    ///< Tone slice
+   int m_channel{-1};
+};
@@ -0,0 +1,83 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#include "UsbSerial.h"
+
+#include <hardware/sync.h>
+#include <pico/stdio_usb.h>
+#include <tusb.h>
+
+bool UsbSerial::begin()
+{
+   return true;
+}
+
+bool UsbSerial::connected() const
+{
+   return stdio_usb_connected();
+}
+
+size_t UsbSerial::write(const char *data, size_t length)
+{
+   if (!connected())
+   {
+      return 0;
+   }
+
+   // Full packets are sent by TinyUSB as the FIFO fills, the rest waits for flush()
+   const uint32_t interrupts = save_and_disable_interrupts();
+   const uint32_t count = tud_cdc_write(data, static_cast<uint32_t>(length));
+   restore_interrupts(interrupts);
+
+   return count;
+}
+
+void UsbSerial::flush()
+{
+   const uint32_t interrupts = save_and_disable_interrupts();
+   tud_cdc_write_flush();
+   restore_interrupts(interrupts);
+}
+
+size_t UsbSerial::read(char *data, size_t length)
+{
+   const int count = stdio_usb.in_chars(data, static_cast<int>(length));
+
+   return (count > 0) ? static_cast<size_t>(count) : 0;
+}
@@ -0,0 +1,76 @@
+/*
+   CBUS Module Library - RasberryPi Pico SDK port
+   Copyright (c) Kevin Kimber 2023
+
+   Based on work by Duncan Greenwood
+   Copyright (C) Duncan Greenwood 2017 (duncan_greenwood@hotmail.com)
+
+   This work is licensed under the:
+      Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+   To view a copy of this license, visit:
+      http://creativecommons.org/licenses/by-nc-sa/4.0/
+   or send a letter to Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+
+   License summary:
+    You are free to:
+      Share, copy and redistribute the material in any medium or format
+      Adapt, remix, transform, and build upon the material
+
+    The licensor cannot revoke these freedoms as long as you follow the license terms.
+
+    Attribution : You must give appropriate credit, provide a link to the license,
+                  and indicate if changes were made. You may do so in any reasonable manner,
+                  but not in any way that suggests the licensor endorses you or your use.
+
+    NonCommercial : You may not use the material for commercial purposes. **(see note below)
+
+    ShareAlike : If you remix, transform, or build upon the material, you must distribute
+                 your contributions under the same license as the original.
+
+    No additional restrictions : You may not apply legal terms or technological measures that
+                                 legally restrict others from doing anything the license permits.
+
+   ** For commercial use, please contact the original copyright holder(s) to agree licensing terms
+
+    This software is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE
+
+*/
+
+#pragma once
+
+#include <cstddef>
+
+///
+/// @brief The USB CDC serial port, read and written in blocks that never wait
+///
+/// Shares the port with USB stdio.  A block is written into the CDC transmit
+/// FIFO with TinyUSB directly, rather than through the stdio driver, which
+/// flushes every call, so the caller decides when a part filled packet goes
+/// with flush().  write() takes no more than the FIFO has room for, so a host
+/// that is not reading holds the data back rather than the caller.
+///
+/// Core 0 only.  The stdio driver's lock is private to it, so TinyUSB is kept
+/// from its USB background task, a core 0 interrupt, by disabling interrupts
+/// around each call instead.  printf is on core 0 too, so never runs inside one.
+///
+class UsbSerial
+{
+public:
+   /// Prepare the port, USB itself is started with stdio
+   bool begin();
+
+   /// A host has the port open (DTR set)
+   bool connected() const;
+
+   /// Write a block, as much of it as there is room for
+   /// @return bytes taken, 0 if the transmit FIFO is full or no host is connected
+   size_t write(const char *data, size_t length);
+
+   /// Send what has been written, including a part filled USB packet
+   void flush();
+
+   /// Read what the host has sent, up to length bytes
+   /// @return bytes read, 0 if nothing is waiting
+   size_t read(char *data, size_t length);
+};
@@ -0,0 +1,47 @@
+# Variant report - footprint of each module variant, side by side
+#
+# Run after the variants are built with
+#   cmake -DDIR=<build dir> -DVARIANTS=<variants, comma separated> -P variant_report.cmake
+#
+# Takes the code and data totals by memory from each variant's placement report
+# (see placement_report.cmake) and writes them as one table to CANBlock.variants.txt.
+# The scratch banks are counted as RAM.
+
+string(REPLACE "," ";" VARIANTS "${VARIANTS}")
+
+set(TEXT "CANBlock module variants, bytes by memory\n\n")
+string(APPEND TEXT "Variant\tFlash code\tFlash data\tRAM code\tRAM data\n")
+
+foreach (variant IN LISTS VARIANTS)
+   set(REPORT ${DIR}/CANBlock_${variant}.placement.txt)
+
+   if (NOT EXISTS ${REPORT})
+      message(WARNING "Variant report: no placement report for ${variant}, ${REPORT}")
+      continue()
+   endif()
+
+   file(STRINGS ${REPORT} LINES REGEX "^(flash|RAM|SCRATCH_X|SCRATCH_Y)\t[0-9]+\t[0-9]+$")
+
+   set(FLASH_CODE 0)
+   set(FLASH_DATA 0)
+   set(RAM_CODE 0)
+   set(RAM_DATA 0)
+
+   foreach (line IN LISTS LINES)
+      string(REGEX MATCH "^([A-Za-z_]+)\t([0-9]+)\t([0-9]+)$" match "${line}")
+
+      if (CMAKE_MATCH_1 STREQUAL "flash")
+         set(FLASH_CODE ${CMAKE_MATCH_2})
+         set(FLASH_DATA ${CMAKE_MATCH_3})
+      else()
+         math(EXPR RAM_CODE "${RAM_CODE} + ${CMAKE_MATCH_2}")
+         math(EXPR RAM_DATA "${RAM_DATA} + ${CMAKE_MATCH_3}")
+      endif()
+   endforeach()
+
+   string(APPEND TEXT "${variant}\t${FLASH_CODE}\t${FLASH_DATA}\t${RAM_CODE}\t${RAM_DATA}\n")
+endforeach()
+
+string(APPEND TEXT "\nDispatch cost on the module: send 'B' on its USB serial port, see README.md\n")
+file(WRITE ${DIR}/CANBlock.variants.txt "${TEXT}")
+message("${TEXT}")